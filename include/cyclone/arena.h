@@ -0,0 +1,132 @@
+/*
+ * Interface file for the per-frame memory arena.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains a linear allocator for data that only lives for
+ * a single frame of the simulation, such as contacts, broadphase
+ * pair lists and solver scratch space.
+ */
+#ifndef CYCLONE_ARENA_H
+#define CYCLONE_ARENA_H
+
+#include <stddef.h>
+#include <new>
+
+namespace cyclone {
+
+    /**
+     * A linear allocator for per-frame data. Allocation moves a
+     * pointer along a block of memory, and everything allocated is
+     * released at once by reset. Individual allocations are never
+     * freed.
+     *
+     * When a block runs out, a new block at least twice the size of
+     * everything allocated so far is added. On the next reset, if
+     * more than one block was used, they are replaced by a single
+     * block large enough for the whole of the previous frame, so
+     * after a few frames the arena settles on one block and neither
+     * allocation nor reset touches the system allocator.
+     */
+    class FrameArena
+    {
+        /**
+         * Holds a block of memory in the arena. The usable memory
+         * follows the structure.
+         */
+        struct Block
+        {
+            Block *previous;
+            size_t size;
+        };
+
+        /** Holds the block currently being allocated from. */
+        Block *current;
+
+        /** Holds the number of bytes used in the current block. */
+        size_t used;
+
+        /** Holds the number of bytes used in the earlier blocks. */
+        size_t usedBefore;
+
+        /** Holds the most bytes in use at once since creation. */
+        size_t peak;
+
+        /**
+         * Adds a new block with room for at least the given number of
+         * bytes.
+         */
+        void grow(size_t bytes);
+
+        /** Frees every block. */
+        void release();
+
+        // The arena owns its blocks, so it cannot be copied.
+        FrameArena(const FrameArena &);
+        FrameArena& operator=(const FrameArena &);
+
+    public:
+        /**
+         * Creates an arena with a first block of the given size.
+         */
+        FrameArena(size_t initialSize = 64*1024);
+
+        ~FrameArena();
+
+        /**
+         * Returns memory for the given number of bytes, aligned to
+         * the given power of two. The memory is valid until the next
+         * reset.
+         */
+        void* allocate(size_t bytes, size_t alignment = 16);
+
+        /**
+         * Returns an array of the given number of default constructed
+         * objects. The objects' destructors are never called, so this
+         * should only be used for types that do not need them.
+         */
+        template<class T>
+        T* allocateArray(unsigned count)
+        {
+            T *array = (T*)allocate(count * sizeof(T));
+            for (unsigned i = 0; i < count; i++) new (array + i) T;
+            return array;
+        }
+
+        /**
+         * Releases everything allocated from the arena. If the last
+         * frame needed more than one block, they are merged into one.
+         */
+        void reset();
+
+        /**
+         * Returns the number of bytes currently allocated.
+         */
+        size_t getUsed() const
+        {
+            return usedBefore + used;
+        }
+
+        /**
+         * Returns the largest number of bytes that have been
+         * allocated between two resets.
+         */
+        size_t getPeak() const
+        {
+            return peak;
+        }
+    };
+
+} // namespace cyclone
+
+#endif // CYCLONE_ARENA_H
@@ -0,0 +1,414 @@
+/*
+ * Interface file for articulated bodies.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains a tree of rigid bodies linked by joints, which
+ * is simulated in the joints' own coordinates so that the joints can
+ * never come apart.
+ */
+#ifndef CYCLONE_ARTICULATION_H
+#define CYCLONE_ARTICULATION_H
+
+#include <vector>
+#include "body.h"
+
+namespace cyclone {
+
+    /**
+     * A tree of rigid bodies linked by joints, such as a robot arm or
+     * a ragdoll, simulated with Featherstone's articulated body
+     * algorithm.
+     *
+     * Joints made from contacts have to be pulled back together
+     * after every step, and long chains of them need many resolver
+     * iterations to stay together. An articulation instead keeps
+     * only the state of its root body and the position and rate of
+     * each joint, and places every other body from them, so the
+     * joints hold exactly whatever the step size. The accelerations
+     * of every joint are found together, from the forces on all the
+     * bodies, in three passes over the tree, in time proportional to
+     * the number of bodies.
+     *
+     * The forces that keep a swinging body on its arc are found from
+     * the velocities at the start of a step, so a long chain whipping
+     * about gains energy when its bodies turn too far in one step,
+     * until it flies apart. Each step is therefore split into parts
+     * in which no body turns more than a small angle (see
+     * setStepLimits). Joint damping is applied implicitly, so any
+     * amount of it is stable, and a little on each joint soaks up
+     * what energy the chain still gains. Where neither is enough,
+     * the articulation can be kept from gaining energy at all (see
+     * setEnergyClamp).
+     *
+     * The first body added is the root. If it has infinite mass it
+     * is fixed in place, as the base of a robot arm; otherwise it is
+     * free to move, as the pelvis of a ragdoll. Each body after it is
+     * linked to a body added before it by one joint.
+     *
+     * Bodies in an articulation are integrated by the articulation,
+     * in place of RigidBody::integrate. Forces, torques and the
+     * world's fields are applied to them as normal. Changes made to
+     * the bodies' velocities between steps, such as by resolving
+     * contacts, are read back into the joint rates at the start of
+     * each step. Changes to their positions are only read back for
+     * the root, since the joints decide where the other bodies are.
+     */
+    class Articulation
+    {
+    public:
+        /**
+         * Identifies the kinds of joint between two bodies.
+         */
+        enum JointType
+        {
+            /**
+             * A hinge, allowing rotation about one axis through the
+             * anchor point.
+             */
+            REVOLUTE_JOINT,
+
+            /**
+             * A slider, allowing movement along one axis with no
+             * change in orientation.
+             */
+            PRISMATIC_JOINT,
+
+            /**
+             * A ball and socket, allowing any rotation about the
+             * anchor point.
+             */
+            SPHERICAL_JOINT
+        };
+
+        /** Marks the root, which has no parent. */
+        static const unsigned NO_PARENT = ~0u;
+
+    protected:
+        /**
+         * Holds a single body in the tree, and the joint that links
+         * it to its parent.
+         */
+        struct Link
+        {
+            /** Holds the body. */
+            RigidBody *body;
+
+            /** Holds the index of the parent link. */
+            unsigned parent;
+
+            /** Holds the kind of joint to the parent. */
+            JointType type;
+
+            /** Holds the joint's anchor, in the parent's coordinates. */
+            Vector3 parentAnchor;
+
+            /** Holds the joint's anchor, in the body's coordinates. */
+            Vector3 childAnchor;
+
+            /**
+             * Holds the joint's axis for hinges and sliders, in the
+             * body's coordinates.
+             */
+            Vector3 axis;
+
+            /**
+             * Holds the body's orientation relative to its parent
+             * when the joint is at its starting position.
+             */
+            Quaternion restOrientation;
+
+            /**
+             * Holds the angle of a hinge, or the distance moved by a
+             * slider, from its starting position.
+             */
+            real position;
+
+            /**
+             * Holds the rotation of a ball and socket from its
+             * starting orientation, in the body's coordinates.
+             */
+            Quaternion rotation;
+
+            /**
+             * Holds the rate of the joint. Hinges and sliders use
+             * only the x component. Ball and sockets hold the body's
+             * angular velocity relative to its parent, in the body's
+             * coordinates.
+             */
+            Vector3 rate;
+
+            /**
+             * Holds the force or torque applied by the joint in the
+             * next step, in the same form as the rate.
+             */
+            Vector3 force;
+
+            /** Holds the damping constant resisting the joint's rate. */
+            real damping;
+
+            /**
+             * @name Solver Data
+             *
+             * These hold the spatial quantities used in each step,
+             * as six values with the angular part first, measured
+             * about a point fixed for the step. They are kept between
+             * steps so that their memory is reused.
+             */
+            /*@{*/
+
+            /**
+             * Holds the number of degrees of freedom of the joint, or
+             * of the root: six if it is free and none if it is fixed.
+             */
+            unsigned dof;
+
+            /** Holds the motion of the body for each unit joint rate. */
+            real motion[3][6];
+
+            /** Holds the body's velocity. */
+            real velocity[6];
+
+            /** Holds the body's acceleration when the joint is still. */
+            real bias[6];
+
+            /** Holds the articulated inertia, a 6x6 matrix. */
+            real inertia[36];
+
+            /** Holds the articulated bias force. */
+            real biasForce[6];
+
+            /** Holds the force applied to the body. */
+            real appliedForce[6];
+
+            /** Holds the articulated inertia times the motion. */
+            real inertiaMotion[3][6];
+
+            /** Holds the inverse of the joint's effective inertia. */
+            Matrix3 inverseJointInertia;
+
+            /** Holds the joint force left after the bias forces. */
+            real effort[3];
+
+            /** Holds the body's acceleration. */
+            real acceleration[6];
+
+            /** Holds the acceleration of the joint. */
+            real jointAcceleration[3];
+
+            /*@}*/
+        };
+
+        /** Holds the links in the tree, each after its parent. */
+        std::vector<Link> links;
+
+        /**
+         * Holds true if each step is kept from adding kinetic energy
+         * that the forces didn't put in.
+         */
+        bool energyClamp;
+
+        /** Holds the furthest a body may turn in one part of a step. */
+        real maxStepRotation;
+
+        /** Holds the most parts a step may be split into. */
+        unsigned maxSteps;
+
+        /**
+         * Reads the joint rates from the bodies' current velocities.
+         */
+        void readVelocities();
+
+        /**
+         * Finds the motion of the given link's body for each unit
+         * rate of its joint, from the bodies' current positions.
+         */
+        void calculateMotion(unsigned index, const Vector3 &origin);
+
+        /**
+         * Finds the motion of each joint, and the velocity, inertia
+         * and bias force of each body, from the root out. Returns the
+         * kinetic energy of the articulation.
+         */
+        real calculateVelocities(const Vector3 &origin,
+                                 const UniformFields *fields);
+
+        /**
+         * Accumulates the articulated inertias and bias forces from
+         * the leaves in.
+         */
+        void calculateInertias(real duration);
+
+        /**
+         * Finds the acceleration of the root and of each joint, from
+         * the root out.
+         */
+        void calculateAccelerations();
+
+        /**
+         * Slows the motion of the bodies relative to each other, if
+         * the articulation has gained more kinetic energy over the
+         * step than the forces on it did work, given its energy at
+         * the start of the step. The bodies must already be updated.
+         */
+        void removeExcessEnergy(real energy, const Vector3 &origin,
+                                real duration);
+
+        /**
+         * Integrates the articulation forward by one part of a step,
+         * without clearing the forces.
+         */
+        void integrateStep(real duration, const UniformFields *fields);
+
+        /**
+         * Places every body after the root from its parent and its
+         * joint, and sets its velocity.
+         */
+        void updateBodies(const Vector3 &origin);
+
+    public:
+        /**
+         * Creates an empty articulation.
+         */
+        Articulation();
+
+        /**
+         * Removes all the bodies from the articulation, and sets the
+         * given body as its root.
+         *
+         * @return The index of the root, which is always zero.
+         */
+        unsigned setRoot(RigidBody *body);
+
+        /**
+         * Links the given body to a body already in the articulation,
+         * returning the new link's index. Both bodies should already
+         * be in their starting positions, which is where the joint's
+         * position is zero.
+         *
+         * @param parent The index of the link to attach to.
+         *
+         * @param type The kind of joint.
+         *
+         * @param anchor The point the joint is at, in world
+         * coordinates.
+         *
+         * @param axis The axis of a hinge or slider, in world
+         * coordinates. It is ignored for ball and sockets.
+         */
+        unsigned addLink(RigidBody *body, unsigned parent, JointType type,
+                         const Vector3 &anchor,
+                         const Vector3 &axis = Vector3(0, 1, 0));
+
+        /**
+         * Returns the number of bodies in the articulation.
+         */
+        unsigned getLinkCount() const
+        {
+            return (unsigned)links.size();
+        }
+
+        /**
+         * Returns the body of the given link.
+         */
+        RigidBody* getBody(unsigned link) const
+        {
+            return links[link].body;
+        }
+
+        /**
+         * Returns the index of the given link's parent, or NO_PARENT
+         * for the root.
+         */
+        unsigned getParent(unsigned link) const
+        {
+            return links[link].parent;
+        }
+
+        /**
+         * Returns the angle of a hinge, or the distance moved by a
+         * slider, from its starting position.
+         */
+        real getJointPosition(unsigned link) const
+        {
+            return links[link].position;
+        }
+
+        /**
+         * Returns the rotation of a ball and socket from its
+         * starting orientation, in the body's coordinates.
+         */
+        Quaternion getJointRotation(unsigned link) const
+        {
+            return links[link].rotation;
+        }
+
+        /**
+         * Returns the rate of the given joint, in the x component for
+         * hinges and sliders.
+         */
+        Vector3 getJointRate(unsigned link) const
+        {
+            return links[link].rate;
+        }
+
+        /**
+         * Sets the damping constant resisting the given joint's rate.
+         * Damping is applied implicitly, so any value is stable.
+         */
+        void setJointDamping(unsigned link, real damping);
+
+        /**
+         * Sets whether each step is kept from adding more kinetic
+         * energy than the forces on the bodies and joints put in, by
+         * slowing the bodies' motion relative to each other when it
+         * would. This leaves the momentum of a free articulation
+         * unchanged, but it also takes out energy the integrator
+         * should keep, so it damps the motion heavily and is off by
+         * default.
+         */
+        void setEnergyClamp(bool clamp);
+
+        /**
+         * Sets how far any body may turn in one part of a step, in
+         * radians, and the most parts a step may be split into. The
+         * defaults are 0.05 radians and 16 parts. A step in which the
+         * fastest body turns no further than the given angle is taken
+         * whole, so slow articulations cost no more to integrate.
+         */
+        void setStepLimits(real maxRotation, unsigned maxSteps);
+
+        /**
+         * Adds a force to a slider, or a torque to a hinge, for the
+         * next step.
+         */
+        void addJointForce(unsigned link, real force);
+
+        /**
+         * Adds a torque to a ball and socket for the next step, in
+         * the body's coordinates.
+         */
+        void addJointTorque(unsigned link, const Vector3 &torque);
+
+        /**
+         * Integrates the articulation forward in time by the given
+         * duration, including the forces in the bodies' accumulators
+         * and the given world fields, and then clears the bodies'
+         * accumulators and the joint forces.
+         */
+        void integrate(real duration, const UniformFields *fields = NULL);
+    };
+
+} // namespace cyclone
+
+#endif // CYCLONE_ARTICULATION_H
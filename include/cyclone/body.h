@@ -20,6 +20,8 @@
 #define CYCLONE_BODY_H
 
 #include "core.h"
+#include "snapshot.h"
+#include "fields.h"
 
 namespace cyclone {
 
@@ -184,6 +186,19 @@ namespace cyclone {
          */
         bool canSleep;
 
+        /**
+         * Holds a stable identifier for the body. The world assigns
+         * these in registration order, and uses them to give contacts
+         * a fixed order when running in deterministic mode.
+         */
+        unsigned id;
+
+        /**
+         * Holds the world fields that affect the body, as a
+         * combination of FieldFlags.
+         */
+        unsigned fieldMask;
+
         /**
          * Holds a transform matrix for converting body space into
          * world space and vice versa. This can be achieved by calling
@@ -195,6 +210,14 @@ namespace cyclone {
          */
         Matrix4 transformMatrix;
 
+        /**
+         * Holds a count of the changes to the transform matrix. It
+         * goes up each time calculateDerivedData finds the body has
+         * moved, so objects caching values derived from the transform
+         * can tell when they are out of date.
+         */
+        unsigned transformVersion;
+
         /*@}*/
 
 
@@ -247,6 +270,12 @@ namespace cyclone {
          */
         /*@{*/
 
+        /**
+         * Creates a rigid body affected by every world field. The
+         * rest of the body's data must be set before it is used.
+         */
+        RigidBody();
+
         /*@}*/
 
 
@@ -278,8 +307,12 @@ namespace cyclone {
          * This function uses a Newton-Euler integration method, which is a
          * linear approximation to the correct integral. For this reason it
          * may be inaccurate in some cases.
+         *
+         * If fields are given, the acceleration they give the body,
+         * limited by its field mask, is added to the acceleration
+         * from its forces. Bodies with infinite mass are unaffected.
          */
-        void integrate(real duration);
+        void integrate(real duration, const UniformFields *fields = NULL);
 
         /*@}*/
 
@@ -654,7 +687,19 @@ namespace cyclone {
          *
          * @return The transform matrix for the rigid body.
          */
-        Matrix4 getTransform() const;
+        const Matrix4& getTransform() const;
+
+        /**
+         * Gets the version of the body's transform matrix. This
+         * changes only when calculateDerivedData finds the body has
+         * moved, so a sleeping or unmoving body keeps its version.
+         *
+         * @return The number of changes made to the transform matrix.
+         */
+        unsigned getTransformVersion() const
+        {
+            return transformVersion;
+        }
 
         /**
          * Converts the given point from world space into the body's
@@ -832,6 +877,60 @@ namespace cyclone {
          */
         void setCanSleep(const bool canSleep=true);
 
+        /**
+         * Sets the stable identifier of the body. This is normally
+         * done by the world when the body is registered with it.
+         *
+         * @param id The new identifier of the body.
+         */
+        void setId(const unsigned id);
+
+        /**
+         * Gets the stable identifier of the body.
+         *
+         * @return The identifier of the body.
+         */
+        unsigned getId() const
+        {
+            return id;
+        }
+
+        /**
+         * Sets the world fields that affect the body.
+         *
+         * @param mask A combination of FieldFlags. Fields whose flag
+         * is not included are ignored by the body.
+         */
+        void setFieldMask(const unsigned mask);
+
+        /**
+         * Gets the world fields that affect the body.
+         *
+         * @return A combination of FieldFlags.
+         */
+        unsigned getFieldMask() const
+        {
+            return fieldMask;
+        }
+
+        /**
+         * Fills the given structure with the kinematic state of the
+         * body: its identifier, position, orientation, velocity,
+         * rotation and sleep state.
+         *
+         * @param state Pointer to a state structure to fill.
+         */
+        void getState(RigidBodyState *state) const;
+
+        /**
+         * Sets the kinematic state of the body from the given
+         * structure, and recalculates the derived data. The
+         * identifier in the state is ignored.
+         *
+         * @param state The state to set the body to.
+         */
+        void setState(const RigidBodyState &state);
+
         /*@}*/
 
 
@@ -932,6 +1031,24 @@ namespace cyclone {
          */
         void addTorque(const Vector3 &torque);
 
+        /**
+         * Returns the force accumulated for the next integration
+         * step, in world coordinates.
+         */
+        Vector3 getAccumulatedForce() const
+        {
+            return forceAccum;
+        }
+
+        /**
+         * Returns the torque accumulated for the next integration
+         * step, in world coordinates.
+         */
+        Vector3 getAccumulatedTorque() const
+        {
+            return torqueAccum;
+        }
+
         /**
          * Sets the constant acceleration of the rigid body.
          *
@@ -0,0 +1,267 @@
+/*
+ * Interface file for the ray and shape casts.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains the tests for casting rays, spheres and boxes
+ * against the collision primitives: moving the shape in a straight
+ * line from where it starts, and finding the first surface it
+ * touches. They are used by the World to answer queries such as line
+ * of sight, and can also be used directly against any primitive.
+ *
+ * Casts find where a shape first touches a surface from outside, so
+ * a primitive that the shape already touches when it starts is not
+ * hit. This lets a cast start from inside the body doing the
+ * casting. As with the contact tests, triangles are one sided, and
+ * can only be hit from in front.
+ */
+#ifndef CYCLONE_COLLISION_CAST_H
+#define CYCLONE_COLLISION_CAST_H
+
+#include "collide_mesh.h"
+
+namespace cyclone {
+
+    /**
+     * The kinds of shape that can be cast.
+     */
+    enum CastType
+    {
+        CAST_RAY,
+        CAST_SPHERE,
+        CAST_BOX
+    };
+
+    /**
+     * Describes a shape to be cast, and the direction to cast it in.
+     * Use one of the set functions to fill it in.
+     */
+    struct CastShape
+    {
+        /**
+         * Holds the kind of shape.
+         */
+        CastType type;
+
+        /**
+         * Holds the starting point of a ray, or the starting centre
+         * of a sphere or box.
+         */
+        Vector3 origin;
+
+        /**
+         * Holds the unit direction the shape is cast in.
+         */
+        Vector3 direction;
+
+        /**
+         * Holds the radius of a sphere.
+         */
+        real radius;
+
+        /**
+         * Holds the orientation and starting position of a box.
+         */
+        Matrix4 transform;
+
+        /**
+         * Holds the half-sizes of a box along its own axes.
+         */
+        Vector3 halfSize;
+
+        /**
+         * Holds the half-sizes along each world axis of a box
+         * enclosing the shape, which bounding volumes are grown by
+         * when the shape is cast against them.
+         */
+        Vector3 extents;
+
+        /**
+         * Sets the shape to a ray from the given origin.
+         */
+        void setRay(const Vector3 &origin, const Vector3 &direction);
+
+        /**
+         * Sets the shape to a sphere with the given centre and radius.
+         */
+        void setSphere(const Vector3 &centre, real radius,
+            const Vector3 &direction);
+
+        /**
+         * Sets the shape to a box with the given transform, which
+         * must be a rotation and translation only, and half-sizes.
+         */
+        void setBox(const Matrix4 &transform, const Vector3 &halfSize,
+            const Vector3 &direction);
+    };
+
+    /**
+     * Holds the result of a cast.
+     */
+    struct CastHit
+    {
+        /**
+         * Holds the body hit, or NULL if the hit was static geometry.
+         */
+        RigidBody *body;
+
+        /**
+         * Holds the primitive hit, or NULL for a body that has no
+         * primitive, which is hit as its bounding sphere.
+         */
+        const CollisionPrimitive *primitive;
+
+        /**
+         * Holds where the shape touched the surface.
+         */
+        Vector3 point;
+
+        /**
+         * Holds the normal of the surface at the hit, pointing back
+         * towards the cast shape.
+         */
+        Vector3 normal;
+
+        /**
+         * Holds how far the shape travelled before it hit.
+         */
+        real distance;
+    };
+
+    /**
+     * A ray, for casting many rays together.
+     */
+    struct Ray
+    {
+        Vector3 origin;
+
+        /**
+         * Holds the unit direction of the ray.
+         */
+        Vector3 direction;
+
+        /**
+         * Holds how far along the ray to look for hits.
+         */
+        real length;
+    };
+
+    /**
+     * A wrapper class that holds the cast tests. Each test casts the
+     * given shape against something, and if the shape hits it within
+     * the given length, fills in the distance, point and normal of
+     * the hit and returns true. The hit is left alone otherwise, so
+     * the same hit can be passed to a series of tests, each given the
+     * distance of the last hit as its length, to find the nearest.
+     */
+    class CastTests
+    {
+    public:
+        /**
+         * Casts the shape against the given primitive, whose
+         * internals must be up to date. This also fills in the body
+         * and primitive of the hit.
+         */
+        static bool shapeAndPrimitive(
+            const CastShape &shape,
+            const CollisionPrimitive &primitive,
+            real length,
+            CastHit *hit
+            );
+
+        /**
+         * Casts the shape against a sphere.
+         */
+        static bool shapeAndSphere(
+            const CastShape &shape,
+            const Vector3 &centre,
+            real radius,
+            real length,
+            CastHit *hit
+            );
+
+        /**
+         * Casts the shape against a box with the given transform and
+         * half-sizes.
+         */
+        static bool shapeAndBox(
+            const CastShape &shape,
+            const Matrix4 &transform,
+            const Vector3 &halfSize,
+            real length,
+            CastHit *hit
+            );
+
+        /**
+         * Casts the shape against a single triangle, given in world
+         * space, whose front face is the one its corners run
+         * anticlockwise around.
+         */
+        static bool shapeAndTriangle(
+            const CastShape &shape,
+            const Vector3 *triangle,
+            real length,
+            CastHit *hit
+            );
+
+        /**
+         * Casts the shape against a half-space.
+         */
+        static bool shapeAndHalfSpace(
+            const CastShape &shape,
+            const CollisionPlane &plane,
+            real length,
+            CastHit *hit
+            );
+
+    protected:
+        /**
+         * Casts the shape against the children of the given compound
+         * in the subtree at the given node, nearest first.
+         */
+        static bool shapeAndCompoundNode(
+            const CastShape &shape,
+            const CollisionCompound &compound,
+            unsigned index,
+            real length,
+            CastHit *hit
+            );
+
+        /**
+         * Casts the shape against the triangles of a mesh, walking
+         * its hierarchy with the shape's path.
+         */
+        static bool shapeAndMesh(
+            const CastShape &shape,
+            const CollisionMesh &mesh,
+            real length,
+            CastHit *hit
+            );
+
+        /**
+         * Casts the shape against the triangles of a heightfield,
+         * stepping through the cells of the grid along the shape's
+         * path, so the cost depends on the length of the cast rather
+         * than the size of the grid.
+         */
+        static bool shapeAndHeightfield(
+            const CastShape &shape,
+            const CollisionHeightfield &heightfield,
+            real length,
+            CastHit *hit
+            );
+    };
+
+} // namespace cyclone
+
+#endif // CYCLONE_COLLISION_CAST_H
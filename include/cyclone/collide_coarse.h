@@ -25,6 +25,50 @@
 
 namespace cyclone {
 
+    /**
+     * Holds four rays, one in each lane of its arrays, so that they
+     * can be tested against a bounding volume together. Each ray has
+     * a unit direction and a length. Lanes that hold no ray are left
+     * out of the active mask.
+     */
+    struct RayPacket
+    {
+        real originX[4];
+        real originY[4];
+        real originZ[4];
+        real directionX[4];
+        real directionY[4];
+        real directionZ[4];
+
+        /**
+         * Holds the inverse of each component of the directions, for
+         * clipping the rays to boxes. Zero components are given a
+         * very large inverse instead.
+         */
+        real inverseX[4];
+        real inverseY[4];
+        real inverseZ[4];
+
+        real length[4];
+
+        /**
+         * Holds a mask with bit i set if lane i holds a ray.
+         */
+        unsigned active;
+
+        /**
+         * Creates a packet with no rays.
+         */
+        RayPacket();
+
+        /**
+         * Puts the given ray into the given lane, and marks it
+         * active.
+         */
+        void setRay(unsigned lane, const Vector3 &origin,
+            const Vector3 &direction, real length);
+    };
+
     /**
      * Represents a bounding sphere that can be tested for overlap.
      */
@@ -51,6 +95,31 @@ namespace cyclone {
          */
         bool overlaps(const BoundingSphere *other) const;
 
+        /**
+         * Checks if the given ray passes through the sphere, after
+         * the sphere is grown to enclose a box with the given
+         * half-sizes centred anywhere inside it, as when a shape that
+         * size is cast along the ray. The direction must be unit
+         * length. If the ray passes through, the distance along it at
+         * which it enters is returned in entry, or zero if it starts
+         * inside.
+         */
+        bool intersectsRay(const Vector3 &origin, const Vector3 &direction,
+            real length, const Vector3 &inflate, real *entry) const;
+
+        /**
+         * Checks each ray of the given packet against the sphere.
+         * Returns a mask with bit i set if ray i is active and passes
+         * through.
+         */
+        unsigned intersectsRays(const RayPacket &packet) const
+        {
+            return packet.active & simdRaysAndSphere(
+                packet.originX, packet.originY, packet.originZ,
+                packet.directionX, packet.directionY, packet.directionZ,
+                packet.length, &centre.x, radius);
+        }
+
         /**
          * Reports how much this bounding sphere would have to grow
          * by to incorporate the given bounding sphere. Note that this
@@ -61,6 +130,23 @@ namespace cyclone {
          */
         real getGrowth(const BoundingSphere &other) const;
 
+        /**
+         * Returns a value proportional to the surface area of the
+         * sphere, in the same units as getGrowth.
+         */
+        real getSurface() const
+        {
+            return radius * radius;
+        }
+
+        /**
+         * Moves the sphere by the given offset.
+         */
+        void translate(const Vector3 &offset)
+        {
+            centre += offset;
+        }
+
         /**
          * Returns the volume of this bounding volume. This is used
          * to calculate how to recurse into the bounding volume tree.
@@ -68,7 +154,93 @@ namespace cyclone {
          */
         real getSize() const
         {
-            return ((real)1.333333) * R_PI * radius * radius * radius;
+            return ((real)1.333333) * Scalar<real>::pi() * radius * radius * radius;
+        }
+    };
+
+    /**
+     * Represents an axis aligned bounding box that can be tested for
+     * overlap. It can be used in place of a bounding sphere in a
+     * BVHTree, and fits long thin objects much more tightly.
+     */
+    struct BoundingBox
+    {
+        Vector3 centre;
+        Vector3 halfSize;
+
+    public:
+        /**
+         * Creates a new bounding box at the given centre with the
+         * given half-sizes along each world axis.
+         */
+        BoundingBox(const Vector3 &centre, const Vector3 &halfSize);
+
+        /**
+         * Creates a bounding box to enclose the two given bounding
+         * boxes.
+         */
+        BoundingBox(const BoundingBox &one, const BoundingBox &two);
+
+        /**
+         * Checks if the bounding box overlaps with the other given
+         * bounding box.
+         */
+        bool overlaps(const BoundingBox *other) const;
+
+        /**
+         * Checks if the given ray passes through the box, after the
+         * box is grown by the given half-sizes, as for
+         * BoundingSphere::intersectsRay.
+         */
+        bool intersectsRay(const Vector3 &origin, const Vector3 &direction,
+            real length, const Vector3 &inflate, real *entry) const;
+
+        /**
+         * Checks each ray of the given packet against the box.
+         * Returns a mask with bit i set if ray i is active and passes
+         * through.
+         */
+        unsigned intersectsRays(const RayPacket &packet) const
+        {
+            Vector3 low = centre - halfSize;
+            Vector3 high = centre + halfSize;
+            return packet.active & simdRaysAndBox(
+                packet.originX, packet.originY, packet.originZ,
+                packet.inverseX, packet.inverseY, packet.inverseZ,
+                packet.length, &low.x, &high.x);
+        }
+
+        /**
+         * Reports how much this bounding box would have to grow by
+         * to incorporate the given bounding box. As for the bounding
+         * sphere, this is proportional to the growth in surface area.
+         */
+        real getGrowth(const BoundingBox &other) const;
+
+        /**
+         * Returns a value proportional to the surface area of the
+         * box, in the same units as getGrowth.
+         */
+        real getSurface() const
+        {
+            return halfSize.x * halfSize.y + halfSize.y * halfSize.z +
+                halfSize.z * halfSize.x;
+        }
+
+        /**
+         * Moves the box by the given offset.
+         */
+        void translate(const Vector3 &offset)
+        {
+            centre += offset;
+        }
+
+        /**
+         * Returns the volume of this bounding volume.
+         */
+        real getSize() const
+        {
+            return 8 * halfSize.x * halfSize.y * halfSize.z;
         }
     };
 
@@ -84,19 +256,30 @@ namespace cyclone {
     };
 
     /**
-     * A base class for nodes in a bounding volume hierarchy.
-     *
-     * This class uses a binary tree to store the bounding
-     * volumes.
+     * Marks the absence of a node in a bounding volume hierarchy.
+     */
+    const unsigned BVH_NULL_NODE = 0xffffffff;
+
+    /**
+     * A node in a bounding volume hierarchy. Nodes are stored in the
+     * node pool of a BVHTree, and refer to each other by their index
+     * in the pool rather than by pointer.
      */
     template<class BoundingVolumeClass>
-    class BVHNode
+    struct BVHNode
     {
-    public:
         /**
-         * Holds the child nodes of this node.
+         * Holds the indices of the child nodes of this node, or
+         * BVH_NULL_NODE for a leaf.
+         */
+        unsigned children[2];
+
+        /**
+         * Holds the index of the node immediately above us in the
+         * tree. For a node in the free list, this holds the index of
+         * the next free node instead.
          */
-        BVHNode * children[2];
+        unsigned parent;
 
         /**
          * Holds a single bounding volume encompassing all the
@@ -106,29 +289,18 @@ namespace cyclone {
 
         /**
          * Holds the rigid body at this node of the hierarchy.
-         * Only leaf nodes can have a rigid body defined (see isLeaf).
-         * Note that it is possible to rewrite the algorithms in this
-         * class to handle objects at all levels of the hierarchy,
-         * but the code provided ignores this vector unless firstChild
-         * is NULL.
+         * Only leaf nodes have a rigid body.
          */
         RigidBody * body;
 
-        // ... other BVHNode code as before ...
-
-        /**
-         * Holds the node immediately above us in the tree.
-         */
-        BVHNode * parent;
-
         /**
-         * Creates a new node in the hierarchy with the given parameters.
+         * Creates a new leaf node with the given parameters.
          */
-        BVHNode(BVHNode *parent, const BoundingVolumeClass &volume,
+        BVHNode(unsigned parent, const BoundingVolumeClass &volume,
             RigidBody* body=NULL)
             : parent(parent), volume(volume), body(body)
         {
-            children[0] = children[1] = NULL;
+            children[0] = children[1] = BVH_NULL_NODE;
         }
 
         /**
@@ -136,62 +308,312 @@ namespace cyclone {
          */
         bool isLeaf() const
         {
-            return (body != NULL);
+            return children[0] == BVH_NULL_NODE;
         }
+    };
+
+    /**
+     * A bounding volume hierarchy over a set of rigid bodies.
+     *
+     * This class uses a binary tree to store the bounding volumes.
+     * The nodes are held in a single pool, and nodes that are
+     * removed are kept on a free list for reuse, so a tree that has
+     * bodies added and removed repeatedly only allocates when it
+     * grows beyond its largest size so far.
+     *
+     * Each body inserted is given a handle, which is the index of
+     * its leaf node. Leaf nodes never move, so the handle stays
+     * valid until the body is removed.
+     *
+     * Any bounding volume class used must have a constructor that
+     * encloses two other volumes, getGrowth and getSurface methods,
+     * and an overlaps method that takes a pointer to another volume of its own type.
+     * To be moved with translate, it must also have a translate
+     * method that moves it by a given offset, and to be cast against
+     * with raycast and raycastPacket, it must have a centre and the
+     * intersectsRay and intersectsRays methods of BoundingSphere.
+     */
+    template<class BoundingVolumeClass>
+    class BVHTree
+    {
+    public:
+        typedef BVHNode<BoundingVolumeClass> Node;
 
+    protected:
         /**
-         * Checks the potential contacts from this node downwards in
-         * the hierarchy, writing them to the given array (up to the
-         * given limit). Returns the number of potential contacts it
-         * found.
+         * Holds the pool of nodes, both in use and free.
          */
-        unsigned getPotentialContacts(PotentialContact* contacts,
-                                      unsigned limit) const;
+        std::vector<Node> nodes;
 
         /**
-         * Inserts the given rigid body, with the given bounding volume,
-         * into the hierarchy. This may involve the creation of
-         * further bounding volume nodes.
+         * Holds the index of the root node, or BVH_NULL_NODE if the
+         * tree is empty.
          */
-        void insert(RigidBody* body, const BoundingVolumeClass &volume);
+        unsigned root;
 
         /**
-         * Deltes this node, removing it first from the hierarchy, along
-         * with its associated
-         * rigid body and child nodes. This method deletes the node
-         * and all its children (but obviously not the rigid bodies). This
-         * also has the effect of deleting the sibling of this node, and
-         * changing the parent node so that it contains the data currently
-         * in that sibling. Finally it forces the hierarchy above the
-         * current node to reconsider its bounding volume.
+         * Holds the index of the first node in the free list.
          */
-        ~BVHNode();
+        unsigned firstFree;
 
-    protected:
+        /**
+         * Holds the number of bodies in the tree.
+         */
+        unsigned leafCount;
+
+        /**
+         * Takes a node from the free list, or adds one to the pool,
+         * and sets it up as a leaf.
+         */
+        unsigned allocateNode(unsigned parent,
+            const BoundingVolumeClass &volume, RigidBody *body);
+
+        /**
+         * Returns the given node to the free list.
+         */
+        void freeNode(unsigned index);
+
+        /**
+         * Places the given leaf into the tree, below the root.
+         */
+        void insertLeaf(unsigned leaf);
+
+        /**
+         * Takes the given leaf out of the tree, without freeing it.
+         */
+        void removeLeaf(unsigned leaf);
+
+        /**
+         * Recalculates the bounding volumes of the given node and
+         * everything above it, rotating each node as it goes.
+         */
+        void recalculateBoundingVolumes(unsigned index);
+
+        /**
+         * Swaps one of the given node's children with one of its
+         * grandchildren on the other side, if that makes the child
+         * that changes smaller. This keeps the tree from becoming
+         * lopsided as bodies are added, removed and moved.
+         */
+        void rotate(unsigned index);
 
         /**
-         * Checks for overlapping between nodes in the hierarchy. Note
-         * that any bounding volume should have an overlaps method implemented
-         * that checks for overlapping with another object of its own type.
+         * Checks the potential contacts within the subtree at the
+         * given node, writing them to the given array (up to the
+         * given limit). Returns the number of potential contacts it
+         * found.
          */
-        bool overlaps(const BVHNode<BoundingVolumeClass> *other) const;
+        unsigned getPotentialContactsIn(unsigned index,
+            PotentialContact* contacts, unsigned limit) const;
 
         /**
-         * Checks the potential contacts between this node and the given
-         * other node, writing them to the given array (up to the
+         * Checks the potential contacts between the two given
+         * subtrees, writing them to the given array (up to the
          * given limit). Returns the number of potential contacts it
          * found.
          */
-        unsigned getPotentialContactsWith(
-            const BVHNode<BoundingVolumeClass> *other,
-            PotentialContact* contacts,
-            unsigned limit) const;
+        unsigned getPotentialContactsWith(unsigned one, unsigned two,
+            PotentialContact* contacts, unsigned limit) const;
+
+        /**
+         * Adds the bodies in the subtree at the given node whose
+         * bounding volumes overlap the given volume to the list.
+         */
+        void queryFrom(unsigned index, const BoundingVolumeClass &volume,
+            std::vector<RigidBody*> &bodies) const;
+
+        /**
+         * Calls the visitor for the bodies in the subtree at the
+         * given node whose bounding volumes overlap the given volume.
+         * Returns false if the visitor ended the query.
+         */
+        template<class Visitor>
+        bool queryFrom(unsigned index, const BoundingVolumeClass &volume,
+            Visitor &visitor) const;
+
+        /**
+         * Casts the given ray through the subtree at the given node,
+         * whose volume the ray is known to pass through, visiting the
+         * nearer branch first.
+         */
+        template<class Visitor>
+        void raycastFrom(unsigned index, const Vector3 &origin,
+            const Vector3 &direction, real &length,
+            const Vector3 &inflate, Visitor &visitor) const;
+
+        /**
+         * Casts the rays of the given packet in the given mask
+         * through the subtree at the given node.
+         */
+        template<class Visitor>
+        void raycastPacketFrom(unsigned index, unsigned mask,
+            RayPacket &packet, Visitor &visitor) const;
+
+    public:
+        /**
+         * Creates an empty tree.
+         */
+        BVHTree()
+            : root(BVH_NULL_NODE), firstFree(BVH_NULL_NODE), leafCount(0)
+        {
+        }
+
+        /**
+         * Makes room in the node pool for the given number of bodies,
+         * so they can be inserted without allocating.
+         */
+        void reserve(unsigned bodies)
+        {
+            if (bodies > 0) nodes.reserve(bodies * 2 - 1);
+        }
+
+        /**
+         * Inserts the given rigid body, with the given bounding
+         * volume, into the hierarchy. Returns a handle that can be
+         * used to update or remove the body.
+         */
+        unsigned insert(RigidBody* body, const BoundingVolumeClass &volume);
+
+        /**
+         * Removes the body with the given handle from the hierarchy.
+         * Its sibling takes the place of their parent, and the leaf
+         * and the parent are returned to the free list.
+         */
+        void remove(unsigned handle);
 
         /**
-         * For non-leaf nodes, this method recalculates the bounding volume
-         * based on the bounding volumes of its children.
+         * Changes the bounding volume of the body with the given
+         * handle, moving it to a better place in the tree. The handle
+         * remains valid, and no nodes are allocated.
          */
-        void recalculateBoundingVolume(bool recurse = true);
+        void update(unsigned handle, const BoundingVolumeClass &volume);
+
+        /**
+         * Moves every bounding volume in the hierarchy by the given
+         * offset, as when the bodies are all moved together. The
+         * shape of the tree is unchanged.
+         */
+        void translate(const Vector3 &offset)
+        {
+            for (unsigned i = 0; i < nodes.size(); i++)
+            {
+                nodes[i].volume.translate(offset);
+            }
+        }
+
+        /**
+         * Removes every body from the hierarchy, keeping the node
+         * pool for reuse.
+         */
+        void clear()
+        {
+            nodes.clear();
+            root = BVH_NULL_NODE;
+            firstFree = BVH_NULL_NODE;
+            leafCount = 0;
+        }
+
+        /**
+         * Returns the number of bodies in the hierarchy.
+         */
+        unsigned getBodyCount() const
+        {
+            return leafCount;
+        }
+
+        /**
+         * Returns the index of the root node, or BVH_NULL_NODE if the
+         * tree is empty.
+         */
+        unsigned getRoot() const
+        {
+            return root;
+        }
+
+        /**
+         * Returns the node with the given index.
+         */
+        const Node& getNode(unsigned index) const
+        {
+            return nodes[index];
+        }
+
+        /**
+         * Checks every pair of bodies in the hierarchy whose bounding
+         * volumes overlap, writing them to the given array (up to
+         * the given limit). Returns the number of potential contacts
+         * it found.
+         */
+        unsigned getPotentialContacts(PotentialContact* contacts,
+                                      unsigned limit) const
+        {
+            if (root == BVH_NULL_NODE) return 0;
+            return getPotentialContactsIn(root, contacts, limit);
+        }
+
+        /**
+         * Adds every body whose bounding volume overlaps the given
+         * volume to the given list. Only the branches of the tree
+         * that overlap the volume are visited.
+         */
+        void query(const BoundingVolumeClass &volume,
+                   std::vector<RigidBody*> &bodies) const
+        {
+            if (root == BVH_NULL_NODE) return;
+            queryFrom(root, volume, bodies);
+        }
+
+        /**
+         * Calls the visitor for every body whose bounding volume
+         * overlaps the given volume, without allocating. The visitor
+         * is called as visitor(body), and returns false to end the
+         * query early.
+         */
+        template<class Visitor>
+        void query(const BoundingVolumeClass &volume, Visitor &visitor) const
+        {
+            if (root == BVH_NULL_NODE) return;
+            queryFrom(root, volume, visitor);
+        }
+
+        /**
+         * Casts the given ray through the hierarchy, calling the
+         * visitor for each body whose bounding volume, grown by the
+         * given half-sizes, the ray passes through. The direction must
+         * be unit length.
+         *
+         * The visitor is called as visitor(body, length), and may
+         * shorten the length when it finds a hit, so that bodies
+         * further along are not visited. Branches nearer the origin
+         * are visited first, so this normally happens early.
+         */
+        template<class Visitor>
+        void raycast(const Vector3 &origin, const Vector3 &direction,
+            real length, const Vector3 &inflate, Visitor &visitor) const
+        {
+            real entry;
+            if (root == BVH_NULL_NODE ||
+                !nodes[root].volume.intersectsRay(
+                    origin, direction, length, inflate, &entry)) return;
+            raycastFrom(root, origin, direction, length, inflate, visitor);
+        }
+
+        /**
+         * Casts the active rays of the given packet through the
+         * hierarchy together, so each branch is fetched once and
+         * tested against all of them at once. The visitor is called
+         * as visitor(body, mask, packet) for each body whose bounding
+         * volume any of the rays pass through, with a mask
+         * of those rays, and may shorten their lengths in the packet.
+         * Packets work best when their rays start near each other and
+         * point in similar directions.
+         */
+        template<class Visitor>
+        void raycastPacket(RayPacket &packet, Visitor &visitor) const
+        {
+            if (root == BVH_NULL_NODE || !packet.active) return;
+            raycastPacketFrom(root, packet.active, packet, visitor);
+        }
     };
 
     // Note that, because we're dealing with a template here, we
@@ -199,189 +621,404 @@ namespace cyclone {
     // imports this header.
 
     template<class BoundingVolumeClass>
-    bool BVHNode<BoundingVolumeClass>::overlaps(
-        const BVHNode<BoundingVolumeClass> * other
-        ) const
+    unsigned BVHTree<BoundingVolumeClass>::allocateNode(
+        unsigned parent, const BoundingVolumeClass &volume, RigidBody *body
+        )
+    {
+        if (firstFree == BVH_NULL_NODE)
+        {
+            nodes.push_back(Node(parent, volume, body));
+            return (unsigned)nodes.size() - 1;
+        }
+
+        unsigned index = firstFree;
+        firstFree = nodes[index].parent;
+        nodes[index] = Node(parent, volume, body);
+        return index;
+    }
+
+    template<class BoundingVolumeClass>
+    void BVHTree<BoundingVolumeClass>::freeNode(unsigned index)
     {
-        return volume->overlaps(other->volume);
+        Node &node = nodes[index];
+        node.body = NULL;
+        node.children[0] = node.children[1] = BVH_NULL_NODE;
+        node.parent = firstFree;
+        firstFree = index;
     }
 
     template<class BoundingVolumeClass>
-    void BVHNode<BoundingVolumeClass>::insert(
+    unsigned BVHTree<BoundingVolumeClass>::insert(
         RigidBody* newBody, const BoundingVolumeClass &newVolume
         )
     {
-        // If we are a leaf, then the only option is to spawn two
-        // new children and place the new body in one.
-        if (isLeaf())
+        unsigned leaf = allocateNode(BVH_NULL_NODE, newVolume, newBody);
+        insertLeaf(leaf);
+        leafCount++;
+        return leaf;
+    }
+
+    template<class BoundingVolumeClass>
+    void BVHTree<BoundingVolumeClass>::insertLeaf(unsigned leaf)
+    {
+        if (root == BVH_NULL_NODE)
         {
-            // Child one is a copy of us.
-            children[0] = new BVHNode<BoundingVolumeClass>(
-                this, volume, body
-                );
+            root = leaf;
+            nodes[leaf].parent = BVH_NULL_NODE;
+            return;
+        }
 
-            // Child two holds the new body
-            children[1] = new BVHNode<BoundingVolumeClass>(
-                this, newVolume, newBody
-                );
+        // Work down the tree looking for the best sibling for the new
+        // body. Pairing it with a node costs the surface of the two
+        // together, plus the growth of every node above, so we stop
+        // as soon as neither child could do better than the node
+        // itself. Always going down to a leaf would make the tree
+        // deeper and its volumes larger with every body added.
+        const BoundingVolumeClass &newVolume = nodes[leaf].volume;
+        unsigned index = root;
+        real inherited = 0;
+        while (!nodes[index].isLeaf())
+        {
+            const Node &node = nodes[index];
+            real growth = node.volume.getGrowth(newVolume);
+            real cost = node.volume.getSurface() + growth + inherited;
+            inherited += growth;
 
-            // And we now loose the body (we're no longer a leaf)
-            this->body = NULL;
+            real childCost[2];
+            for (unsigned i = 0; i < 2; i++)
+            {
+                const Node &child = nodes[node.children[i]];
+                childCost[i] = inherited + child.volume.getGrowth(newVolume);
+                if (child.isLeaf()) childCost[i] += child.volume.getSurface();
+            }
+            if (cost <= childCost[0] && cost <= childCost[1]) break;
 
-            // We need to recalculate our bounding volume
-            recalculateBoundingVolume();
+            index = node.children[childCost[0] <= childCost[1] ? 0 : 1];
         }
 
-        // Otherwise we need to work out which child gets to keep
-        // the inserted body. We give it to whoever would grow the
-        // least to incorporate it.
+        // The node we reached is replaced by a new branch holding it
+        // and the new leaf. The old node keeps its index, so if it is
+        // a leaf its handle stays valid.
+        unsigned oldParent = nodes[index].parent;
+        unsigned branch = allocateNode(oldParent, nodes[index].volume, NULL);
+        nodes[branch].children[0] = index;
+        nodes[branch].children[1] = leaf;
+        nodes[index].parent = branch;
+        nodes[leaf].parent = branch;
+
+        if (oldParent == BVH_NULL_NODE)
+        {
+            root = branch;
+        }
         else
         {
-            if (children[0]->volume.getGrowth(newVolume) <
-                children[1]->volume.getGrowth(newVolume))
-            {
-                children[0]->insert(newBody, newVolume);
-            }
-            else
-            {
-                children[1]->insert(newBody, newVolume);
-            }
+            Node &parent = nodes[oldParent];
+            if (parent.children[0] == index) parent.children[0] = branch;
+            else parent.children[1] = branch;
         }
+
+        recalculateBoundingVolumes(branch);
+    }
+
+    template<class BoundingVolumeClass>
+    void BVHTree<BoundingVolumeClass>::remove(unsigned handle)
+    {
+        removeLeaf(handle);
+        freeNode(handle);
+        leafCount--;
     }
 
     template<class BoundingVolumeClass>
-    BVHNode<BoundingVolumeClass>::~BVHNode()
+    void BVHTree<BoundingVolumeClass>::removeLeaf(unsigned leaf)
     {
-        // If we don't have a parent, then we ignore the sibling
-        // processing
-        if (parent)
-        {
-            // Find our sibling
-            BVHNode<BoundingVolumeClass> *sibling;
-            if (parent->children[0] == this) sibling = parent->children[1];
-            else sibling = parent->children[0];
-
-            // Write its data to our parent
-            parent->volume = sibling->volume;
-            parent->body = sibling->body;
-            parent->children[0] = sibling->children[0];
-            parent->children[1] = sibling->children[1];
-
-            // Delete the sibling (we blank its parent and
-            // children to avoid processing/deleting them)
-            sibling->parent = NULL;
-            sibling->body = NULL;
-            sibling->children[0] = NULL;
-            sibling->children[1] = NULL;
-            delete sibling;
-
-            // Recalculate the parent's bounding volume
-            parent->recalculateBoundingVolume();
-        }
-
-        // Delete our children (again we remove their
-        // parent data so we don't try to process their siblings
-        // as they are deleted).
-        if (children[0]) {
-            children[0]->parent = NULL;
-            delete children[0];
-        }
-        if (children[1]) {
-            children[1]->parent = NULL;
-            delete children[0];
+        unsigned parentIndex = nodes[leaf].parent;
+        if (parentIndex == BVH_NULL_NODE)
+        {
+            root = BVH_NULL_NODE;
+            return;
+        }
+
+        // Our sibling takes the place of our parent.
+        const Node &parent = nodes[parentIndex];
+        unsigned sibling = (parent.children[0] == leaf) ?
+            parent.children[1] : parent.children[0];
+        unsigned grandparent = parent.parent;
+
+        nodes[sibling].parent = grandparent;
+        if (grandparent == BVH_NULL_NODE)
+        {
+            root = sibling;
         }
+        else
+        {
+            Node &above = nodes[grandparent];
+            if (above.children[0] == parentIndex) above.children[0] = sibling;
+            else above.children[1] = sibling;
+            recalculateBoundingVolumes(grandparent);
+        }
+
+        freeNode(parentIndex);
+        nodes[leaf].parent = BVH_NULL_NODE;
+    }
+
+    template<class BoundingVolumeClass>
+    void BVHTree<BoundingVolumeClass>::update(
+        unsigned handle, const BoundingVolumeClass &volume
+        )
+    {
+        // Removing the leaf frees its parent, and inserting it again
+        // takes that node straight back off the free list.
+        removeLeaf(handle);
+        nodes[handle].volume = volume;
+        insertLeaf(handle);
     }
 
     template<class BoundingVolumeClass>
-        void BVHNode<BoundingVolumeClass>::recalculateBoundingVolume(
-        bool recurse
+    void BVHTree<BoundingVolumeClass>::recalculateBoundingVolumes(
+        unsigned index
         )
     {
-        if (isLeaf()) return;
+        while (index != BVH_NULL_NODE)
+        {
+            Node &node = nodes[index];
+            if (!node.isLeaf())
+            {
+                rotate(index);
 
-        // Use the bounding volume combining constructor.
-        volume = BoundingVolumeClass(
-            children[0]->volume,
-            children[1]->volume
-            );
+                // Use the bounding volume combining constructor.
+                node.volume = BoundingVolumeClass(
+                    nodes[node.children[0]].volume,
+                    nodes[node.children[1]].volume
+                    );
+            }
+            index = node.parent;
+        }
+    }
+
+    template<class BoundingVolumeClass>
+    void BVHTree<BoundingVolumeClass>::rotate(unsigned index)
+    {
+        Node &node = nodes[index];
+
+        // Find the swap that shrinks the child it changes the most.
+        real bestGain = 0;
+        unsigned bestSide = 0, bestGrandchild = 0;
+        bool found = false;
+        for (unsigned side = 0; side < 2; side++)
+        {
+            const Node &other = nodes[node.children[1 - side]];
+            if (other.isLeaf()) continue;
+
+            for (unsigned j = 0; j < 2; j++)
+            {
+                // The other child would hold this side's child and
+                // the grandchild that isn't moved.
+                BoundingVolumeClass rotated(
+                    nodes[node.children[side]].volume,
+                    nodes[other.children[1 - j]].volume
+                    );
+                real gain = other.volume.getSurface() - rotated.getSurface();
+                if (gain > bestGain)
+                {
+                    bestGain = gain;
+                    bestSide = side;
+                    bestGrandchild = j;
+                    found = true;
+                }
+            }
+        }
+        if (!found) return;
+
+        unsigned child = node.children[bestSide];
+        unsigned otherIndex = node.children[1 - bestSide];
+        Node &other = nodes[otherIndex];
+        unsigned grandchild = other.children[bestGrandchild];
 
-        // Recurse up the tree
-        if (parent) parent->recalculateBoundingVolume(true);
+        node.children[bestSide] = grandchild;
+        nodes[grandchild].parent = index;
+        other.children[bestGrandchild] = child;
+        nodes[child].parent = otherIndex;
+        other.volume = BoundingVolumeClass(
+            nodes[other.children[0]].volume,
+            nodes[other.children[1]].volume
+            );
     }
 
     template<class BoundingVolumeClass>
-    unsigned BVHNode<BoundingVolumeClass>::getPotentialContacts(
-        PotentialContact* contacts, unsigned limit
+    unsigned BVHTree<BoundingVolumeClass>::getPotentialContactsIn(
+        unsigned index, PotentialContact* contacts, unsigned limit
         ) const
     {
         // Early out if we don't have the room for contacts, or
         // if we're a leaf node.
-        if (isLeaf() || limit == 0) return 0;
+        const Node &node = nodes[index];
+        if (node.isLeaf() || limit == 0) return 0;
 
-        // Get the potential contacts of one of our children with
-        // the other
-        return children[0]->getPotentialContactsWith(
-            children[1], contacts, limit
+        // Find the contacts within each child, then those between
+        // the children.
+        unsigned count = getPotentialContactsIn(
+            node.children[0], contacts, limit
+            );
+        count += getPotentialContactsIn(
+            node.children[1], contacts+count, limit-count
+            );
+        count += getPotentialContactsWith(
+            node.children[0], node.children[1],
+            contacts+count, limit-count
             );
+        return count;
     }
 
     template<class BoundingVolumeClass>
-    unsigned BVHNode<BoundingVolumeClass>::getPotentialContactsWith(
-        const BVHNode<BoundingVolumeClass> *other,
+    unsigned BVHTree<BoundingVolumeClass>::getPotentialContactsWith(
+        unsigned one, unsigned two,
         PotentialContact* contacts,
         unsigned limit
         ) const
     {
+        const Node &first = nodes[one];
+        const Node &second = nodes[two];
+
         // Early out if we don't overlap or if we have no room
         // to report contacts
-        if (!overlaps(other) || limit == 0) return 0;
+        if (limit == 0 || !first.volume.overlaps(&second.volume)) return 0;
 
         // If we're both at leaf nodes, then we have a potential contact
-        if (isLeaf() && other->isLeaf())
+        if (first.isLeaf() && second.isLeaf())
         {
-            contacts->body[0] = body;
-            contacts->body[1] = other->body;
+            contacts->body[0] = first.body;
+            contacts->body[1] = second.body;
             return 1;
         }
 
         // Determine which node to descend into. If either is
         // a leaf, then we descend the other. If both are branches,
         // then we use the one with the largest size.
-        if (other->isLeaf() ||
-            (!isLeaf() && volume->getSize() >= other->volume->getSize()))
+        if (second.isLeaf() ||
+            (!first.isLeaf() &&
+                first.volume.getSize() >= second.volume.getSize()))
         {
-            // Recurse into ourself
-            unsigned count = children[0]->getPotentialContactsWith(
-                other, contacts, limit
+            // Recurse into the first node
+            unsigned count = getPotentialContactsWith(
+                first.children[0], two, contacts, limit
+                );
+            return count + getPotentialContactsWith(
+                first.children[1], two, contacts+count, limit-count
                 );
-
-            // Check we have enough slots to do the other side too
-            if (limit > count) {
-                return count + children[1]->getPotentialContactsWith(
-                    other, contacts+count, limit-count
-                    );
-            } else {
-                return count;
-            }
         }
         else
         {
-            // Recurse into the other node
+            // Recurse into the second node
             unsigned count = getPotentialContactsWith(
-                other->children[0], contacts, limit
+                one, second.children[0], contacts, limit
+                );
+            return count + getPotentialContactsWith(
+                one, second.children[1], contacts+count, limit-count
                 );
+        }
+    }
 
-            // Check we have enough slots to do the other side too
-            if (limit > count) {
-                return count + getPotentialContactsWith(
-                    other->children[1], contacts+count, limit-count
-                    );
-            } else {
-                return count;
+    template<class BoundingVolumeClass>
+    void BVHTree<BoundingVolumeClass>::queryFrom(
+        unsigned index, const BoundingVolumeClass &volume,
+        std::vector<RigidBody*> &bodies
+        ) const
+    {
+        const Node &node = nodes[index];
+        if (!node.volume.overlaps(&volume)) return;
+
+        if (node.isLeaf())
+        {
+            bodies.push_back(node.body);
+            return;
+        }
+        queryFrom(node.children[0], volume, bodies);
+        queryFrom(node.children[1], volume, bodies);
+    }
+
+    template<class BoundingVolumeClass>
+    template<class Visitor>
+    bool BVHTree<BoundingVolumeClass>::queryFrom(
+        unsigned index, const BoundingVolumeClass &volume,
+        Visitor &visitor
+        ) const
+    {
+        const Node &node = nodes[index];
+        if (!node.volume.overlaps(&volume)) return true;
+
+        if (node.isLeaf()) return visitor(node.body);
+        return queryFrom(node.children[0], volume, visitor) &&
+            queryFrom(node.children[1], volume, visitor);
+    }
+
+    template<class BoundingVolumeClass>
+    template<class Visitor>
+    void BVHTree<BoundingVolumeClass>::raycastFrom(
+        unsigned index, const Vector3 &origin, const Vector3 &direction,
+        real &length, const Vector3 &inflate, Visitor &visitor
+        ) const
+    {
+        const Node &node = nodes[index];
+        if (node.isLeaf())
+        {
+            visitor(node.body, length);
+            return;
+        }
+
+        real entry[2];
+        bool hit[2];
+        for (unsigned i = 0; i < 2; i++)
+        {
+            hit[i] = nodes[node.children[i]].volume.intersectsRay(
+                origin, direction, length, inflate, entry + i);
+        }
+
+        // Visit the nearer child first, so a hit there can shorten
+        // the ray before the further child is checked against it.
+        unsigned first = (hit[1] && (!hit[0] || entry[1] < entry[0])) ? 1 : 0;
+        for (unsigned i = 0; i < 2; i++)
+        {
+            unsigned child = i == 0 ? first : 1 - first;
+            if (hit[child] && entry[child] <= length)
+            {
+                raycastFrom(node.children[child], origin, direction,
+                    length, inflate, visitor);
             }
         }
     }
 
+    template<class BoundingVolumeClass>
+    template<class Visitor>
+    void BVHTree<BoundingVolumeClass>::raycastPacketFrom(
+        unsigned index, unsigned mask, RayPacket &packet,
+        Visitor &visitor
+        ) const
+    {
+        const Node &node = nodes[index];
+        mask &= node.volume.intersectsRays(packet);
+        if (!mask) return;
+
+        if (node.isLeaf())
+        {
+            visitor(node.body, mask, packet);
+            return;
+        }
+
+        // Visit first the child nearer the origin along the first
+        // ray, which the others are assumed to roughly follow.
+        unsigned lane = 0;
+        while (!(mask & (1u << lane))) lane++;
+        Vector3 direction(packet.directionX[lane], packet.directionY[lane],
+            packet.directionZ[lane]);
+        const Node &one = nodes[node.children[0]];
+        const Node &two = nodes[node.children[1]];
+        unsigned first = two.volume.centre * direction <
+            one.volume.centre * direction ? 1 : 0;
+
+        raycastPacketFrom(node.children[first], mask, packet, visitor);
+        raycastPacketFrom(node.children[1 - first], mask, packet, visitor);
+    }
+
 } // namespace cyclone
 
-#endif // CYCLONE_COLLISION_FINE_H
\ No newline at end of file
+#endif // CYCLONE_COLLISION_COARSE_H
@@ -25,13 +25,30 @@
 #ifndef CYCLONE_COLLISION_FINE_H
 #define CYCLONE_COLLISION_FINE_H
 
-#include "contacts.h"
+#include "collide_coarse.h"
 
 namespace cyclone {
 
     // Forward declarations of primitive friends
     class IntersectionTests;
     class CollisionDetector;
+    class CollisionCompound;
+    class CollisionMesh;
+    class CollisionHeightfield;
+    class CastTests;
+
+    /**
+     * Identifies the kinds of collision primitive, so that a pair of
+     * primitives can be passed to the right collision test.
+     */
+    enum PrimitiveType
+    {
+        PRIMITIVE_SPHERE,
+        PRIMITIVE_BOX,
+        PRIMITIVE_COMPOUND,
+        PRIMITIVE_MESH,
+        PRIMITIVE_HEIGHTFIELD
+    };
 
     /**
      * Represents a primitive to detect collisions against.
@@ -46,22 +63,52 @@ namespace cyclone {
          */
         friend IntersectionTests;
         friend CollisionDetector;
+        friend CollisionCompound;
 
         /**
-         * The rigid body that is represented by this primitive.
+         * The rigid body that is represented by this primitive. This
+         * is NULL for static geometry, which doesn't move.
          */
         RigidBody * body;
 
         /**
-         * The offset of this primitive from the given rigid body.
+         * The offset of this primitive from the given rigid body, or
+         * its place in the world if it has no body. If this is
+         * changed after the primitive has been used, call invalidate
+         * so the cached transform is recalculated.
          */
         Matrix4 offset;
 
         /**
-         * Calculates the internals for the primitive.
+         * Creates a primitive with no body and no offset.
+         */
+        CollisionPrimitive();
+
+        virtual ~CollisionPrimitive() {}
+
+        /**
+         * Returns the kind of primitive this is.
+         */
+        virtual PrimitiveType getType() const = 0;
+
+        /**
+         * Calculates the internals for the primitive. The transform
+         * and bounding box are cached, and only recalculated when
+         * the body's transform version shows it has moved, so this
+         * costs almost nothing for sleeping or static bodies.
          */
         void calculateInternals();
 
+        /**
+         * Marks the cached transform and bounding box as out of
+         * date. This is needed after changing the offset or the size
+         * of the primitive, which don't move the body.
+         */
+        void invalidate()
+        {
+            transformCurrent = false;
+        }
+
         /**
          * This is a convenience function to allow access to the
          * axis vectors in the transform for this primitive.
@@ -82,14 +129,55 @@ namespace cyclone {
             return transform;
         }
 
+        /**
+         * Returns the world space bounding box of the primitive, as
+         * of the last call to calculateInternals.
+         */
+        const BoundingBox& getBoundingBox() const
+        {
+            return boundingBox;
+        }
+
 
     protected:
+        /**
+         * Returns the half-sizes along each world axis of a box
+         * enclosing the primitive, using the current transform. The
+         * base primitive is a single point.
+         */
+        virtual Vector3 getBoundingHalfSize() const;
+
+        /**
+         * Sets the resultant transform of the primitive, and
+         * calculates its bounding box to match.
+         */
+        virtual void setTransform(const Matrix4 &newTransform);
+
         /**
          * The resultant transform of the primitive. This is
          * calculated by combining the offset of the primitive
          * with the transform of the rigid body.
          */
         Matrix4 transform;
+
+        /**
+         * The world space bounding box of the primitive, calculated
+         * along with the transform.
+         */
+        BoundingBox boundingBox;
+
+        /**
+         * The body, and its transform version, that the transform
+         * was last calculated from.
+         */
+        const RigidBody *transformBody;
+        unsigned transformVersion;
+
+        /**
+         * True if the transform has been calculated since the
+         * primitive was last invalidated.
+         */
+        bool transformCurrent;
     };
 
     /**
@@ -103,6 +191,14 @@ namespace cyclone {
          * The radius of the sphere.
          */
         real radius;
+
+        virtual PrimitiveType getType() const
+        {
+            return PRIMITIVE_SPHERE;
+        }
+
+    protected:
+        virtual Vector3 getBoundingHalfSize() const;
     };
 
     /**
@@ -135,6 +231,114 @@ namespace cyclone {
          * Holds the half-sizes of the box along each of its local axes.
          */
         Vector3 halfSize;
+
+        virtual PrimitiveType getType() const
+        {
+            return PRIMITIVE_BOX;
+        }
+
+    protected:
+        virtual Vector3 getBoundingHalfSize() const;
+    };
+
+    /**
+     * Represents a rigid body made up of several primitives, such as
+     * a die with rounded corners made from a box and a sphere. The
+     * children share the compound's body, so the body is integrated
+     * once and the children follow it.
+     *
+     * The children are held in a small bounding volume hierarchy,
+     * built in the body's space when they are added and refitted in
+     * world space whenever the body moves. Collision tests against a
+     * compound use it to skip the children that can't be touching.
+     */
+    class CollisionCompound : public CollisionPrimitive
+    {
+    public:
+        friend CollisionDetector;
+        friend CastTests;
+
+        /**
+         * Adds the given primitive to the compound. Its offset is
+         * taken relative to the compound's offset, and its body is
+         * set to the compound's body. The compound doesn't own its
+         * children, and they can be any kind of primitive, including
+         * other compounds.
+         */
+        void addChild(CollisionPrimitive *child);
+
+        /**
+         * Removes all the children from the compound.
+         */
+        void clearChildren();
+
+        /**
+         * Returns the number of children in the compound.
+         */
+        unsigned getChildCount() const
+        {
+            return (unsigned)children.size();
+        }
+
+        /**
+         * Returns the child with the given index.
+         */
+        CollisionPrimitive* getChild(unsigned index) const
+        {
+            return children[index];
+        }
+
+        virtual PrimitiveType getType() const
+        {
+            return PRIMITIVE_COMPOUND;
+        }
+
+    protected:
+        /**
+         * A node in the compound's hierarchy. Branches have two
+         * children, leaves have a primitive.
+         */
+        struct Node
+        {
+            BoundingBox volume;
+            unsigned children[2];
+            CollisionPrimitive *primitive;
+
+            Node()
+                : volume(Vector3(), Vector3()), primitive(0)
+            {
+                children[0] = children[1] = BVH_NULL_NODE;
+            }
+
+            bool isLeaf() const
+            {
+                return primitive != 0;
+            }
+        };
+
+        /**
+         * Holds the children of the compound.
+         */
+        std::vector<CollisionPrimitive*> children;
+
+        /**
+         * Holds the hierarchy over the children, root first, with
+         * every node stored before its own children. It is empty
+         * when it needs rebuilding.
+         */
+        std::vector<Node> nodes;
+
+        /**
+         * Sets the transform of the compound, moving its children
+         * with it and refitting the hierarchy around them.
+         */
+        virtual void setTransform(const Matrix4 &newTransform);
+
+        /**
+         * Builds the part of the hierarchy holding the children with
+         * the given indices, and returns the index of its root.
+         */
+        unsigned buildNodes(unsigned *indices, unsigned count);
     };
 
     /**
@@ -158,6 +362,15 @@ namespace cyclone {
             const CollisionBox &one,
             const CollisionBox &two);
 
+        /**
+         * Does an intersection test on an arbitrarily aligned box and
+         * a sphere, by finding the point in the box closest to the
+         * sphere's centre.
+         */
+        static bool boxAndSphere(
+            const CollisionBox &box,
+            const CollisionSphere &sphere);
+
         /**
          * Does an intersection test on an arbitrarily aligned box and a
          * half-space.
@@ -303,11 +516,138 @@ namespace cyclone {
             const CollisionSphere &sphere,
             CollisionData *data
             );
+        /**
+         * Does a collision test on two primitives of any kind,
+         * passing them to the test for their types. Pairs with no
+         * test, such as two meshes, return no contacts.
+         */
+        static unsigned primitiveAndPrimitive(
+            const CollisionPrimitive &one,
+            const CollisionPrimitive &two,
+            CollisionData *data
+            );
+
+        /**
+         * Does a collision test on a sphere and the triangles of a
+         * mesh near it.
+         */
+        static unsigned sphereAndMesh(
+            const CollisionSphere &sphere,
+            const CollisionMesh &mesh,
+            CollisionData *data
+            );
+
+        /**
+         * Does a collision test on a box and the triangles of a mesh
+         * near it.
+         */
+        static unsigned boxAndMesh(
+            const CollisionBox &box,
+            const CollisionMesh &mesh,
+            CollisionData *data
+            );
+
+        /**
+         * Does a collision test on a sphere and the triangles of a
+         * heightfield near it.
+         */
+        static unsigned sphereAndHeightfield(
+            const CollisionSphere &sphere,
+            const CollisionHeightfield &heightfield,
+            CollisionData *data
+            );
+
+        /**
+         * Does a collision test on a box and the triangles of a
+         * heightfield near it.
+         */
+        static unsigned boxAndHeightfield(
+            const CollisionBox &box,
+            const CollisionHeightfield &heightfield,
+            CollisionData *data
+            );
+
+        /**
+         * Does a collision test on a primitive of any kind and a
+         * half-space.
+         */
+        static unsigned primitiveAndHalfSpace(
+            const CollisionPrimitive &primitive,
+            const CollisionPlane &plane,
+            CollisionData *data
+            );
+
+        /**
+         * Does a collision test on a compound and another primitive.
+         * Only the children whose bounding boxes overlap the
+         * primitive's are tested.
+         */
+        static unsigned compoundAndPrimitive(
+            const CollisionCompound &compound,
+            const CollisionPrimitive &primitive,
+            CollisionData *data
+            );
+
+        /**
+         * Does a collision test on two compounds, descending both
+         * hierarchies together so that only pairs of children with
+         * overlapping bounding boxes are tested.
+         */
+        static unsigned compoundAndCompound(
+            const CollisionCompound &one,
+            const CollisionCompound &two,
+            CollisionData *data
+            );
+
+        /**
+         * Does a collision test on a compound and a half-space.
+         */
+        static unsigned compoundAndHalfSpace(
+            const CollisionCompound &compound,
+            const CollisionPlane &plane,
+            CollisionData *data
+            );
+
 		static unsigned eightDiceAndHalfSpace(
 			const CollisionBox &dice,
 			const CollisionPlane &plane,
 			CollisionData *data
 			);
+
+    protected:
+        /**
+         * Tests the given primitive against the children below the
+         * given node of the compound's hierarchy.
+         */
+        static unsigned compoundNodeAndPrimitive(
+            const CollisionCompound &compound,
+            unsigned node,
+            const CollisionPrimitive &primitive,
+            CollisionData *data
+            );
+
+        /**
+         * Tests the children below the given nodes of two compounds'
+         * hierarchies against each other.
+         */
+        static unsigned compoundNodeAndCompoundNode(
+            const CollisionCompound &one,
+            unsigned nodeOne,
+            const CollisionCompound &two,
+            unsigned nodeTwo,
+            CollisionData *data
+            );
+
+        /**
+         * Tests the children below the given node of the compound's
+         * hierarchy against the half-space.
+         */
+        static unsigned compoundNodeAndHalfSpace(
+            const CollisionCompound &compound,
+            unsigned node,
+            const CollisionPlane &plane,
+            CollisionData *data
+            );
     };
 
 
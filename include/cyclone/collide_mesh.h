@@ -0,0 +1,259 @@
+/*
+ * Interface file for the triangle mesh and heightfield primitives.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains the collision primitives for level geometry
+ * made of triangles: arbitrary triangle meshes, and heightfields for
+ * terrain. Both are normally used as static geometry, and are
+ * collided against spheres and boxes by the tests in
+ * CollisionDetector.
+ *
+ * Triangles are one sided. Their front face is the one from which
+ * their corners run anticlockwise, and objects behind a triangle do
+ * not touch it. Edges and corners shared with a neighbouring
+ * triangle that don't stick out from the surface are internal, and
+ * contacts with them use the triangle's face normal, so objects
+ * slide over the joins between triangles without catching on them.
+ */
+#ifndef CYCLONE_COLLISION_MESH_H
+#define CYCLONE_COLLISION_MESH_H
+
+#include "collide_fine.h"
+
+namespace cyclone {
+
+    /**
+     * A function that generates the contacts between a primitive and
+     * a single triangle, given in world space. The flags mark the
+     * triangle's internal edges and corners, and the body is the one
+     * the triangle belongs to, if any.
+     */
+    typedef unsigned (*TriangleCollisionTest)(
+        const CollisionPrimitive &primitive,
+        const Vector3 *triangle,
+        unsigned flags,
+        RigidBody *body,
+        CollisionData *data
+        );
+
+    /**
+     * Represents an arbitrary triangle mesh for collision detection.
+     *
+     * The triangles are held in a bounding volume hierarchy that is
+     * built once, when the mesh is set. To keep large levels small,
+     * each node's bounds are quantised to 16 bits within the bounds
+     * of the whole mesh, rounding outwards, and the nodes are laid
+     * out so that they can be walked in order without a stack: each
+     * node is followed by its subtree, and a branch holds the number
+     * of nodes to skip to pass it. A node takes sixteen bytes, and a
+     * mesh of a million triangles needs two million of them.
+     */
+    class CollisionMesh : public CollisionPrimitive
+    {
+    public:
+        friend CollisionDetector;
+        friend CastTests;
+
+        /**
+         * Sets the triangles of the mesh, and builds its hierarchy
+         * and the flags for its internal edges. The vertices are
+         * given in the mesh's own space, and each triangle is three
+         * indices into them. The data is copied.
+         */
+        void setTriangles(const Vector3 *vertices, unsigned vertexCount,
+            const unsigned *indices, unsigned triangleCount);
+
+        /**
+         * Returns the number of triangles in the mesh.
+         */
+        unsigned getTriangleCount() const
+        {
+            return (unsigned)indices.size() / 3;
+        }
+
+        virtual PrimitiveType getType() const
+        {
+            return PRIMITIVE_MESH;
+        }
+
+    protected:
+        /**
+         * Marks a leaf node in the hierarchy.
+         */
+        static const unsigned LEAF_NODE = 0x80000000;
+
+        /**
+         * A node in the mesh's hierarchy. A leaf has the top bit of
+         * its data set, and holds the index of its triangle in the
+         * rest. A branch holds the number of nodes in its subtree,
+         * including itself.
+         */
+        struct Node
+        {
+            unsigned short minimum[3];
+            unsigned short maximum[3];
+            unsigned data;
+        };
+
+        /**
+         * Holds the vertices of the mesh, in the mesh's space.
+         */
+        std::vector<Vector3> vertices;
+
+        /**
+         * Holds three vertex indices for each triangle.
+         */
+        std::vector<unsigned> indices;
+
+        /**
+         * Holds the internal edge and corner flags of each triangle.
+         */
+        std::vector<unsigned char> flags;
+
+        /**
+         * Holds the hierarchy over the triangles, root first.
+         */
+        std::vector<Node> nodes;
+
+        /**
+         * Holds the lowest corner of the mesh's bounds, and the
+         * scale from the mesh's space to the quantised bounds.
+         */
+        Vector3 boundsMinimum;
+        Vector3 quantisation;
+
+        /**
+         * Holds the centre and half-sizes of the mesh's bounds, in
+         * the mesh's space.
+         */
+        Vector3 boundsCentre;
+        Vector3 boundsHalfSize;
+
+        /**
+         * Sets the transform of the mesh, and calculates its world
+         * bounding box from its bounds.
+         */
+        virtual void setTransform(const Matrix4 &newTransform);
+
+        /**
+         * Builds the part of the hierarchy holding the given
+         * triangles, whose centres are in the given array.
+         */
+        void buildNodes(unsigned *triangles, unsigned count,
+            const Vector3 *centres);
+
+        /**
+         * Converts the given box, in the mesh's space, to quantised
+         * bounds, rounding outwards. Returns false if the box is
+         * clear of the mesh.
+         */
+        bool quantise(const Vector3 &low, const Vector3 &high,
+            unsigned short *quantisedLow,
+            unsigned short *quantisedHigh) const;
+
+        /**
+         * Runs the given test on each triangle whose node overlaps
+         * the given primitive's bounding box. Returns the number of
+         * contacts generated.
+         */
+        unsigned collideTriangles(const CollisionPrimitive &primitive,
+            TriangleCollisionTest test, CollisionData *data) const;
+    };
+
+    /**
+     * Represents a terrain heightfield for collision detection.
+     *
+     * The heights are held on a regular grid in the heightfield's
+     * xz plane, with the first height at the origin, and each cell
+     * of the grid is split into two triangles. The grid itself is
+     * used to find the triangles near an object, so no hierarchy is
+     * needed, and the internal edges are found as they are tested.
+     */
+    class CollisionHeightfield : public CollisionPrimitive
+    {
+    public:
+        friend CollisionDetector;
+        friend CastTests;
+
+        /**
+         * Creates an empty heightfield.
+         */
+        CollisionHeightfield();
+
+        /**
+         * Sets the heights of the heightfield. The heights are given
+         * row by row, along the x axis, with the rows along the z
+         * axis. The data is copied.
+         *
+         * @param spacing The distance between neighbouring heights.
+         */
+        void setHeights(const real *heights, unsigned columns,
+            unsigned rows, real spacing);
+
+        /**
+         * Returns the point of the grid at the given column and row,
+         * in the heightfield's space.
+         */
+        Vector3 getPoint(unsigned column, unsigned row) const
+        {
+            return Vector3(column * spacing, heights[row * columns + column],
+                row * spacing);
+        }
+
+        virtual PrimitiveType getType() const
+        {
+            return PRIMITIVE_HEIGHTFIELD;
+        }
+
+    protected:
+        /**
+         * Holds the heights of the grid.
+         */
+        std::vector<real> heights;
+
+        /**
+         * Holds the size of the grid.
+         */
+        unsigned columns;
+        unsigned rows;
+
+        /**
+         * Holds the distance between neighbouring heights.
+         */
+        real spacing;
+
+        /**
+         * Holds the lowest and highest heights in the grid.
+         */
+        real minimumHeight;
+        real maximumHeight;
+
+        /**
+         * Sets the transform of the heightfield, and calculates its
+         * world bounding box from the grid.
+         */
+        virtual void setTransform(const Matrix4 &newTransform);
+
+        /**
+         * Runs the given test on each triangle of the cells under the
+         * given primitive's bounding box. Returns the number of
+         * contacts generated.
+         */
+        unsigned collideTriangles(const CollisionPrimitive &primitive,
+            TriangleCollisionTest test, CollisionData *data) const;
+    };
+
+} // namespace cyclone
+
+#endif // CYCLONE_COLLISION_MESH_H
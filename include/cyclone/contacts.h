@@ -436,6 +436,18 @@ namespace cyclone {
          * been written.
          */
         virtual unsigned addContact(Contact *contact, unsigned limit) const = 0;
+
+        /**
+         * Returns the most contacts the generator can write in one
+         * call to addContact. The world makes at least this much
+         * room before calling the generator, and calls it only once
+         * a frame, so generators that can write more than one contact
+         * should override this.
+         */
+        virtual unsigned getMaxContacts() const
+        {
+            return 1;
+        }
     };
 
 } // namespace cyclone
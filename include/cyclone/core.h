@@ -98,6 +98,7 @@
 #define CYCLONE_CORE_H
 
 #include "precision.h"
+#include "simd.h"
 
 /**
  * The cyclone namespace includes all cyclone functions and
@@ -152,54 +153,64 @@ namespace cyclone {
      * @note This class contains a lot of inline methods for basic
      * mathematics. The implementations are included in the header
      * file.
+     *
+     * @note The vector is templated on its number type, so that code
+     * outside the simulation, such as geometry tools or rendering,
+     * can do its maths at a different precision from the library.
+     * Vector3 is the vector of the library's real number type, which
+     * every world, body and force generator uses.
      */
-    class Vector3
+    template <typename Real>
+    class Vector3T
     {
     public:
          /** Holds the value along the x axis. */
-        real x;
+        Real x;
 
         /** Holds the value along the y axis. */
-        real y;
+        Real y;
 
         /** Holds the value along the z axis. */
-        real z;
+        Real z;
 
     private:
-        /** Padding to ensure 4 word alignment. */
-        real pad;
+        /**
+         * Padding to ensure 4 word alignment. It is kept at zero, so
+         * the vector instructions in simd.h can load all four words.
+         */
+        Real pad;
 
     public:
         /** The default constructor creates a zero vector. */
-        Vector3() : x(0), y(0), z(0) {}
+        Vector3T() : x(0), y(0), z(0), pad(0) {}
 
         /**
          * The explicit constructor creates a vector with the given
          * components.
          */
-        Vector3(const real x, const real y, const real z)
-            : x(x), y(y), z(z) {}
-
-        const static Vector3 GRAVITY;
-        const static Vector3 HIGH_GRAVITY;
-        const static Vector3 UP;
-        const static Vector3 RIGHT;
-        const static Vector3 OUT_OF_SCREEN;
-        const static Vector3 X;
-        const static Vector3 Y;
-        const static Vector3 Z;
+        Vector3T(const Real x, const Real y, const Real z)
+            : x(x), y(y), z(z), pad(0) {}
+
+        const static Vector3T GRAVITY;
+        const static Vector3T HIGH_GRAVITY;
+        const static Vector3T UP;
+        const static Vector3T RIGHT;
+        const static Vector3T OUT_OF_SCREEN;
+        const static Vector3T X;
+        const static Vector3T Y;
+        const static Vector3T Z;
 
         // ... Other Vector3 code as before ...
 
 
-        real operator[](unsigned i) const
+        Real operator[](unsigned i) const
         {
             if (i == 0) return x;
             if (i == 1) return y;
             return z;
         }
 
-        real& operator[](unsigned i)
+        Real& operator[](unsigned i)
         {
             if (i == 0) return x;
             if (i == 1) return y;
@@ -207,7 +218,7 @@ namespace cyclone {
         }
 
         /** Adds the given vector to this. */
-        void operator+=(const Vector3& v)
+        void operator+=(const Vector3T& v)
         {
             x += v.x;
             y += v.y;
@@ -217,13 +228,13 @@ namespace cyclone {
         /**
          * Returns the value of the given vector added to this.
          */
-        Vector3 operator+(const Vector3& v) const
+        Vector3T operator+(const Vector3T& v) const
         {
-            return Vector3(x+v.x, y+v.y, z+v.z);
+            return Vector3T(x+v.x, y+v.y, z+v.z);
         }
 
         /** Subtracts the given vector from this. */
-        void operator-=(const Vector3& v)
+        void operator-=(const Vector3T& v)
         {
             x -= v.x;
             y -= v.y;
@@ -233,13 +244,13 @@ namespace cyclone {
         /**
          * Returns the value of the given vector subtracted from this.
          */
-        Vector3 operator-(const Vector3& v) const
+        Vector3T operator-(const Vector3T& v) const
         {
-            return Vector3(x-v.x, y-v.y, z-v.z);
+            return Vector3T(x-v.x, y-v.y, z-v.z);
         }
 
         /** Multiplies this vector by the given scalar. */
-        void operator*=(const real value)
+        void operator*=(const Real value)
         {
             x *= value;
             y *= value;
@@ -247,25 +258,25 @@ namespace cyclone {
         }
 
         /** Returns a copy of this vector scaled the given value. */
-        Vector3 operator*(const real value) const
+        Vector3T operator*(const Real value) const
         {
-            return Vector3(x*value, y*value, z*value);
+            return Vector3T(x*value, y*value, z*value);
         }
 
         /**
          * Calculates and returns a component-wise product of this
          * vector with the given vector.
          */
-        Vector3 componentProduct(const Vector3 &vector) const
+        Vector3T componentProduct(const Vector3T &vector) const
         {
-            return Vector3(x * vector.x, y * vector.y, z * vector.z);
+            return Vector3T(x * vector.x, y * vector.y, z * vector.z);
         }
 
         /**
          * Performs a component-wise product with the given vector and
          * sets this vector to its result.
          */
-        void componentProductUpdate(const Vector3 &vector)
+        void componentProductUpdate(const Vector3T &vector)
         {
             x *= vector.x;
             y *= vector.y;
@@ -276,18 +287,18 @@ namespace cyclone {
          * Calculates and returns the vector product of this vector
          * with the given vector.
          */
-        Vector3 vectorProduct(const Vector3 &vector) const
+        Vector3T vectorProduct(const Vector3T &vector) const
         {
-            return Vector3(y*vector.z-z*vector.y,
-                           z*vector.x-x*vector.z,
-                           x*vector.y-y*vector.x);
+            Vector3T result;
+            simdCross(&x, &vector.x, &result.x);
+            return result;
         }
 
         /**
          * Updates this vector to be the vector product of its current
          * value and the given vector.
          */
-        void operator %=(const Vector3 &vector)
+        void operator %=(const Vector3T &vector)
         {
             *this = vectorProduct(vector);
         }
@@ -296,35 +307,35 @@ namespace cyclone {
          * Calculates and returns the vector product of this vector
          * with the given vector.
          */
-        Vector3 operator%(const Vector3 &vector) const
+        Vector3T operator%(const Vector3T &vector) const
         {
-            return Vector3(y*vector.z-z*vector.y,
-                           z*vector.x-x*vector.z,
-                           x*vector.y-y*vector.x);
+            Vector3T result;
+            simdCross(&x, &vector.x, &result.x);
+            return result;
         }
 
         /**
          * Calculates and returns the scalar product of this vector
          * with the given vector.
          */
-        real scalarProduct(const Vector3 &vector) const
+        Real scalarProduct(const Vector3T &vector) const
         {
-            return x*vector.x + y*vector.y + z*vector.z;
+            return simdDot(&x, &vector.x);
         }
 
         /**
          * Calculates and returns the scalar product of this vector
          * with the given vector.
          */
-        real operator *(const Vector3 &vector) const
+        Real operator *(const Vector3T &vector) const
         {
-            return x*vector.x + y*vector.y + z*vector.z;
+            return simdDot(&x, &vector.x);
         }
 
         /**
          * Adds the given vector to this, scaled by the given amount.
          */
-        void addScaledVector(const Vector3& vector, real scale)
+        void addScaledVector(const Vector3T& vector, Real scale)
         {
             x += vector.x * scale;
             y += vector.y * scale;
@@ -332,19 +343,19 @@ namespace cyclone {
         }
 
         /** Gets the magnitude of this vector. */
-        real magnitude() const
+        Real magnitude() const
         {
-            return real_sqrt(x*x+y*y+z*z);
+            return Scalar<Real>::sqrt(simdDot(&x, &x));
         }
 
         /** Gets the squared magnitude of this vector. */
-        real squareMagnitude() const
+        Real squareMagnitude() const
         {
-            return x*x+y*y+z*z;
+            return simdDot(&x, &x);
         }
 
         /** Limits the size of the vector to the given maximum. */
-        void trim(real size)
+        void trim(Real size)
         {
             if (squareMagnitude() > size*size)
             {
@@ -358,23 +369,23 @@ namespace cyclone {
         /** Turns a non-zero vector into a vector of unit length. */
         void normalise()
         {
-            real l = magnitude();
+            Real l = magnitude();
             if (l > 0)
             {
-                (*this) *= ((real)1)/l;
+                (*this) *= ((Real)1)/l;
             }
         }
 
         /** Returns the normalised version of a vector. */
-        Vector3 unit() const
+        Vector3T unit() const
         {
-            Vector3 result = *this;
+            Vector3T result = *this;
             result.normalise();
             return result;
         }
 
         /** Checks if the two vectors have identical components. */
-        bool operator==(const Vector3& other) const
+        bool operator==(const Vector3T& other) const
         {
             return x == other.x &&
                 y == other.y &&
@@ -382,7 +393,7 @@ namespace cyclone {
         }
 
         /** Checks if the two vectors have non-identical components. */
-        bool operator!=(const Vector3& other) const
+        bool operator!=(const Vector3T& other) const
         {
             return !(*this == other);
         }
@@ -394,7 +405,7 @@ namespace cyclone {
          * @note This does not behave like a single-value comparison:
          * !(a < b) does not imply (b >= a).
          */
-        bool operator<(const Vector3& other) const
+        bool operator<(const Vector3T& other) const
         {
             return x < other.x && y < other.y && z < other.z;
         }
@@ -406,7 +417,7 @@ namespace cyclone {
          * @note This does not behave like a single-value comparison:
          * !(a < b) does not imply (b >= a).
          */
-        bool operator>(const Vector3& other) const
+        bool operator>(const Vector3T& other) const
         {
             return x > other.x && y > other.y && z > other.z;
         }
@@ -418,7 +429,7 @@ namespace cyclone {
          * @note This does not behave like a single-value comparison:
          * !(a <= b) does not imply (b > a).
          */
-        bool operator<=(const Vector3& other) const
+        bool operator<=(const Vector3T& other) const
         {
             return x <= other.x && y <= other.y && z <= other.z;
         }
@@ -430,7 +441,7 @@ namespace cyclone {
          * @note This does not behave like a single-value comparison:
          * !(a <= b) does not imply (b > a).
          */
-        bool operator>=(const Vector3& other) const
+        bool operator>=(const Vector3T& other) const
         {
             return x >= other.x && y >= other.y && z >= other.z;
         }
@@ -468,7 +479,8 @@ namespace cyclone {
      * represented as vectors. Quaternions are only needed for
      * orientation.
      */
-    class Quaternion
+    template <typename Real>
+    class QuaternionT
     {
     public:
         union {
@@ -476,31 +488,31 @@ namespace cyclone {
                 /**
                  * Holds the real component of the quaternion.
                  */
-                real r;
+                Real r;
 
                 /**
                  * Holds the first complex component of the
                  * quaternion.
                  */
-                real i;
+                Real i;
 
                 /**
                  * Holds the second complex component of the
                  * quaternion.
                  */
-                real j;
+                Real j;
 
                 /**
                  * Holds the third complex component of the
                  * quaternion.
                  */
-                real k;
+                Real k;
             };
 
             /**
              * Holds the quaternion data in array form.
              */
-            real data[4];
+            Real data[4];
         };
 
         // ... other Quaternion code as before ...
@@ -509,7 +521,7 @@ namespace cyclone {
          * The default constructor creates a quaternion representing
          * a zero rotation.
          */
-        Quaternion() : r(1), i(0), j(0), k(0) {}
+        QuaternionT() : r(1), i(0), j(0), k(0) {}
 
         /**
          * The explicit constructor creates a quaternion with the given
@@ -535,7 +547,7 @@ namespace cyclone {
          *
          * @see normalise
          */
-        Quaternion(const real r, const real i, const real j, const real k)
+        QuaternionT(const Real r, const Real i, const Real j, const Real k)
             : r(r), i(i), j(j), k(k)
         {
         }
@@ -546,7 +558,7 @@ namespace cyclone {
          */
         void normalise()
         {
-            real d = r*r+i*i+j*j+k*k;
+            Real d = r*r+i*i+j*j+k*k;
 
             // Check for zero length quaternion, and use the no-rotation
             // quaternion in that case.
@@ -555,7 +567,7 @@ namespace cyclone {
                 return;
             }
 
-            d = ((real)1.0)/real_sqrt(d);
+            d = ((Real)1.0)/Scalar<Real>::sqrt(d);
             r *= d;
             i *= d;
             j *= d;
@@ -567,17 +579,9 @@ namespace cyclone {
          *
          * @param multiplier The quaternion by which to multiply.
          */
-        void operator *=(const Quaternion &multiplier)
+        void operator *=(const QuaternionT &multiplier)
         {
-            Quaternion q = *this;
-            r = q.r*multiplier.r - q.i*multiplier.i -
-                q.j*multiplier.j - q.k*multiplier.k;
-            i = q.r*multiplier.i + q.i*multiplier.r +
-                q.j*multiplier.k - q.k*multiplier.j;
-            j = q.r*multiplier.j + q.j*multiplier.r +
-                q.k*multiplier.i - q.i*multiplier.k;
-            k = q.r*multiplier.k + q.k*multiplier.r +
-                q.i*multiplier.j - q.j*multiplier.i;
+            simdQuaternionMultiply(data, multiplier.data, data);
         }
 
         /**
@@ -589,22 +593,22 @@ namespace cyclone {
          *
          * @param scale The amount of the vector to add.
          */
-        void addScaledVector(const Vector3& vector, real scale)
+        void addScaledVector(const Vector3T<Real>& vector, Real scale)
         {
-            Quaternion q(0,
+            QuaternionT q(0,
                 vector.x * scale,
                 vector.y * scale,
                 vector.z * scale);
             q *= *this;
-            r += q.r * ((real)0.5);
-            i += q.i * ((real)0.5);
-            j += q.j * ((real)0.5);
-            k += q.k * ((real)0.5);
+            r += q.r * ((Real)0.5);
+            i += q.i * ((Real)0.5);
+            j += q.j * ((Real)0.5);
+            k += q.k * ((Real)0.5);
         }
 
-        void rotateByVector(const Vector3& vector)
+        void rotateByVector(const Vector3T<Real>& vector)
         {
-            Quaternion q(0, vector.x, vector.y, vector.z);
+            QuaternionT q(0, vector.x, vector.y, vector.z);
             (*this) *= q;
         }
     };
@@ -614,13 +618,14 @@ namespace cyclone {
      * a position. The matrix has 12 elements, it is assumed that the
      * remaining four are (0,0,0,1); producing a homogenous matrix.
      */
-    class Matrix4
+    template <typename Real>
+    class Matrix4T
     {
     public:
         /**
          * Holds the transform matrix data in array form.
          */
-        real data[12];
+        Real data[12];
 
         // ... Other Matrix4 code as before ...
 
@@ -628,7 +633,7 @@ namespace cyclone {
         /**
          * Creates an identity matrix.
          */
-        Matrix4()
+        Matrix4T()
         {
             data[1] = data[2] = data[3] = data[4] = data[6] =
                 data[7] = data[8] = data[9] = data[11] = 0;
@@ -638,7 +643,7 @@ namespace cyclone {
         /**
          * Sets the matrix to be a diagonal matrix with the given coefficients.
          */
-        void setDiagonal(real a, real b, real c)
+        void setDiagonal(Real a, Real b, Real c)
         {
             data[0] = a;
             data[5] = b;
@@ -649,9 +654,9 @@ namespace cyclone {
          * Returns a matrix which is this matrix multiplied by the given
          * other matrix.
          */
-        Matrix4 operator*(const Matrix4 &o) const
+        Matrix4T operator*(const Matrix4T &o) const
         {
-            Matrix4 result;
+            Matrix4T result;
             result.data[0] = (o.data[0]*data[0]) + (o.data[4]*data[1]) + (o.data[8]*data[2]);
             result.data[4] = (o.data[0]*data[4]) + (o.data[4]*data[5]) + (o.data[8]*data[6]);
             result.data[8] = (o.data[0]*data[8]) + (o.data[4]*data[9]) + (o.data[8]*data[10]);
@@ -676,21 +681,11 @@ namespace cyclone {
          *
          * @param vector The vector to transform.
          */
-        Vector3 operator*(const Vector3 &vector) const
+        Vector3T<Real> operator*(const Vector3T<Real> &vector) const
         {
-            return Vector3(
-                vector.x * data[0] +
-                vector.y * data[1] +
-                vector.z * data[2] + data[3],
-
-                vector.x * data[4] +
-                vector.y * data[5] +
-                vector.z * data[6] + data[7],
-
-                vector.x * data[8] +
-                vector.y * data[9] +
-                vector.z * data[10] + data[11]
-            );
+            Vector3T<Real> result;
+            simdTransform4(data, &vector.x, &result.x);
+            return result;
         }
 
         /**
@@ -698,7 +693,7 @@ namespace cyclone {
          *
          * @param vector The vector to transform.
          */
-        Vector3 transform(const Vector3 &vector) const
+        Vector3T<Real> transform(const Vector3T<Real> &vector) const
         {
             return (*this) * vector;
         }
@@ -706,19 +701,19 @@ namespace cyclone {
         /**
          * Returns the determinant of the matrix.
          */
-        real getDeterminant() const;
+        Real getDeterminant() const;
 
         /**
          * Sets the matrix to be the inverse of the given matrix.
          *
          * @param m The matrix to invert and use to set this.
          */
-        void setInverse(const Matrix4 &m);
+        void setInverse(const Matrix4T &m);
 
         /** Returns a new matrix containing the inverse of this matrix. */
-        Matrix4 inverse() const
+        Matrix4T inverse() const
         {
-            Matrix4 result;
+            Matrix4T result;
             result.setInverse(*this);
             return result;
         }
@@ -739,9 +734,9 @@ namespace cyclone {
          *
          * @param vector The vector to transform.
          */
-        Vector3 transformDirection(const Vector3 &vector) const
+        Vector3T<Real> transformDirection(const Vector3T<Real> &vector) const
         {
-            return Vector3(
+            return Vector3T<Real>(
                 vector.x * data[0] +
                 vector.y * data[1] +
                 vector.z * data[2],
@@ -772,9 +767,9 @@ namespace cyclone {
          *
          * @param vector The vector to transform.
          */
-        Vector3 transformInverseDirection(const Vector3 &vector) const
+        Vector3T<Real> transformInverseDirection(const Vector3T<Real> &vector) const
         {
-            return Vector3(
+            return Vector3T<Real>(
                 vector.x * data[0] +
                 vector.y * data[4] +
                 vector.z * data[8],
@@ -802,13 +797,13 @@ namespace cyclone {
          *
          * @param vector The vector to transform.
          */
-        Vector3 transformInverse(const Vector3 &vector) const
+        Vector3T<Real> transformInverse(const Vector3T<Real> &vector) const
         {
-            Vector3 tmp = vector;
+            Vector3T<Real> tmp = vector;
             tmp.x -= data[3];
             tmp.y -= data[7];
             tmp.z -= data[11];
-            return Vector3(
+            return Vector3T<Real>(
                 tmp.x * data[0] +
                 tmp.y * data[4] +
                 tmp.z * data[8],
@@ -831,16 +826,16 @@ namespace cyclone {
          *
          * @return The vector.
          */
-        Vector3 getAxisVector(int i) const
+        Vector3T<Real> getAxisVector(int i) const
         {
-            return Vector3(data[i], data[i+4], data[i+8]);
+            return Vector3T<Real>(data[i], data[i+4], data[i+8]);
         }
 
         /**
          * Sets this matrix to be the rotation matrix corresponding to
          * the given quaternion.
          */
-        void setOrientationAndPos(const Quaternion &q, const Vector3 &pos)
+        void setOrientationAndPos(const QuaternionT<Real> &q, const Vector3T<Real> &pos)
         {
             data[0] = 1 - (2*q.j*q.j + 2*q.k*q.k);
             data[1] = 2*q.i*q.j + 2*q.k*q.r;
@@ -866,24 +861,24 @@ namespace cyclone {
          */
         void fillGLArray(float array[16]) const
         {
-            array[0] = (float)data[0];
-            array[1] = (float)data[4];
-            array[2] = (float)data[8];
+            array[0] = Scalar<Real>::toFloat(data[0]);
+            array[1] = Scalar<Real>::toFloat(data[4]);
+            array[2] = Scalar<Real>::toFloat(data[8]);
             array[3] = (float)0;
 
-            array[4] = (float)data[1];
-            array[5] = (float)data[5];
-            array[6] = (float)data[9];
+            array[4] = Scalar<Real>::toFloat(data[1]);
+            array[5] = Scalar<Real>::toFloat(data[5]);
+            array[6] = Scalar<Real>::toFloat(data[9]);
             array[7] = (float)0;
 
-            array[8] = (float)data[2];
-            array[9] = (float)data[6];
-            array[10] = (float)data[10];
+            array[8] = Scalar<Real>::toFloat(data[2]);
+            array[9] = Scalar<Real>::toFloat(data[6]);
+            array[10] = Scalar<Real>::toFloat(data[10]);
             array[11] = (float)0;
 
-            array[12] = (float)data[3];
-            array[13] = (float)data[7];
-            array[14] = (float)data[11];
+            array[12] = Scalar<Real>::toFloat(data[3]);
+            array[13] = Scalar<Real>::toFloat(data[7]);
+            array[14] = Scalar<Real>::toFloat(data[11]);
             array[15] = (float)1;
         }
     };
@@ -895,20 +890,21 @@ namespace cyclone {
      * damping coefficients to make the 12-element characteristics array
      * of a rigid body.
      */
-    class Matrix3
+    template <typename Real>
+    class Matrix3T
     {
     public:
         /**
          * Holds the tensor matrix data in array form.
          */
-        real data[9];
+        Real data[9];
 
         // ... Other Matrix3 code as before ...
 
         /**
          * Creates a new matrix.
          */
-        Matrix3()
+        Matrix3T()
         {
             data[0] = data[1] = data[2] = data[3] = data[4] = data[5] =
                 data[6] = data[7] = data[8] = 0;
@@ -918,8 +914,8 @@ namespace cyclone {
          * Creates a new matrix with the given three vectors making
          * up its columns.
          */
-        Matrix3(const Vector3 &compOne, const Vector3 &compTwo,
-            const Vector3 &compThree)
+        Matrix3T(const Vector3T<Real> &compOne, const Vector3T<Real> &compTwo,
+            const Vector3T<Real> &compThree)
         {
             setComponents(compOne, compTwo, compThree);
         }
@@ -927,8 +923,8 @@ namespace cyclone {
         /**
          * Creates a new matrix with explicit coefficients.
          */
-        Matrix3(real c0, real c1, real c2, real c3, real c4, real c5,
-            real c6, real c7, real c8)
+        Matrix3T(Real c0, Real c1, Real c2, Real c3, Real c4, Real c5,
+            Real c6, Real c7, Real c8)
         {
             data[0] = c0; data[1] = c1; data[2] = c2;
             data[3] = c3; data[4] = c4; data[5] = c5;
@@ -939,7 +935,7 @@ namespace cyclone {
          * Sets the matrix to be a diagonal matrix with the given
          * values along the leading diagonal.
          */
-        void setDiagonal(real a, real b, real c)
+        void setDiagonal(Real a, Real b, Real c)
         {
             setInertiaTensorCoeffs(a, b, c);
         }
@@ -947,8 +943,8 @@ namespace cyclone {
         /**
          * Sets the value of the matrix from inertia tensor values.
          */
-        void setInertiaTensorCoeffs(real ix, real iy, real iz,
-            real ixy=0, real ixz=0, real iyz=0)
+        void setInertiaTensorCoeffs(Real ix, Real iy, Real iz,
+            Real ixy=0, Real ixz=0, Real iyz=0)
         {
             data[0] = ix;
             data[1] = data[3] = -ixy;
@@ -963,9 +959,9 @@ namespace cyclone {
          * a rectangular block aligned with the body's coordinate
          * system with the given axis half-sizes and mass.
          */
-        void setBlockInertiaTensor(const Vector3 &halfSizes, real mass)
+        void setBlockInertiaTensor(const Vector3T<Real> &halfSizes, Real mass)
         {
-            Vector3 squares = halfSizes.componentProduct(halfSizes);
+            Vector3T<Real> squares = halfSizes.componentProduct(halfSizes);
             setInertiaTensorCoeffs(0.3f*mass*(squares.y + squares.z),
                 0.3f*mass*(squares.x + squares.z),
                 0.3f*mass*(squares.x + squares.y));
@@ -977,7 +973,7 @@ namespace cyclone {
          * of the vector product. So if a,b are vectors. a x b = A_s b
          * where A_s is the skew symmetric form of a.
          */
-        void setSkewSymmetric(const Vector3 vector)
+        void setSkewSymmetric(const Vector3T<Real> vector)
         {
             data[0] = data[4] = data[8] = 0;
             data[1] = -vector.z;
@@ -992,8 +988,8 @@ namespace cyclone {
          * Sets the matrix values from the given three vector components.
          * These are arranged as the three columns of the vector.
          */
-        void setComponents(const Vector3 &compOne, const Vector3 &compTwo,
-            const Vector3 &compThree)
+        void setComponents(const Vector3T<Real> &compOne, const Vector3T<Real> &compTwo,
+            const Vector3T<Real> &compThree)
         {
             data[0] = compOne.x;
             data[1] = compTwo.x;
@@ -1012,13 +1008,11 @@ namespace cyclone {
          *
          * @param vector The vector to transform.
          */
-        Vector3 operator*(const Vector3 &vector) const
+        Vector3T<Real> operator*(const Vector3T<Real> &vector) const
         {
-            return Vector3(
-                vector.x * data[0] + vector.y * data[1] + vector.z * data[2],
-                vector.x * data[3] + vector.y * data[4] + vector.z * data[5],
-                vector.x * data[6] + vector.y * data[7] + vector.z * data[8]
-            );
+            Vector3T<Real> result;
+            simdTransform3(data, &vector.x, &result.x);
+            return result;
         }
 
         /**
@@ -1026,7 +1020,7 @@ namespace cyclone {
          *
          * @param vector The vector to transform.
          */
-        Vector3 transform(const Vector3 &vector) const
+        Vector3T<Real> transform(const Vector3T<Real> &vector) const
         {
             return (*this) * vector;
         }
@@ -1036,13 +1030,11 @@ namespace cyclone {
          *
          * @param vector The vector to transform.
          */
-        Vector3 transformTranspose(const Vector3 &vector) const
+        Vector3T<Real> transformTranspose(const Vector3T<Real> &vector) const
         {
-            return Vector3(
-                vector.x * data[0] + vector.y * data[3] + vector.z * data[6],
-                vector.x * data[1] + vector.y * data[4] + vector.z * data[7],
-                vector.x * data[2] + vector.y * data[5] + vector.z * data[8]
-            );
+            Vector3T<Real> result;
+            simdTransformTranspose3(data, &vector.x, &result.x);
+            return result;
         }
 
         /**
@@ -1050,9 +1042,9 @@ namespace cyclone {
          *
          * @param i The row to return.
          */
-        Vector3 getRowVector(int i) const
+        Vector3T<Real> getRowVector(int i) const
         {
-            return Vector3(data[i*3], data[i*3+1], data[i*3+2]);
+            return Vector3T<Real>(data[i*3], data[i*3+1], data[i*3+2]);
         }
 
         /**
@@ -1062,9 +1054,9 @@ namespace cyclone {
          *
          * @return The vector.
          */
-        Vector3 getAxisVector(int i) const
+        Vector3T<Real> getAxisVector(int i) const
         {
-            return Vector3(data[i], data[i+3], data[i+6]);
+            return Vector3T<Real>(data[i], data[i+3], data[i+6]);
         }
 
         /**
@@ -1072,22 +1064,22 @@ namespace cyclone {
          *
          * @param m The matrix to invert and use to set this.
          */
-        void setInverse(const Matrix3 &m)
+        void setInverse(const Matrix3T &m)
         {
-            real t4 = m.data[0]*m.data[4];
-            real t6 = m.data[0]*m.data[5];
-            real t8 = m.data[1]*m.data[3];
-            real t10 = m.data[2]*m.data[3];
-            real t12 = m.data[1]*m.data[6];
-            real t14 = m.data[2]*m.data[6];
+            Real t4 = m.data[0]*m.data[4];
+            Real t6 = m.data[0]*m.data[5];
+            Real t8 = m.data[1]*m.data[3];
+            Real t10 = m.data[2]*m.data[3];
+            Real t12 = m.data[1]*m.data[6];
+            Real t14 = m.data[2]*m.data[6];
 
             // Calculate the determinant
-            real t16 = (t4*m.data[8] - t6*m.data[7] - t8*m.data[8]+
+            Real t16 = (t4*m.data[8] - t6*m.data[7] - t8*m.data[8]+
                         t10*m.data[7] + t12*m.data[5] - t14*m.data[4]);
 
             // Make sure the determinant is non-zero.
-            if (t16 == (real)0.0f) return;
-            real t17 = 1/t16;
+            if (t16 == (Real)0.0f) return;
+            Real t17 = 1/t16;
 
             data[0] = (m.data[4]*m.data[8]-m.data[5]*m.data[7])*t17;
             data[1] = -(m.data[1]*m.data[8]-m.data[2]*m.data[7])*t17;
@@ -1101,9 +1093,9 @@ namespace cyclone {
         }
 
         /** Returns a new matrix containing the inverse of this matrix. */
-        Matrix3 inverse() const
+        Matrix3T inverse() const
         {
-            Matrix3 result;
+            Matrix3T result;
             result.setInverse(*this);
             return result;
         }
@@ -1121,7 +1113,7 @@ namespace cyclone {
          *
          * @param m The matrix to transpose and use to set this.
          */
-        void setTranspose(const Matrix3 &m)
+        void setTranspose(const Matrix3T &m)
         {
             data[0] = m.data[0];
             data[1] = m.data[3];
@@ -1135,9 +1127,9 @@ namespace cyclone {
         }
 
         /** Returns a new matrix containing the transpose of this matrix. */
-        Matrix3 transpose() const
+        Matrix3T transpose() const
         {
-            Matrix3 result;
+            Matrix3T result;
             result.setTranspose(*this);
             return result;
         }
@@ -1146,9 +1138,9 @@ namespace cyclone {
          * Returns a matrix which is this matrix multiplied by the given
          * other matrix.
          */
-        Matrix3 operator*(const Matrix3 &o) const
+        Matrix3T operator*(const Matrix3T &o) const
         {
-            return Matrix3(
+            return Matrix3T(
                 data[0]*o.data[0] + data[1]*o.data[3] + data[2]*o.data[6],
                 data[0]*o.data[1] + data[1]*o.data[4] + data[2]*o.data[7],
                 data[0]*o.data[2] + data[1]*o.data[5] + data[2]*o.data[8],
@@ -1166,11 +1158,11 @@ namespace cyclone {
         /**
          * Multiplies this matrix in place by the given other matrix.
          */
-        void operator*=(const Matrix3 &o)
+        void operator*=(const Matrix3T &o)
         {
-            real t1;
-            real t2;
-            real t3;
+            Real t1;
+            Real t2;
+            Real t3;
 
             t1 = data[0]*o.data[0] + data[1]*o.data[3] + data[2]*o.data[6];
             t2 = data[0]*o.data[1] + data[1]*o.data[4] + data[2]*o.data[7];
@@ -1197,7 +1189,7 @@ namespace cyclone {
         /**
          * Multiplies this matrix in place by the given scalar.
          */
-        void operator*=(const real scalar)
+        void operator*=(const Real scalar)
         {
             data[0] *= scalar; data[1] *= scalar; data[2] *= scalar;
             data[3] *= scalar; data[4] *= scalar; data[5] *= scalar;
@@ -1208,7 +1200,7 @@ namespace cyclone {
          * Does a component-wise addition of this matrix and the given
          * matrix.
          */
-        void operator+=(const Matrix3 &o)
+        void operator+=(const Matrix3T &o)
         {
             data[0] += o.data[0]; data[1] += o.data[1]; data[2] += o.data[2];
             data[3] += o.data[3]; data[4] += o.data[4]; data[5] += o.data[5];
@@ -1219,7 +1211,7 @@ namespace cyclone {
          * Sets this matrix to be the rotation matrix corresponding to
          * the given quaternion.
          */
-        void setOrientation(const Quaternion &q)
+        void setOrientation(const QuaternionT<Real> &q)
         {
             data[0] = 1 - (2*q.j*q.j + 2*q.k*q.k);
             data[1] = 2*q.i*q.j + 2*q.k*q.r;
@@ -1235,9 +1227,74 @@ namespace cyclone {
         /**
          * Interpolates a couple of matrices.
          */
-        static Matrix3 linearInterpolate(const Matrix3& a, const Matrix3& b, real prop);
+        static Matrix3T linearInterpolate(const Matrix3T& a, const Matrix3T& b, Real prop);
     };
 
+    /**
+     * @name Core Types
+     *
+     * These are the core mathematical types in the library's real
+     * number type, which the rest of the library uses, followed by
+     * each of them in single and double precision. The templates are
+     * compiled for float and double in core.cpp.
+     */
+    /*@{*/
+    typedef Vector3T<real> Vector3;
+    typedef QuaternionT<real> Quaternion;
+    typedef Matrix4T<real> Matrix4;
+    typedef Matrix3T<real> Matrix3;
+
+    typedef Vector3T<float> Vector3f;
+    typedef QuaternionT<float> Quaternionf;
+    typedef Matrix4T<float> Matrix4f;
+    typedef Matrix3T<float> Matrix3f;
+
+    typedef Vector3T<double> Vector3d;
+    typedef QuaternionT<double> Quaterniond;
+    typedef Matrix4T<double> Matrix4d;
+    typedef Matrix3T<double> Matrix3d;
+    /*@}*/
+
+    /**
+     * Holds the starting value for a checksum built up with the
+     * addToChecksum functions.
+     */
+    const unsigned CHECKSUM_SEED = 2166136261u;
+
+    /**
+     * Folds the given block of bytes into a running checksum, using
+     * the FNV-1a hash. The result depends only on the bit patterns
+     * of the data, so two simulations in exactly the same state will
+     * always give the same checksum.
+     *
+     * @param checksum The checksum so far (start from CHECKSUM_SEED).
+     *
+     * @param data The data to add.
+     *
+     * @param size The number of bytes of data to add.
+     *
+     * @return The updated checksum.
+     */
+    unsigned addToChecksum(unsigned checksum, const void *data,
+                           unsigned size);
+
+    /**
+     * Folds the given real number into a running checksum.
+     */
+    unsigned addToChecksum(unsigned checksum, real value);
+
+    /**
+     * Folds the components of the given vector into a running
+     * checksum. The padding of the vector is not included.
+     */
+    unsigned addToChecksum(unsigned checksum, const Vector3 &vector);
+
+    /**
+     * Folds the components of the given quaternion into a running
+     * checksum.
+     */
+    unsigned addToChecksum(unsigned checksum, const Quaternion &quaternion);
+
 }
 
 #endif // CYCLONE_CORE_H
\ No newline at end of file
@@ -10,13 +10,26 @@
  * software licence.
  */
 #include "precision.h"
+#include "simd.h"
 #include "core.h"
 #include "random.h"
+#include "snapshot.h"
+#include "recorder.h"
+#include "arena.h"
+#include "fields.h"
+#include "origin.h"
+#include "wind.h"
+#include "water.h"
 #include "particle.h"
+#include "pnetwork.h"
 #include "body.h"
+#include "articulation.h"
 #include "pcontacts.h"
+#include "ptree.h"
 #include "pworld.h"
 #include "collide_fine.h"
+#include "collide_mesh.h"
+#include "collide_cast.h"
 #include "contacts.h"
 #include "fgen.h"
 #include "joints.h"
\ No newline at end of file
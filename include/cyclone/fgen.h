@@ -20,6 +20,7 @@
 
 #include "body.h"
 #include "pfgen.h"
+#include "wind.h"
 #include <vector>
 
 namespace cyclone {
@@ -55,6 +56,14 @@ namespace cyclone {
 
         /** Applies the gravitational force to the given rigid body. */
         virtual void updateForce(RigidBody *body, real duration);
+
+        /**
+         * Sets each of count forces to the gravitational force on a
+         * body with the matching inverse mass. This is what
+         * updateForce applies, found for many bodies at once.
+         */
+        void getForces(const real *inverseMasses, Vector3 *forces,
+                       unsigned count) const;
     };
 
     /**
@@ -101,6 +110,12 @@ namespace cyclone {
      * This force generator is intended to represent a single
      * explosion effect for multiple rigid bodies. The force generator
      * can also act as a particle force generator.
+     *
+     * The explosion keeps track of its own time, which must be moved
+     * on once per frame with advance. World::applyExplosion does
+     * this, and only visits the bodies within the explosion's reach,
+     * so the explosion doesn't need to be registered with every body
+     * it might affect.
      */
     class Explosion : public ForceGenerator,
                       public ParticleForceGenerator
@@ -223,12 +238,43 @@ namespace cyclone {
          * Calculates and applies the force that the explosion has
          * on the given particle.
          */
-        virtual void updateForce(Particle *particle, real duration) = 0;
+        virtual void updateForce(Particle *particle, real duration);
+
+        /**
+         * Calculates the force the explosion has, at its current
+         * time, on an object at the given position moving with the
+         * given velocity.
+         */
+        Vector3 getForce(const Vector3 &position,
+                         const Vector3 &velocity) const;
+
+        /**
+         * Returns the distance from the detonation beyond which the
+         * explosion currently has no effect.
+         */
+        real getRadius() const;
+
+        /**
+         * Returns true once every phase of the explosion is over.
+         */
+        bool isFinished() const;
+
+        /**
+         * Moves the explosion on by the given time. This should be
+         * called once per frame, after the forces for that frame have
+         * been applied.
+         */
+        void advance(real duration);
 
     };
 
     /**
      * A force generator that applies an aerodynamic force.
+     *
+     * The wind either comes from a single shared windspeed vector,
+     * or is sampled from a wind field at the surface's position in
+     * world space, so surfaces in different places can feel
+     * different winds from one shared field.
      */
     class Aero : public ForceGenerator
     {
@@ -253,6 +299,12 @@ namespace cyclone {
          */
         const Vector3* windspeed;
 
+        /**
+         * Holds the wind field the windspeed is sampled from, or NULL
+         * if the windspeed vector is used.
+         */
+        const WindField* windField;
+
     public:
         /**
          * Creates a new aerodynamic force generator with the
@@ -261,11 +313,56 @@ namespace cyclone {
         Aero(const Matrix3 &tensor, const Vector3 &position,
              const Vector3 *windspeed);
 
+        /**
+         * Creates a new aerodynamic force generator that samples its
+         * windspeed from the given wind field.
+         */
+        Aero(const Matrix3 &tensor, const Vector3 &position,
+             const WindField *windField);
+
+        /**
+         * Sets the wind field the windspeed is sampled from. Setting
+         * NULL returns to using the windspeed vector.
+         */
+        void setWindField(const WindField *windField);
+
+        /**
+         * Returns the wind field the windspeed is sampled from, or
+         * NULL if there is none.
+         */
+        const WindField* getWindField() const
+        {
+            return windField;
+        }
+
+        /**
+         * Returns the point in world space at which the surface
+         * samples the wind field when attached to the given body.
+         */
+        Vector3 getSamplePoint(const RigidBody *body) const
+        {
+            return body->getPointInWorldSpace(position);
+        }
+
+        /**
+         * Returns the windspeed felt by the surface when attached to
+         * the given body.
+         */
+        Vector3 getWind(const RigidBody *body) const;
+
         /**
          * Applies the force to the given rigid body.
          */
         virtual void updateForce(RigidBody *body, real duration);
 
+        /**
+         * Applies the force to the given rigid body, for the given
+         * windspeed at the surface. This lets the force registry
+         * sample the wind for many surfaces at once.
+         */
+        virtual void updateForceInWind(RigidBody *body, real duration,
+                                       const Vector3 &wind);
+
     protected:
         /**
          * Uses an explicit tensor matrix to update the force on
@@ -274,6 +371,14 @@ namespace cyclone {
          */
         void updateForceFromTensor(RigidBody *body, real duration,
                                    const Matrix3 &tensor);
+
+        /**
+         * Uses an explicit tensor matrix and windspeed to update the
+         * force on the given rigid body.
+         */
+        void updateForceFromTensor(RigidBody *body, real duration,
+                                   const Matrix3 &tensor,
+                                   const Vector3 &wind);
     };
 
     /**
@@ -322,6 +427,14 @@ namespace cyclone {
                     const Matrix3 &min, const Matrix3 &max,
                     const Vector3 &position, const Vector3 *windspeed);
 
+        /**
+         * Creates a new aerodynamic control surface that samples its
+         * windspeed from the given wind field.
+         */
+        AeroControl(const Matrix3 &base,
+                    const Matrix3 &min, const Matrix3 &max,
+                    const Vector3 &position, const WindField *windField);
+
         /**
          * Sets the control position of this control. This * should
         range between -1 (in which case the minTensor value is *
@@ -335,11 +448,21 @@ namespace cyclone {
          * Applies the force to the given rigid body.
          */
         virtual void updateForce(RigidBody *body, real duration);
+
+        /**
+         * Applies the force to the given rigid body, for the given
+         * windspeed at the surface.
+         */
+        virtual void updateForceInWind(RigidBody *body, real duration,
+                                       const Vector3 &wind);
     };
 
     /**
      * A force generator with an aerodynamic surface that can be
      * re-oriented relative to its rigid body. This derives the
+     * surface's position and tensor from Aero; the tensor is given
+     * in the surface's own coordinates and rotated into body
+     * coordinates by the surface's orientation.
      */
     class AngledAero : public Aero
     {
@@ -356,6 +479,13 @@ namespace cyclone {
         AngledAero(const Matrix3 &tensor, const Vector3 &position,
              const Vector3 *windspeed);
 
+        /**
+         * Creates a new aerodynamic surface that samples its
+         * windspeed from the given wind field.
+         */
+        AngledAero(const Matrix3 &tensor, const Vector3 &position,
+             const WindField *windField);
+
         /**
          * Sets the relative orientation of the aerodynamic surface,
          * relative to the rigid body it is attached to. Note that
@@ -368,6 +498,13 @@ namespace cyclone {
          * Applies the force to the given rigid body.
          */
         virtual void updateForce(RigidBody *body, real duration);
+
+        /**
+         * Applies the force to the given rigid body, for the given
+         * windspeed at the surface.
+         */
+        virtual void updateForceInWind(RigidBody *body, real duration,
+                                       const Vector3 &wind);
     };
 
     /**
@@ -403,6 +540,15 @@ namespace cyclone {
          */
         Vector3 centreOfBuoyancy;
 
+        /**
+         * The water surface, or NULL if the flat water height is
+         * used.
+         */
+        const WaterSurface *surface;
+
+        /** Holds the last water height this generator looked up. */
+        WaterHeightCache heightCache;
+
     public:
 
         /** Creates a new buoyancy force with the given parameters. */
@@ -410,14 +556,77 @@ namespace cyclone {
             real maxDepth, real volume, real waterHeight,
             real liquidDensity = 1000.0f);
 
+        /**
+         * Sets the water surface the body floats on. Setting NULL
+         * returns to the flat water height.
+         */
+        void setWaterSurface(const WaterSurface *surface);
+
+        /**
+         * Returns the water surface the body floats on, or NULL if
+         * the flat water height is used.
+         */
+        const WaterSurface* getWaterSurface() const
+        {
+            return surface;
+        }
+
+        /**
+         * Returns the centre of buoyancy of the given body in world
+         * space.
+         */
+        Vector3 getSamplePoint(const RigidBody *body) const
+        {
+            return body->getPointInWorldSpace(centreOfBuoyancy);
+        }
+
+        /**
+         * Finds the water height above the given point if it is
+         * known without a lookup, returning false if it is not.
+         */
+        bool getKnownHeight(const Vector3 &point, real *height) const;
+
+        /**
+         * Stores the water height looked up above the given point.
+         */
+        void cacheHeight(const Vector3 &point, real height);
+
         /**
          * Applies the force to the given rigid body.
          */
         virtual void updateForce(RigidBody *body, real duration);
+
+        /**
+         * Applies the force to the given rigid body, whose centre of
+         * buoyancy is at the given point with the water surface at
+         * the given height above it.
+         */
+        void updateForceAtHeight(RigidBody *body, real duration,
+                                 const Vector3 &point, real height);
     };
 
     /**
     * Holds all the force generators and the bodies they apply to.
+    *
+    * Registrations are kept in separate buckets for each of the
+    * common generator types, decided by the exact type of the
+    * generator when it is added. Each bucket is updated in its own
+    * loop with direct, non-virtual calls, so the same code runs for
+    * every registration in a bucket. Generators of other types,
+    * including classes derived from the common ones, are kept in a
+    * general bucket and called virtually.
+    *
+    * The aerodynamic buckets are updated in two passes: the wind for
+    * every surface is found first, with consecutive registrations
+    * that share a wind field sampled in one batch, and then the
+    * forces are applied. Registering surfaces that share a field
+    * together gives the longest batches. The buoyancy bucket finds
+    * its water heights in the same way.
+    *
+    * Adding a registration returns a handle that removes it in
+    * constant time. Removal moves the last registration in the
+    * bucket into the gap, so the order registrations are updated in
+    * depends only on the sequence of adds and removes made.
     */
     class ForceRegistry
     {
@@ -427,32 +636,134 @@ namespace cyclone {
         * Keeps track of one force generator and the body it
         * applies to.
         */
-        struct ForceRegistration
+        template<class Generator>
+        struct TypedRegistration
         {
             RigidBody *body;
-            ForceGenerator *fg;
+            Generator *fg;
+
+            /** Holds the handle slot of this registration. */
+            unsigned slot;
         };
 
         /**
-        * Holds the list of registrations.
+        * Identifies the bucket a registration is held in.
+        */
+        enum Bucket
+        {
+            GENERAL_BUCKET,
+            GRAVITY_BUCKET,
+            SPRING_BUCKET,
+            AERO_BUCKET,
+            AERO_CONTROL_BUCKET,
+            ANGLED_AERO_BUCKET,
+            BUOYANCY_BUCKET
+        };
+
+        typedef TypedRegistration<ForceGenerator> ForceRegistration;
+
+        /**
+        * Holds the list of registrations of generators without a
+        * bucket of their own.
         */
         typedef std::vector<ForceRegistration> Registry;
         Registry registrations;
 
+        /** Holds the registrations of Gravity generators. */
+        std::vector< TypedRegistration<Gravity> > gravityRegistrations;
+
+        /** Holds the registrations of Spring generators. */
+        std::vector< TypedRegistration<Spring> > springRegistrations;
+
+        /** Holds the registrations of Aero generators. */
+        std::vector< TypedRegistration<Aero> > aeroRegistrations;
+
+        /** Holds the registrations of AeroControl generators. */
+        std::vector< TypedRegistration<AeroControl> >
+            aeroControlRegistrations;
+
+        /** Holds the registrations of AngledAero generators. */
+        std::vector< TypedRegistration<AngledAero> >
+            angledAeroRegistrations;
+
+        /** Holds the registrations of Buoyancy generators. */
+        std::vector< TypedRegistration<Buoyancy> > buoyancyRegistrations;
+
+        /** Holds the positions of the registrations by handle. */
+        ForceHandleTable handles;
+
+        /**
+         * Holds the inverse masses of the bodies in the gravity
+         * bucket, reused between updates.
+         */
+        std::vector<real> batchMasses;
+
+        /** Holds the forces found for the gravity bucket. */
+        std::vector<Vector3> batchForces;
+
+        /**
+         * Holds the points at which aerodynamic surfaces sample the
+         * wind, reused between updates.
+         */
+        std::vector<Vector3> windPoints;
+
+        /** Holds the wind found at each of the sample points. */
+        std::vector<Vector3> windSamples;
+
+        /**
+         * Holds the centres of buoyancy of the bodies in the buoyancy
+         * bucket, reused between updates.
+         */
+        std::vector<Vector3> waterPoints;
+
+        /**
+         * Holds the surface each centre's height must be looked up
+         * on, or NULL if it is already known.
+         */
+        std::vector<const WaterSurface*> waterSurfaces;
+
+        /** Holds the water height above each centre. */
+        std::vector<real> waterHeights;
+
+        /**
+        * Returns the bucket that registrations of the given
+        * generator are held in.
+        */
+        static unsigned getBucket(const ForceGenerator *fg);
+
+        /**
+        * Removes the registration at the given position, moving the
+        * last registration in its bucket into its place.
+        */
+        void removeAt(unsigned bucket, unsigned index);
+
     public:
         /**
         * Registers the given force generator to apply to the
-        * given body.
+        * given body. Returns a handle to the registration.
+        */
+        ForceHandle add(RigidBody* body, ForceGenerator *fg);
+
+        /**
+        * Removes the registration with the given handle in constant
+        * time. Returns false, with no effect, if the handle is stale.
         */
-        void add(RigidBody* body, ForceGenerator *fg);
+        bool remove(const ForceHandle &handle);
 
         /**
         * Removes the given registered pair from the registry.
         * If the pair is not registered, this method will have
-        * no effect.
+        * no effect. This searches the generator's bucket, so it is
+        * slower than removing by handle.
         */
         void remove(RigidBody* body, ForceGenerator *fg);
 
+        /**
+        * Removes every registration for the given body. The
+        * registrations that remain keep their relative order.
+        */
+        void removeAll(RigidBody* body);
+
         /**
         * Clears all registrations from the registry. This will
         * not delete the bodies or the force generators
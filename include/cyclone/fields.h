@@ -0,0 +1,104 @@
+/*
+ * Interface file for uniform force fields.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains the uniform fields a world applies to all of
+ * its objects as part of integration, without needing a force
+ * generator registration for each object.
+ */
+#ifndef CYCLONE_FIELDS_H
+#define CYCLONE_FIELDS_H
+
+#include "core.h"
+
+namespace cyclone {
+
+    /**
+     * Flags for the fields an object is affected by. Each object
+     * holds a mask of these, and ignores any field whose flag is
+     * cleared.
+     */
+    enum FieldFlags
+    {
+        /** The object is accelerated by the gravity field. */
+        FIELD_GRAVITY = 1,
+
+        /** The object's drag is relative to the wind, not still air. */
+        FIELD_WIND = 2,
+
+        /** The object is slowed by linear drag. */
+        FIELD_DRAG = 4,
+
+        /** The object is affected by every field. */
+        FIELD_ALL = 7
+    };
+
+    /**
+     * Holds fields that are the same everywhere in a world. These are
+     * folded into the acceleration each object is integrated with,
+     * so they cost nothing beyond the integration pass itself.
+     *
+     * All the fields are zero when created, and have no effect.
+     */
+    struct UniformFields
+    {
+        /**
+         * Holds the acceleration due to gravity, applied to every
+         * object with finite mass regardless of its mass.
+         */
+        Vector3 gravity;
+
+        /**
+         * Holds the velocity of the air. This only has an effect
+         * through linear drag, which pulls objects towards moving
+         * with the wind.
+         */
+        Vector3 wind;
+
+        /**
+         * Holds the linear drag coefficient. The drag force is this
+         * coefficient times the velocity of the object relative to
+         * the air, as for the k1 term of ParticleDrag.
+         */
+        real linearDrag;
+
+        /**
+         * Creates a set of fields with no effect.
+         */
+        UniformFields() : linearDrag(0) {}
+
+        /**
+         * Adds the acceleration the fields give an object with the
+         * given velocity, inverse mass and field mask to the given
+         * acceleration.
+         */
+        void addAcceleration(Vector3 *acceleration,
+                             const Vector3 &velocity,
+                             real inverseMass,
+                             unsigned mask) const
+        {
+            if (mask & FIELD_GRAVITY) *acceleration += gravity;
+            if (linearDrag != 0 && (mask & FIELD_DRAG))
+            {
+                Vector3 relative = velocity;
+                if (mask & FIELD_WIND) relative -= wind;
+                acceleration->addScaledVector(
+                    relative, -linearDrag * inverseMass);
+            }
+        }
+    };
+
+} // namespace cyclone
+
+#endif // CYCLONE_FIELDS_H
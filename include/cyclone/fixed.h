@@ -0,0 +1,747 @@
+/*
+ * Interface file for fixed point numbers.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains fixed point numbers, which can be used in place
+ * of floating point reals wherever results must be identical on every
+ * machine.
+ *
+ * Floating point results depend on the compiler: whether it keeps
+ * intermediate values at higher precision, fuses multiplies and adds,
+ * or reorders sums. Fixed point numbers are integers underneath, and
+ * every operation on them is done with integer arithmetic whose result
+ * is fully defined, so two programs doing the same operations always
+ * get the same bits, whatever they were compiled with.
+ */
+#ifndef CYCLONE_FIXED_H
+#define CYCLONE_FIXED_H
+
+#include <limits.h>
+#include <math.h>
+
+/**
+ * Defined when the compiler allows members with constructors in a
+ * union, as C++11 does. QuaternionT holds its components in a union,
+ * so it can only be used with fixed point numbers when this is
+ * defined.
+ */
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+#define CYCLONE_FIXED_QUATERNIONS
+#endif
+
+namespace cyclone {
+
+    template <typename Real> struct Scalar;
+
+    /**
+     * Describes the integer types behind a fixed point number with
+     * the given raw type.
+     */
+    template <typename Raw> struct FixedRaw;
+
+    /**
+     * The integer types behind a 32 bit fixed point number. Products
+     * are held in 64 bits.
+     */
+    template <> struct FixedRaw<int>
+    {
+        typedef unsigned int Unsigned;
+        static int maximum() { return INT_MAX; }
+        static int minimum() { return INT_MIN; }
+    };
+
+    /**
+     * The integer types behind a 64 bit fixed point number. Products
+     * are held in 128 bits, as a pair of 64 bit words.
+     */
+    template <> struct FixedRaw<long long>
+    {
+        typedef unsigned long long Unsigned;
+        static long long maximum() { return LLONG_MAX; }
+        static long long minimum() { return LLONG_MIN; }
+    };
+
+    /**
+     * Holds a 128 bit unsigned integer, for the intermediate results
+     * of 64 bit fixed point arithmetic.
+     */
+    struct FixedWide
+    {
+        unsigned long long high;
+        unsigned long long low;
+
+        FixedWide(unsigned long long high, unsigned long long low)
+            : high(high), low(low) {}
+
+        /** Returns the product of two 64 bit integers. */
+        static FixedWide multiply(unsigned long long a, unsigned long long b)
+        {
+            unsigned long long aLow = a & 0xffffffffULL, aHigh = a >> 32;
+            unsigned long long bLow = b & 0xffffffffULL, bHigh = b >> 32;
+
+            unsigned long long lowLow = aLow * bLow;
+            unsigned long long middle1 = aHigh * bLow;
+            unsigned long long middle2 = aLow * bHigh;
+            unsigned long long highHigh = aHigh * bHigh;
+
+            unsigned long long carry = (lowLow >> 32) +
+                (middle1 & 0xffffffffULL) + (middle2 & 0xffffffffULL);
+            return FixedWide(
+                highHigh + (middle1 >> 32) + (middle2 >> 32) + (carry >> 32),
+                (carry << 32) | (lowLow & 0xffffffffULL));
+        }
+
+        /** Adds the given 64 bit integer to this. */
+        void add(unsigned long long value)
+        {
+            low += value;
+            if (low < value) high++;
+        }
+
+        /** Adds the given 128 bit integer to this. */
+        void add(const FixedWide &value)
+        {
+            add(value.low);
+            high += value.high;
+        }
+
+        /** Subtracts the given 128 bit integer from this. */
+        void subtract(const FixedWide &value)
+        {
+            if (low < value.low) high--;
+            low -= value.low;
+            high -= value.high;
+        }
+
+        /** Returns true if this is at least the given integer. */
+        bool atLeast(const FixedWide &value) const
+        {
+            return high != value.high ? high > value.high : low >= value.low;
+        }
+
+        /** Returns this shifted right by the given number of bits. */
+        FixedWide shiftRight(unsigned bits) const
+        {
+            if (bits == 0) return *this;
+            if (bits >= 64) return FixedWide(0, high >> (bits - 64));
+            return FixedWide(high >> bits, (low >> bits) | (high << (64 - bits)));
+        }
+
+        /** Returns this shifted left by the given number of bits. */
+        FixedWide shiftLeft(unsigned bits) const
+        {
+            if (bits == 0) return *this;
+            if (bits >= 64) return FixedWide(low << (bits - 64), 0);
+            return FixedWide((high << bits) | (low >> (64 - bits)), low << bits);
+        }
+
+        /**
+         * Returns the low 64 bits of this divided by the given
+         * number, which must not be zero.
+         */
+        unsigned long long divide(unsigned long long divisor) const
+        {
+            unsigned long long quotient = 0;
+            unsigned long long remainder = 0;
+            for (int bit = 127; bit >= 0; bit--)
+            {
+                // The remainder is always less than the divisor, so
+                // if doubling it carries out of 64 bits it is
+                // certainly larger than the divisor.
+                bool carry = (remainder >> 63) != 0;
+                unsigned long long next = bit >= 64 ?
+                    (high >> (bit - 64)) & 1 : (low >> bit) & 1;
+                remainder = (remainder << 1) | next;
+                quotient <<= 1;
+                if (carry || remainder >= divisor)
+                {
+                    remainder -= divisor;
+                    quotient |= 1;
+                }
+            }
+            return quotient;
+        }
+
+        /** Returns the square root of this, rounded to nearest. */
+        unsigned long long squareRoot() const
+        {
+            FixedWide number = *this;
+            FixedWide result(0, 0);
+            FixedWide bit(1ULL << 62, 0);
+            while (bit.high != 0 || bit.low != 0)
+            {
+                FixedWide trial = result;
+                trial.add(bit);
+                result = result.shiftRight(1);
+                if (number.atLeast(trial))
+                {
+                    number.subtract(trial);
+                    result.add(bit);
+                }
+                bit = bit.shiftRight(2);
+            }
+            // The remainder is more than the root exactly when the
+            // true root is nearer the next integer up.
+            if (number.atLeast(FixedWide(result.high, result.low + 1)) &&
+                result.low + 1 != 0)
+            {
+                result.low++;
+            }
+            return result.low;
+        }
+    };
+
+    /**
+     * Internal function that rounds a product held with the given
+     * number of extra fraction bits to the nearest, with halves
+     * rounded away from zero.
+     */
+    inline long long _fixedRound(long long wide, int bits)
+    {
+        unsigned long long half = 1ULL << (bits - 1);
+        if (wide >= 0)
+        {
+            return (long long)(((unsigned long long)wide + half) >> bits);
+        }
+        return -(long long)((0ULL - (unsigned long long)wide + half) >> bits);
+    }
+
+    /**
+     * Internal functions that multiply two raw fixed point numbers
+     * with the given number of fraction bits, rounding to nearest.
+     */
+    inline int _fixedMultiply(int a, int b, int bits)
+    {
+        return (int)(unsigned int)_fixedRound((long long)a * b, bits);
+    }
+
+    inline long long _fixedMultiply(long long a, long long b, int bits)
+    {
+        bool negative = (a < 0) != (b < 0);
+        unsigned long long ua = a < 0 ? 0ULL - (unsigned long long)a : a;
+        unsigned long long ub = b < 0 ? 0ULL - (unsigned long long)b : b;
+
+        FixedWide product = FixedWide::multiply(ua, ub);
+        product.add(1ULL << (bits - 1));
+        unsigned long long result = product.shiftRight(bits).low;
+        return (long long)(negative ? 0ULL - result : result);
+    }
+
+    /**
+     * Internal functions that divide two raw fixed point numbers
+     * with the given number of fraction bits, rounding to nearest.
+     * Dividing by zero gives the largest number with the sign of the
+     * dividend.
+     */
+    inline int _fixedDivide(int a, int b, int bits)
+    {
+        if (b == 0) return a < 0 ? INT_MIN : INT_MAX;
+        bool negative = (a < 0) != (b < 0);
+        unsigned long long ua = a < 0 ? 0ULL - (unsigned long long)a : a;
+        unsigned long long ub = b < 0 ? 0ULL - (unsigned long long)b : b;
+
+        unsigned long long result = ((ua << bits) + ub / 2) / ub;
+        return (int)(unsigned int)(negative ? 0ULL - result : result);
+    }
+
+    inline long long _fixedDivide(long long a, long long b, int bits)
+    {
+        if (b == 0) return a < 0 ? LLONG_MIN : LLONG_MAX;
+        bool negative = (a < 0) != (b < 0);
+        unsigned long long ua = a < 0 ? 0ULL - (unsigned long long)a : a;
+        unsigned long long ub = b < 0 ? 0ULL - (unsigned long long)b : b;
+
+        FixedWide dividend = FixedWide(0, ua).shiftLeft(bits);
+        dividend.add(ub / 2);
+        unsigned long long result = dividend.divide(ub);
+        return (long long)(negative ? 0ULL - result : result);
+    }
+
+    /**
+     * Internal function that gives a raw fixed point number with the
+     * given number of fraction bits, which must be no more than 32,
+     * from one with 32 fraction bits.
+     */
+    inline long long _fixedFromQ32(long long value, int bits)
+    {
+        return bits == 32 ? value : _fixedRound(value, 32 - bits);
+    }
+
+    /**
+     * Internal function that finds the sine and cosine of an angle
+     * in radians, with all three values held with 32 fraction bits.
+     * This uses CORDIC, which needs only shifts and additions.
+     */
+    inline void _fixedSinCos(long long angle, long long *sine,
+                             long long *cosine)
+    {
+        // The arctangents of 1, 1/2, 1/4, ... with 32 fraction bits.
+        static const long long arctangents[32] = {
+            3373259426LL, 1991351318LL, 1052175346LL, 534100635LL,
+            268086748LL, 134174063LL, 67103403LL, 33553749LL,
+            16777131LL, 8388597LL, 4194303LL, 2097152LL,
+            1048576LL, 524288LL, 262144LL, 131072LL,
+            65536LL, 32768LL, 16384LL, 8192LL,
+            4096LL, 2048LL, 1024LL, 512LL,
+            256LL, 128LL, 64LL, 32LL,
+            16LL, 8LL, 4LL, 2LL
+        };
+        const long long pi = 13493037705LL;
+        const long long twoPi = 26986075409LL;
+        const long long halfPi = 6746518852LL;
+
+        // Bring the angle into -pi to pi.
+        unsigned long long turns = angle < 0 ?
+            0ULL - (unsigned long long)angle : angle;
+        turns %= (unsigned long long)twoPi;
+        angle = angle < 0 ? -(long long)turns : (long long)turns;
+        if (angle > pi) angle -= twoPi;
+        else if (angle < -pi) angle += twoPi;
+
+        // CORDIC converges for angles up to about 1.74, so fold the
+        // angle into -pi/2 to pi/2, which flips the cosine.
+        bool flip = false;
+        if (angle > halfPi)
+        {
+            angle = pi - angle;
+            flip = true;
+        }
+        else if (angle < -halfPi)
+        {
+            angle = -pi - angle;
+            flip = true;
+        }
+
+        // Start from the x axis scaled down by the gain of all the
+        // rotations, and rotate by each arctangent in turn towards
+        // the angle.
+        long long x = 2608131496LL;
+        long long y = 0;
+        for (unsigned i = 0; i < 32; i++)
+        {
+            long long dx = y >> i;
+            long long dy = x >> i;
+            if (angle >= 0)
+            {
+                x -= dx;
+                y += dy;
+                angle -= arctangents[i];
+            }
+            else
+            {
+                x += dx;
+                y -= dy;
+                angle += arctangents[i];
+            }
+        }
+
+        *sine = y;
+        *cosine = flip ? -x : x;
+    }
+
+    /**
+     * Internal function that finds the base two logarithm of a
+     * positive number, with both held with 32 fraction bits. Each
+     * bit of the fraction is found by squaring the number scaled
+     * into 1 to 2, and seeing whether the square reaches 2.
+     */
+    inline long long _fixedLog2(unsigned long long value)
+    {
+        int top = 63;
+        while (((value >> top) & 1) == 0) top--;
+
+        // Scale the number into 1 to 2, with 31 fraction bits so its
+        // square fits in 64 bits.
+        unsigned long long mantissa = top >= 31 ?
+            value >> (top - 31) : value << (31 - top);
+        long long result = (long long)(top - 32) * 4294967296LL;
+        for (int bit = 31; bit >= 0; bit--)
+        {
+            mantissa = (mantissa * mantissa + (1ULL << 30)) >> 31;
+            if (mantissa >= (1ULL << 32))
+            {
+                mantissa >>= 1;
+                result += 1LL << bit;
+            }
+        }
+        return result;
+    }
+
+    /**
+     * Internal function that raises two to a power, with both held
+     * with 32 fraction bits. The fraction of the power is built up
+     * from the powers of two of each of its bits. Results too large
+     * to hold give the largest number.
+     */
+    inline long long _fixedExp2(long long power)
+    {
+        // Two to the power of 1/2, 1/4, 1/8, ... with 62 fraction
+        // bits.
+        static const long long roots[32] = {
+            6521908912666391106LL, 5484249825272419512LL,
+            5029079263719320435LL, 4815862801830788490LL,
+            4712668792719003884LL, 4661903986662671290LL,
+            4636727017470743990LL, 4624189567668517720LL,
+            4617933561212708776LL, 4614808732577250068LL,
+            4613247111281068008LL, 4612466498810092975LL,
+            4612076242109103707LL, 4611881126141011236LL,
+            4611783571252412754LL, 4611734794581956353LL,
+            4611710406440186476LL, 4611698212417665819LL,
+            4611692115418496524LL, 4611689066921934630LL,
+            4611687542674409371LL, 4611686780550835664LL,
+            4611686399489096040LL, 4611686208958238036LL,
+            4611686113692811986LL, 4611686066060099699LL,
+            4611686042243743740LL, 4611686030335565807LL,
+            4611686024381476851LL, 4611686021404432377LL,
+            4611686019915910140LL, 4611686019171649022LL
+        };
+
+        // Split the power into its whole part, rounded down, and a
+        // fraction from 0 to 1.
+        unsigned long long fraction =
+            (unsigned long long)power & 0xffffffffULL;
+        long long whole = (power - (long long)fraction) / 4294967296LL;
+        if (whole > 30) return LLONG_MAX;
+        if (whole < -33) return 0;
+
+        unsigned long long result = 1ULL << 62;
+        for (unsigned i = 0; i < 32; i++)
+        {
+            if (((fraction >> (31 - i)) & 1) == 0) continue;
+            FixedWide product =
+                FixedWide::multiply(result, (unsigned long long)roots[i]);
+            product.add(1ULL << 61);
+            result = product.shiftRight(62).low;
+        }
+
+        // The result has 62 fraction bits, and is wanted with 32,
+        // scaled by the whole part.
+        int shift = 30 - (int)whole;
+        if (shift == 0) return (long long)result;
+        return (long long)((result + (1ULL << (shift - 1))) >> shift);
+    }
+
+    /**
+     * Holds a fixed point number: a signed integer raw value, which
+     * is the number multiplied by two to the power of FractionBits.
+     *
+     * Every operation is exactly defined, so results are the same on
+     * every machine and with every compiler. Multiplication and
+     * division round to the nearest value, with halves rounded away
+     * from zero. Results too large to hold wrap around, as with
+     * unsigned integers. Fixed16 and Fixed32 are the usual formats.
+     *
+     * Fixed point numbers can be used as the number type of the core
+     * mathematical types, such as Vector3T<Fixed32>, and Scalar gives
+     * them deterministic square roots, sines, cosines, exponentials
+     * and powers. Quaternions of them need a C++11 compiler: see
+     * CYCLONE_FIXED_QUATERNIONS.
+     *
+     * Integers and floating point numbers convert to fixed point
+     * implicitly, rounding to the nearest value, so constants can be
+     * written as normal. Converting back has to be asked for, with
+     * toDouble, toFloat or toInt, so that floating point arithmetic
+     * can't creep into a calculation unnoticed. Only convert from
+     * floating point when setting a scene up: the conversion is
+     * exact, but the floating point value may not be.
+     */
+    template <typename Raw, int FractionBits>
+    class FixedT
+    {
+    public:
+        typedef typename FixedRaw<Raw>::Unsigned Unsigned;
+
+        /** Holds the number multiplied by 2^FractionBits. */
+        Raw raw;
+
+        /** The default constructor creates zero. */
+        FixedT() : raw(0) {}
+
+        /** Creates the given integer. */
+        FixedT(int value)
+            : raw((Raw)((Unsigned)(Raw)value << FractionBits)) {}
+
+        /** Creates the given integer. */
+        FixedT(unsigned value)
+            : raw((Raw)((Unsigned)value << FractionBits)) {}
+
+        /**
+         * Creates the nearest fixed point number to the given value.
+         * Values outside the range of the format are clamped.
+         */
+        FixedT(double value)
+        {
+            double scaled = value * (double)(1ULL << FractionBits);
+            double maximum = (double)FixedRaw<Raw>::maximum();
+            double minimum = (double)FixedRaw<Raw>::minimum();
+            if (scaled >= maximum) raw = FixedRaw<Raw>::maximum();
+            else if (scaled <= minimum) raw = FixedRaw<Raw>::minimum();
+            else
+            {
+                double whole = floor(scaled);
+                raw = (Raw)whole;
+                if (scaled - whole >= 0.5) raw++;
+            }
+        }
+
+        /** Creates a fixed point number with the given raw value. */
+        static FixedT fromRaw(Raw raw)
+        {
+            FixedT result;
+            result.raw = raw;
+            return result;
+        }
+
+        /** Returns the nearest double to this number. */
+        double toDouble() const
+        {
+            return (double)raw / (double)(1ULL << FractionBits);
+        }
+
+        /** Returns the nearest float to this number. */
+        float toFloat() const
+        {
+            return (float)toDouble();
+        }
+
+        /** Returns the largest integer no greater than this number. */
+        int toInt() const
+        {
+            return (int)(raw >> FractionBits);
+        }
+
+        FixedT operator-() const
+        {
+            return fromRaw((Raw)(0 - (Unsigned)raw));
+        }
+
+        FixedT operator+() const
+        {
+            return *this;
+        }
+
+        void operator+=(const FixedT &other)
+        {
+            raw = (Raw)((Unsigned)raw + (Unsigned)other.raw);
+        }
+
+        void operator-=(const FixedT &other)
+        {
+            raw = (Raw)((Unsigned)raw - (Unsigned)other.raw);
+        }
+
+        void operator*=(const FixedT &other)
+        {
+            raw = _fixedMultiply(raw, other.raw, FractionBits);
+        }
+
+        void operator/=(const FixedT &other)
+        {
+            raw = _fixedDivide(raw, other.raw, FractionBits);
+        }
+
+        friend FixedT operator+(FixedT a, const FixedT &b)
+        {
+            a += b;
+            return a;
+        }
+
+        friend FixedT operator-(FixedT a, const FixedT &b)
+        {
+            a -= b;
+            return a;
+        }
+
+        friend FixedT operator*(FixedT a, const FixedT &b)
+        {
+            a *= b;
+            return a;
+        }
+
+        friend FixedT operator/(FixedT a, const FixedT &b)
+        {
+            a /= b;
+            return a;
+        }
+
+        friend bool operator==(const FixedT &a, const FixedT &b)
+        {
+            return a.raw == b.raw;
+        }
+
+        friend bool operator!=(const FixedT &a, const FixedT &b)
+        {
+            return a.raw != b.raw;
+        }
+
+        friend bool operator<(const FixedT &a, const FixedT &b)
+        {
+            return a.raw < b.raw;
+        }
+
+        friend bool operator>(const FixedT &a, const FixedT &b)
+        {
+            return a.raw > b.raw;
+        }
+
+        friend bool operator<=(const FixedT &a, const FixedT &b)
+        {
+            return a.raw <= b.raw;
+        }
+
+        friend bool operator>=(const FixedT &a, const FixedT &b)
+        {
+            return a.raw >= b.raw;
+        }
+    };
+
+    /** A fixed point number with 16 integer and 16 fraction bits. */
+    typedef FixedT<int, 16> Fixed16;
+
+    /** A fixed point number with 32 integer and 32 fraction bits. */
+    typedef FixedT<long long, 32> Fixed32;
+
+    /**
+     * The constants and functions for fixed point numbers. They are
+     * all calculated with integer arithmetic, so they give the same
+     * results everywhere. Formats with more than 32 fraction bits are
+     * not supported.
+     */
+    template <typename Raw, int FractionBits>
+    struct Scalar< FixedT<Raw, FractionBits> >
+    {
+        typedef FixedT<Raw, FractionBits> Fixed;
+
+        /** Returns the highest value for the number. */
+        static Fixed maximum()
+        {
+            return Fixed::fromRaw(FixedRaw<Raw>::maximum());
+        }
+
+        /** Returns the ratio of a circle's circumference to its diameter. */
+        static Fixed pi()
+        {
+            return Fixed::fromRaw(
+                (Raw)_fixedFromQ32(13493037705LL, FractionBits));
+        }
+
+        /** Returns the square root, or zero for negative values. */
+        static Fixed sqrt(const Fixed &value)
+        {
+            if (value.raw <= 0) return Fixed();
+            FixedWide square = FixedWide(0, (unsigned long long)value.raw)
+                .shiftLeft(FractionBits);
+            return Fixed::fromRaw((Raw)square.squareRoot());
+        }
+
+        static Fixed abs(const Fixed &value)
+        {
+            return value.raw < 0 ? -value : value;
+        }
+
+        static Fixed sin(const Fixed &value)
+        {
+            long long sine, cosine;
+            _fixedSinCos((long long)value.raw * (1LL << (32 - FractionBits)),
+                         &sine, &cosine);
+            return Fixed::fromRaw((Raw)_fixedFromQ32(sine, FractionBits));
+        }
+
+        static Fixed cos(const Fixed &value)
+        {
+            long long sine, cosine;
+            _fixedSinCos((long long)value.raw * (1LL << (32 - FractionBits)),
+                         &sine, &cosine);
+            return Fixed::fromRaw((Raw)_fixedFromQ32(cosine, FractionBits));
+        }
+
+        /**
+         * Returns e to the power of the value, or the largest number
+         * if that is too large to hold.
+         */
+        static Fixed exp(const Fixed &value)
+        {
+            // e^x is 2^(x log2 e), with log2 e held with 32 fraction
+            // bits.
+            long long power = _fixedMultiply(
+                (long long)value.raw * (1LL << (32 - FractionBits)),
+                6196328019LL, 32);
+            return fromQ32(_fixedExp2(power));
+        }
+
+        /**
+         * Returns the value raised to the given power. The value must
+         * not be negative, and zero raised to any power gives zero.
+         */
+        static Fixed pow(const Fixed &value, const Fixed &power)
+        {
+            if (value.raw <= 0) return Fixed();
+            long long logarithm = _fixedLog2(
+                (unsigned long long)value.raw << (32 - FractionBits));
+            long long product = _fixedMultiply(logarithm,
+                (long long)power.raw * (1LL << (32 - FractionBits)), 32);
+            return fromQ32(_fixedExp2(product));
+        }
+
+        static Fixed floor(const Fixed &value)
+        {
+            typename Fixed::Unsigned whole =
+                (typename Fixed::Unsigned)(value.raw >> FractionBits);
+            return Fixed::fromRaw((Raw)(whole << FractionBits));
+        }
+
+        /**
+         * Returns the remainder of dividing the value by the divisor,
+         * with the sign of the value.
+         */
+        static Fixed fmod(const Fixed &value, const Fixed &divisor)
+        {
+            if (divisor.raw == 0) return Fixed();
+            typename Fixed::Unsigned magnitude = value.raw < 0 ?
+                0 - (typename Fixed::Unsigned)value.raw : value.raw;
+            typename Fixed::Unsigned modulus = divisor.raw < 0 ?
+                0 - (typename Fixed::Unsigned)divisor.raw : divisor.raw;
+            magnitude %= modulus;
+            return Fixed::fromRaw(value.raw < 0 ?
+                (Raw)(0 - magnitude) : (Raw)magnitude);
+        }
+
+        /**
+         * Returns the nearest float to the value, for handing to
+         * code outside the simulation such as rendering.
+         */
+        static float toFloat(const Fixed &value)
+        {
+            return value.toFloat();
+        }
+
+    private:
+        /**
+         * Returns the nearest number to a positive value held with 32
+         * fraction bits, or the largest number if it is too large.
+         */
+        static Fixed fromQ32(long long value)
+        {
+            long long raw = _fixedFromQ32(value, FractionBits);
+            if (raw > (long long)FixedRaw<Raw>::maximum())
+            {
+                return maximum();
+            }
+            return Fixed::fromRaw((Raw)raw);
+        }
+    };
+
+} // namespace cyclone
+
+#endif // CYCLONE_FIXED_H
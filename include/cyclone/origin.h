@@ -0,0 +1,76 @@
+/*
+ * Interface file for the local origin of a world.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains the local origin a world measures its objects'
+ * positions from, so that a large scene can be simulated near the
+ * origin, where real numbers are most precise.
+ */
+#ifndef CYCLONE_ORIGIN_H
+#define CYCLONE_ORIGIN_H
+
+#include "core.h"
+
+namespace cyclone {
+
+    /**
+     * Holds where a world's origin is in the scene as a whole.
+     *
+     * Real numbers lose precision as they get larger, so in single
+     * precision objects a few kilometres from the origin no longer
+     * move smoothly, and their contacts jitter. A world therefore
+     * holds its objects' positions relative to a local origin, which
+     * can be moved to stay near the action with the world's
+     * shiftOrigin method. The local origin itself is held in double
+     * precision, so that global positions stay exact however far it
+     * is moved.
+     *
+     * A large scene can also be split into regions, each simulated
+     * by its own world with its own local origin. Objects moving
+     * between regions are converted through global coordinates.
+     */
+    struct LocalOrigin
+    {
+        /**
+         * Holds the position of the local origin in global
+         * coordinates.
+         */
+        Vector3d position;
+
+        /**
+         * Converts the given position from the world's local
+         * coordinates to global coordinates.
+         */
+        Vector3d toGlobal(const Vector3 &local) const
+        {
+            return Vector3d(position.x + local.x,
+                            position.y + local.y,
+                            position.z + local.z);
+        }
+
+        /**
+         * Converts the given position from global coordinates to the
+         * world's local coordinates.
+         */
+        Vector3 toLocal(const Vector3d &global) const
+        {
+            return Vector3((real)(global.x - position.x),
+                           (real)(global.y - position.y),
+                           (real)(global.z - position.z));
+        }
+    };
+
+} // namespace cyclone
+
+#endif // CYCLONE_ORIGIN_H
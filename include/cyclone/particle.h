@@ -21,6 +21,8 @@
 #define CYCLONE_PARTICLE_H
 
 #include "core.h"
+#include "snapshot.h"
+#include "fields.h"
 
 namespace cyclone {
 
@@ -131,6 +133,19 @@ namespace cyclone {
 
         /*@}*/
 
+        /**
+         * Holds a stable identifier for the particle. The particle
+         * world uses it to give contacts a fixed order when running
+         * in deterministic mode.
+         */
+        unsigned id;
+
+        /**
+         * Holds the world fields that affect the particle, as a
+         * combination of FieldFlags.
+         */
+        unsigned fieldMask;
+
     public:
         /**
          * @name Constructor and Destructor
@@ -140,6 +155,13 @@ namespace cyclone {
          * automatically.
          */
         /*@{*/
+
+        /**
+         * Creates a particle affected by every world field. The rest
+         * of the particle's data must be set before it is used.
+         */
+        Particle();
+
         /*@}*/
 
         /**
@@ -161,8 +183,12 @@ namespace cyclone {
          * This function uses a Newton-Euler integration method, which is a
          * linear approximation to the correct integral. For this reason it
          * may be inaccurate in some cases.
+         *
+         * If fields are given, the acceleration they give the
+         * particle, limited by its field mask, is added to the
+         * acceleration from its forces.
          */
-        void integrate(real duration);
+        void integrate(real duration, const UniformFields *fields = NULL);
 
         /*@}*/
 
@@ -342,6 +368,57 @@ namespace cyclone {
          */
         Vector3 getAcceleration() const;
 
+        /**
+         * Sets the stable identifier of the particle.
+         *
+         * @param id The new identifier of the particle.
+         */
+        void setId(const unsigned id);
+
+        /**
+         * Gets the stable identifier of the particle.
+         *
+         * @return The identifier of the particle.
+         */
+        unsigned getId() const
+        {
+            return id;
+        }
+
+        /**
+         * Sets the world fields that affect the particle.
+         *
+         * @param mask A combination of FieldFlags. Fields whose flag
+         * is not included are ignored by the particle.
+         */
+        void setFieldMask(const unsigned mask);
+
+        /**
+         * Gets the world fields that affect the particle.
+         *
+         * @return A combination of FieldFlags.
+         */
+        unsigned getFieldMask() const
+        {
+            return fieldMask;
+        }
+
+        /**
+         * Fills the given structure with the position and velocity
+         * of the particle.
+         *
+         * @param state Pointer to a state structure to fill.
+         */
+        void getState(ParticleState *state) const;
+
+        /**
+         * Sets the position and velocity of the particle from the
+         * given structure.
+         *
+         * @param state The state to set the particle to.
+         */
+        void setState(const ParticleState &state);
+
         /*@}*/
 
         /**
@@ -366,6 +443,14 @@ namespace cyclone {
          */
         void addForce(const Vector3 &force);
 
+        /**
+         * Returns the force accumulated for the next iteration.
+         */
+        Vector3 getAccumulatedForce() const
+        {
+            return forceAccum;
+        }
+
 
     };
 }
@@ -171,6 +171,30 @@ namespace cyclone {
             real duration);
     };
 
+    /**
+     * Describes a contact generator that keeps the distance between
+     * two particles, or a particle and an anchor, within a range.
+     * Solvers that work on positions directly use this in place of
+     * the contacts the generator would create.
+     */
+    struct ParticleDistanceConstraint
+    {
+        /**
+         * Holds the particles involved. The second is NULL if the
+         * first particle is held to the anchor instead.
+         */
+        Particle *particle[2];
+
+        /** Holds the anchor, if there is no second particle. */
+        Vector3 anchor;
+
+        /** Holds the shortest allowed distance. */
+        real minLength;
+
+        /** Holds the longest allowed distance. */
+        real maxLength;
+    };
+
     /**
      * This is the basic polymorphic interface for contact generators
      * applying to particles.
@@ -188,6 +212,29 @@ namespace cyclone {
          */
         virtual unsigned addContact(ParticleContact *contact,
                                     unsigned limit) const = 0;
+
+        /**
+         * Returns the most contacts the generator can write in one
+         * call to addContact. The world makes at least this much
+         * room before calling the generator, and calls it only once
+         * a frame, so generators that can write more than one contact
+         * should override this.
+         */
+        virtual unsigned getMaxContacts() const
+        {
+            return 1;
+        }
+
+        /**
+         * Fills the given structure with the distance constraint this
+         * generator enforces, and returns true, if the generator is
+         * a distance constraint. Other generators return false.
+         */
+        virtual bool getDistanceConstraint(
+            ParticleDistanceConstraint *) const
+        {
+            return false;
+        }
     };
 
 
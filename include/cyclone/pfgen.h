@@ -20,10 +20,91 @@
 
 #include "core.h"
 #include "particle.h"
+#include "water.h"
 #include <vector>
 
 namespace cyclone {
 
+    /**
+     * Identifies a single registration in a force registry. A handle
+     * stays valid until its registration is removed, after which it
+     * is recognised as stale and ignored.
+     */
+    struct ForceHandle
+    {
+        /** Holds the index of the registration's slot. */
+        unsigned slot;
+
+        /** Holds the number of times the slot had been reused. */
+        unsigned generation;
+
+        /** Creates a handle that refers to no registration. */
+        ForceHandle() : slot(~0u), generation(0) {}
+    };
+
+    /**
+     * Maps the handles of a force registry to the positions of their
+     * registrations. The registry moves registrations around as it
+     * removes others, and tells the table where they went, so a
+     * handle can always be turned into a position in constant time.
+     * Freed slots are reused, with their generation increased so old
+     * handles to them no longer match.
+     */
+    class ForceHandleTable
+    {
+        /**
+         * Holds the position of one registration. For a free slot,
+         * the index holds the next free slot.
+         */
+        struct Slot
+        {
+            unsigned bucket;
+            unsigned index;
+            unsigned generation;
+        };
+
+        /** Holds every slot, in use or free. */
+        std::vector<Slot> slots;
+
+        /** Holds the first free slot, or ~0 if there are none. */
+        unsigned firstFree;
+
+    public:
+        ForceHandleTable() : firstFree(~0u) {}
+
+        /**
+         * Takes a slot for a registration at the given position, and
+         * returns a handle to it.
+         */
+        ForceHandle allocate(unsigned bucket, unsigned index);
+
+        /**
+         * Finds the position of the registration with the given
+         * handle. Returns false if the handle is stale or invalid.
+         */
+        bool find(const ForceHandle &handle,
+                  unsigned *bucket, unsigned *index) const;
+
+        /**
+         * Records that the registration in the given slot has moved
+         * to the given index in its bucket.
+         */
+        void move(unsigned slot, unsigned index)
+        {
+            slots[slot].index = index;
+        }
+
+        /**
+         * Frees the given slot, making handles to it stale.
+         */
+        void release(unsigned slot);
+
+        /**
+         * Frees every slot.
+         */
+        void clear();
+    };
+
     /**
      * A force generator can be asked to add a force to one or more
      * particles.
@@ -55,6 +136,14 @@ namespace cyclone {
 
         /** Applies the gravitational force to the given particle. */
         virtual void updateForce(Particle *particle, real duration);
+
+        /**
+         * Sets each of count forces to the gravitational force on a
+         * particle with the matching inverse mass. This is what
+         * updateForce applies, found for many particles at once.
+         */
+        void getForces(const real *inverseMasses, Vector3 *forces,
+                       unsigned count) const;
     };
 
     /**
@@ -76,6 +165,14 @@ namespace cyclone {
 
         /** Applies the drag force to the given particle. */
         virtual void updateForce(Particle *particle, real duration);
+
+        /**
+         * Sets each of count forces to the drag on a particle moving
+         * with the matching velocity. This is what updateForce
+         * applies, found for many particles at once.
+         */
+        void getForces(const Vector3 *velocities, Vector3 *forces,
+                       unsigned count) const;
     };
 
     /**
@@ -231,18 +328,80 @@ namespace cyclone {
          */
         real liquidDensity;
 
+        /**
+         * The water surface, or NULL if the flat water height is
+         * used.
+         */
+        const WaterSurface *surface;
+
+        /** Holds the last water height this generator looked up. */
+        WaterHeightCache heightCache;
+
     public:
 
         /** Creates a new buoyancy force with the given parameters. */
         ParticleBuoyancy(real maxDepth, real volume, real waterHeight,
             real liquidDensity = 1000.0f);
 
+        /**
+         * Sets the water surface the particle floats on. Setting NULL
+         * returns to the flat water height.
+         */
+        void setWaterSurface(const WaterSurface *surface);
+
+        /**
+         * Returns the water surface the particle floats on, or NULL
+         * if the flat water height is used.
+         */
+        const WaterSurface* getWaterSurface() const
+        {
+            return surface;
+        }
+
+        /**
+         * Returns the point whose depth the buoyancy depends on.
+         */
+        Vector3 getSamplePoint(const Particle *particle) const
+        {
+            return particle->getPosition();
+        }
+
+        /**
+         * Finds the water height above the given point if it is
+         * known without a lookup, returning false if it is not.
+         */
+        bool getKnownHeight(const Vector3 &point, real *height) const;
+
+        /**
+         * Stores the water height looked up above the given point.
+         */
+        void cacheHeight(const Vector3 &point, real height);
+
         /** Applies the buoyancy force to the given particle. */
         virtual void updateForce(Particle *particle, real duration);
+
+        /**
+         * Applies the buoyancy force to the given particle, whose
+         * sample point is at the given position with the water
+         * surface at the given height above it.
+         */
+        void updateForceAtHeight(Particle *particle, real duration,
+                                 const Vector3 &point, real height);
     };
 
     /**
      * Holds all the force generators and the particles they apply to.
+     *
+     * Registrations are kept in separate buckets for each of the
+     * common generator types, decided by the exact type of the
+     * generator when it is added, and each bucket is updated in its
+     * own loop with direct, non-virtual calls. Generators of other
+     * types are kept in a general bucket and called virtually.
+     *
+     * Adding a registration returns a handle that removes it in
+     * constant time. Removal moves the last registration in the
+     * bucket into the gap, so the order registrations are updated in
+     * depends only on the sequence of adds and removes made.
      */
     class ParticleForceRegistry
     {
@@ -252,32 +411,132 @@ namespace cyclone {
          * Keeps track of one force generator and the particle it
          * applies to.
          */
-        struct ParticleForceRegistration
+        template<class Generator>
+        struct TypedRegistration
         {
             Particle *particle;
-            ParticleForceGenerator *fg;
+            Generator *fg;
+
+            /** Holds the handle slot of this registration. */
+            unsigned slot;
         };
 
         /**
-         * Holds the list of registrations.
+         * Identifies the bucket a registration is held in.
+         */
+        enum Bucket
+        {
+            GENERAL_BUCKET,
+            GRAVITY_BUCKET,
+            DRAG_BUCKET,
+            SPRING_BUCKET,
+            BUNGEE_BUCKET,
+            ANCHORED_SPRING_BUCKET,
+            BUOYANCY_BUCKET
+        };
+
+        typedef TypedRegistration<ParticleForceGenerator>
+            ParticleForceRegistration;
+
+        /**
+         * Holds the list of registrations of generators without a
+         * bucket of their own.
          */
         typedef std::vector<ParticleForceRegistration> Registry;
         Registry registrations;
 
+        /** Holds the registrations of ParticleGravity generators. */
+        std::vector< TypedRegistration<ParticleGravity> >
+            gravityRegistrations;
+
+        /** Holds the registrations of ParticleDrag generators. */
+        std::vector< TypedRegistration<ParticleDrag> > dragRegistrations;
+
+        /** Holds the registrations of ParticleSpring generators. */
+        std::vector< TypedRegistration<ParticleSpring> >
+            springRegistrations;
+
+        /** Holds the registrations of ParticleBungee generators. */
+        std::vector< TypedRegistration<ParticleBungee> >
+            bungeeRegistrations;
+
+        /** Holds the registrations of ParticleAnchoredSpring generators. */
+        std::vector< TypedRegistration<ParticleAnchoredSpring> >
+            anchoredSpringRegistrations;
+
+        /** Holds the registrations of ParticleBuoyancy generators. */
+        std::vector< TypedRegistration<ParticleBuoyancy> >
+            buoyancyRegistrations;
+
+        /** Holds the positions of the registrations by handle. */
+        ForceHandleTable handles;
+
+        /**
+         * Holds the inverse masses of the particles in the gravity
+         * bucket, reused between updates.
+         */
+        std::vector<real> batchMasses;
+
+        /** Holds the velocities of the particles in the drag bucket. */
+        std::vector<Vector3> batchVelocities;
+
+        /** Holds the forces found for the gravity and drag buckets. */
+        std::vector<Vector3> batchForces;
+
+        /**
+         * Holds the points at which buoyancy is found, reused
+         * between updates.
+         */
+        std::vector<Vector3> waterPoints;
+
+        /**
+         * Holds the surface each point's height must be looked up
+         * on, or NULL if it is already known.
+         */
+        std::vector<const WaterSurface*> waterSurfaces;
+
+        /** Holds the water height above each point. */
+        std::vector<real> waterHeights;
+
+        /**
+         * Returns the bucket that registrations of the given
+         * generator are held in.
+         */
+        static unsigned getBucket(const ParticleForceGenerator *fg);
+
+        /**
+         * Removes the registration at the given position, moving the
+         * last registration in its bucket into its place.
+         */
+        void removeAt(unsigned bucket, unsigned index);
+
     public:
         /**
          * Registers the given force generator to apply to the
-         * given particle.
+         * given particle. Returns a handle to the registration.
          */
-        void add(Particle* particle, ParticleForceGenerator *fg);
+        ForceHandle add(Particle* particle, ParticleForceGenerator *fg);
+
+        /**
+         * Removes the registration with the given handle in constant
+         * time. Returns false, with no effect, if the handle is stale.
+         */
+        bool remove(const ForceHandle &handle);
 
         /**
          * Removes the given registered pair from the registry.
          * If the pair is not registered, this method will have
-         * no effect.
+         * no effect. This searches the generator's bucket, so it is
+         * slower than removing by handle.
          */
         void remove(Particle* particle, ParticleForceGenerator *fg);
 
+        /**
+         * Removes every registration for the given particle. The
+         * registrations that remain keep their relative order.
+         */
+        void removeAll(Particle* particle);
+
         /**
          * Clears all registrations from the registry. This will
          * not delete the particles or the force generators
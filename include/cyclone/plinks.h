@@ -84,6 +84,12 @@ namespace cyclone {
          */
         virtual unsigned addContact(ParticleContact *contact,
                                     unsigned limit) const;
+
+        /**
+         * Describes the cable as a distance constraint.
+         */
+        virtual bool getDistanceConstraint(
+            ParticleDistanceConstraint *constraint) const;
     };
 
     /**
@@ -105,6 +111,12 @@ namespace cyclone {
          */
         virtual unsigned addContact(ParticleContact *contact,
                                      unsigned limit) const;
+
+        /**
+         * Describes the rod as a distance constraint.
+         */
+        virtual bool getDistanceConstraint(
+            ParticleDistanceConstraint *constraint) const;
     };
 
     /**
@@ -171,6 +183,12 @@ namespace cyclone {
         */
         virtual unsigned addContact(ParticleContact *contact,
             unsigned limit) const;
+
+        /**
+         * Describes the cable as a distance constraint.
+         */
+        virtual bool getDistanceConstraint(
+            ParticleDistanceConstraint *constraint) const;
     };
 
     /**
@@ -192,6 +210,12 @@ namespace cyclone {
         */
         virtual unsigned addContact(ParticleContact *contact,
             unsigned limit) const;
+
+        /**
+         * Describes the rod as a distance constraint.
+         */
+        virtual bool getDistanceConstraint(
+            ParticleDistanceConstraint *constraint) const;
     };
 } // namespace cyclone
 
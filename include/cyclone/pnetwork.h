@@ -0,0 +1,259 @@
+/*
+ * Interface file for implicitly integrated particle spring networks.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains a network of particles joined by springs, which
+ * is integrated implicitly as a whole so that stiff springs stay
+ * stable at large time steps.
+ */
+#ifndef CYCLONE_PNETWORK_H
+#define CYCLONE_PNETWORK_H
+
+#include <vector>
+#include "particle.h"
+#include "fields.h"
+
+namespace cyclone {
+
+    /**
+     * A set of particles joined by springs, such as a cloth or soft
+     * body mesh, integrated with backward Euler.
+     *
+     * Springs added as force generators are integrated explicitly,
+     * one particle at a time, and become unstable once they are
+     * stiff compared to the time step. A network instead solves for
+     * the velocity change of every particle at once, using the
+     * springs' forces at the end of the step. The linear system this
+     * gives is assembled as a sparse matrix, with a 3x3 block for
+     * each particle and each spring, and solved with a preconditioned
+     * conjugate gradient method. This damps high frequency motion
+     * rather than amplifying it, so the step can be many times
+     * larger.
+     *
+     * Particles in a network are integrated by the network in place
+     * of Particle::integrate. Other forces are still applied through
+     * the particles' accumulators, and are treated explicitly.
+     * Particles with infinite mass are held in place.
+     */
+    class ParticleSpringNetwork
+    {
+    public:
+        /**
+         * Marks a spring end that is attached to an anchor rather
+         * than to a particle.
+         */
+        static const unsigned ANCHOR = ~0u;
+
+    protected:
+        /**
+         * Holds a single spring in the network.
+         */
+        struct Spring
+        {
+            /** Holds the indices of the particles at each end. */
+            unsigned particle[2];
+
+            /**
+             * Holds the anchor the second end is attached to, if it
+             * is not attached to a particle.
+             */
+            const Vector3 *anchor;
+
+            /** Holds the spring constant. */
+            real springConstant;
+
+            /** Holds the rest length of the spring. */
+            real restLength;
+
+            /**
+             * Holds the damping constant, which resists the ends'
+             * relative velocity along the spring.
+             */
+            real damping;
+
+            /**
+             * True if the spring only pulls, like a bungee, and has
+             * no effect when shorter than its rest length.
+             */
+            bool bungee;
+        };
+
+        /** Holds the particles in the network. */
+        std::vector<Particle*> particles;
+
+        /** Holds the springs in the network. */
+        std::vector<Spring> springs;
+
+        /**
+         * Holds the largest number of conjugate gradient iterations
+         * each step may use.
+         */
+        unsigned maxIterations;
+
+        /**
+         * Holds the residual, relative to the right hand side, at
+         * which the solve stops.
+         */
+        real tolerance;
+
+        /** Holds the iterations used by the last step. */
+        unsigned lastIterations;
+
+        /**
+         * @name Solver Data
+         *
+         * These hold the system solved in each step. They are kept
+         * between steps so that their memory is reused.
+         */
+        /*@{*/
+
+        /** Holds the diagonal block of the matrix for each particle. */
+        std::vector<Matrix3> diagonal;
+
+        /** Holds the off-diagonal block of the matrix for each spring. */
+        std::vector<Matrix3> offDiagonal;
+
+        /** Holds the inverse of each diagonal element of the matrix. */
+        std::vector<Vector3> preconditioner;
+
+        /** Holds the right hand side of the system. */
+        std::vector<Vector3> rhs;
+
+        /** Holds the velocity change being solved for. */
+        std::vector<Vector3> deltaV;
+
+        /** Holds the conjugate gradient residual. */
+        std::vector<Vector3> residual;
+
+        /** Holds the preconditioned residual. */
+        std::vector<Vector3> preconditioned;
+
+        /** Holds the conjugate gradient search direction. */
+        std::vector<Vector3> direction;
+
+        /** Holds the matrix times the search direction. */
+        std::vector<Vector3> product;
+
+        /*@}*/
+
+        /**
+         * Adds a spring with the given properties to the network.
+         */
+        void addSpring(unsigned a, unsigned b, const Vector3 *anchor,
+                       real springConstant, real restLength,
+                       real damping, bool bungee);
+
+        /**
+         * Builds the matrix and right hand side of the system for a
+         * step of the given duration.
+         */
+        void assemble(real duration, const UniformFields *fields);
+
+        /**
+         * Multiplies the given vector by the matrix of the system.
+         */
+        void multiply(const std::vector<Vector3> &vector,
+                      std::vector<Vector3> &result) const;
+
+        /**
+         * Solves the system for the velocity changes, returning the
+         * number of iterations used.
+         */
+        unsigned solve();
+
+    public:
+        /**
+         * Creates an empty network.
+         *
+         * @param maxIterations The most conjugate gradient iterations
+         * each step may use.
+         *
+         * @param tolerance The relative residual at which the solve
+         * is accepted.
+         */
+        ParticleSpringNetwork(unsigned maxIterations = 50,
+                              real tolerance = (real)0.0001);
+
+        /**
+         * Adds a particle to the network, returning its index for use
+         * when adding springs.
+         */
+        unsigned addParticle(Particle *particle);
+
+        /**
+         * Adds a spring between the particles with the given indices.
+         *
+         * @param damping A damping constant for the spring, which
+         * resists the particles moving apart or together.
+         */
+        void addSpring(unsigned a, unsigned b,
+                       real springConstant, real restLength,
+                       real damping = 0);
+
+        /**
+         * Adds a bungee between the particles with the given indices,
+         * which only acts when stretched beyond its rest length.
+         */
+        void addBungee(unsigned a, unsigned b,
+                       real springConstant, real restLength,
+                       real damping = 0);
+
+        /**
+         * Adds a spring between the particle with the given index and
+         * an anchor point. The anchor is held by pointer, so it can be
+         * moved.
+         */
+        void addAnchoredSpring(unsigned a, const Vector3 *anchor,
+                               real springConstant, real restLength,
+                               real damping = 0);
+
+        /**
+         * Removes all the particles and springs from the network.
+         */
+        void clear();
+
+        /**
+         * Returns the particles in the network.
+         */
+        const std::vector<Particle*>& getParticles() const
+        {
+            return particles;
+        }
+
+        /**
+         * Sets the limits on the solve in each step.
+         */
+        void setSolverLimits(unsigned maxIterations, real tolerance);
+
+        /**
+         * Returns the number of iterations the last step's solve
+         * used.
+         */
+        unsigned getLastIterations() const
+        {
+            return lastIterations;
+        }
+
+        /**
+         * Integrates every particle in the network forward in time by
+         * the given duration, including the forces in their
+         * accumulators and the given world fields, and then clears
+         * their accumulators.
+         */
+        void integrate(real duration, const UniformFields *fields = NULL);
+    };
+
+} // namespace cyclone
+
+#endif // CYCLONE_PNETWORK_H
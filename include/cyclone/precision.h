@@ -16,20 +16,44 @@
  *
  * Because Cyclone is designed to work at either single or double
  * precision, mathematical functions such as sqrt cannot be used
- * in the source code or headers. This file provides defines for
- * the real number type and mathematical formulae that work on it.
+ * in the source code or headers. This file provides the Scalar
+ * traits, which give the constants and mathematical formulae for
+ * each precision, and defines the real number type used by the rest
+ * of the library along with shorthands for its formulae.
  *
- * @note All the contents of this file need to be changed to compile
- * Cyclone at a different precision.
+ * @note Only the choice of real at the top of this file needs to be
+ * changed to compile Cyclone at a different precision. The core
+ * mathematical types can be used at either precision whichever is
+ * chosen, and with the fixed point numbers in fixed.h, but the
+ * worlds, bodies and force generators all use real, so a program
+ * has one precision for all of its simulation.
  */
 #ifndef CYCLONE_PRECISION_H
 #define CYCLONE_PRECISION_H
 
 #include <float.h>
+#include <math.h>
+#include "fixed.h"
 
 namespace cyclone {
 
-#if 0
+#if defined(CYCLONE_FIXED_POINT)
+    /**
+     * Defines we're in fixed point mode, for any code that needs to
+     * be conditionally compiled. Defining CYCLONE_FIXED_POINT when
+     * building makes the real number type Fixed32, so that results
+     * are identical on every machine. So far only the core types,
+     * snapshots and particles (core.cpp, snapshot.cpp and
+     * particle.cpp) are written to build this way; the rest of the
+     * library still needs floating point. The library's quaternions
+     * are then of fixed point numbers, which needs a C++11 compiler.
+     */
+    #ifndef CYCLONE_FIXED_QUATERNIONS
+    #error Fixed point mode needs a C++11 compiler.
+    #endif
+    #define FIXED_PRECISION
+    typedef Fixed32 real;
+#elif 0
     /**
      * Defines we're in single precision mode, for any code
      * that needs to be conditionally compiled.
@@ -42,42 +66,92 @@ namespace cyclone {
      * provided.
      */
     typedef float real;
+#else
+    #define DOUBLE_PRECISION
+    typedef double real;
+#endif
+
+    /**
+     * Holds the constants and mathematical functions for one
+     * precision of real number. Code templated on its number type
+     * uses Scalar<Real>::sqrt and so on, where code written for the
+     * library's real type can use the shorthands below.
+     *
+     * The functions all inline to the standard library's function for
+     * the type, so they cost no more than calling it directly.
+     */
+    template <typename Real> struct Scalar;
+
+    /**
+     * The constants and functions for single precision.
+     */
+    template <> struct Scalar<float>
+    {
+        /** Returns the highest value for the real number. */
+        static float maximum() { return FLT_MAX; }
+
+        /** Returns the ratio of a circle's circumference to its diameter. */
+        static float pi() { return 3.14159265358979f; }
+
+        static float sqrt(float value) { return ::sqrtf(value); }
+        static float abs(float value) { return ::fabsf(value); }
+        static float sin(float value) { return ::sinf(value); }
+        static float cos(float value) { return ::cosf(value); }
+        static float exp(float value) { return ::expf(value); }
+        static float pow(float value, float power) { return ::powf(value, power); }
+        static float fmod(float value, float divisor) { return ::fmodf(value, divisor); }
+        static float floor(float value) { return ::floorf(value); }
+        static float toFloat(float value) { return value; }
+    };
+
+    /**
+     * The constants and functions for double precision.
+     */
+    template <> struct Scalar<double>
+    {
+        /** Returns the highest value for the real number. */
+        static double maximum() { return DBL_MAX; }
+
+        /** Returns the ratio of a circle's circumference to its diameter. */
+        static double pi() { return 3.14159265358979; }
+
+        static double sqrt(double value) { return ::sqrt(value); }
+        static double abs(double value) { return ::fabs(value); }
+        static double sin(double value) { return ::sin(value); }
+        static double cos(double value) { return ::cos(value); }
+        static double exp(double value) { return ::exp(value); }
+        static double pow(double value, double power) { return ::pow(value, power); }
+        static double fmod(double value, double divisor) { return ::fmod(value, divisor); }
+        static double floor(double value) { return ::floor(value); }
+        static float toFloat(double value) { return (float)value; }
+    };
 
     /** Defines the highest value for the real number. */
-    #define REAL_MAX FLT_MAX
+    #define REAL_MAX (cyclone::Scalar<cyclone::real>::maximum())
 
     /** Defines the precision of the square root operator. */
-    #define real_sqrt sqrtf
+    #define real_sqrt cyclone::Scalar<cyclone::real>::sqrt
+
     /** Defines the precision of the absolute magnitude operator. */
-    #define real_abs fabsf
+    #define real_abs cyclone::Scalar<cyclone::real>::abs
+
     /** Defines the precision of the sine operator. */
-    #define real_sin sinf
+    #define real_sin cyclone::Scalar<cyclone::real>::sin
 
     /** Defines the precision of the cosine operator. */
-    #define real_cos cosf
+    #define real_cos cyclone::Scalar<cyclone::real>::cos
 
     /** Defines the precision of the exponent operator. */
-    #define real_exp expf
+    #define real_exp cyclone::Scalar<cyclone::real>::exp
+
     /** Defines the precision of the power operator. */
-    #define real_pow powf
+    #define real_pow cyclone::Scalar<cyclone::real>::pow
 
     /** Defines the precision of the floating point modulo operator. */
-    #define real_fmod fmodf
+    #define real_fmod cyclone::Scalar<cyclone::real>::fmod
 
-    #define R_PI 3.14159f
-#else
-    #define DOUBLE_PRECISION
-    typedef double real;
-    #define REAL_MAX DBL_MAX
-    #define real_sqrt sqrt
-    #define real_abs fabs
-    #define real_sin sin
-    #define real_cos cos
-    #define real_exp exp
-    #define real_pow pow
-    #define real_fmod fmod
-    #define R_PI 3.14159265358979
-#endif
+    /** Defines the precision of the floor operator. */
+    #define real_floor cyclone::Scalar<cyclone::real>::floor
 }
 
-#endif // CYCLONE_PRECISION_H
\ No newline at end of file
+#endif // CYCLONE_PRECISION_H
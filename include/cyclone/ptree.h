@@ -0,0 +1,209 @@
+/*
+ * Interface file for the direct solver for trees of particle links.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains a solver that enforces particle distance
+ * constraints exactly, in linear time, when they link the particles
+ * into chains or trees.
+ */
+#ifndef CYCLONE_PTREE_H
+#define CYCLONE_PTREE_H
+
+#include <vector>
+#include "pcontacts.h"
+
+namespace cyclone {
+
+    /**
+     * Solves distance constraints between particles directly, for
+     * every group of linked particles that has no loops.
+     *
+     * The constraints and particles make up a linear system whose
+     * unknowns are the particles' movements and the constraints'
+     * Lagrange multipliers. When the links between particles form a
+     * tree, so does the system, and it can be factored and solved
+     * exactly by eliminating from the leaves to the root and then
+     * substituting back, in time proportional to the number of
+     * particles. Chains and skeletons are then held at their exact
+     * lengths, however long they are, with no iteration budget to
+     * run out.
+     *
+     * Each solve first moves the particles so the constraints are met,
+     * and then removes any velocity that would break them. Groups of
+     * particles whose links form a loop are left unsolved, for the
+     * caller to deal with some other way. Anchors and particles with
+     * infinite mass all count as the world, so a group held to the
+     * world in more than one place has a loop through it.
+     *
+     * Constraints that only limit the distance on one side, like
+     * cables, are ignored until their limit is passed. They are then
+     * moved back to it, and lose only the velocity that would carry
+     * them further past it: a taut cable stops its end moving away,
+     * but lets it swing back in.
+     */
+    class ParticleTreeSolver
+    {
+    protected:
+        /** Marks a node with no parent. */
+        static const unsigned NO_NODE = ~0u;
+
+        /** Holds the number of position passes made in each solve. */
+        unsigned positionIterations;
+
+        /** Holds the number of constraints in the current solve. */
+        unsigned constraintCount;
+
+        /** Holds the number of particles in the current solve. */
+        unsigned particleCount;
+
+        /** Holds the constraints in the current solve. */
+        const ParticleDistanceConstraint *constraints;
+
+        /** Holds the particles in the current solve. */
+        Particle *const *particles;
+
+        /**
+         * Holds the index of each constraint's particles, with
+         * NO_NODE for an anchor or a particle that can't move.
+         */
+        std::vector<unsigned> ends;
+
+        /** Holds true for each constraint being solved. */
+        std::vector<bool> active;
+
+        /** Holds the group each particle is linked into. */
+        std::vector<unsigned> groups;
+
+        /** Holds true for each group whose links form a loop. */
+        std::vector<bool> loops;
+
+        /** Holds the number of links from each group to the world. */
+        std::vector<unsigned> grounded;
+
+        /** Holds the constraints at each particle, in index order. */
+        std::vector<unsigned> adjacencyStart;
+        std::vector<unsigned> adjacency;
+
+        /**
+         * Holds the nodes of the system in an order where every node
+         * comes after its parent. Particles are nodes 0 to
+         * particleCount-1, and constraints follow.
+         */
+        std::vector<unsigned> order;
+
+        /** Holds the parent of each node. */
+        std::vector<unsigned> parent;
+
+        /** Holds the unit vector along each constraint. */
+        std::vector<Vector3> normals;
+
+        /** Holds the inverse of each particle's factored block. */
+        std::vector<Matrix3> particleBlocks;
+
+        /** Holds each constraint's factored block. */
+        std::vector<real> constraintBlocks;
+
+        /**
+         * Holds the link from each node to its parent in the
+         * factored system.
+         */
+        std::vector<Vector3> links;
+
+        /** Holds the solution for each particle. */
+        std::vector<Vector3> particleValues;
+
+        /** Holds the solution for each constraint. */
+        std::vector<real> constraintValues;
+
+        /** Holds the right hand side for the constraints. */
+        std::vector<real> rhsValues;
+
+        /**
+         * Finds which constraints belong to groups without loops, and
+         * orders their nodes from the roots out. Returns the number of
+         * constraints that can be solved.
+         */
+        unsigned buildForest();
+
+        /**
+         * Lists the active constraints at each particle, and orders
+         * their nodes from the roots out.
+         */
+        void orderForest();
+
+        /**
+         * Adds the tree with the given root node to the node order.
+         */
+        void addTree(unsigned root);
+
+        /**
+         * Updates the constraint directions and factors the system
+         * for the particles' current positions.
+         */
+        void factor();
+
+        /**
+         * Solves the factored system for the given right hand side
+         * for the constraints, leaving the particles' changes in
+         * particleValues.
+         */
+        void solve(const std::vector<real> &rhs);
+
+        /**
+         * Returns the direction a particle moving increases the
+         * length of the given constraint.
+         */
+        Vector3 getGradient(unsigned constraint, unsigned particle) const
+        {
+            return ends[constraint*2] == particle ?
+                normals[constraint] : normals[constraint] * -1;
+        }
+
+    public:
+        /**
+         * Creates a solver that makes the given number of position
+         * passes in each solve. The constraints are linearised in
+         * each pass, so a second pass removes most of the error left
+         * when particles swing a long way in a step.
+         */
+        ParticleTreeSolver(unsigned positionIterations = 2);
+
+        /**
+         * Sets the number of position passes made in each solve.
+         */
+        void setPositionIterations(unsigned iterations);
+
+        /**
+         * Solves the given constraints between the given particles,
+         * adjusting the particles' positions and velocities.
+         *
+         * The particles' identifiers must be their index in the given
+         * array. Constraints involving particles that are not in the
+         * array, or that are part of a loop, are not solved.
+         *
+         * @param solved An array with one entry per constraint, which
+         * is set to true for each constraint that was solved.
+         *
+         * @return The number of constraints solved.
+         */
+        unsigned solve(const ParticleDistanceConstraint *constraints,
+                       unsigned constraintCount,
+                       Particle *const *particles,
+                       unsigned particleCount,
+                       bool *solved);
+    };
+
+} // namespace cyclone
+
+#endif // CYCLONE_PTREE_H
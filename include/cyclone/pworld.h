@@ -21,6 +21,11 @@
 
 #include "pfgen.h"
 #include "plinks.h"
+#include "snapshot.h"
+#include "arena.h"
+#include "pnetwork.h"
+#include "ptree.h"
+#include "origin.h"
 
 namespace cyclone {
 
@@ -33,6 +38,37 @@ namespace cyclone {
     public:
         typedef std::vector<Particle*> Particles;
         typedef std::vector<ParticleContactGenerator*> ContactGenerators;
+        typedef std::vector<ParticleSpringNetwork*> SpringNetworks;
+
+        /**
+         * Identifies the ways the world can keep its particles'
+         * links and constraints satisfied.
+         */
+        enum SolverMode
+        {
+            /**
+             * Every contact generator creates contacts, which are
+             * resolved by the contact resolver.
+             */
+            CONTACT_SOLVER,
+
+            /**
+             * Generators that are distance constraints, such as rods
+             * and cables, are solved by projecting the particles'
+             * positions (extended position based dynamics). Other
+             * generators still create contacts for the resolver.
+             */
+            XPBD_SOLVER,
+
+            /**
+             * Distance constraints that link particles into chains
+             * or trees are solved exactly by a direct solver after
+             * the particles are integrated. Constraints in groups
+             * with loops, and other generators, create contacts for
+             * the resolver.
+             */
+            DIRECT_SOLVER
+        };
 
     protected:
         /**
@@ -62,24 +98,113 @@ namespace cyclone {
         ContactGenerators contactGenerators;
 
         /**
-         * Holds the list of contacts.
+         * Holds the spring networks, which integrate their own
+         * particles.
+         */
+        SpringNetworks springNetworks;
+
+        /**
+         * Holds the memory for data that lives for a single frame,
+         * including the contacts. It is reset at the start of each
+         * frame.
+         */
+        FrameArena arena;
+
+        /**
+         * Holds the list of contacts for the current frame,
+         * allocated from the frame arena.
          */
         ParticleContact *contacts;
 
         /**
-         * Holds the maximum number of contacts allowed (i.e. the
-         * size of the contacts array).
+         * Holds the number of contacts that will be made room for
+         * when contacts are next generated. This grows to fit the
+         * largest number of contacts any frame has needed.
+         */
+        unsigned contactCapacity;
+
+        /**
+         * True if the world should put contacts into a fixed order
+         * before resolving them.
+         */
+        bool deterministic;
+
+        /**
+         * Holds the number of contacts generated in the last frame,
+         * which are kept in the contacts array until the next one.
+         */
+        unsigned lastContactCount;
+
+        /**
+         * Holds the fields applied to every particle in the world.
+         */
+        UniformFields fields;
+
+        /**
+         * Holds where the world's origin is in global coordinates.
          */
-        unsigned maxContacts;
+        LocalOrigin origin;
+
+        /** Holds the way links and constraints are solved. */
+        SolverMode solverMode;
+
+        /** Holds the number of substeps each XPBD frame is split into. */
+        unsigned xpbdSubsteps;
+
+        /** Holds the number of XPBD sweeps made in each substep. */
+        unsigned xpbdIterations;
+
+        /**
+         * Holds the compliance of XPBD distance constraints, the
+         * inverse of their stiffness. Zero makes them rigid.
+         */
+        real xpbdCompliance;
+
+        /**
+         * Holds the number of colours the last XPBD frame's
+         * constraints were divided into.
+         */
+        unsigned lastColourCount;
+
+        /** Holds the solver for trees of distance constraints. */
+        ParticleTreeSolver treeSolver;
+
+        /**
+         * Holds, for each contact generator, whether the direct
+         * solver has dealt with it this frame. This is allocated from
+         * the frame arena, and is NULL when nothing was solved.
+         */
+        bool *directlySolved;
+
+        /**
+         * Returns an array holding, for each particle in the list,
+         * whether it is integrated by one of the spring networks, or
+         * NULL if there are no networks. The array is allocated from
+         * the frame arena.
+         */
+        bool* findNetworkedParticles();
+
+        /**
+         * Moves every particle on by the given duration and projects
+         * the distance constraints, in XPBD mode.
+         */
+        void runPositionSolver(real duration);
+
+        /**
+         * Solves the distance constraints that form trees exactly,
+         * in direct solver mode. Returns the number solved.
+         */
+        unsigned runDirectSolver();
 
     public:
 
         /**
-         * Creates a new particle simulator that can handle up to the
-         * given number of contacts per frame. You can also optionally
-         * give a number of contact-resolution iterations to use. If you
-         * don't give a number of iterations, then twice the number of
-         * contacts will be used.
+         * Creates a new particle simulator that initially makes room
+         * for the given number of contacts per frame. More room is
+         * made whenever a frame needs it, so this is only a hint. You
+         * can also optionally give a number of contact-resolution
+         * iterations to use. If you don't give a number of
+         * iterations, then twice the number of contacts will be used.
          */
         ParticleWorld(unsigned maxContacts, unsigned iterations=0);
 
@@ -91,12 +216,17 @@ namespace cyclone {
         /**
          * Calls each of the registered contact generators to report
          * their contacts. Returns the number of generated contacts.
+         *
+         * Before each generator is called, the contact array is
+         * grown until it has room for the generator's maximum number
+         * of contacts, so each generator is called once.
          */
         unsigned generateContacts();
 
         /**
          * Integrates all the particles in this world forward in time
-         * by the given duration.
+         * by the given duration. Particles in one of the world's
+         * spring networks are integrated by their network.
          */
         void integrate(real duration);
 
@@ -107,12 +237,52 @@ namespace cyclone {
 
         /**
          * Initializes the world for a simulation frame. This clears
-         * the force accumulators for particles in the world. After
-         * calling this, the particles can have their forces for this
-         * frame added.
+         * the force accumulators for particles in the world, and
+         * releases the last frame's contacts and other per-frame
+         * data. After calling this, the particles can have their
+         * forces for this frame added.
          */
         void startFrame();
 
+        /**
+         * Returns the arena for data that only lives for the current
+         * frame. Everything allocated from it is released by the next
+         * call to startFrame.
+         */
+        FrameArena& getFrameArena()
+        {
+            return arena;
+        }
+
+        /**
+         * Returns the uniform fields applied to every particle in the
+         * world as it is integrated. They have no effect until set.
+         */
+        UniformFields& getFields()
+        {
+            return fields;
+        }
+
+        /**
+         * Returns where the world's origin is in global coordinates,
+         * for converting positions in and out of the world.
+         */
+        const LocalOrigin& getOrigin() const
+        {
+            return origin;
+        }
+
+        /**
+         * Moves the world's origin to the given position, in the
+         * world's current coordinates, so that particles near it are
+         * held with the most precision. Every particle is moved in
+         * one pass; nothing in the world moves in global coordinates.
+         *
+         * Anchors held outside the world, such as those of cables,
+         * rods and anchored springs, must be moved by the caller.
+         */
+        void shiftOrigin(const Vector3 &newOrigin);
+
         /**
          *  Returns the list of particles.
          */
@@ -127,6 +297,107 @@ namespace cyclone {
          * Returns the force registry.
          */
         ParticleForceRegistry& getForceRegistry();
+
+        /**
+         * Returns the list of spring networks. A network's particles
+         * should also be in the particle list, so they take part in
+         * contacts and snapshots, but are integrated by the network.
+         */
+        SpringNetworks& getSpringNetworks()
+        {
+            return springNetworks;
+        }
+
+        /**
+         * Turns deterministic mode on or off. In deterministic mode
+         * each particle is given its index in the particle list as
+         * its identifier, and the contacts generated each frame are
+         * sorted by those identifiers before they are resolved. The
+         * outcome of a frame then depends only on the order of the
+         * particle list, and not on the order in which the contact
+         * generators were registered.
+         */
+        void setDeterministic(bool deterministic);
+
+        /**
+         * Sets the way links and constraints are solved.
+         */
+        void setSolverMode(SolverMode mode);
+
+        /**
+         * Returns the way links and constraints are solved.
+         */
+        SolverMode getSolverMode() const
+        {
+            return solverMode;
+        }
+
+        /**
+         * Sets the parameters of the XPBD solver.
+         *
+         * @param substeps The number of substeps each frame is split
+         * into. More substeps converge faster than more iterations.
+         *
+         * @param iterations The number of sweeps over the constraints
+         * in each substep.
+         *
+         * @param compliance The inverse stiffness of the constraints,
+         * zero for rigid links.
+         */
+        void setXPBDParameters(unsigned substeps, unsigned iterations,
+                               real compliance);
+
+        /**
+         * Returns the solver used for trees of distance constraints
+         * in direct solver mode.
+         */
+        ParticleTreeSolver& getTreeSolver()
+        {
+            return treeSolver;
+        }
+
+        /**
+         * Returns the number of colours the last XPBD frame divided
+         * its constraints into. Constraints of one colour share no
+         * particles, so each colour could be solved in parallel.
+         */
+        unsigned getColourCount() const
+        {
+            return lastColourCount;
+        }
+
+        /**
+         * Returns true if the world is running in deterministic mode.
+         */
+        bool isDeterministic() const
+        {
+            return deterministic;
+        }
+
+        /**
+         * Calculates a checksum over the position and velocity of
+         * every particle in the world. Two worlds whose particles are
+         * bit-for-bit identical give the same checksum.
+         */
+        unsigned getChecksum() const;
+
+        /**
+         * Saves the position and velocity of every particle in the
+         * world, and the contacts from the last frame, into the
+         * particle sections of the given snapshot. Contacts refer to
+         * particles by their index in the particle list, so each
+         * particle is given its index as its identifier.
+         */
+        void saveSnapshot(Snapshot *snapshot);
+
+        /**
+         * Restores the world from the particle sections of the given
+         * snapshot. The particle list must hold the same particles in
+         * the same order as when the snapshot was saved. Returns
+         * false, leaving the world unchanged, if the snapshot does
+         * not match the world's particles.
+         */
+        bool restoreSnapshot(const Snapshot &snapshot);
     };
 
     /**
@@ -142,6 +413,8 @@ namespace cyclone {
 
         virtual unsigned addContact(cyclone::ParticleContact *contact,
             unsigned limit) const;
+
+        virtual unsigned getMaxContacts() const;
     };
 
 } // namespace cyclone
@@ -0,0 +1,371 @@
+/*
+ * Interface file for the trajectory recorder.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains a recorder that streams the positions and
+ * orientations of a set of bodies and particles to a memory mapped
+ * file each frame, and a reader that gives random access to the
+ * frames of a recording.
+ */
+#ifndef CYCLONE_RECORDER_H
+#define CYCLONE_RECORDER_H
+
+#include <stddef.h>
+#include <vector>
+#include "body.h"
+#include "particle.h"
+
+namespace cyclone {
+
+    /**
+     * Internal class that holds a file mapped into memory. It hides
+     * the differences between the Windows and POSIX mapping calls.
+     */
+    class MappedFile
+    {
+        void *fileHandle;
+        void *mappingHandle;
+        int descriptor;
+        bool writable;
+
+    public:
+        /** Holds the start of the mapped data, or NULL if closed. */
+        unsigned char *data;
+
+        /** Holds the number of bytes that are mapped. */
+        size_t size;
+
+        MappedFile();
+        ~MappedFile();
+
+        /**
+         * Creates a new file of the given size, replacing any
+         * existing file, and maps it for writing.
+         */
+        bool create(const char *filename, size_t size);
+
+        /**
+         * Maps an existing file for reading.
+         */
+        bool open(const char *filename);
+
+        /**
+         * Changes the size of a file opened with create, remapping
+         * it. The data pointer may change.
+         */
+        bool resize(size_t size);
+
+        /**
+         * Unmaps and closes the file.
+         */
+        void close();
+    };
+
+    /**
+     * The encodings a recording can use for its frames.
+     */
+    enum RecordingEncoding
+    {
+        /**
+         * Every frame holds the full precision position and
+         * orientation of each body and position of each particle.
+         */
+        RECORD_RAW = 0,
+
+        /**
+         * A full precision keyframe is written at least every
+         * keyframeInterval frames. The frames between hold each
+         * position as a 16 bit offset from the last keyframe, in
+         * steps of the recording's precision, and each orientation
+         * quantised to 16 bits per component. This is around a
+         * quarter of the size of a raw frame. If any object has moved
+         * too far from the last keyframe for its offset to fit, a
+         * keyframe is written instead, so positions are never
+         * clamped. An index of the keyframes is written after the
+         * frames when the recording is closed.
+         */
+        RECORD_DELTA = 1
+    };
+
+    /**
+     * Holds the header at the start of a recording file.
+     */
+    struct RecordingHeader
+    {
+        unsigned magic;
+        unsigned version;
+        unsigned realSize;
+        unsigned encoding;
+        unsigned bodyCount;
+        unsigned particleCount;
+        unsigned keyframeInterval;
+        unsigned frameCount;
+        unsigned keyframeCount;
+        unsigned long long indexOffset;
+        real precision;
+    };
+
+    /**
+     * Holds an entry in the index of keyframes at the end of a delta
+     * recording: the frame number of the keyframe, and the byte
+     * offset of its tag.
+     */
+    struct RecordingKeyframe
+    {
+        unsigned frame;
+        unsigned long long offset;
+    };
+
+    /**
+     * Records the trajectories of a set of rigid bodies and particles
+     * into a memory mapped file. Bodies and particles are registered
+     * with the recorder before the file is opened, and every call to
+     * recordFrame then appends one frame holding their current
+     * positions and orientations.
+     *
+     * Raw frames have a fixed size, so the file can be read at any
+     * frame without parsing the ones before it. Delta frames start
+     * with a byte saying whether they are a keyframe, and every
+     * frame up to the next keyframe is a delta frame, so the offset
+     * of any frame follows from the keyframe before it. Closing the
+     * recording writes the frame number and offset of each keyframe
+     * after the frames, for the reader to look up.
+     *
+     * The file is grown in large steps as frames are appended, and
+     * recording a frame is a single pass over the registered objects
+     * writing straight into the mapped memory.
+     */
+    class TrajectoryRecorder
+    {
+    protected:
+        /** Holds the bodies whose trajectories are recorded. */
+        std::vector<const RigidBody*> bodies;
+
+        /** Holds the particles whose trajectories are recorded. */
+        std::vector<const Particle*> particles;
+
+        /** Holds the file being recorded into. */
+        MappedFile file;
+
+        /** Holds a copy of the header of the open recording. */
+        RecordingHeader header;
+
+        /** Holds the byte offset at which the next frame is written. */
+        size_t writeOffset;
+
+        /** Holds the byte offset of the last keyframe's data. */
+        size_t keyframeOffset;
+
+        /** Holds the number of delta frames since the last keyframe. */
+        unsigned deltaCount;
+
+        /**
+         * Holds the number of keyframes written early because an
+         * object had moved too far for a delta frame.
+         */
+        unsigned extraKeyframeCount;
+
+        /** Holds the index of the keyframes written so far. */
+        std::vector<RecordingKeyframe> keyframes;
+
+        /**
+         * Makes sure the file has room for at least the given number
+         * of further bytes, growing it if needed.
+         */
+        bool reserve(size_t bytes);
+
+        /**
+         * Writes the full precision state of every object at the
+         * given position.
+         */
+        void writeKeyframe(unsigned char *out) const;
+
+        /**
+         * Writes the state of every object at the given position,
+         * relative to the last keyframe. Returns false if any object
+         * is too far from the keyframe, leaving the frame unfinished.
+         */
+        bool writeDeltaFrame(unsigned char *out) const;
+
+    public:
+        TrajectoryRecorder();
+        ~TrajectoryRecorder();
+
+        /**
+         * Registers a body to be recorded. Bodies cannot be added
+         * once a recording has been opened.
+         */
+        void addBody(const RigidBody *body);
+
+        /**
+         * Registers a particle to be recorded. Particles cannot be
+         * added once a recording has been opened.
+         */
+        void addParticle(const Particle *particle);
+
+        /**
+         * Creates the given file and starts a recording in it.
+         *
+         * @param filename The file to record into.
+         *
+         * @param encoding The encoding to use for the frames.
+         *
+         * @param keyframeInterval For delta encoding, the number of
+         * frames between each full precision keyframe.
+         *
+         * @param precision For delta encoding, the size of the step
+         * positions are quantised to. An object that moves more than
+         * 32767 steps from its position at the last keyframe causes
+         * an extra keyframe to be written.
+         *
+         * @return False if the file could not be created.
+         */
+        bool open(const char *filename,
+            RecordingEncoding encoding = RECORD_RAW,
+            unsigned keyframeInterval = 30,
+            real precision = (real)0.0001);
+
+        /**
+         * Appends a frame with the current state of every registered
+         * object. Returns false if the file could not be grown.
+         */
+        bool recordFrame();
+
+        /**
+         * Finishes the recording, writing the keyframe index after
+         * the frames, trimming the file to them and closing it.
+         */
+        void close();
+
+        /**
+         * Returns the number of frames recorded so far.
+         */
+        unsigned getFrameCount() const
+        {
+            return header.frameCount;
+        }
+
+        /**
+         * Returns the number of keyframes that were written early
+         * because an object had moved outside the range of a delta
+         * frame. If this is high, a coarser precision or a shorter
+         * keyframe interval will make a smaller recording.
+         */
+        unsigned getExtraKeyframeCount() const
+        {
+            return extraKeyframeCount;
+        }
+    };
+
+    /**
+     * Reads a recording made by a TrajectoryRecorder. Any frame can
+     * be read directly: a raw frame is read from its fixed offset,
+     * and a delta frame is read by combining it with its keyframe,
+     * whose offset is looked up in the index at the end of the file.
+     * Opening a recording reads only its header and index, however
+     * long it is.
+     *
+     * A delta recording that was never closed, such as one left by a
+     * program that crashed, has no index. Its frames' tags are then
+     * read the first time a frame after them is asked for, and the
+     * keyframes found are kept. Reading such a recording changes the
+     * reader, so one reader can't be shared between threads.
+     */
+    class TrajectoryReader
+    {
+    protected:
+        /** Holds the recording file. */
+        MappedFile file;
+
+        /** Holds a copy of the header of the recording. */
+        RecordingHeader header;
+
+        /**
+         * For delta encoding, holds the keyframes in frame order,
+         * either read from the index or found so far by reading the
+         * frames' tags.
+         */
+        mutable std::vector<RecordingKeyframe> keyframes;
+
+        /**
+         * Holds the number of frames whose offsets are known. This is
+         * every frame in a recording with an index.
+         */
+        mutable unsigned knownFrameCount;
+
+        /** Holds the byte offset of the first frame not yet known. */
+        mutable size_t scanOffset;
+
+        /** Holds the byte offset at which the frames end. */
+        size_t framesEnd;
+
+        /**
+         * Reads the tags of the frames in a recording with no index,
+         * until the given frame is known or the frames run out.
+         */
+        void scanFrames(unsigned frame) const;
+
+    public:
+        TrajectoryReader();
+
+        /**
+         * Opens the given recording. Returns false if the file does
+         * not exist or is not a recording made by this build.
+         */
+        bool open(const char *filename);
+
+        /**
+         * Closes the recording.
+         */
+        void close();
+
+        /**
+         * Returns the number of frames in the recording. For a
+         * recording that was never closed, this is the count last
+         * written, and frames that turn out to be missing from the
+         * file can't be read.
+         */
+        unsigned getFrameCount() const
+        {
+            return header.frameCount;
+        }
+
+        /** Returns the number of bodies in each frame. */
+        unsigned getBodyCount() const
+        {
+            return header.bodyCount;
+        }
+
+        /** Returns the number of particles in each frame. */
+        unsigned getParticleCount() const
+        {
+            return header.particleCount;
+        }
+
+        /**
+         * Reads the given frame of the recording. Any of the output
+         * arrays may be NULL if that data is not wanted; otherwise
+         * they must have room for every body or particle.
+         *
+         * @return False if the frame is not in the recording.
+         */
+        bool readFrame(unsigned frame,
+            Vector3 *bodyPositions,
+            Quaternion *bodyOrientations,
+            Vector3 *particlePositions) const;
+    };
+
+} // namespace cyclone
+
+#endif // CYCLONE_RECORDER_H
@@ -0,0 +1,1386 @@
+/*
+ * Interface file for the vector instructions used by the core.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file holds the arithmetic at the heart of the core's vector,
+ * matrix and quaternion types, written once for each instruction set
+ * Cyclone can use. The instruction set is chosen when Cyclone is
+ * compiled, from what the compiler has been told the processor
+ * supports:
+ *
+ * - CYCLONE_SIMD_AVX2 uses 256 bit registers, holding a whole vector
+ *   or quaternion at double precision.
+ *
+ * - CYCLONE_SIMD_SSE41 adds the SSE4.1 dot product instructions to
+ *   SSE2.
+ *
+ * - CYCLONE_SIMD_SSE2 uses 128 bit registers, which every x64
+ *   processor has.
+ *
+ * - CYCLONE_SIMD_SCALAR uses plain C++, for any other processor.
+ *
+ * Any of these can be defined before this file is included to choose
+ * a backend by hand, as long as the processor supports it. Each
+ * backend also defines the names of those below it. The name of the
+ * chosen backend is given by CYCLONE_SIMD_NAME.
+ *
+ * The functions here work on vectors held as four numbers, the
+ * fourth of which is Vector3T's padding, and which they may read and
+ * must leave zero. Each is a template written in plain C++, which
+ * works for any number type, with overloads for float and double that
+ * use the chosen instruction set. Backends can round floating point
+ * results differently in the last place, so simulations that must
+ * match bit for bit, such as peers comparing checksums, should use the
+ * same backend, or fixed point numbers, whose results are the same
+ * with every backend.
+ */
+#ifndef CYCLONE_SIMD_H
+#define CYCLONE_SIMD_H
+
+#include "precision.h"
+
+#if !defined(CYCLONE_SIMD_AVX2) && !defined(CYCLONE_SIMD_SSE41) && \
+    !defined(CYCLONE_SIMD_SSE2) && !defined(CYCLONE_SIMD_SCALAR)
+    #if defined(__AVX2__)
+        #define CYCLONE_SIMD_AVX2
+    #elif defined(__SSE4_1__)
+        #define CYCLONE_SIMD_SSE41
+    #elif defined(__SSE2__) || defined(_M_X64) || \
+        (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        #define CYCLONE_SIMD_SSE2
+    #else
+        #define CYCLONE_SIMD_SCALAR
+    #endif
+#endif
+
+#if defined(CYCLONE_SIMD_AVX2)
+    #define CYCLONE_SIMD_NAME "AVX2"
+    #ifndef CYCLONE_SIMD_SSE41
+        #define CYCLONE_SIMD_SSE41
+    #endif
+    #include <immintrin.h>
+#elif defined(CYCLONE_SIMD_SSE41)
+    #define CYCLONE_SIMD_NAME "SSE4.1"
+#elif defined(CYCLONE_SIMD_SSE2)
+    #define CYCLONE_SIMD_NAME "SSE2"
+#else
+    #define CYCLONE_SIMD_NAME "scalar"
+#endif
+
+#if defined(CYCLONE_SIMD_SSE41)
+    #ifndef CYCLONE_SIMD_SSE2
+        #define CYCLONE_SIMD_SSE2
+    #endif
+    #include <smmintrin.h>
+#endif
+
+#if defined(CYCLONE_SIMD_SSE2)
+    #include <emmintrin.h>
+#endif
+
+namespace cyclone {
+
+    /**
+     * Returns the scalar product of two vectors.
+     */
+    template <typename Real>
+    inline Real simdDot(const Real *a, const Real *b)
+    {
+        return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+    }
+
+    /**
+     * Sets out to the vector product of a and b. The output may not
+     * be either input.
+     */
+    template <typename Real>
+    inline void simdCross(const Real *a, const Real *b, Real *out)
+    {
+        out[0] = a[1]*b[2] - a[2]*b[1];
+        out[1] = a[2]*b[0] - a[0]*b[2];
+        out[2] = a[0]*b[1] - a[1]*b[0];
+        out[3] = 0;
+    }
+
+    /**
+     * Sets out to the vector v transformed by the 3x3 matrix m,
+     * stored by rows. The output may not be the input.
+     */
+    template <typename Real>
+    inline void simdTransform3(const Real *m, const Real *v, Real *out)
+    {
+        out[0] = v[0]*m[0] + v[1]*m[1] + v[2]*m[2];
+        out[1] = v[0]*m[3] + v[1]*m[4] + v[2]*m[5];
+        out[2] = v[0]*m[6] + v[1]*m[7] + v[2]*m[8];
+        out[3] = 0;
+    }
+
+    /**
+     * Sets out to the vector v transformed by the transpose of the
+     * 3x3 matrix m, stored by rows. The output may not be the input.
+     */
+    template <typename Real>
+    inline void simdTransformTranspose3(const Real *m, const Real *v,
+                                        Real *out)
+    {
+        out[0] = v[0]*m[0] + v[1]*m[3] + v[2]*m[6];
+        out[1] = v[0]*m[1] + v[1]*m[4] + v[2]*m[7];
+        out[2] = v[0]*m[2] + v[1]*m[5] + v[2]*m[8];
+        out[3] = 0;
+    }
+
+    /**
+     * Sets out to the point v transformed by the 3x4 matrix m,
+     * stored by rows with the translation in the last column. The
+     * output may not be the input.
+     */
+    template <typename Real>
+    inline void simdTransform4(const Real *m, const Real *v, Real *out)
+    {
+        out[0] = v[0]*m[0] + v[1]*m[1] + v[2]*m[2] + m[3];
+        out[1] = v[0]*m[4] + v[1]*m[5] + v[2]*m[6] + m[7];
+        out[2] = v[0]*m[8] + v[1]*m[9] + v[2]*m[10] + m[11];
+        out[3] = 0;
+    }
+
+    /**
+     * Sets out to the product of the quaternions a and b, each held
+     * as the real component followed by the three imaginary ones.
+     * The output may be either input.
+     */
+    template <typename Real>
+    inline void simdQuaternionMultiply(const Real *a, const Real *b,
+                                       Real *out)
+    {
+        Real r = a[0]*b[0] - a[1]*b[1] - a[2]*b[2] - a[3]*b[3];
+        Real i = a[0]*b[1] + a[1]*b[0] + a[2]*b[3] - a[3]*b[2];
+        Real j = a[0]*b[2] + a[2]*b[0] + a[3]*b[1] - a[1]*b[3];
+        Real k = a[0]*b[3] + a[3]*b[0] + a[1]*b[2] - a[2]*b[1];
+        out[0] = r;
+        out[1] = i;
+        out[2] = j;
+        out[3] = k;
+    }
+
+    /**
+     * Checks four rays, held one in each lane of the given arrays,
+     * against a sphere. Each ray starts at its origin, runs along its
+     * unit direction for its length, and passes through the sphere if
+     * any part of it is inside. Returns a mask with bit i set if ray
+     * i passes through.
+     */
+    template <typename Real>
+    inline unsigned simdRaysAndSphere(const Real *originX,
+        const Real *originY, const Real *originZ,
+        const Real *directionX, const Real *directionY,
+        const Real *directionZ, const Real *length,
+        const Real *centre, Real radius)
+    {
+        Real radiusSquared = radius*radius;
+        unsigned mask = 0;
+        for (unsigned i = 0; i < 4; i++)
+        {
+            Real x = centre[0] - originX[i];
+            Real y = centre[1] - originY[i];
+            Real z = centre[2] - originZ[i];
+            Real along = x*directionX[i] + y*directionY[i] + z*directionZ[i];
+            Real distanceSquared = x*x + y*y + z*z;
+            Real offSquared = distanceSquared - along*along;
+            Real beyond = along - length[i];
+            if (distanceSquared <= radiusSquared ||
+                (along >= 0 && offSquared <= radiusSquared &&
+                 (beyond <= 0 ||
+                  beyond*beyond <= radiusSquared - offSquared)))
+            {
+                mask |= 1u << i;
+            }
+        }
+        return mask;
+    }
+
+    /**
+     * Checks four rays, held one in each lane of the given arrays,
+     * against an axis aligned box with the given lowest and highest
+     * corners. The rays are given by their origins, the inverses of
+     * the components of their directions, and their lengths. A
+     * direction with a zero component should have a very large
+     * inverse with the same sign instead. Returns a mask with bit i
+     * set if ray i passes through the box.
+     */
+    template <typename Real>
+    inline unsigned simdRaysAndBox(const Real *originX,
+        const Real *originY, const Real *originZ,
+        const Real *inverseX, const Real *inverseY,
+        const Real *inverseZ, const Real *length,
+        const Real *low, const Real *high)
+    {
+        const Real *origins[3] = { originX, originY, originZ };
+        const Real *inverses[3] = { inverseX, inverseY, inverseZ };
+        unsigned mask = 0;
+        for (unsigned i = 0; i < 4; i++)
+        {
+            Real enter = 0;
+            Real leave = length[i];
+            for (unsigned j = 0; j < 3; j++)
+            {
+                Real one = (low[j] - origins[j][i]) * inverses[j][i];
+                Real two = (high[j] - origins[j][i]) * inverses[j][i];
+                if (one > two)
+                {
+                    Real swap = one;
+                    one = two;
+                    two = swap;
+                }
+                if (one > enter) enter = one;
+                if (two < leave) leave = two;
+            }
+            if (enter <= leave) mask |= 1u << i;
+        }
+        return mask;
+    }
+
+    /**
+     * Sets each of count forces to the weight, in the given gravity,
+     * of a body with the matching inverse mass. A body with an
+     * inverse mass of zero cannot be moved, and is given no weight.
+     * The forces are vectors held one after another, four numbers
+     * each.
+     */
+    template <typename Real>
+    inline void simdGravity(const Real *gravity, const Real *inverseMasses,
+                            Real *forces, unsigned count)
+    {
+        for (unsigned i = 0; i < count; i++, forces += 4)
+        {
+            Real mass = 0;
+            if (inverseMasses[i] > 0) mass = ((Real)1) / inverseMasses[i];
+            forces[0] = gravity[0] * mass;
+            forces[1] = gravity[1] * mass;
+            forces[2] = gravity[2] * mass;
+            forces[3] = 0;
+        }
+    }
+
+    /**
+     * Sets each of count forces to the drag on a body moving with the
+     * matching velocity, for the drag coefficients k1, which scales
+     * with speed, and k2, which scales with its square. The velocities
+     * and forces are vectors held one after another, four numbers
+     * each.
+     */
+    template <typename Real>
+    inline void simdDrag(const Real *velocities, Real k1, Real k2,
+                         Real *forces, unsigned count)
+    {
+        for (unsigned i = 0; i < count; i++, velocities += 4, forces += 4)
+        {
+            const Real *v = velocities;
+            Real speed = Scalar<Real>::sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+
+            // The drag is the unit velocity times -(k1*speed +
+            // k2*speed*speed), which is the velocity times this.
+            Real scale = -(k1 + k2*speed);
+            forces[0] = v[0] * scale;
+            forces[1] = v[1] * scale;
+            forces[2] = v[2] * scale;
+            forces[3] = 0;
+        }
+    }
+
+    /**
+     * Sets out to the blend of the eight vectors at the corners of a
+     * grid cell, at the fractions fx, fy and fz across it. The first
+     * corner is at v, and the steps to the next corner along each
+     * axis are dx, dy and dz, counted in vectors. The blend is along
+     * x, then y, then z.
+     */
+    template <typename Real>
+    inline void simdTrilinear(const Real *v, unsigned dx, unsigned dy,
+                              unsigned dz, Real fx, Real fy, Real fz,
+                              Real *out)
+    {
+        dx *= 4;
+        dy *= 4;
+        dz *= 4;
+        for (unsigned i = 0; i < 3; i++)
+        {
+            const Real *c = v + i;
+            Real x00 = c[0] + (c[dx] - c[0]) * fx;
+            Real x10 = c[dy] + (c[dy+dx] - c[dy]) * fx;
+            Real x01 = c[dz] + (c[dz+dx] - c[dz]) * fx;
+            Real x11 = c[dz+dy] + (c[dz+dy+dx] - c[dz+dy]) * fx;
+            Real y0 = x00 + (x10 - x00) * fy;
+            Real y1 = x01 + (x11 - x01) * fy;
+            out[i] = y0 + (y1 - y0) * fz;
+        }
+        out[3] = 0;
+    }
+
+#if defined(CYCLONE_SIMD_SSE2)
+
+    /**
+     * Internal function that loads the first three reals of a
+     * vector, with zero in the fourth.
+     */
+    inline __m128 _simdLoad3(const float *v)
+    {
+        return _mm_movelh_ps(
+            _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)v),
+            _mm_load_ss(v + 2));
+    }
+
+    /**
+     * Internal function that sets the fourth real of a vector to
+     * zero.
+     */
+    inline __m128 _simdMask3(__m128 v)
+    {
+        return _mm_and_ps(v, _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1)));
+    }
+
+    /**
+     * Internal function that returns the sum of the two halves of a
+     * register in its lower half.
+     */
+    inline __m128d _simdSumPair(__m128d a, __m128d b)
+    {
+    #if defined(CYCLONE_SIMD_SSE41)
+        return _mm_dp_pd(a, b, 0x31);
+    #else
+        __m128d product = _mm_mul_pd(a, b);
+        return _mm_add_sd(product, _mm_unpackhi_pd(product, product));
+    #endif
+    }
+
+#if defined(CYCLONE_SIMD_AVX2)
+
+    /**
+     * Internal function that loads the first three reals of a
+     * vector, with zero in the fourth, without reading the fourth.
+     */
+    inline __m256d _simdLoad3(const double *v)
+    {
+        return _mm256_maskload_pd(v, _mm256_set_epi64x(0, -1, -1, -1));
+    }
+
+    /**
+     * Internal function that sets the fourth real of a vector to
+     * zero.
+     */
+    inline __m256d _simdMask3(__m256d v)
+    {
+        return _mm256_blend_pd(v, _mm256_setzero_pd(), 8);
+    }
+
+#endif
+
+    /**
+     * The single precision version of simdDot.
+     */
+    inline float simdDot(const float *a, const float *b)
+    {
+    #if defined(CYCLONE_SIMD_SSE41)
+        return _mm_cvtss_f32(_mm_dp_ps(_mm_loadu_ps(a), _mm_loadu_ps(b), 0x71));
+    #else
+        __m128 product = _mm_mul_ps(_mm_loadu_ps(a), _mm_loadu_ps(b));
+        __m128 sum = _mm_add_ss(product,
+            _mm_shuffle_ps(product, product, _MM_SHUFFLE(1, 1, 1, 1)));
+        return _mm_cvtss_f32(_mm_add_ss(sum, _mm_movehl_ps(product, product)));
+    #endif
+    }
+
+    /**
+     * The double precision version of simdDot.
+     */
+    inline double simdDot(const double *a, const double *b)
+    {
+        // A whole vector only fills half of a 256 bit register, so
+        // this is as quick with AVX2.
+        __m128d sum = _simdSumPair(_mm_loadu_pd(a), _mm_loadu_pd(b));
+        return _mm_cvtsd_f64(_mm_add_sd(sum,
+            _mm_mul_sd(_mm_load_sd(a + 2), _mm_load_sd(b + 2))));
+    }
+
+    /**
+     * The single precision version of simdCross.
+     */
+    inline void simdCross(const float *a, const float *b, float *out)
+    {
+        __m128 va = _mm_loadu_ps(a);
+        __m128 vb = _mm_loadu_ps(b);
+        __m128 result = _mm_sub_ps(
+            _mm_mul_ps(_mm_shuffle_ps(va, va, _MM_SHUFFLE(3, 0, 2, 1)),
+                       _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 1, 0, 2))),
+            _mm_mul_ps(_mm_shuffle_ps(va, va, _MM_SHUFFLE(3, 1, 0, 2)),
+                       _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 0, 2, 1))));
+        _mm_storeu_ps(out, _simdMask3(result));
+    }
+
+    /**
+     * The double precision version of simdCross.
+     */
+    inline void simdCross(const double *a, const double *b, double *out)
+    {
+    #if defined(CYCLONE_SIMD_AVX2)
+        __m256d va = _mm256_loadu_pd(a);
+        __m256d vb = _mm256_loadu_pd(b);
+        __m256d result = _mm256_sub_pd(
+            _mm256_mul_pd(_mm256_permute4x64_pd(va, _MM_SHUFFLE(3, 0, 2, 1)),
+                          _mm256_permute4x64_pd(vb, _MM_SHUFFLE(3, 1, 0, 2))),
+            _mm256_mul_pd(_mm256_permute4x64_pd(va, _MM_SHUFFLE(3, 1, 0, 2)),
+                          _mm256_permute4x64_pd(vb, _MM_SHUFFLE(3, 0, 2, 1))));
+        _mm256_storeu_pd(out, _simdMask3(result));
+    #else
+        __m128d a0 = _mm_load_sd(a);
+        __m128d a2 = _mm_load_sd(a + 2);
+        __m128d b0 = _mm_load_sd(b);
+        __m128d b2 = _mm_load_sd(b + 2);
+        __m128d xy = _mm_sub_pd(
+            _mm_mul_pd(_mm_loadu_pd(a + 1), _mm_unpacklo_pd(b2, b0)),
+            _mm_mul_pd(_mm_unpacklo_pd(a2, a0), _mm_loadu_pd(b + 1)));
+        __m128d z = _mm_sub_sd(
+            _mm_mul_sd(a0, _mm_load_sd(b + 1)),
+            _mm_mul_sd(_mm_load_sd(a + 1), b0));
+        _mm_storeu_pd(out, xy);
+        _mm_storeu_pd(out + 2, z);
+    #endif
+    }
+
+    /**
+     * The single precision version of simdTransform3.
+     */
+    inline void simdTransform3(const float *m, const float *v, float *out)
+    {
+    #if defined(CYCLONE_SIMD_SSE41)
+        __m128 vector = _mm_loadu_ps(v);
+        __m128 result = _mm_or_ps(
+            _mm_or_ps(_mm_dp_ps(_mm_loadu_ps(m), vector, 0x71),
+                      _mm_dp_ps(_mm_loadu_ps(m + 3), vector, 0x72)),
+            _mm_dp_ps(_simdLoad3(m + 6), vector, 0x74));
+        _mm_storeu_ps(out, result);
+    #else
+        __m128 row0 = _mm_loadu_ps(m);
+        __m128 row1 = _mm_loadu_ps(m + 3);
+        __m128 row2 = _simdLoad3(m + 6);
+        __m128 row3 = _mm_setzero_ps();
+        _MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+        __m128 vector = _mm_loadu_ps(v);
+        __m128 result = _mm_add_ps(
+            _mm_add_ps(
+                _mm_mul_ps(row0, _mm_shuffle_ps(vector, vector, 0x00)),
+                _mm_mul_ps(row1, _mm_shuffle_ps(vector, vector, 0x55))),
+            _mm_mul_ps(row2, _mm_shuffle_ps(vector, vector, 0xaa)));
+        _mm_storeu_ps(out, result);
+    #endif
+    }
+
+    /**
+     * The double precision version of simdTransform3.
+     */
+    inline void simdTransform3(const double *m, const double *v, double *out)
+    {
+    #if defined(CYCLONE_SIMD_AVX2)
+        __m256d vector = _simdLoad3(v);
+        __m256d product0 = _mm256_mul_pd(_mm256_loadu_pd(m), vector);
+        __m256d product1 = _mm256_mul_pd(_mm256_loadu_pd(m + 3), vector);
+        __m256d product2 = _mm256_mul_pd(_simdLoad3(m + 6), vector);
+
+        // Pair up the first two products of each row, and the third.
+        __m256d pairs01 = _mm256_hadd_pd(product0, product1);
+        __m256d pairs2 = _mm256_hadd_pd(product2, product2);
+        __m256d result = _mm256_add_pd(
+            _mm256_permute2f128_pd(pairs01, pairs2, 0x20),
+            _mm256_permute2f128_pd(pairs01, pairs2, 0x31));
+        _mm256_storeu_pd(out, _simdMask3(result));
+    #else
+        __m128d xy = _mm_loadu_pd(v);
+        __m128d z = _mm_load_sd(v + 2);
+        for (unsigned i = 0; i < 3; i++)
+        {
+            __m128d sum = _simdSumPair(_mm_loadu_pd(m + i*3), xy);
+            sum = _mm_add_sd(sum, _mm_mul_sd(_mm_load_sd(m + i*3 + 2), z));
+            _mm_store_sd(out + i, sum);
+        }
+        out[3] = 0;
+    #endif
+    }
+
+    /**
+     * The single precision version of simdTransformTranspose3.
+     */
+    inline void simdTransformTranspose3(const float *m, const float *v,
+                                        float *out)
+    {
+        __m128 vector = _mm_loadu_ps(v);
+        __m128 result = _mm_add_ps(
+            _mm_add_ps(
+                _mm_mul_ps(_mm_loadu_ps(m), _mm_shuffle_ps(vector, vector, 0x00)),
+                _mm_mul_ps(_mm_loadu_ps(m + 3), _mm_shuffle_ps(vector, vector, 0x55))),
+            _mm_mul_ps(_simdLoad3(m + 6), _mm_shuffle_ps(vector, vector, 0xaa)));
+        _mm_storeu_ps(out, _simdMask3(result));
+    }
+
+    /**
+     * The double precision version of simdTransformTranspose3.
+     */
+    inline void simdTransformTranspose3(const double *m, const double *v,
+                                        double *out)
+    {
+    #if defined(CYCLONE_SIMD_AVX2)
+        __m256d result = _mm256_add_pd(
+            _mm256_add_pd(
+                _mm256_mul_pd(_mm256_loadu_pd(m), _mm256_broadcast_sd(v)),
+                _mm256_mul_pd(_mm256_loadu_pd(m + 3), _mm256_broadcast_sd(v + 1))),
+            _mm256_mul_pd(_simdLoad3(m + 6), _mm256_broadcast_sd(v + 2)));
+        _mm256_storeu_pd(out, _simdMask3(result));
+    #else
+        __m128d x = _mm_load1_pd(v);
+        __m128d y = _mm_load1_pd(v + 1);
+        __m128d z = _mm_load1_pd(v + 2);
+        __m128d xy = _mm_add_pd(
+            _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(m), x),
+                       _mm_mul_pd(_mm_loadu_pd(m + 3), y)),
+            _mm_mul_pd(_mm_loadu_pd(m + 6), z));
+        __m128d last = _mm_add_sd(
+            _mm_add_sd(_mm_mul_sd(_mm_load_sd(m + 2), x),
+                       _mm_mul_sd(_mm_load_sd(m + 5), y)),
+            _mm_mul_sd(_mm_load_sd(m + 8), z));
+        _mm_storeu_pd(out, xy);
+        _mm_storeu_pd(out + 2, _mm_move_sd(_mm_setzero_pd(), last));
+    #endif
+    }
+
+    /**
+     * The single precision version of simdTransform4.
+     */
+    inline void simdTransform4(const float *m, const float *v, float *out)
+    {
+        __m128 column0 = _mm_loadu_ps(m);
+        __m128 column1 = _mm_loadu_ps(m + 4);
+        __m128 column2 = _mm_loadu_ps(m + 8);
+        __m128 column3 = _mm_setzero_ps();
+        _MM_TRANSPOSE4_PS(column0, column1, column2, column3);
+        __m128 vector = _mm_loadu_ps(v);
+        __m128 result = _mm_add_ps(
+            _mm_add_ps(
+                _mm_add_ps(
+                    _mm_mul_ps(column0, _mm_shuffle_ps(vector, vector, 0x00)),
+                    _mm_mul_ps(column1, _mm_shuffle_ps(vector, vector, 0x55))),
+                _mm_mul_ps(column2, _mm_shuffle_ps(vector, vector, 0xaa))),
+            column3);
+        _mm_storeu_ps(out, result);
+    }
+
+    /**
+     * The double precision version of simdTransform4.
+     */
+    inline void simdTransform4(const double *m, const double *v, double *out)
+    {
+    #if defined(CYCLONE_SIMD_AVX2)
+        // Transpose the rows into columns, with zero in the fourth
+        // row, and add up the columns scaled by the point.
+        __m256d row0 = _mm256_loadu_pd(m);
+        __m256d row1 = _mm256_loadu_pd(m + 4);
+        __m256d row2 = _mm256_loadu_pd(m + 8);
+        __m256d zero = _mm256_setzero_pd();
+        __m256d low01 = _mm256_unpacklo_pd(row0, row1);
+        __m256d high01 = _mm256_unpackhi_pd(row0, row1);
+        __m256d low2 = _mm256_unpacklo_pd(row2, zero);
+        __m256d high2 = _mm256_unpackhi_pd(row2, zero);
+        __m256d result = _mm256_add_pd(
+            _mm256_add_pd(
+                _mm256_add_pd(
+                    _mm256_mul_pd(_mm256_permute2f128_pd(low01, low2, 0x20),
+                                  _mm256_broadcast_sd(v)),
+                    _mm256_mul_pd(_mm256_permute2f128_pd(high01, high2, 0x20),
+                                  _mm256_broadcast_sd(v + 1))),
+                _mm256_mul_pd(_mm256_permute2f128_pd(low01, low2, 0x31),
+                              _mm256_broadcast_sd(v + 2))),
+            _mm256_permute2f128_pd(high01, high2, 0x31));
+        _mm256_storeu_pd(out, result);
+    #else
+        __m128d xy = _mm_loadu_pd(v);
+        __m128d z = _mm_load_sd(v + 2);
+        for (unsigned i = 0; i < 3; i++)
+        {
+            __m128d sum = _simdSumPair(_mm_loadu_pd(m + i*4), xy);
+            sum = _mm_add_sd(sum, _mm_mul_sd(_mm_load_sd(m + i*4 + 2), z));
+            sum = _mm_add_sd(sum, _mm_load_sd(m + i*4 + 3));
+            _mm_store_sd(out + i, sum);
+        }
+        out[3] = 0;
+    #endif
+    }
+
+    /**
+     * The single precision version of simdQuaternionMultiply.
+     */
+    inline void simdQuaternionMultiply(const float *a, const float *b,
+                                       float *out)
+    {
+        // Each component of the product is the real part of a times
+        // b, plus each imaginary part of a times b reordered, with
+        // some signs flipped.
+        __m128 qa = _mm_loadu_ps(a);
+        __m128 qb = _mm_loadu_ps(b);
+        __m128 sign1 = _mm_castsi128_ps(
+            _mm_set_epi32(0, (int)0x80000000, 0, (int)0x80000000));
+        __m128 sign2 = _mm_castsi128_ps(
+            _mm_set_epi32((int)0x80000000, 0, 0, (int)0x80000000));
+        __m128 sign3 = _mm_castsi128_ps(
+            _mm_set_epi32(0, 0, (int)0x80000000, (int)0x80000000));
+        __m128 result = _mm_mul_ps(_mm_shuffle_ps(qa, qa, 0x00), qb);
+        result = _mm_add_ps(result, _mm_mul_ps(
+            _mm_shuffle_ps(qa, qa, 0x55),
+            _mm_xor_ps(_mm_shuffle_ps(qb, qb, _MM_SHUFFLE(2, 3, 0, 1)), sign1)));
+        result = _mm_add_ps(result, _mm_mul_ps(
+            _mm_shuffle_ps(qa, qa, 0xaa),
+            _mm_xor_ps(_mm_shuffle_ps(qb, qb, _MM_SHUFFLE(1, 0, 3, 2)), sign2)));
+        result = _mm_add_ps(result, _mm_mul_ps(
+            _mm_shuffle_ps(qa, qa, 0xff),
+            _mm_xor_ps(_mm_shuffle_ps(qb, qb, _MM_SHUFFLE(0, 1, 2, 3)), sign3)));
+        _mm_storeu_ps(out, result);
+    }
+
+    /**
+     * The double precision version of simdQuaternionMultiply.
+     */
+    inline void simdQuaternionMultiply(const double *a, const double *b,
+                                       double *out)
+    {
+        // Each component of the product is the real part of a times
+        // b, plus each imaginary part of a times b reordered, with
+        // some signs flipped.
+    #if defined(CYCLONE_SIMD_AVX2)
+        __m256d qb = _mm256_loadu_pd(b);
+        __m256d sign1 = _mm256_set_pd(0.0, -0.0, 0.0, -0.0);
+        __m256d sign2 = _mm256_set_pd(-0.0, 0.0, 0.0, -0.0);
+        __m256d sign3 = _mm256_set_pd(0.0, 0.0, -0.0, -0.0);
+        __m256d result = _mm256_mul_pd(_mm256_broadcast_sd(a), qb);
+        result = _mm256_add_pd(result, _mm256_mul_pd(
+            _mm256_broadcast_sd(a + 1),
+            _mm256_xor_pd(_mm256_permute4x64_pd(qb, _MM_SHUFFLE(2, 3, 0, 1)),
+                          sign1)));
+        result = _mm256_add_pd(result, _mm256_mul_pd(
+            _mm256_broadcast_sd(a + 2),
+            _mm256_xor_pd(_mm256_permute4x64_pd(qb, _MM_SHUFFLE(1, 0, 3, 2)),
+                          sign2)));
+        result = _mm256_add_pd(result, _mm256_mul_pd(
+            _mm256_broadcast_sd(a + 3),
+            _mm256_xor_pd(_mm256_permute4x64_pd(qb, _MM_SHUFFLE(0, 1, 2, 3)),
+                          sign3)));
+        _mm256_storeu_pd(out, result);
+    #else
+        __m128d low = _mm_loadu_pd(b);
+        __m128d high = _mm_loadu_pd(b + 2);
+        __m128d lowSwapped = _mm_shuffle_pd(low, low, 1);
+        __m128d highSwapped = _mm_shuffle_pd(high, high, 1);
+        __m128d minusPlus = _mm_set_pd(0.0, -0.0);
+        __m128d plusMinus = _mm_set_pd(-0.0, 0.0);
+        __m128d minusMinus = _mm_set1_pd(-0.0);
+
+        __m128d scale = _mm_load1_pd(a);
+        __m128d resultLow = _mm_mul_pd(scale, low);
+        __m128d resultHigh = _mm_mul_pd(scale, high);
+
+        scale = _mm_load1_pd(a + 1);
+        resultLow = _mm_add_pd(resultLow,
+            _mm_mul_pd(scale, _mm_xor_pd(lowSwapped, minusPlus)));
+        resultHigh = _mm_add_pd(resultHigh,
+            _mm_mul_pd(scale, _mm_xor_pd(highSwapped, minusPlus)));
+
+        scale = _mm_load1_pd(a + 2);
+        resultLow = _mm_add_pd(resultLow,
+            _mm_mul_pd(scale, _mm_xor_pd(high, minusPlus)));
+        resultHigh = _mm_add_pd(resultHigh,
+            _mm_mul_pd(scale, _mm_xor_pd(low, plusMinus)));
+
+        scale = _mm_load1_pd(a + 3);
+        resultLow = _mm_add_pd(resultLow,
+            _mm_mul_pd(scale, _mm_xor_pd(highSwapped, minusMinus)));
+        resultHigh = _mm_add_pd(resultHigh,
+            _mm_mul_pd(scale, lowSwapped));
+
+        _mm_storeu_pd(out, resultLow);
+        _mm_storeu_pd(out + 2, resultHigh);
+    #endif
+    }
+
+    /*
+     * The rays pass through the sphere if their origins are inside
+     * it, or if the sphere is ahead of them, their lines pass within
+     * its radius, and the point on each line nearest its centre is
+     * either within the ray's length or close enough to the end that
+     * the end is inside. Each test is done on every lane at once, and
+     * the results are combined into the mask.
+     */
+
+    /**
+     * The single precision version of simdRaysAndSphere.
+     */
+    inline unsigned simdRaysAndSphere(const float *originX,
+        const float *originY, const float *originZ,
+        const float *directionX, const float *directionY,
+        const float *directionZ, const float *length,
+        const float *centre, float radius)
+    {
+        __m128 x = _mm_sub_ps(_mm_set1_ps(centre[0]), _mm_loadu_ps(originX));
+        __m128 y = _mm_sub_ps(_mm_set1_ps(centre[1]), _mm_loadu_ps(originY));
+        __m128 z = _mm_sub_ps(_mm_set1_ps(centre[2]), _mm_loadu_ps(originZ));
+        __m128 along = _mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(x, _mm_loadu_ps(directionX)),
+            _mm_mul_ps(y, _mm_loadu_ps(directionY))),
+            _mm_mul_ps(z, _mm_loadu_ps(directionZ)));
+        __m128 distanceSquared = _mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+        __m128 radiusSquared = _mm_set1_ps(radius*radius);
+        __m128 offSquared = _mm_sub_ps(distanceSquared, _mm_mul_ps(along, along));
+        __m128 beyond = _mm_sub_ps(along, _mm_loadu_ps(length));
+        __m128 zero = _mm_setzero_ps();
+
+        __m128 within = _mm_or_ps(_mm_cmple_ps(beyond, zero),
+            _mm_cmple_ps(_mm_mul_ps(beyond, beyond),
+                         _mm_sub_ps(radiusSquared, offSquared)));
+        __m128 passes = _mm_and_ps(_mm_and_ps(
+            _mm_cmpge_ps(along, zero),
+            _mm_cmple_ps(offSquared, radiusSquared)), within);
+        passes = _mm_or_ps(passes, _mm_cmple_ps(distanceSquared, radiusSquared));
+        return (unsigned)_mm_movemask_ps(passes);
+    }
+
+    /**
+     * The double precision version of simdRaysAndSphere.
+     */
+    inline unsigned simdRaysAndSphere(const double *originX,
+        const double *originY, const double *originZ,
+        const double *directionX, const double *directionY,
+        const double *directionZ, const double *length,
+        const double *centre, double radius)
+    {
+    #if defined(CYCLONE_SIMD_AVX2)
+        __m256d x = _mm256_sub_pd(_mm256_broadcast_sd(centre),
+                                  _mm256_loadu_pd(originX));
+        __m256d y = _mm256_sub_pd(_mm256_broadcast_sd(centre + 1),
+                                  _mm256_loadu_pd(originY));
+        __m256d z = _mm256_sub_pd(_mm256_broadcast_sd(centre + 2),
+                                  _mm256_loadu_pd(originZ));
+        __m256d along = _mm256_add_pd(_mm256_add_pd(
+            _mm256_mul_pd(x, _mm256_loadu_pd(directionX)),
+            _mm256_mul_pd(y, _mm256_loadu_pd(directionY))),
+            _mm256_mul_pd(z, _mm256_loadu_pd(directionZ)));
+        __m256d distanceSquared = _mm256_add_pd(_mm256_add_pd(
+            _mm256_mul_pd(x, x), _mm256_mul_pd(y, y)), _mm256_mul_pd(z, z));
+        __m256d radiusSquared = _mm256_set1_pd(radius*radius);
+        __m256d offSquared = _mm256_sub_pd(distanceSquared,
+                                           _mm256_mul_pd(along, along));
+        __m256d beyond = _mm256_sub_pd(along, _mm256_loadu_pd(length));
+        __m256d zero = _mm256_setzero_pd();
+
+        __m256d within = _mm256_or_pd(
+            _mm256_cmp_pd(beyond, zero, _CMP_LE_OQ),
+            _mm256_cmp_pd(_mm256_mul_pd(beyond, beyond),
+                          _mm256_sub_pd(radiusSquared, offSquared), _CMP_LE_OQ));
+        __m256d passes = _mm256_and_pd(_mm256_and_pd(
+            _mm256_cmp_pd(along, zero, _CMP_GE_OQ),
+            _mm256_cmp_pd(offSquared, radiusSquared, _CMP_LE_OQ)), within);
+        passes = _mm256_or_pd(passes,
+            _mm256_cmp_pd(distanceSquared, radiusSquared, _CMP_LE_OQ));
+        return (unsigned)_mm256_movemask_pd(passes);
+    #else
+        // Two lanes fit in a register, so the rays are done in pairs.
+        __m128d radiusSquared = _mm_set1_pd(radius*radius);
+        __m128d zero = _mm_setzero_pd();
+        unsigned mask = 0;
+        for (unsigned i = 0; i < 4; i += 2)
+        {
+            __m128d x = _mm_sub_pd(_mm_load1_pd(centre),
+                                   _mm_loadu_pd(originX + i));
+            __m128d y = _mm_sub_pd(_mm_load1_pd(centre + 1),
+                                   _mm_loadu_pd(originY + i));
+            __m128d z = _mm_sub_pd(_mm_load1_pd(centre + 2),
+                                   _mm_loadu_pd(originZ + i));
+            __m128d along = _mm_add_pd(_mm_add_pd(
+                _mm_mul_pd(x, _mm_loadu_pd(directionX + i)),
+                _mm_mul_pd(y, _mm_loadu_pd(directionY + i))),
+                _mm_mul_pd(z, _mm_loadu_pd(directionZ + i)));
+            __m128d distanceSquared = _mm_add_pd(_mm_add_pd(
+                _mm_mul_pd(x, x), _mm_mul_pd(y, y)), _mm_mul_pd(z, z));
+            __m128d offSquared = _mm_sub_pd(distanceSquared,
+                                            _mm_mul_pd(along, along));
+            __m128d beyond = _mm_sub_pd(along, _mm_loadu_pd(length + i));
+
+            __m128d within = _mm_or_pd(_mm_cmple_pd(beyond, zero),
+                _mm_cmple_pd(_mm_mul_pd(beyond, beyond),
+                             _mm_sub_pd(radiusSquared, offSquared)));
+            __m128d passes = _mm_and_pd(_mm_and_pd(
+                _mm_cmpge_pd(along, zero),
+                _mm_cmple_pd(offSquared, radiusSquared)), within);
+            passes = _mm_or_pd(passes,
+                _mm_cmple_pd(distanceSquared, radiusSquared));
+            mask |= (unsigned)_mm_movemask_pd(passes) << i;
+        }
+        return mask;
+    #endif
+    }
+
+    /*
+     * The rays are clipped to the slab between each pair of the box's
+     * faces in turn, keeping the latest entry and the earliest exit.
+     * They pass through the box if they enter before they leave.
+     */
+
+    /**
+     * The single precision version of simdRaysAndBox.
+     */
+    inline unsigned simdRaysAndBox(const float *originX,
+        const float *originY, const float *originZ,
+        const float *inverseX, const float *inverseY,
+        const float *inverseZ, const float *length,
+        const float *low, const float *high)
+    {
+        const float *origins[3] = { originX, originY, originZ };
+        const float *inverses[3] = { inverseX, inverseY, inverseZ };
+        __m128 enter = _mm_setzero_ps();
+        __m128 leave = _mm_loadu_ps(length);
+        for (unsigned j = 0; j < 3; j++)
+        {
+            __m128 origin = _mm_loadu_ps(origins[j]);
+            __m128 inverse = _mm_loadu_ps(inverses[j]);
+            __m128 one = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(low[j]), origin),
+                                    inverse);
+            __m128 two = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(high[j]), origin),
+                                    inverse);
+            enter = _mm_max_ps(enter, _mm_min_ps(one, two));
+            leave = _mm_min_ps(leave, _mm_max_ps(one, two));
+        }
+        return (unsigned)_mm_movemask_ps(_mm_cmple_ps(enter, leave));
+    }
+
+    /**
+     * The double precision version of simdRaysAndBox.
+     */
+    inline unsigned simdRaysAndBox(const double *originX,
+        const double *originY, const double *originZ,
+        const double *inverseX, const double *inverseY,
+        const double *inverseZ, const double *length,
+        const double *low, const double *high)
+    {
+        const double *origins[3] = { originX, originY, originZ };
+        const double *inverses[3] = { inverseX, inverseY, inverseZ };
+    #if defined(CYCLONE_SIMD_AVX2)
+        __m256d enter = _mm256_setzero_pd();
+        __m256d leave = _mm256_loadu_pd(length);
+        for (unsigned j = 0; j < 3; j++)
+        {
+            __m256d origin = _mm256_loadu_pd(origins[j]);
+            __m256d inverse = _mm256_loadu_pd(inverses[j]);
+            __m256d one = _mm256_mul_pd(
+                _mm256_sub_pd(_mm256_broadcast_sd(low + j), origin), inverse);
+            __m256d two = _mm256_mul_pd(
+                _mm256_sub_pd(_mm256_broadcast_sd(high + j), origin), inverse);
+            enter = _mm256_max_pd(enter, _mm256_min_pd(one, two));
+            leave = _mm256_min_pd(leave, _mm256_max_pd(one, two));
+        }
+        return (unsigned)_mm256_movemask_pd(
+            _mm256_cmp_pd(enter, leave, _CMP_LE_OQ));
+    #else
+        // Two lanes fit in a register, so the rays are done in pairs.
+        unsigned mask = 0;
+        for (unsigned i = 0; i < 4; i += 2)
+        {
+            __m128d enter = _mm_setzero_pd();
+            __m128d leave = _mm_loadu_pd(length + i);
+            for (unsigned j = 0; j < 3; j++)
+            {
+                __m128d origin = _mm_loadu_pd(origins[j] + i);
+                __m128d inverse = _mm_loadu_pd(inverses[j] + i);
+                __m128d one = _mm_mul_pd(
+                    _mm_sub_pd(_mm_load1_pd(low + j), origin), inverse);
+                __m128d two = _mm_mul_pd(
+                    _mm_sub_pd(_mm_load1_pd(high + j), origin), inverse);
+                enter = _mm_max_pd(enter, _mm_min_pd(one, two));
+                leave = _mm_min_pd(leave, _mm_max_pd(one, two));
+            }
+            mask |= (unsigned)_mm_movemask_pd(_mm_cmple_pd(enter, leave)) << i;
+        }
+        return mask;
+    #endif
+    }
+
+    /*
+     * The batch functions work on four bodies at a time, or two for
+     * double precision without AVX2, finding the scale of each body's
+     * vector in one register before applying it. The bodies left over
+     * are done by the templates.
+     */
+
+    /**
+     * The single precision version of simdGravity.
+     */
+    inline void simdGravity(const float *gravity, const float *inverseMasses,
+                            float *forces, unsigned count)
+    {
+        __m128 weight = _simdLoad3(gravity);
+        __m128 one = _mm_set1_ps(1.0f);
+        unsigned i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 inverse = _mm_loadu_ps(inverseMasses + i);
+            float masses[4];
+            _mm_storeu_ps(masses, _mm_and_ps(_mm_div_ps(one, inverse),
+                _mm_cmpgt_ps(inverse, _mm_setzero_ps())));
+            for (unsigned j = 0; j < 4; j++)
+            {
+                _mm_storeu_ps(forces + 4*(i+j), _simdMask3(
+                    _mm_mul_ps(weight, _mm_set1_ps(masses[j]))));
+            }
+        }
+        simdGravity<float>(gravity, inverseMasses + i, forces + 4*i, count - i);
+    }
+
+    /**
+     * The double precision version of simdGravity.
+     */
+    inline void simdGravity(const double *gravity, const double *inverseMasses,
+                            double *forces, unsigned count)
+    {
+        unsigned i = 0;
+    #if defined(CYCLONE_SIMD_AVX2)
+        __m256d weight = _simdLoad3(gravity);
+        __m256d one = _mm256_set1_pd(1.0);
+        for (; i + 4 <= count; i += 4)
+        {
+            __m256d inverse = _mm256_loadu_pd(inverseMasses + i);
+            double masses[4];
+            _mm256_storeu_pd(masses, _mm256_and_pd(
+                _mm256_div_pd(one, inverse),
+                _mm256_cmp_pd(inverse, _mm256_setzero_pd(), _CMP_GT_OQ)));
+            for (unsigned j = 0; j < 4; j++)
+            {
+                _mm256_storeu_pd(forces + 4*(i+j), _simdMask3(
+                    _mm256_mul_pd(weight, _mm256_broadcast_sd(masses + j))));
+            }
+        }
+    #else
+        __m128d weightXY = _mm_loadu_pd(gravity);
+        __m128d weightZ = _mm_load_sd(gravity + 2);
+        __m128d one = _mm_set1_pd(1.0);
+        for (; i + 2 <= count; i += 2)
+        {
+            __m128d inverse = _mm_loadu_pd(inverseMasses + i);
+            double masses[2];
+            _mm_storeu_pd(masses, _mm_and_pd(_mm_div_pd(one, inverse),
+                _mm_cmpgt_pd(inverse, _mm_setzero_pd())));
+            for (unsigned j = 0; j < 2; j++)
+            {
+                __m128d mass = _mm_load1_pd(masses + j);
+                _mm_storeu_pd(forces + 4*(i+j), _mm_mul_pd(weightXY, mass));
+                _mm_storeu_pd(forces + 4*(i+j) + 2, _mm_mul_sd(weightZ, mass));
+            }
+        }
+    #endif
+        simdGravity<double>(gravity, inverseMasses + i, forces + 4*i,
+                            count - i);
+    }
+
+    /**
+     * The single precision version of simdDrag.
+     */
+    inline void simdDrag(const float *velocities, float k1, float k2,
+                         float *forces, unsigned count)
+    {
+        unsigned i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            const float *v = velocities + 4*i;
+            __m128 v0 = _mm_loadu_ps(v);
+            __m128 v1 = _mm_loadu_ps(v + 4);
+            __m128 v2 = _mm_loadu_ps(v + 8);
+            __m128 v3 = _mm_loadu_ps(v + 12);
+
+            // Turn the four vectors into one register for each axis.
+            __m128 x = v0, y = v1, z = v2, w = v3;
+            _MM_TRANSPOSE4_PS(x, y, z, w);
+            __m128 speed = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+            float scales[4];
+            _mm_storeu_ps(scales, _mm_sub_ps(_mm_setzero_ps(), _mm_add_ps(
+                _mm_set1_ps(k1), _mm_mul_ps(_mm_set1_ps(k2), speed))));
+
+            float *f = forces + 4*i;
+            _mm_storeu_ps(f, _mm_mul_ps(v0, _mm_set1_ps(scales[0])));
+            _mm_storeu_ps(f + 4, _mm_mul_ps(v1, _mm_set1_ps(scales[1])));
+            _mm_storeu_ps(f + 8, _mm_mul_ps(v2, _mm_set1_ps(scales[2])));
+            _mm_storeu_ps(f + 12, _mm_mul_ps(v3, _mm_set1_ps(scales[3])));
+        }
+        simdDrag<float>(velocities + 4*i, k1, k2, forces + 4*i, count - i);
+    }
+
+    /**
+     * The double precision version of simdDrag.
+     */
+    inline void simdDrag(const double *velocities, double k1, double k2,
+                         double *forces, unsigned count)
+    {
+        unsigned i = 0;
+    #if defined(CYCLONE_SIMD_AVX2)
+        for (; i + 4 <= count; i += 4)
+        {
+            const double *v = velocities + 4*i;
+            __m256d v0 = _mm256_loadu_pd(v);
+            __m256d v1 = _mm256_loadu_pd(v + 4);
+            __m256d v2 = _mm256_loadu_pd(v + 8);
+            __m256d v3 = _mm256_loadu_pd(v + 12);
+
+            // Add the squares in pairs, then put the pairs from each
+            // vector in the same lane and add them.
+            __m256d low = _mm256_hadd_pd(_mm256_mul_pd(v0, v0),
+                                         _mm256_mul_pd(v1, v1));
+            __m256d high = _mm256_hadd_pd(_mm256_mul_pd(v2, v2),
+                                          _mm256_mul_pd(v3, v3));
+            __m256d speed = _mm256_sqrt_pd(_mm256_add_pd(
+                _mm256_permute2f128_pd(low, high, 0x20),
+                _mm256_permute2f128_pd(low, high, 0x31)));
+            double scales[4];
+            _mm256_storeu_pd(scales, _mm256_sub_pd(_mm256_setzero_pd(),
+                _mm256_add_pd(_mm256_set1_pd(k1),
+                              _mm256_mul_pd(_mm256_set1_pd(k2), speed))));
+
+            double *f = forces + 4*i;
+            _mm256_storeu_pd(f, _mm256_mul_pd(v0, _mm256_broadcast_sd(scales)));
+            _mm256_storeu_pd(f + 4,
+                _mm256_mul_pd(v1, _mm256_broadcast_sd(scales + 1)));
+            _mm256_storeu_pd(f + 8,
+                _mm256_mul_pd(v2, _mm256_broadcast_sd(scales + 2)));
+            _mm256_storeu_pd(f + 12,
+                _mm256_mul_pd(v3, _mm256_broadcast_sd(scales + 3)));
+        }
+    #else
+        for (; i + 2 <= count; i += 2)
+        {
+            const double *v = velocities + 4*i;
+            __m128d xy0 = _mm_loadu_pd(v);
+            __m128d zw0 = _mm_loadu_pd(v + 2);
+            __m128d xy1 = _mm_loadu_pd(v + 4);
+            __m128d zw1 = _mm_loadu_pd(v + 6);
+
+            __m128d square0 = _mm_mul_pd(xy0, xy0);
+            __m128d square1 = _mm_mul_pd(xy1, xy1);
+            __m128d sum = _mm_add_pd(_mm_unpacklo_pd(square0, square1),
+                                     _mm_unpackhi_pd(square0, square1));
+            sum = _mm_add_pd(sum, _mm_unpacklo_pd(_mm_mul_pd(zw0, zw0),
+                                                  _mm_mul_pd(zw1, zw1)));
+            __m128d speed = _mm_sqrt_pd(sum);
+            double scales[2];
+            _mm_storeu_pd(scales, _mm_sub_pd(_mm_setzero_pd(), _mm_add_pd(
+                _mm_set1_pd(k1), _mm_mul_pd(_mm_set1_pd(k2), speed))));
+
+            double *f = forces + 4*i;
+            __m128d scale = _mm_load1_pd(scales);
+            _mm_storeu_pd(f, _mm_mul_pd(xy0, scale));
+            _mm_storeu_pd(f + 2, _mm_mul_pd(zw0, scale));
+            scale = _mm_load1_pd(scales + 1);
+            _mm_storeu_pd(f + 4, _mm_mul_pd(xy1, scale));
+            _mm_storeu_pd(f + 6, _mm_mul_pd(zw1, scale));
+        }
+    #endif
+        simdDrag<double>(velocities + 4*i, k1, k2, forces + 4*i, count - i);
+    }
+
+    /**
+     * Internal function that returns a + (b - a) * f.
+     */
+    inline __m128 _simdLerp(__m128 a, __m128 b, __m128 f)
+    {
+        return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), f));
+    }
+
+    /**
+     * Internal function that returns a + (b - a) * f.
+     */
+    inline __m128d _simdLerp(__m128d a, __m128d b, __m128d f)
+    {
+        return _mm_add_pd(a, _mm_mul_pd(_mm_sub_pd(b, a), f));
+    }
+
+#if defined(CYCLONE_SIMD_AVX2)
+
+    /**
+     * Internal function that returns a + (b - a) * f.
+     */
+    inline __m256d _simdLerp(__m256d a, __m256d b, __m256d f)
+    {
+        return _mm256_add_pd(a, _mm256_mul_pd(_mm256_sub_pd(b, a), f));
+    }
+
+#endif
+
+    /*
+     * The trilinear blend works on whole vectors, so each of its
+     * seven steps is one register operation, or two for double
+     * precision without AVX2.
+     */
+
+    /**
+     * The single precision version of simdTrilinear.
+     */
+    inline void simdTrilinear(const float *v, unsigned dx, unsigned dy,
+                              unsigned dz, float fx, float fy, float fz,
+                              float *out)
+    {
+        dx *= 4;
+        dy *= 4;
+        dz *= 4;
+        __m128 x = _mm_set1_ps(fx);
+        __m128 x00 = _simdLerp(_mm_loadu_ps(v), _mm_loadu_ps(v + dx), x);
+        __m128 x10 = _simdLerp(_mm_loadu_ps(v + dy),
+                               _mm_loadu_ps(v + dy + dx), x);
+        __m128 x01 = _simdLerp(_mm_loadu_ps(v + dz),
+                               _mm_loadu_ps(v + dz + dx), x);
+        __m128 x11 = _simdLerp(_mm_loadu_ps(v + dz + dy),
+                               _mm_loadu_ps(v + dz + dy + dx), x);
+        __m128 y = _mm_set1_ps(fy);
+        __m128 y0 = _simdLerp(x00, x10, y);
+        __m128 y1 = _simdLerp(x01, x11, y);
+        _mm_storeu_ps(out, _simdLerp(y0, y1, _mm_set1_ps(fz)));
+    }
+
+    /**
+     * The double precision version of simdTrilinear.
+     */
+    inline void simdTrilinear(const double *v, unsigned dx, unsigned dy,
+                              unsigned dz, double fx, double fy, double fz,
+                              double *out)
+    {
+        dx *= 4;
+        dy *= 4;
+        dz *= 4;
+    #if defined(CYCLONE_SIMD_AVX2)
+        __m256d x = _mm256_set1_pd(fx);
+        __m256d x00 = _simdLerp(_mm256_loadu_pd(v),
+                                _mm256_loadu_pd(v + dx), x);
+        __m256d x10 = _simdLerp(_mm256_loadu_pd(v + dy),
+                                _mm256_loadu_pd(v + dy + dx), x);
+        __m256d x01 = _simdLerp(_mm256_loadu_pd(v + dz),
+                                _mm256_loadu_pd(v + dz + dx), x);
+        __m256d x11 = _simdLerp(_mm256_loadu_pd(v + dz + dy),
+                                _mm256_loadu_pd(v + dz + dy + dx), x);
+        __m256d y = _mm256_set1_pd(fy);
+        __m256d y0 = _simdLerp(x00, x10, y);
+        __m256d y1 = _simdLerp(x01, x11, y);
+        _mm256_storeu_pd(out, _simdLerp(y0, y1, _mm256_set1_pd(fz)));
+    #else
+        // Each vector is done in two halves.
+        __m128d x = _mm_set1_pd(fx);
+        __m128d y = _mm_set1_pd(fy);
+        __m128d z = _mm_set1_pd(fz);
+        for (unsigned i = 0; i < 4; i += 2)
+        {
+            const double *c = v + i;
+            __m128d x00 = _simdLerp(_mm_loadu_pd(c),
+                                    _mm_loadu_pd(c + dx), x);
+            __m128d x10 = _simdLerp(_mm_loadu_pd(c + dy),
+                                    _mm_loadu_pd(c + dy + dx), x);
+            __m128d x01 = _simdLerp(_mm_loadu_pd(c + dz),
+                                    _mm_loadu_pd(c + dz + dx), x);
+            __m128d x11 = _simdLerp(_mm_loadu_pd(c + dz + dy),
+                                    _mm_loadu_pd(c + dz + dy + dx), x);
+            __m128d y0 = _simdLerp(x00, x10, y);
+            __m128d y1 = _simdLerp(x01, x11, y);
+            _mm_storeu_pd(out + i, _simdLerp(y0, y1, z));
+        }
+    #endif
+    }
+
+#endif
+
+    /*
+     * Fixed16 has its own versions of each function, which add up
+     * the exact products and round once, rather than rounding each
+     * product as the templates would. This is both more accurate and
+     * what the integer vector instructions do naturally, and every
+     * backend gives the same results.
+     */
+
+    /**
+     * Internal function that rounds a sum of Fixed16 products.
+     */
+    inline Fixed16 _simdFixedResult(unsigned long long sum)
+    {
+        return Fixed16::fromRaw((int)(unsigned)_fixedRound((long long)sum, 16));
+    }
+
+    /**
+     * Internal function that returns the exact product of two Fixed16
+     * numbers, for adding up with wrap around.
+     */
+    inline unsigned long long _simdFixedProduct(const Fixed16 &a,
+                                                const Fixed16 &b)
+    {
+        return (unsigned long long)((long long)a.raw * b.raw);
+    }
+
+#if defined(CYCLONE_SIMD_SSE41)
+
+    /**
+     * Internal function that loads the first three numbers of a
+     * vector, with zero in the fourth, without reading the fourth.
+     */
+    inline __m128i _simdLoad3(const Fixed16 *v)
+    {
+        return _mm_insert_epi32(_mm_loadl_epi64((const __m128i*)v), v[2].raw, 2);
+    }
+
+    /**
+     * Internal function that returns the sum of the exact products
+     * of the four pairs of Fixed16 numbers in the given registers.
+     */
+    inline unsigned long long _simdFixedSum(__m128i a, __m128i b)
+    {
+        __m128i even = _mm_mul_epi32(a, b);
+        __m128i odd = _mm_mul_epi32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+        __m128i sum = _mm_add_epi64(even, odd);
+        sum = _mm_add_epi64(sum, _mm_srli_si128(sum, 8));
+
+        unsigned long long result;
+        _mm_storel_epi64((__m128i*)&result, sum);
+        return result;
+    }
+
+#endif
+
+    /**
+     * The Fixed16 version of simdDot.
+     */
+    inline Fixed16 simdDot(const Fixed16 *a, const Fixed16 *b)
+    {
+    #if defined(CYCLONE_SIMD_SSE41)
+        return _simdFixedResult(_simdFixedSum(
+            _mm_loadu_si128((const __m128i*)a), _simdLoad3(b)));
+    #else
+        return _simdFixedResult(_simdFixedProduct(a[0], b[0]) +
+            _simdFixedProduct(a[1], b[1]) + _simdFixedProduct(a[2], b[2]));
+    #endif
+    }
+
+    /**
+     * The Fixed16 version of simdCross.
+     */
+    inline void simdCross(const Fixed16 *a, const Fixed16 *b, Fixed16 *out)
+    {
+        out[0] = _simdFixedResult(_simdFixedProduct(a[1], b[2]) -
+                                  _simdFixedProduct(a[2], b[1]));
+        out[1] = _simdFixedResult(_simdFixedProduct(a[2], b[0]) -
+                                  _simdFixedProduct(a[0], b[2]));
+        out[2] = _simdFixedResult(_simdFixedProduct(a[0], b[1]) -
+                                  _simdFixedProduct(a[1], b[0]));
+        out[3] = Fixed16();
+    }
+
+    /**
+     * The Fixed16 version of simdTransform3.
+     */
+    inline void simdTransform3(const Fixed16 *m, const Fixed16 *v,
+                               Fixed16 *out)
+    {
+    #if defined(CYCLONE_SIMD_SSE41)
+        __m128i vector = _simdLoad3(v);
+        out[0] = _simdFixedResult(_simdFixedSum(
+            _mm_loadu_si128((const __m128i*)m), vector));
+        out[1] = _simdFixedResult(_simdFixedSum(
+            _mm_loadu_si128((const __m128i*)(m + 3)), vector));
+        out[2] = _simdFixedResult(_simdFixedSum(_simdLoad3(m + 6), vector));
+    #else
+        for (unsigned i = 0; i < 3; i++)
+        {
+            out[i] = _simdFixedResult(
+                _simdFixedProduct(v[0], m[i*3]) +
+                _simdFixedProduct(v[1], m[i*3 + 1]) +
+                _simdFixedProduct(v[2], m[i*3 + 2]));
+        }
+    #endif
+        out[3] = Fixed16();
+    }
+
+    /**
+     * The Fixed16 version of simdTransformTranspose3.
+     */
+    inline void simdTransformTranspose3(const Fixed16 *m, const Fixed16 *v,
+                                        Fixed16 *out)
+    {
+        for (unsigned i = 0; i < 3; i++)
+        {
+            out[i] = _simdFixedResult(
+                _simdFixedProduct(v[0], m[i]) +
+                _simdFixedProduct(v[1], m[i + 3]) +
+                _simdFixedProduct(v[2], m[i + 6]));
+        }
+        out[3] = Fixed16();
+    }
+
+    /**
+     * The Fixed16 version of simdTransform4.
+     */
+    inline void simdTransform4(const Fixed16 *m, const Fixed16 *v,
+                               Fixed16 *out)
+    {
+    #if defined(CYCLONE_SIMD_SSE41)
+        __m128i vector = _simdLoad3(v);
+    #endif
+        for (unsigned i = 0; i < 3; i++)
+        {
+            // The translation is added at the products' scale, so the
+            // sum is still only rounded once.
+            unsigned long long translation =
+                (unsigned long long)((long long)m[i*4 + 3].raw * 65536);
+        #if defined(CYCLONE_SIMD_SSE41)
+            out[i] = _simdFixedResult(translation + _simdFixedSum(
+                _mm_loadu_si128((const __m128i*)(m + i*4)), vector));
+        #else
+            out[i] = _simdFixedResult(translation +
+                _simdFixedProduct(v[0], m[i*4]) +
+                _simdFixedProduct(v[1], m[i*4 + 1]) +
+                _simdFixedProduct(v[2], m[i*4 + 2]));
+        #endif
+        }
+        out[3] = Fixed16();
+    }
+
+    /**
+     * The Fixed16 version of simdQuaternionMultiply.
+     */
+    inline void simdQuaternionMultiply(const Fixed16 *a, const Fixed16 *b,
+                                       Fixed16 *out)
+    {
+        Fixed16 r = _simdFixedResult(
+            _simdFixedProduct(a[0], b[0]) - _simdFixedProduct(a[1], b[1]) -
+            _simdFixedProduct(a[2], b[2]) - _simdFixedProduct(a[3], b[3]));
+        Fixed16 i = _simdFixedResult(
+            _simdFixedProduct(a[0], b[1]) + _simdFixedProduct(a[1], b[0]) +
+            _simdFixedProduct(a[2], b[3]) - _simdFixedProduct(a[3], b[2]));
+        Fixed16 j = _simdFixedResult(
+            _simdFixedProduct(a[0], b[2]) + _simdFixedProduct(a[2], b[0]) +
+            _simdFixedProduct(a[3], b[1]) - _simdFixedProduct(a[1], b[3]));
+        Fixed16 k = _simdFixedResult(
+            _simdFixedProduct(a[0], b[3]) + _simdFixedProduct(a[3], b[0]) +
+            _simdFixedProduct(a[1], b[2]) - _simdFixedProduct(a[2], b[1]));
+        out[0] = r;
+        out[1] = i;
+        out[2] = j;
+        out[3] = k;
+    }
+
+} // namespace cyclone
+
+#endif // CYCLONE_SIMD_H
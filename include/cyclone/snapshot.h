@@ -0,0 +1,142 @@
+/*
+ * Interface file for simulation snapshots.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains the flat state records that a world can be
+ * saved to and restored from, and the snapshot that holds them and
+ * converts them to and from a compact binary form.
+ */
+#ifndef CYCLONE_SNAPSHOT_H
+#define CYCLONE_SNAPSHOT_H
+
+#include <vector>
+#include "core.h"
+
+namespace cyclone {
+
+    /**
+     * Holds the complete kinematic state of a rigid body. The record
+     * contains no pointers and no padding vectors, so arrays of them
+     * can be copied and written as raw memory.
+     */
+    struct RigidBodyState
+    {
+        /** Holds the identifier of the body this state belongs to. */
+        unsigned id;
+
+        /** Holds the awake and can-sleep flags of the body. */
+        unsigned flags;
+
+        real position[3];
+        real orientation[4];
+        real velocity[3];
+        real rotation[3];
+        real lastFrameAcceleration[3];
+
+        /** Holds the recency weighted motion used for sleeping. */
+        real motion;
+    };
+
+    /**
+     * Holds the kinematic state of a particle.
+     */
+    struct ParticleState
+    {
+        real position[3];
+        real velocity[3];
+    };
+
+    /**
+     * Holds a contact from the rigid body world's last frame. Bodies
+     * are stored by their identifiers, with ~0 for the scenery.
+     */
+    struct ContactState
+    {
+        unsigned body[2];
+        real contactPoint[3];
+        real contactNormal[3];
+        real penetration;
+        real friction;
+        real restitution;
+    };
+
+    /**
+     * Holds a contact from the particle world's last frame. Particles
+     * are stored by their index in the world's particle list, with ~0
+     * for the scenery.
+     */
+    struct ParticleContactState
+    {
+        unsigned particle[2];
+        real contactNormal[3];
+        real penetration;
+        real restitution;
+    };
+
+    /**
+     * A snapshot of the state of a simulation. A World and a
+     * ParticleWorld can both save into the same snapshot, each
+     * filling its own sections. Saving and restoring are a single
+     * pass over the bodies into contiguous arrays, and the arrays
+     * keep their storage between saves, so a snapshot that is reused
+     * each frame does not allocate.
+     *
+     * The snapshot can be converted to a compact binary form for
+     * storage or transmission. The binary form is only readable by
+     * a build of Cyclone with the same precision.
+     */
+    class Snapshot
+    {
+    public:
+        /** Holds the state of each rigid body. */
+        std::vector<RigidBodyState> bodies;
+
+        /** Holds the rigid body contacts of the last frame. */
+        std::vector<ContactState> contacts;
+
+        /** Holds the state of each particle. */
+        std::vector<ParticleState> particles;
+
+        /** Holds the particle contacts of the last frame. */
+        std::vector<ParticleContactState> particleContacts;
+
+        /**
+         * Empties every section of the snapshot, keeping the storage
+         * that has been allocated.
+         */
+        void clear();
+
+        /**
+         * Returns the number of bytes needed for the binary form of
+         * the snapshot.
+         */
+        unsigned getBinarySize() const;
+
+        /**
+         * Writes the binary form of the snapshot into the given
+         * buffer, which must be at least getBinarySize() bytes long.
+         */
+        void writeBinary(void *buffer) const;
+
+        /**
+         * Reads the snapshot from the given binary data. Returns
+         * false, leaving the snapshot unchanged, if the data is not a
+         * valid snapshot for this build.
+         */
+        bool readBinary(const void *buffer, unsigned size);
+    };
+
+} // namespace cyclone
+
+#endif // CYCLONE_SNAPSHOT_H
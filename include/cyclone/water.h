@@ -0,0 +1,257 @@
+/*
+ * Interface file for the water surface.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains a water surface whose height varies across the
+ * XZ plane and over time, shared by the buoyancy force generators.
+ */
+#ifndef CYCLONE_WATER_H
+#define CYCLONE_WATER_H
+
+#include <vector>
+#include "core.h"
+
+namespace cyclone {
+
+    /**
+     * Holds a single travelling wave on a water surface.
+     */
+    struct WaterWave
+    {
+        /** Holds the direction of travel, in the XZ plane. */
+        real directionX, directionZ;
+
+        /** Holds the distance between crests. */
+        real wavelength;
+
+        /** Holds the height of a crest above the mean surface. */
+        real amplitude;
+
+        /** Holds the speed the crests travel at. */
+        real speed;
+
+        /** Holds the phase of the wave at the origin at time zero. */
+        real phase;
+    };
+
+    /**
+     * Holds the last height a buoyancy generator found, so it can be
+     * reused while the object stays at the same place over an
+     * unchanged surface.
+     */
+    struct WaterHeightCache
+    {
+        /** Holds the point in the XZ plane the height was found at. */
+        real x, z;
+
+        /** Holds the surface version the height was found with. */
+        unsigned version;
+
+        /** Holds the height found. */
+        real height;
+
+        /** Creates an empty cache. */
+        WaterHeightCache() : x(0), z(0), version(0), height(0) {}
+    };
+
+    /**
+     * The surface of a body of water, as a height above each point in
+     * the XZ plane. The height is the sum of a base height, an
+     * optional heightfield sampled with bilinear interpolation and
+     * clamped at its edges, and any number of travelling sine waves.
+     *
+     * A surface with no heightfield and no waves is a flat plane, and
+     * behaves as the single water height the buoyancy generators
+     * used before.
+     *
+     * The surface has a version number that changes whenever its
+     * shape does, which lets lookups be cached.
+     */
+    class WaterSurface
+    {
+    protected:
+        /** Holds the height of the surface with no other effects. */
+        real baseHeight;
+
+        /** Holds the position of the first heightfield point. */
+        real originX, originZ;
+
+        /** Holds the distance between heightfield points. */
+        real cellSize;
+
+        /** Holds the number of heightfield points along X and Z. */
+        unsigned countX, countZ;
+
+        /** Holds the heightfield, stored in rows along X. */
+        std::vector<real> heights;
+
+        /** Holds the waves on the surface. */
+        std::vector<WaterWave> waves;
+
+        /** Holds the current time of the surface. */
+        real time;
+
+        /** Holds the version of the surface's shape. */
+        unsigned version;
+
+        /** Marks the surface's shape as changed. */
+        void changed()
+        {
+            version++;
+            if (version == 0) version = 1;
+        }
+
+    public:
+        /**
+         * Creates a flat surface at the given height.
+         */
+        WaterSurface(real baseHeight = 0);
+
+        /**
+         * Sets the height of the surface with no other effects.
+         */
+        void setBaseHeight(real height);
+
+        /**
+         * Returns the height of the surface with no other effects.
+         */
+        real getBaseHeight() const
+        {
+            return baseHeight;
+        }
+
+        /**
+         * Gives the surface a heightfield with the given number of
+         * points, all at zero height.
+         *
+         * @param originX, originZ The position of the first point.
+         * @param cellSize The distance between points.
+         * @param x, z The number of points along X and Z, each at
+         * least one.
+         */
+        void setHeightfield(real originX, real originZ, real cellSize,
+                            unsigned x, unsigned z);
+
+        /**
+         * Sets the height of the given heightfield point, relative to
+         * the base height.
+         */
+        void setFieldHeight(unsigned x, unsigned z, real height);
+
+        /**
+         * Removes the heightfield.
+         */
+        void clearHeightfield();
+
+        /**
+         * Adds a wave to the surface. The wave's direction is
+         * normalised.
+         */
+        void addWave(const WaterWave &wave);
+
+        /**
+         * Removes every wave from the surface.
+         */
+        void clearWaves();
+
+        /**
+         * Sets the current time of the surface, which moves its waves.
+         */
+        void setTime(real time);
+
+        /**
+         * Moves the surface's time on by the given duration.
+         */
+        void advance(real duration)
+        {
+            setTime(time + duration);
+        }
+
+        /**
+         * Returns the current time of the surface.
+         */
+        real getTime() const
+        {
+            return time;
+        }
+
+        /**
+         * Returns the version of the surface's shape, which changes
+         * whenever the height at any point may have changed. This is
+         * never zero.
+         */
+        unsigned getVersion() const
+        {
+            return version;
+        }
+
+        /**
+         * Returns true if the surface is the same height everywhere.
+         */
+        bool isFlat() const
+        {
+            return heights.empty() && waves.empty();
+        }
+
+        /**
+         * Returns the height of the surface above the given point in
+         * the XZ plane.
+         */
+        real getHeight(real x, real z) const;
+
+        /**
+         * Returns the height of the surface above the given point,
+         * reusing the height in the given cache if it was found at
+         * the same point on the same version of the surface, and
+         * updating it otherwise.
+         */
+        real getHeight(real x, real z, WaterHeightCache *cache) const;
+
+        /**
+         * Finds the height above the given point without looking it
+         * up, if that is possible: if the surface is flat, or the
+         * given cache holds the height at the same point on the same
+         * version of the surface. Returns false otherwise.
+         */
+        bool getCachedHeight(real x, real z, const WaterHeightCache &cache,
+                             real *height) const;
+
+        /**
+         * Stores the given height, found above the given point on the
+         * current version of the surface, in the given cache.
+         */
+        void cacheHeight(real x, real z, real height,
+                         WaterHeightCache *cache) const;
+
+        /**
+         * Finds the height of the surface above each of the given
+         * positions, writing them to the given array.
+         */
+        void getHeights(const Vector3 *positions, real *heights,
+                        unsigned count) const;
+
+        /**
+         * Finds the heights for a batch of positions that may lie on
+         * different surfaces. Positions whose surface is NULL are
+         * skipped, leaving their heights unchanged. Each run of
+         * positions sharing a surface is looked up in one call.
+         */
+        static void getHeights(const WaterSurface *const *surfaces,
+                               const Vector3 *positions, real *heights,
+                               unsigned count);
+    };
+
+} // namespace cyclone
+
+#endif // CYCLONE_WATER_H
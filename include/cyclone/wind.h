@@ -0,0 +1,190 @@
+/*
+ * Interface file for the gridded wind field.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains a wind field that varies through space and
+ * time, for aerodynamic force generators to sample.
+ */
+#ifndef CYCLONE_WIND_H
+#define CYCLONE_WIND_H
+
+#include <vector>
+#include "random.h"
+
+namespace cyclone {
+
+    /**
+     * A wind velocity that varies through a region of space, stored
+     * on a regular grid and sampled with trilinear interpolation.
+     * Positions outside the grid take the value at its nearest edge.
+     *
+     * The wind at each grid point is the sum of a base value, which
+     * can be set point by point, a mean wind shared by the whole
+     * field, and turbulence. The turbulence is a random vector at
+     * each grid point, regenerated from the field's seed once every
+     * turbulence period and blended smoothly between those
+     * keyframes, so two fields with the same seed and time give the
+     * same wind.
+     *
+     * The blended grid is calculated once when the field's time is
+     * set, so sampling costs only the interpolation. Many positions
+     * can be sampled in one call.
+     */
+    class WindField
+    {
+    protected:
+        /** Holds the position of the first grid point. */
+        Vector3 origin;
+
+        /** Holds the distance between neighbouring grid points. */
+        real cellSize;
+
+        /** Holds the number of grid points along each axis. */
+        unsigned counts[3];
+
+        /** Holds the base wind at each grid point. */
+        std::vector<Vector3> base;
+
+        /** Holds the wind at each grid point at the current time. */
+        std::vector<Vector3> values;
+
+        /**
+         * Holds the turbulence at each grid point for the keyframes
+         * before and after the current time.
+         */
+        std::vector<Vector3> keyframes[2];
+
+        /** Holds the index of the keyframe before the current time. */
+        int keyframe;
+
+        /** Holds the wind added at every grid point. */
+        Vector3 meanWind;
+
+        /** Holds the largest turbulence on each axis. */
+        real turbulence;
+
+        /** Holds the time between turbulence keyframes. */
+        real period;
+
+        /** Holds the seed the turbulence is generated from. */
+        unsigned seed;
+
+        /** Holds the current time of the field. */
+        real time;
+
+        /**
+         * Fills the given array with the turbulence for the given
+         * keyframe.
+         */
+        void generateKeyframe(int index, std::vector<Vector3> &turbulence);
+
+        /**
+         * Returns how far the current time is between the two
+         * keyframes, smoothed so the gusts blend without sudden
+         * changes in their rate of change.
+         */
+        real getKeyframeBlend() const;
+
+        /**
+         * Calculates the wind at the grid point with the given index,
+         * blending its turbulence by the given amount.
+         */
+        Vector3 calculateValue(unsigned index, real blend) const;
+
+        /**
+         * Recalculates the wind at each grid point for the current
+         * time.
+         */
+        void calculateValues();
+
+        /**
+         * Returns the index of the given grid point.
+         */
+        unsigned getIndex(unsigned x, unsigned y, unsigned z) const
+        {
+            return (z * counts[1] + y) * counts[0] + x;
+        }
+
+    public:
+        /**
+         * Creates a wind field with the given grid, with no wind.
+         *
+         * @param origin The position of the first grid point.
+         * @param cellSize The distance between grid points.
+         * @param x, y, z The number of grid points along each axis,
+         * each at least one.
+         * @param seed The seed the turbulence is generated from.
+         */
+        WindField(const Vector3 &origin, real cellSize,
+                  unsigned x, unsigned y, unsigned z,
+                  unsigned seed = 0);
+
+        /**
+         * Sets the base wind at the given grid point.
+         */
+        void setBase(unsigned x, unsigned y, unsigned z, const Vector3 &wind);
+
+        /**
+         * Sets the wind added at every grid point.
+         */
+        void setMeanWind(const Vector3 &wind);
+
+        /**
+         * Sets the turbulence of the field.
+         *
+         * @param amount The largest turbulence on each axis.
+         * @param period The time between turbulence keyframes, which
+         * must be positive. Other periods are rejected, leaving the
+         * turbulence unchanged.
+         */
+        void setTurbulence(real amount, real period);
+
+        /**
+         * Sets the current time of the field, recalculating the wind
+         * at each grid point.
+         */
+        void setTime(real time);
+
+        /**
+         * Moves the field's time on by the given duration.
+         */
+        void advance(real duration)
+        {
+            setTime(time + duration);
+        }
+
+        /**
+         * Returns the current time of the field.
+         */
+        real getTime() const
+        {
+            return time;
+        }
+
+        /**
+         * Returns the wind at the given position.
+         */
+        Vector3 sample(const Vector3 &position) const;
+
+        /**
+         * Finds the wind at each of the given positions, writing them
+         * to the given array.
+         */
+        void sample(const Vector3 *positions, Vector3 *winds,
+                    unsigned count) const;
+    };
+
+} // namespace cyclone
+
+#endif // CYCLONE_WIND_H
@@ -19,10 +19,33 @@
 #ifndef CYCLONE_WORLD_H
 #define CYCLONE_WORLD_H
 
+#include <vector>
 #include "body.h"
 #include "contacts.h"
+#include "collide_cast.h"
+#include "snapshot.h"
+#include "arena.h"
+#include "articulation.h"
+#include "origin.h"
 
 namespace cyclone {
+
+    class Explosion;
+
+    /**
+     * The interface for anything that wants to be given the bodies
+     * found by a region query on the world.
+     */
+    class OverlapCallback
+    {
+    public:
+        /**
+         * Called with each body found by the query. Returning false
+         * ends the query, so no further bodies are given.
+         */
+        virtual bool addBody(RigidBody *body) = 0;
+    };
+
     /**
      * The world represents an independent simulation of physics.  It
      * keeps track of a set of rigid bodies, and provides the means to
@@ -30,6 +53,10 @@ namespace cyclone {
      */
     class World
     {
+    public:
+        typedef std::vector<Articulation*> Articulations;
+
+    private:
         // ... other World data as before ...
         /**
          * True if the world should calculate the number of iterations
@@ -44,6 +71,33 @@ namespace cyclone {
         {
             RigidBody *body;
             BodyRegistration * next;
+
+            /** Holds the body's handle in the broadphase. */
+            unsigned broadphaseHandle;
+
+            /** Holds the radius of a sphere enclosing the body. */
+            real radius;
+
+            /**
+             * Holds the centre of the body's box in the
+             * broadphase, which is enlarged by the broadphase margin
+             * so that small movements don't need it to be updated.
+             */
+            Vector3 broadphaseCentre;
+
+            /**
+             * Holds the margin the body's box was enlarged by when it
+             * was last put in the broadphase. The world's margin can
+             * change since then, and the body must stay within this
+             * one.
+             */
+            real broadphaseMargin;
+
+            /**
+             * Holds the primitive tested against the static geometry
+             * for this body, or NULL if it has none.
+             */
+            CollisionPrimitive *primitive;
         };
 
         /**
@@ -71,44 +125,479 @@ namespace cyclone {
         ContactGenRegistration *firstContactGen;
 
         /**
-         * Holds an array of contacts, for filling by the contact
-         * generators.
+         * Holds the memory for data that lives for a single frame:
+         * the contacts, and any pair lists or scratch space that
+         * contact generators need. It is reset at the start of each
+         * frame.
+         */
+        FrameArena arena;
+
+        /**
+         * Holds the array of contacts for the current frame, for
+         * filling by the contact generators. It is allocated from the
+         * frame arena.
          */
         Contact *contacts;
 
         /**
-         * Holds the maximum number of contacts allowed (i.e. the size
-         * of the contacts array).
+         * Holds the number of contacts that will be made room for
+         * when contacts are next generated. This grows to fit the
+         * largest number of contacts any frame has needed.
+         */
+        unsigned contactCapacity;
+
+        /**
+         * True if the world should put contacts into a fixed order
+         * before resolving them, so the result does not depend on the
+         * order in which contact generators were registered.
+         */
+        bool deterministic;
+
+        /**
+         * Holds the identifier that will be given to the next body
+         * registered with the world.
+         */
+        unsigned nextBodyId;
+
+        /**
+         * Holds the number of contacts generated in the last frame,
+         * which are kept in the contacts array until the next one.
+         */
+        unsigned lastContactCount;
+
+        /**
+         * Holds a table from body identifier to body, filled when a
+         * snapshot with contacts is restored. It is kept between
+         * restores so that its storage can be reused.
+         */
+        std::vector<RigidBody*> bodiesById;
+
+        /**
+         * Holds the fields applied to every body in the world.
+         */
+        UniformFields fields;
+
+        /**
+         * Holds where the world's origin is in global coordinates.
+         */
+        LocalOrigin origin;
+
+        /**
+         * Holds a bounding box hierarchy over the bodies in the
+         * world, used to find the bodies in a region. Each body's box
+         * encloses its sphere, enlarged by the broadphase margin.
+         */
+        BVHTree<BoundingBox> broadphase;
+
+        /**
+         * Holds how far a body can move before its box in the
+         * broadphase needs to be updated.
+         */
+        real broadphaseMargin;
+
+        /**
+         * Holds the articulations in the world, which integrate
+         * their own bodies.
+         */
+        Articulations articulations;
+
+        /**
+         * Holds the static geometry of the world. Its hierarchy is
+         * built once, when the geometry is first tested after being
+         * added, and as it never moves it is never refitted.
+         */
+        CollisionCompound staticGeometry;
+
+        /**
+         * Holds the static half-spaces of the world, such as the
+         * ground.
+         */
+        std::vector<CollisionPlane> staticPlanes;
+
+        /**
+         * Holds the friction and restitution of contacts with the
+         * static geometry.
+         */
+        real staticFriction;
+        real staticRestitution;
+
+        /**
+         * Holds each body's registration, indexed by the body's
+         * identifier, so the shapes of the bodies found in the
+         * broadphase can be looked up.
+         */
+        std::vector<BodyRegistration*> registrations;
+
+        /**
+         * Visitors for casts through the broadphase, one ray or
+         * shape at a time or four rays at a time.
+         */
+        struct CastVisitor;
+        struct PacketVisitor;
+
+        /**
+         * Casts the given shape against the given body's primitive,
+         * or its bounding sphere if it has none.
+         */
+        bool castBody(RigidBody *body, const CastShape &shape,
+            real length, CastHit *hit);
+
+        /**
+         * Casts the given shape against the static geometry and
+         * planes.
+         */
+        bool castStatic(const CastShape &shape, real length, CastHit *hit);
+
+        /**
+         * Casts the given shape against everything in the world.
+         */
+        bool cast(const CastShape &shape, real length, CastHit *hit);
+
+        /**
+         * Visitors for region queries through the broadphase, for
+         * explosions and for the overlap queries.
+         */
+        struct ExplosionVisitor;
+        struct OverlapVisitor;
+
+        /**
+         * Returns true if the given body's primitive, or its bounding
+         * sphere if it has none, overlaps the given sphere or box.
+         */
+        bool overlapsBody(const BodyRegistration *reg,
+            const CollisionPrimitive &shape) const;
+
+        /**
+         * Finds the bodies overlapping the given sphere or box, whose
+         * internals must be up to date, writing them to the array
+         * until it is full, or giving them to the callback if there
+         * is one.
+         */
+        unsigned overlap(const CollisionPrimitive &shape,
+            RigidBody **bodies, unsigned limit, OverlapCallback *callback);
+
+        /**
+         * Doubles the room for contacts, keeping the given number of
+         * contacts already generated.
+         */
+        void growContacts(unsigned used);
+
+        /**
+         * Tests the primitives of the awake bodies against the static
+         * geometry, adding contacts after the given number already
+         * generated. Returns the new total number of contacts.
          */
-        unsigned maxContacts;
+        unsigned generateStaticContacts(unsigned used);
+
+        /**
+         * Returns an array, allocated from the frame arena, with an
+         * entry for each registered body in list order that is true
+         * if the body is integrated by an articulation. Returns NULL
+         * if there are no articulations.
+         */
+        bool* findArticulatedBodies();
 
     public:
         /**
-         * Creates a new simulator that can handle up to the given
-         * number of contacts per frame. You can also optionally give
-         * a number of contact-resolution iterations to use. If you
-         * don't give a number of iterations, then four times the
-         * number of detected contacts will be used for each frame.
+         * Creates a new simulator that initially makes room for the
+         * given number of contacts per frame. More room is made
+         * whenever a frame needs it, so this is only a hint. You can
+         * also optionally give a number of contact-resolution
+         * iterations to use. If you don't give a number of
+         * iterations, then four times the number of detected contacts
+         * will be used for each frame.
          */
         World(unsigned maxContacts, unsigned iterations=0);
         ~World();
 
+        /**
+         * Registers the given body with the world. The body is given
+         * the next stable identifier, so bodies registered in the same
+         * order always receive the same identifiers.
+         *
+         * @param boundingRadius The radius of a sphere around the
+         * body's centre of mass that encloses the body. This is used
+         * to find the bodies in a region of the world.
+         *
+         * @param primitive A primitive attached to the body, which
+         * the world tests against its static geometry while the body
+         * is awake. Bodies without one don't touch the static
+         * geometry.
+         */
+        void addBody(RigidBody *body, real boundingRadius = 0,
+            CollisionPrimitive *primitive = NULL);
+
+        /**
+         * Adds the given primitive to the world's static geometry.
+         * The primitive must have no body, and its offset gives its
+         * place in the world. Static geometry is never integrated or
+         * moved: it is only tested against awake bodies with
+         * primitives, through a hierarchy that skips everything not
+         * near them. Level geometry should be added here rather than
+         * as bodies with infinite mass.
+         */
+        void addStaticPrimitive(CollisionPrimitive *primitive);
+
+        /**
+         * Adds the given half-space to the world's static geometry.
+         * It is tested against awake bodies with primitives, in the
+         * same way as the other static geometry.
+         */
+        void addStaticPlane(const CollisionPlane &plane);
+
+        /**
+         * Sets the friction and restitution of contacts with the
+         * static geometry.
+         */
+        void setStaticMaterial(real friction, real restitution);
+
+        /**
+         * Registers the given contact generator with the world.
+         */
+        void addContactGenerator(ContactGenerator *gen);
+
+        /**
+         * Returns the articulations in the world. Each is integrated
+         * by runPhysics in place of its bodies, which should also be
+         * registered with the world so they take part in contacts.
+         */
+        Articulations& getArticulations()
+        {
+            return articulations;
+        }
+
+        /**
+         * Turns deterministic mode on or off. In deterministic mode
+         * the contacts generated each frame are sorted by the
+         * identifiers of the bodies involved before they are
+         * resolved, so the outcome of a frame depends only on the
+         * state of the bodies and not on the order in which contact
+         * generators are registered. Any code that splits the work of
+         * a frame between threads must check this flag and avoid
+         * reductions whose result depends on thread scheduling.
+         */
+        void setDeterministic(bool deterministic);
+
+        /**
+         * Returns true if the world is running in deterministic mode.
+         */
+        bool isDeterministic() const
+        {
+            return deterministic;
+        }
+
+        /**
+         * Calculates a checksum over the state of every body in the
+         * world: position, orientation, velocity, rotation and awake
+         * state. Two worlds whose bodies are bit-for-bit identical
+         * give the same checksum, so this can be compared between
+         * peers each frame to detect a simulation that has diverged.
+         */
+        unsigned getChecksum() const;
+
+        /**
+         * Saves the state of every body in the world, and the
+         * contacts from the last frame, into the bodies and contacts
+         * sections of the given snapshot. The bodies are saved in the
+         * order they are held by the world.
+         */
+        void saveSnapshot(Snapshot *snapshot) const;
+
+        /**
+         * Restores the world from the bodies and contacts sections of
+         * the given snapshot. The snapshot must have been saved from
+         * this world, or from one with the same bodies registered in
+         * the same order. Returns false, leaving the world unchanged,
+         * if the snapshot does not match the world's bodies.
+         */
+        bool restoreSnapshot(const Snapshot &snapshot);
+
         /**
          * Calls each of the registered contact generators to report
-         * their contacts. Returns the number of generated contacts.
+         * their contacts, and then tests the awake bodies against the
+         * static geometry. Returns the number of generated contacts.
+         *
+         * Before each generator is called, the contact array is
+         * grown until it has room for the generator's maximum number
+         * of contacts, so each generator is called once, and may
+         * change the bodies it generates contacts for.
          */
         unsigned generateContacts();
 
+        /**
+         * Returns the arena for data that only lives for the current
+         * frame. Contact generators can use it for broadphase pair
+         * lists and scratch space. Everything allocated from it is
+         * released by the next call to startFrame.
+         */
+        FrameArena& getFrameArena()
+        {
+            return arena;
+        }
+
+        /**
+         * Returns the uniform fields applied to every body in the
+         * world as it is integrated. They have no effect until set.
+         */
+        UniformFields& getFields()
+        {
+            return fields;
+        }
+
         /**
          * Processes all the physics for the world.
          */
         void runPhysics(real duration);
 
+        /**
+         * Updates the broadphase boxes of the bodies that have moved
+         * further than the margin their box was built with, or whose
+         * box was built with a different margin to the world's
+         * current one. This is done automatically by runPhysics, and
+         * only needs calling if bodies are moved directly.
+         */
+        void updateBroadphase();
+
+        /**
+         * Sets how far a body can move before its box in the
+         * broadphase is updated. Larger margins mean fewer updates
+         * but more bodies considered by each query. Every body's box
+         * is rebuilt with the new margin by the next call to
+         * updateBroadphase.
+         */
+        void setBroadphaseMargin(real margin);
+
+        /**
+         * Returns where the world's origin is in global coordinates,
+         * for converting positions in and out of the world.
+         */
+        const LocalOrigin& getOrigin() const
+        {
+            return origin;
+        }
+
+        /**
+         * Moves the world's origin to the given position, in the
+         * world's current coordinates, so that objects near it are
+         * held with the most precision. Every body, the contacts from
+         * the last frame and the broadphase are moved in one pass;
+         * nothing in the world moves in global coordinates.
+         *
+         * The static geometry is moved too, but scenery held outside
+         * the world, such as contact generators' planes or an
+         * explosion's centre, must be moved by the caller. Snapshots
+         * are in the coordinates in force when they were taken.
+         */
+        void shiftOrigin(const Vector3 &newOrigin);
+
+        /**
+         * Applies the given explosion to the bodies in the world, and
+         * then advances its time by the given duration. Only bodies
+         * within the explosion's current reach are found, using the
+         * broadphase, and the explosion doesn't need registering with
+         * any body. This should be called once per frame, between
+         * startFrame and runPhysics, for as long as the explosion
+         * lasts.
+         *
+         * @return The number of bodies within the explosion's reach.
+         */
+        unsigned applyExplosion(Explosion &explosion, real duration);
+
+        /**
+         * Casts a ray from the given origin along the given unit
+         * direction, and finds the first thing it hits within the
+         * given length: a body, through the broadphase, or the static
+         * geometry. Bodies registered without a primitive are hit as
+         * their bounding sphere. Anything the ray starts inside is
+         * not hit, so a ray can start inside the body casting it.
+         *
+         * @return True if the ray hit something, in which case the
+         * hit is filled in.
+         */
+        bool raycast(const Vector3 &origin, const Vector3 &direction,
+            real length, CastHit *hit);
+
+        /**
+         * Casts a sphere as for raycast, finding the first thing it
+         * would touch as it moves.
+         */
+        bool sphereCast(const Vector3 &centre, real radius,
+            const Vector3 &direction, real length, CastHit *hit);
+
+        /**
+         * Casts a box, with the given transform and half-sizes, as
+         * for raycast. The transform must be a rotation and
+         * translation only.
+         */
+        bool boxCast(const Matrix4 &transform, const Vector3 &halfSize,
+            const Vector3 &direction, real length, CastHit *hit);
+
+        /**
+         * Casts each of the given rays as for raycast, writing the
+         * first hit of each to the matching entry of the hits array.
+         * A ray that hits nothing has a zero normal, a NULL body and
+         * primitive, and a distance of its length.
+         *
+         * The rays are taken four at a time, and each group is cast
+         * through the broadphase together, testing each branch
+         * against all four rays at once. This is fastest when rays
+         * that are next to each other in the array start close
+         * together and point in similar directions, as with a fan of
+         * sensor rays.
+         *
+         * @return The number of rays that hit something.
+         */
+        unsigned raycast(const Ray *rays, unsigned count, CastHit *hits);
+
+        /**
+         * Finds the bodies that overlap the given axis-aligned box,
+         * and writes them to the given array, stopping when it is
+         * full. Only the branches of the broadphase near the box are
+         * visited, and nothing is allocated, so this is cheap enough
+         * to call many times a frame. Bodies are tested with their
+         * primitive, or as their bounding sphere if they have none;
+         * meshes and heightfields are tested as their bounding box.
+         * Static geometry is not included.
+         *
+         * @return The number of bodies written to the array.
+         */
+        unsigned overlapBox(const Vector3 &centre, const Vector3 &halfSize,
+            RigidBody **bodies, unsigned limit);
+
+        /**
+         * Finds the bodies that overlap the given axis-aligned box as
+         * above, giving each of them to the callback in turn.
+         *
+         * @return The number of bodies given to the callback.
+         */
+        unsigned overlapBox(const Vector3 &centre, const Vector3 &halfSize,
+            OverlapCallback *callback);
+
+        /**
+         * Finds the bodies that overlap the given box, with the given
+         * transform and half-sizes, as for the axis-aligned box. The
+         * transform must be a rotation and translation only.
+         */
+        unsigned overlapBox(const Matrix4 &transform,
+            const Vector3 &halfSize, RigidBody **bodies, unsigned limit);
+        unsigned overlapBox(const Matrix4 &transform,
+            const Vector3 &halfSize, OverlapCallback *callback);
+
+        /**
+         * Finds the bodies that overlap the given sphere, as for the
+         * axis-aligned box.
+         */
+        unsigned overlapSphere(const Vector3 &centre, real radius,
+            RigidBody **bodies, unsigned limit);
+        unsigned overlapSphere(const Vector3 &centre, real radius,
+            OverlapCallback *callback);
+
         /**
          * Initialises the world for a simulation frame. This clears
          * the force and torque accumulators for bodies in the
-         * world. After calling this, the bodies can have their forces
-         * and torques for this frame added.
+         * world, and releases the last frame's contacts and other
+         * per-frame data. After calling this, the bodies can have
+         * their forces and torques for this frame added.
          */
         void startFrame();
 
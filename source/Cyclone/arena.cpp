@@ -0,0 +1,112 @@
+/*
+ * Implementation file for the per-frame memory arena.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+#include <cstdlib>
+#include <cyclone/arena.h>
+
+using namespace cyclone;
+
+/**
+ * The size of the block header, rounded up so the memory after it
+ * keeps the largest alignment malloc gives.
+ */
+static const size_t BLOCK_HEADER_SIZE = 16;
+
+FrameArena::FrameArena(size_t initialSize)
+:
+current(NULL),
+used(0),
+usedBefore(0),
+peak(0)
+{
+    grow(initialSize);
+}
+
+FrameArena::~FrameArena()
+{
+    release();
+}
+
+void FrameArena::release()
+{
+    while (current)
+    {
+        Block *previous = current->previous;
+        free(current);
+        current = previous;
+    }
+    used = 0;
+    usedBefore = 0;
+}
+
+void FrameArena::grow(size_t bytes)
+{
+    // Grow geometrically, so a frame that keeps allocating only adds
+    // a logarithmic number of blocks.
+    size_t size = (usedBefore + used) * 2;
+    if (size < bytes) size = bytes;
+
+    Block *block = (Block*)malloc(BLOCK_HEADER_SIZE + size);
+    if (!block) throw std::bad_alloc();
+    block->previous = current;
+    block->size = size;
+
+    if (current) usedBefore += used;
+    current = block;
+    used = 0;
+}
+
+/**
+ * Internal function that returns the offset into a block at which an
+ * allocation with the given alignment can start.
+ */
+static inline size_t _alignedStart(const void *memory, size_t used,
+                                   size_t alignment)
+{
+    size_t address = (size_t)memory + used;
+    size_t aligned = (address + alignment - 1) & ~(alignment - 1);
+    return used + (aligned - address);
+}
+
+void* FrameArena::allocate(size_t bytes, size_t alignment)
+{
+    unsigned char *memory = (unsigned char*)current + BLOCK_HEADER_SIZE;
+    size_t start = _alignedStart(memory, used, alignment);
+    if (start + bytes > current->size)
+    {
+        grow(bytes + alignment);
+        memory = (unsigned char*)current + BLOCK_HEADER_SIZE;
+        start = _alignedStart(memory, 0, alignment);
+    }
+
+    used = start + bytes;
+    if (usedBefore + used > peak) peak = usedBefore + used;
+    return memory + start;
+}
+
+void FrameArena::reset()
+{
+    if (current->previous)
+    {
+        // Replace the chain with a single block that would have held
+        // the whole of the last frame.
+        size_t size = 0;
+        for (Block *block = current; block; block = block->previous)
+        {
+            size += block->size;
+        }
+        release();
+        grow(size);
+    }
+    used = 0;
+    usedBefore = 0;
+}
@@ -0,0 +1,831 @@
+/*
+ * Implementation file for articulated bodies.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+#include <assert.h>
+#include <memory.h>
+#include <cyclone/articulation.h>
+
+using namespace cyclone;
+
+/**
+ * Internal function that sets a spatial vector from its angular and
+ * linear parts.
+ */
+static inline void _setSpatial(real *out, const Vector3 &angular,
+                               const Vector3 &linear)
+{
+    out[0] = angular.x; out[1] = angular.y; out[2] = angular.z;
+    out[3] = linear.x; out[4] = linear.y; out[5] = linear.z;
+}
+
+/**
+ * Internal function that returns the angular part of a spatial vector.
+ */
+static inline Vector3 _angular(const real *v)
+{
+    return Vector3(v[0], v[1], v[2]);
+}
+
+/**
+ * Internal function that returns the linear part of a spatial vector.
+ */
+static inline Vector3 _linear(const real *v)
+{
+    return Vector3(v[3], v[4], v[5]);
+}
+
+/**
+ * Internal function that returns the scalar product of two spatial
+ * vectors.
+ */
+static inline real _dot(const real *a, const real *b)
+{
+    return a[0]*b[0] + a[1]*b[1] + a[2]*b[2] +
+        a[3]*b[3] + a[4]*b[4] + a[5]*b[5];
+}
+
+/**
+ * Internal function that finds the rate of change of the motion m
+ * carried along by a body moving with velocity v.
+ */
+static inline void _crossMotion(const real *v, const real *m, real *out)
+{
+    Vector3 w = _angular(v);
+    _setSpatial(out, w % _angular(m),
+        w % _linear(m) + _linear(v) % _angular(m));
+}
+
+/**
+ * Internal function that finds the rate of change of the force f
+ * carried along by a body moving with velocity v.
+ */
+static inline void _crossForce(const real *v, const real *f, real *out)
+{
+    Vector3 w = _angular(v);
+    _setSpatial(out, w % _angular(f) + _linear(v) % _linear(f),
+        w % _linear(f));
+}
+
+/**
+ * Internal function that multiplies a spatial vector by a 6x6
+ * matrix.
+ */
+static inline void _transform(const real *m, const real *v, real *out)
+{
+    for (unsigned i = 0; i < 6; i++) out[i] = _dot(m + i*6, v);
+}
+
+/**
+ * Internal function that sets the spatial inertia of a body with the
+ * given mass and inertia tensor, whose centre of mass is at c.
+ */
+static void _setBodyInertia(real *out, real mass, const Matrix3 &inertia,
+                            const Vector3 &c)
+{
+    Matrix3 skew;
+    skew.setSkewSymmetric(c * mass);
+
+    // The angular block is the inertia tensor moved to the origin by
+    // the parallel axis theorem.
+    real squared = c * c;
+    for (unsigned i = 0; i < 3; i++)
+    {
+        for (unsigned j = 0; j < 3; j++)
+        {
+            real parallel = -mass * c[i] * c[j];
+            if (i == j) parallel += mass * squared;
+            out[i*6 + j] = inertia.data[i*3 + j] + parallel;
+            out[i*6 + j + 3] = skew.data[i*3 + j];
+            out[(i+3)*6 + j] = -skew.data[i*3 + j];
+            out[(i+3)*6 + j + 3] = (i == j) ? mass : 0;
+        }
+    }
+}
+
+/**
+ * Internal function that solves m x = b for a symmetric positive
+ * definite 6x6 matrix, by Cholesky decomposition. The matrix and
+ * right hand side are overwritten.
+ */
+static void _solve(real *m, real *b)
+{
+    for (unsigned j = 0; j < 6; j++)
+    {
+        real diagonal = m[j*6 + j];
+        for (unsigned k = 0; k < j; k++) diagonal -= m[j*6 + k] * m[j*6 + k];
+        diagonal = real_sqrt(diagonal > 0 ? diagonal : (real)1e-12);
+        m[j*6 + j] = diagonal;
+
+        for (unsigned i = j+1; i < 6; i++)
+        {
+            real value = m[i*6 + j];
+            for (unsigned k = 0; k < j; k++) value -= m[i*6 + k] * m[j*6 + k];
+            m[i*6 + j] = value / diagonal;
+        }
+    }
+
+    for (unsigned i = 0; i < 6; i++)
+    {
+        for (unsigned k = 0; k < i; k++) b[i] -= m[i*6 + k] * b[k];
+        b[i] /= m[i*6 + i];
+    }
+    for (unsigned i = 6; i-- > 0;)
+    {
+        for (unsigned k = i+1; k < 6; k++) b[i] -= m[k*6 + i] * b[k];
+        b[i] /= m[i*6 + i];
+    }
+}
+
+/**
+ * Internal function that returns the velocity of the given point,
+ * fixed to the given body.
+ */
+static inline Vector3 _pointVelocity(const RigidBody *body,
+                                     const Vector3 &point)
+{
+    return body->getVelocity() +
+        body->getRotation() % (point - body->getPosition());
+}
+
+/**
+ * Internal function that returns the kinetic energy of a body with
+ * the given spatial velocity, whose centre of mass is at the given
+ * position.
+ */
+static inline real _kineticEnergy(const RigidBody *body,
+                                  const real *velocity,
+                                  const Vector3 &centre)
+{
+    if (body->getInverseMass() <= 0) return 0;
+
+    Vector3 rotation = _angular(velocity);
+    Vector3 linear = _linear(velocity) + rotation % centre;
+    return ((real)0.5) * (body->getMass() * (linear * linear) +
+        rotation * body->getInertiaTensorWorld().transform(rotation));
+}
+
+/**
+ * Internal function that returns the rotation by the given angle
+ * about the given unit axis.
+ */
+static inline Quaternion _axisRotation(const Vector3 &axis, real angle)
+{
+    real s = real_sin(angle * (real)0.5);
+    return Quaternion(real_cos(angle * (real)0.5),
+        axis.x * s, axis.y * s, axis.z * s);
+}
+
+Articulation::Articulation()
+:
+energyClamp(false),
+maxStepRotation((real)0.05),
+maxSteps(16)
+{
+}
+
+unsigned Articulation::setRoot(RigidBody *body)
+{
+    links.clear();
+
+    Link link;
+    link.body = body;
+    link.parent = NO_PARENT;
+    link.type = SPHERICAL_JOINT;
+    link.position = 0;
+    link.damping = 0;
+    link.dof = 0;
+    links.push_back(link);
+    return 0;
+}
+
+unsigned Articulation::addLink(RigidBody *body, unsigned parent,
+                               JointType type, const Vector3 &anchor,
+                               const Vector3 &axis)
+{
+    assert(parent < links.size());
+    assert(body->getInverseMass() > 0);
+
+    RigidBody *parentBody = links[parent].body;
+    parentBody->calculateDerivedData();
+    body->calculateDerivedData();
+
+    Link link;
+    link.body = body;
+    link.parent = parent;
+    link.type = type;
+    link.parentAnchor = parentBody->getPointInLocalSpace(anchor);
+    link.childAnchor = body->getPointInLocalSpace(anchor);
+    link.axis = body->getDirectionInLocalSpace(axis);
+    link.axis.normalise();
+
+    // The body's orientation relative to its parent.
+    Quaternion parentOrientation = parentBody->getOrientation();
+    link.restOrientation = Quaternion(parentOrientation.r,
+        -parentOrientation.i, -parentOrientation.j, -parentOrientation.k);
+    link.restOrientation *= body->getOrientation();
+    link.restOrientation.normalise();
+
+    link.position = 0;
+    link.damping = 0;
+    link.dof = (type == SPHERICAL_JOINT) ? 3 : 1;
+    links.push_back(link);
+    return (unsigned)links.size() - 1;
+}
+
+void Articulation::setJointDamping(unsigned link, real damping)
+{
+    links[link].damping = damping;
+}
+
+void Articulation::setEnergyClamp(bool clamp)
+{
+    energyClamp = clamp;
+}
+
+void Articulation::setStepLimits(real maxRotation, unsigned maxSteps)
+{
+    assert(maxRotation > 0 && maxSteps > 0);
+    maxStepRotation = maxRotation;
+    Articulation::maxSteps = maxSteps;
+}
+
+void Articulation::addJointForce(unsigned link, real force)
+{
+    links[link].force.x += force;
+}
+
+void Articulation::addJointTorque(unsigned link, const Vector3 &torque)
+{
+    links[link].force += torque;
+}
+
+void Articulation::readVelocities()
+{
+    for (unsigned i = 1; i < links.size(); i++)
+    {
+        Link &link = links[i];
+        const RigidBody *body = link.body;
+        const RigidBody *parentBody = links[link.parent].body;
+
+        Matrix3 orientation;
+        body->getOrientation(&orientation);
+        Vector3 relativeRotation =
+            body->getRotation() - parentBody->getRotation();
+
+        switch (link.type)
+        {
+        case REVOLUTE_JOINT:
+            link.rate.x = orientation.transform(link.axis) * relativeRotation;
+            break;
+
+        case PRISMATIC_JOINT:
+            {
+                Vector3 point = body->getPointInWorldSpace(link.childAnchor);
+                Vector3 relativeVelocity = _pointVelocity(body, point) -
+                    _pointVelocity(parentBody, point);
+                link.rate.x =
+                    orientation.transform(link.axis) * relativeVelocity;
+            }
+            break;
+
+        case SPHERICAL_JOINT:
+            link.rate = orientation.transformTranspose(relativeRotation);
+            break;
+        }
+    }
+}
+
+void Articulation::calculateMotion(unsigned index, const Vector3 &origin)
+{
+    Link &link = links[index];
+    const RigidBody *parentBody = links[link.parent].body;
+
+    Matrix3 orientation;
+    link.body->getOrientation(&orientation);
+    Vector3 anchor =
+        parentBody->getPointInWorldSpace(link.parentAnchor) - origin;
+
+    switch (link.type)
+    {
+    case REVOLUTE_JOINT:
+        {
+            Vector3 axis = orientation.transform(link.axis);
+            _setSpatial(link.motion[0], axis, anchor % axis);
+        }
+        break;
+
+    case PRISMATIC_JOINT:
+        _setSpatial(link.motion[0], Vector3(),
+            orientation.transform(link.axis));
+        break;
+
+    case SPHERICAL_JOINT:
+        for (unsigned k = 0; k < 3; k++)
+        {
+            Vector3 axis = orientation.getAxisVector(k);
+            _setSpatial(link.motion[k], axis, anchor % axis);
+        }
+        break;
+    }
+}
+
+real Articulation::calculateVelocities(const Vector3 &origin,
+                                       const UniformFields *fields)
+{
+    real energy = 0;
+    for (unsigned i = 0; i < links.size(); i++)
+    {
+        Link &link = links[i];
+        RigidBody *body = link.body;
+        Vector3 centre = body->getPosition() - origin;
+
+        if (i == 0)
+        {
+            // The root's velocity is its own.
+            Vector3 rotation = body->getRotation();
+            _setSpatial(link.velocity, rotation,
+                body->getVelocity() - rotation % centre);
+            memset(link.bias, 0, sizeof(link.bias));
+            link.dof = body->getInverseMass() > 0 ? 6 : 0;
+            if (link.dof == 0)
+            {
+                memset(link.inertia, 0, sizeof(link.inertia));
+                memset(link.biasForce, 0, sizeof(link.biasForce));
+                memset(link.appliedForce, 0, sizeof(link.appliedForce));
+                continue;
+            }
+        }
+        else
+        {
+            // Other bodies move with their parent and their joint.
+            calculateMotion(i, origin);
+            real jointVelocity[6] = {0, 0, 0, 0, 0, 0};
+            for (unsigned k = 0; k < link.dof; k++)
+            {
+                for (unsigned j = 0; j < 6; j++)
+                {
+                    jointVelocity[j] += link.motion[k][j] * link.rate[k];
+                }
+            }
+
+            const real *parentVelocity = links[link.parent].velocity;
+            for (unsigned j = 0; j < 6; j++)
+            {
+                link.velocity[j] = parentVelocity[j] + jointVelocity[j];
+            }
+            _crossMotion(link.velocity, jointVelocity, link.bias);
+        }
+
+        // Find the body's inertia and the forces on it.
+        real inverseMass = body->getInverseMass();
+        real mass = ((real)1.0) / inverseMass;
+        _setBodyInertia(link.inertia, mass,
+            body->getInertiaTensorWorld(), centre);
+
+        Vector3 acceleration = body->getAcceleration();
+        if (fields)
+        {
+            fields->addAcceleration(&acceleration, body->getVelocity(),
+                inverseMass, body->getFieldMask());
+        }
+        Vector3 force = body->getAccumulatedForce();
+        force.addScaledVector(acceleration, mass);
+        Vector3 torque = body->getAccumulatedTorque() + centre % force;
+
+        _setSpatial(link.appliedForce, torque, force);
+
+        // The bias force is what it takes to keep the body's
+        // momentum, less the forces that are applied.
+        real momentum[6];
+        _transform(link.inertia, link.velocity, momentum);
+        _crossForce(link.velocity, momentum, link.biasForce);
+        for (unsigned j = 0; j < 6; j++)
+        {
+            link.biasForce[j] -= link.appliedForce[j];
+        }
+        energy += ((real)0.5) * _dot(link.velocity, momentum);
+    }
+    return energy;
+}
+
+void Articulation::calculateInertias(real duration)
+{
+    for (unsigned i = (unsigned)links.size(); i-- > 1;)
+    {
+        Link &link = links[i];
+        Link &parent = links[link.parent];
+        unsigned dof = link.dof;
+
+        // Find the inertia felt by the joint. Its damping is treated
+        // implicitly by adding to this.
+        Matrix3 jointInertia;
+        for (unsigned k = 0; k < dof; k++)
+        {
+            _transform(link.inertia, link.motion[k], link.inertiaMotion[k]);
+        }
+        for (unsigned a = 0; a < dof; a++)
+        {
+            for (unsigned b = 0; b < dof; b++)
+            {
+                jointInertia.data[a*3 + b] =
+                    _dot(link.motion[a], link.inertiaMotion[b]);
+            }
+            jointInertia.data[a*3 + a] += link.damping * duration;
+            link.effort[a] = link.force[a] - link.damping * link.rate[a] -
+                _dot(link.motion[a], link.biasForce);
+        }
+        if (dof == 1)
+        {
+            link.inverseJointInertia.data[0] =
+                ((real)1.0) / jointInertia.data[0];
+        }
+        else
+        {
+            link.inverseJointInertia = jointInertia.inverse();
+        }
+
+        // Pass on what the parent feels through the joint: the
+        // inertia and bias force the joint's motion can't absorb.
+        real scaled[3][6];
+        for (unsigned a = 0; a < dof; a++)
+        {
+            for (unsigned j = 0; j < 6; j++)
+            {
+                real value = 0;
+                for (unsigned b = 0; b < dof; b++)
+                {
+                    value += link.inertiaMotion[b][j] *
+                        link.inverseJointInertia.data[b*3 + a];
+                }
+                scaled[a][j] = value;
+            }
+        }
+
+        real inertia[36];
+        for (unsigned r = 0; r < 6; r++)
+        {
+            for (unsigned c = 0; c < 6; c++)
+            {
+                real value = link.inertia[r*6 + c];
+                for (unsigned a = 0; a < dof; a++)
+                {
+                    value -= scaled[a][r] * link.inertiaMotion[a][c];
+                }
+                inertia[r*6 + c] = value;
+                parent.inertia[r*6 + c] += value;
+            }
+        }
+
+        real biasForce[6];
+        _transform(inertia, link.bias, biasForce);
+        for (unsigned j = 0; j < 6; j++)
+        {
+            real value = link.biasForce[j] + biasForce[j];
+            for (unsigned a = 0; a < dof; a++)
+            {
+                value += scaled[a][j] * link.effort[a];
+            }
+            parent.biasForce[j] += value;
+        }
+    }
+}
+
+void Articulation::calculateAccelerations()
+{
+    Link &root = links[0];
+    memset(root.acceleration, 0, sizeof(root.acceleration));
+    if (root.dof > 0)
+    {
+        real inertia[36];
+        memcpy(inertia, root.inertia, sizeof(inertia));
+        for (unsigned j = 0; j < 6; j++)
+        {
+            root.acceleration[j] = -root.biasForce[j];
+        }
+        _solve(inertia, root.acceleration);
+    }
+
+    for (unsigned i = 1; i < links.size(); i++)
+    {
+        Link &link = links[i];
+        const real *parentAcceleration = links[link.parent].acceleration;
+
+        real acceleration[6];
+        for (unsigned j = 0; j < 6; j++)
+        {
+            acceleration[j] = parentAcceleration[j] + link.bias[j];
+        }
+
+        real effort[3];
+        for (unsigned a = 0; a < link.dof; a++)
+        {
+            effort[a] = link.effort[a] -
+                _dot(link.inertiaMotion[a], acceleration);
+        }
+        for (unsigned a = 0; a < link.dof; a++)
+        {
+            real value = 0;
+            for (unsigned b = 0; b < link.dof; b++)
+            {
+                value += link.inverseJointInertia.data[a*3 + b] * effort[b];
+            }
+            link.jointAcceleration[a] = value;
+
+            for (unsigned j = 0; j < 6; j++)
+            {
+                acceleration[j] += link.motion[a][j] * value;
+            }
+        }
+        memcpy(link.acceleration, acceleration, sizeof(acceleration));
+    }
+}
+
+void Articulation::updateBodies(const Vector3 &origin)
+{
+    Link &root = links[0];
+    RigidBody *rootBody = root.body;
+    Vector3 centre = rootBody->getPosition() - origin;
+    Vector3 rotation = rootBody->getRotation();
+    _setSpatial(root.velocity, rotation,
+        rootBody->getVelocity() - rotation % centre);
+
+    for (unsigned i = 1; i < links.size(); i++)
+    {
+        Link &link = links[i];
+        RigidBody *body = link.body;
+        const RigidBody *parentBody = links[link.parent].body;
+
+        // Place the body from its parent and its joint.
+        Quaternion orientation = parentBody->getOrientation();
+        orientation *= link.restOrientation;
+        if (link.type == REVOLUTE_JOINT)
+        {
+            orientation *= _axisRotation(link.axis, link.position);
+        }
+        else if (link.type == SPHERICAL_JOINT)
+        {
+            orientation *= link.rotation;
+        }
+        body->setOrientation(orientation);
+        body->calculateDerivedData();
+
+        Vector3 anchor = parentBody->getPointInWorldSpace(link.parentAnchor);
+        if (link.type == PRISMATIC_JOINT)
+        {
+            anchor.addScaledVector(body->getDirectionInWorldSpace(link.axis),
+                link.position);
+        }
+        body->setPosition(anchor -
+            body->getDirectionInWorldSpace(link.childAnchor));
+        body->calculateDerivedData();
+
+        // Give it the velocity of its parent and its joint.
+        calculateMotion(i, origin);
+        const real *parentVelocity = links[link.parent].velocity;
+        for (unsigned j = 0; j < 6; j++)
+        {
+            real value = parentVelocity[j];
+            for (unsigned k = 0; k < link.dof; k++)
+            {
+                value += link.motion[k][j] * link.rate[k];
+            }
+            link.velocity[j] = value;
+        }
+        rotation = _angular(link.velocity);
+        centre = body->getPosition() - origin;
+        body->setRotation(rotation);
+        body->setVelocity(_linear(link.velocity) + rotation % centre);
+    }
+}
+
+void Articulation::removeExcessEnergy(real energy, const Vector3 &origin,
+                                      real duration)
+{
+    Link &root = links[0];
+    unsigned count = (unsigned)links.size();
+
+    // Find the kinetic energy the bodies have, and the work the
+    // forces did to give it them.
+    real newEnergy = 0;
+    real work = 0;
+    real momentum[6] = {0, 0, 0, 0, 0, 0};
+    real compositeInertia[36];
+    memset(compositeInertia, 0, sizeof(compositeInertia));
+    for (unsigned i = 0; i < count; i++)
+    {
+        Link &link = links[i];
+        RigidBody *body = link.body;
+        if (body->getInverseMass() > 0)
+        {
+            _setBodyInertia(link.inertia, body->getMass(),
+                body->getInertiaTensorWorld(), body->getPosition() - origin);
+        }
+        else
+        {
+            memset(link.inertia, 0, sizeof(link.inertia));
+        }
+
+        real bodyMomentum[6];
+        _transform(link.inertia, link.velocity, bodyMomentum);
+        newEnergy += ((real)0.5) * _dot(link.velocity, bodyMomentum);
+        for (unsigned j = 0; j < 6; j++) momentum[j] += bodyMomentum[j];
+        for (unsigned j = 0; j < 36; j++)
+        {
+            compositeInertia[j] += link.inertia[j];
+        }
+
+        work += _dot(link.appliedForce, link.velocity);
+        for (unsigned k = 0; k < link.dof && i > 0; k++)
+        {
+            work += link.force[k] * link.rate[k];
+        }
+    }
+
+    real allowed = energy + work * duration;
+    if (newEnergy <= allowed) return;
+
+    // Split the motion into the velocity the whole articulation would
+    // have moving rigidly, and the motion of each body relative to
+    // that. The rigid velocity of a free articulation is the one with
+    // the same momentum, so scaling down the rest leaves its momentum
+    // unchanged. A fixed root keeps its own velocity.
+    real rigid[6];
+    memcpy(rigid, root.velocity, sizeof(rigid));
+    if (root.dof > 0)
+    {
+        memcpy(rigid, momentum, sizeof(rigid));
+        _solve(compositeInertia, rigid);
+    }
+
+    // The energy is a quadratic in the scale applied to the relative
+    // motion. Find the largest scale that gives the allowed energy.
+    real quadratic = 0, linear = 0, constant = 0;
+    for (unsigned i = 0; i < count; i++)
+    {
+        Link &link = links[i];
+        real relative[6], product[6];
+        for (unsigned j = 0; j < 6; j++)
+        {
+            relative[j] = link.velocity[j] - rigid[j];
+        }
+        _transform(link.inertia, relative, product);
+        quadratic += ((real)0.5) * _dot(relative, product);
+        linear += _dot(rigid, product);
+        _transform(link.inertia, rigid, product);
+        constant += ((real)0.5) * _dot(rigid, product);
+    }
+
+    real scale = 0;
+    real discriminant = linear*linear - 4*quadratic*(constant - allowed);
+    if (quadratic > 0 && discriminant >= 0)
+    {
+        scale = (real_sqrt(discriminant) - linear) / (2*quadratic);
+        if (scale < 0) scale = 0;
+        else if (scale > 1) scale = 1;
+    }
+
+    // Apply the scaled motion to the joints and the bodies.
+    for (unsigned i = 0; i < count; i++)
+    {
+        Link &link = links[i];
+        if (i > 0) link.rate *= scale;
+        else if (root.dof == 0) continue;
+
+        for (unsigned j = 0; j < 6; j++)
+        {
+            link.velocity[j] = rigid[j] +
+                (link.velocity[j] - rigid[j]) * scale;
+        }
+        Vector3 rotation = _angular(link.velocity);
+        Vector3 centre = link.body->getPosition() - origin;
+        link.body->setRotation(rotation);
+        link.body->setVelocity(_linear(link.velocity) + rotation % centre);
+    }
+}
+
+void Articulation::integrate(real duration, const UniformFields *fields)
+{
+    assert(duration > 0.0);
+    if (links.empty()) return;
+
+    // Split the step so that no body turns further than the limit in
+    // any part of it, as far as can be told from the bodies' current
+    // rotations.
+    real fastest = 0;
+    for (unsigned i = 0; i < links.size(); i++)
+    {
+        real rotation = links[i].body->getRotation().squareMagnitude();
+        if (rotation > fastest) fastest = rotation;
+    }
+    real turn = real_sqrt(fastest) * duration;
+    unsigned steps = 1;
+    if (turn > maxStepRotation)
+    {
+        steps = (unsigned)real_floor(turn / maxStepRotation) + 1;
+        if (steps > maxSteps) steps = maxSteps;
+    }
+    real stepDuration = duration / (real)steps;
+    for (unsigned step = 0; step < steps; step++)
+    {
+        integrateStep(stepDuration, fields);
+    }
+
+    for (unsigned i = 0; i < links.size(); i++)
+    {
+        links[i].body->clearAccumulators();
+        links[i].force = Vector3();
+    }
+}
+
+void Articulation::integrateStep(real duration, const UniformFields *fields)
+{
+    readVelocities();
+
+    // Everything is measured about the root's centre of mass at the
+    // start of the step, which keeps the values small wherever the
+    // articulation is.
+    Link &rootLink = links[0];
+    RigidBody *root = rootLink.body;
+    Vector3 origin = root->getPosition();
+    real energy = calculateVelocities(origin, fields);
+    calculateInertias(duration);
+    calculateAccelerations();
+
+    // Find the root's new velocity. A fixed root keeps the velocity
+    // it is given.
+    Vector3 velocity = root->getVelocity();
+    Vector3 rotation = root->getRotation();
+    if (rootLink.dof > 0)
+    {
+        // The spatial acceleration is that of the point on the body
+        // at the origin, which is the root's centre of mass, so its
+        // centre accelerates by that plus the turning of its velocity.
+        const real *acceleration = rootLink.acceleration;
+        velocity.addScaledVector(
+            _linear(acceleration) + rotation % velocity, duration);
+        rotation.addScaledVector(_angular(acceleration), duration);
+
+        velocity *= real_pow(root->getLinearDamping(), duration);
+        rotation *= real_pow(root->getAngularDamping(), duration);
+    }
+
+    // Find the new joint rates.
+    for (unsigned i = 1; i < links.size(); i++)
+    {
+        Link &link = links[i];
+        for (unsigned a = 0; a < link.dof; a++)
+        {
+            link.rate[a] += link.jointAcceleration[a] * duration;
+        }
+    }
+
+    // Move the root.
+    root->setVelocity(velocity);
+    root->setRotation(rotation);
+
+    Vector3 position = root->getPosition();
+    position.addScaledVector(velocity, duration);
+    root->setPosition(position);
+
+    Quaternion orientation = root->getOrientation();
+    orientation.addScaledVector(rotation, duration);
+    root->setOrientation(orientation);
+    root->calculateDerivedData();
+
+    // Move the joints.
+    for (unsigned i = 1; i < links.size(); i++)
+    {
+        Link &link = links[i];
+        if (link.type == SPHERICAL_JOINT)
+        {
+            // The rate is in the body's coordinates, so it turns the
+            // rotation from the right.
+            Quaternion change = link.rotation;
+            change.rotateByVector(link.rate * (duration * (real)0.5));
+            link.rotation.r += change.r;
+            link.rotation.i += change.i;
+            link.rotation.j += change.j;
+            link.rotation.k += change.k;
+            link.rotation.normalise();
+        }
+        else
+        {
+            link.position += link.rate.x * duration;
+        }
+    }
+
+    updateBodies(origin);
+
+    // Take out any energy the step added that the forces didn't put
+    // in, if asked to.
+    if (energyClamp) removeExcessEnergy(energy, origin, duration);
+}
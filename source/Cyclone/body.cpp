@@ -141,8 +141,16 @@ void RigidBody::calculateDerivedData()
 {
     orientation.normalise();
 
-    // Calculate the transform matrix for the body.
-    _calculateTransformMatrix(transformMatrix, position, orientation);
+    // Calculate the transform matrix for the body, and only count
+    // it as a change if the body has actually moved.
+    Matrix4 newTransform;
+    _calculateTransformMatrix(newTransform, position, orientation);
+    if (memcmp(newTransform.data, transformMatrix.data,
+        sizeof(transformMatrix.data)) != 0)
+    {
+        transformMatrix = newTransform;
+        transformVersion++;
+    }
 
     // Calculate the inertiaTensor in world space.
     _transformInertiaTensor(inverseInertiaTensorWorld,
@@ -152,7 +160,15 @@ void RigidBody::calculateDerivedData()
 
 }
 
-void RigidBody::integrate(real duration)
+RigidBody::RigidBody()
+:
+id(0),
+fieldMask(FIELD_ALL),
+transformVersion(0)
+{
+}
+
+void RigidBody::integrate(real duration, const UniformFields *fields)
 {
     if (!isAwake) return;
 
@@ -160,6 +176,13 @@ void RigidBody::integrate(real duration)
     lastFrameAcceleration = acceleration;
     lastFrameAcceleration.addScaledVector(forceAccum, inverseMass);
 
+    // Add the world's fields, which don't move immovable bodies.
+    if (fields && inverseMass > 0)
+    {
+        fields->addAcceleration(&lastFrameAcceleration, velocity,
+            inverseMass, fieldMask);
+    }
+
     // Calculate angular acceleration from torque inputs.
     Vector3 angularAcceleration =
         inverseInertiaTensorWorld.transform(torqueAccum);
@@ -419,7 +442,7 @@ void RigidBody::getGLTransform(float matrix[16]) const
     matrix[15] = 1;
 }
 
-Matrix4 RigidBody::getTransform() const
+const Matrix4& RigidBody::getTransform() const
 {
     return transformMatrix;
 }
@@ -521,6 +544,66 @@ void RigidBody::setCanSleep(const bool canSleep)
     if (!canSleep && !isAwake) setAwake();
 }
 
+void RigidBody::setId(const unsigned id)
+{
+    RigidBody::id = id;
+}
+
+void RigidBody::setFieldMask(const unsigned mask)
+{
+    RigidBody::fieldMask = mask;
+}
+
+void RigidBody::getState(RigidBodyState *state) const
+{
+    state->id = id;
+    state->flags = (isAwake ? 1 : 0) | (canSleep ? 2 : 0);
+    state->position[0] = position.x;
+    state->position[1] = position.y;
+    state->position[2] = position.z;
+    state->orientation[0] = orientation.r;
+    state->orientation[1] = orientation.i;
+    state->orientation[2] = orientation.j;
+    state->orientation[3] = orientation.k;
+    state->velocity[0] = velocity.x;
+    state->velocity[1] = velocity.y;
+    state->velocity[2] = velocity.z;
+    state->rotation[0] = rotation.x;
+    state->rotation[1] = rotation.y;
+    state->rotation[2] = rotation.z;
+    state->lastFrameAcceleration[0] = lastFrameAcceleration.x;
+    state->lastFrameAcceleration[1] = lastFrameAcceleration.y;
+    state->lastFrameAcceleration[2] = lastFrameAcceleration.z;
+    state->motion = motion;
+}
+
+void RigidBody::setState(const RigidBodyState &state)
+{
+    // The flags are set directly, since setAwake would change the
+    // velocities and motion we are restoring.
+    isAwake = (state.flags & 1) != 0;
+    canSleep = (state.flags & 2) != 0;
+    position.x = state.position[0];
+    position.y = state.position[1];
+    position.z = state.position[2];
+    orientation.r = state.orientation[0];
+    orientation.i = state.orientation[1];
+    orientation.j = state.orientation[2];
+    orientation.k = state.orientation[3];
+    velocity.x = state.velocity[0];
+    velocity.y = state.velocity[1];
+    velocity.z = state.velocity[2];
+    rotation.x = state.rotation[0];
+    rotation.y = state.rotation[1];
+    rotation.z = state.rotation[2];
+    lastFrameAcceleration.x = state.lastFrameAcceleration[0];
+    lastFrameAcceleration.y = state.lastFrameAcceleration[1];
+    lastFrameAcceleration.z = state.lastFrameAcceleration[2];
+    motion = state.motion;
+
+    calculateDerivedData();
+}
+
 
 void RigidBody::getLastFrameAcceleration(Vector3 *acceleration) const
 {
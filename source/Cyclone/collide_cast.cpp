@@ -0,0 +1,947 @@
+/*
+ * Implementation file for the ray and shape casts.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+#include <cyclone/collide_cast.h>
+
+using namespace cyclone;
+
+/**
+ * Internal function that returns the half-sizes along the axes of
+ * the given transform of a box enclosing a box with the given
+ * half-sizes along the world axes.
+ */
+static inline Vector3 _extentsToLocal(const Matrix4 &transform,
+                                      const Vector3 &extents)
+{
+    Vector3 local;
+    for (unsigned i = 0; i < 3; i++)
+    {
+        local[i] =
+            extents.x * real_abs(transform.data[i]) +
+            extents.y * real_abs(transform.data[4+i]) +
+            extents.z * real_abs(transform.data[8+i]);
+    }
+    return local;
+}
+
+/**
+ * Internal function that returns the point on the segment from start
+ * to end that is closest to the given point.
+ */
+static inline Vector3 _closestPointOnSegment(const Vector3 &point,
+                                             const Vector3 &start,
+                                             const Vector3 &end)
+{
+    Vector3 segment = end - start;
+    real lengthSquared = segment.squareMagnitude();
+    if (lengthSquared <= 0) return start;
+
+    real along = ((point - start) * segment) / lengthSquared;
+    if (along < 0) along = 0;
+    else if (along > 1) along = 1;
+    return start + segment * along;
+}
+
+/**
+ * Internal function that checks if a point lies over a triangle with
+ * the given normal, when looking along the normal.
+ */
+static bool _isOverTriangle(const Vector3 &point, const Vector3 *triangle,
+                            const Vector3 &normal)
+{
+    for (unsigned i = 0; i < 3; i++)
+    {
+        Vector3 edge = triangle[(i+1)%3] - triangle[i];
+        real side = (edge % (point - triangle[i])) * normal;
+        if (side < -(real)1e-6 * edge.squareMagnitude()) return false;
+    }
+    return true;
+}
+
+/**
+ * Internal function that finds how far along a ray it first enters
+ * a sphere. Rays that start inside the sphere don't hit it.
+ */
+static bool _rayAndSphere(const Vector3 &origin, const Vector3 &direction,
+                          const Vector3 &centre, real radius,
+                          real length, real *distance)
+{
+    Vector3 offset = origin - centre;
+    real along = offset * direction;
+    real excess = offset.squareMagnitude() - radius*radius;
+    if (excess <= 0 || along >= 0) return false;
+
+    real discriminant = along*along - excess;
+    if (discriminant < 0) return false;
+
+    real entry = -along - real_sqrt(discriminant);
+    if (entry > length) return false;
+    *distance = entry;
+    return true;
+}
+
+/**
+ * Internal function that finds how far along a ray it first comes
+ * within the given radius of the segment from start to end, and the
+ * point on the segment it is then closest to. The shape within the
+ * radius is a capsule: a cylinder around the segment, capped by a
+ * sphere at each end.
+ */
+static bool _rayAndCapsule(const Vector3 &origin, const Vector3 &direction,
+                           const Vector3 &start, const Vector3 &end,
+                           real radius, real length,
+                           real *distance, Vector3 *closest)
+{
+    bool found = false;
+
+    // Check the cylinder, using the parts of the ray and of its
+    // offset that are at right angles to the segment.
+    Vector3 axis = end - start;
+    real axisSquared = axis.squareMagnitude();
+    if (axisSquared > 0)
+    {
+        Vector3 offset = origin - start;
+        Vector3 across = direction - axis * ((direction * axis) / axisSquared);
+        Vector3 away = offset - axis * ((offset * axis) / axisSquared);
+        real a = across.squareMagnitude();
+        real b = across * away;
+        real c = away.squareMagnitude() - radius*radius;
+        real discriminant = b*b - a*c;
+        if (a > 0 && c > 0 && b < 0 && discriminant >= 0)
+        {
+            real entry = (-b - real_sqrt(discriminant)) / a;
+            real along = ((offset + direction * entry) * axis) / axisSquared;
+            if (entry <= length && along >= 0 && along <= 1)
+            {
+                length = entry;
+                *closest = start + axis * along;
+                found = true;
+            }
+        }
+    }
+
+    // Then the caps.
+    real entry;
+    if (_rayAndSphere(origin, direction, start, radius, length, &entry))
+    {
+        length = entry;
+        *closest = start;
+        found = true;
+    }
+    if (_rayAndSphere(origin, direction, end, radius, length, &entry))
+    {
+        length = entry;
+        *closest = end;
+        found = true;
+    }
+
+    if (found) *distance = length;
+    return found;
+}
+
+/**
+ * Internal function that casts a sphere, or a ray if the radius is
+ * zero, against a box.
+ *
+ * The centre of the sphere hits the box grown by the radius, which
+ * has flat faces, but rounded edges and corners. So the cast is first
+ * made against the grown box as if it were square, and if it arrives
+ * at one of the corner regions, it is redone against the capsules
+ * around the box's edges there.
+ */
+static bool _sweptSphereAndBox(const Vector3 &origin,
+                               const Vector3 &direction, real radius,
+                               const Matrix4 &transform,
+                               const Vector3 &halfSize,
+                               real length, CastHit *hit)
+{
+    Vector3 start = transform.transformInverse(origin);
+    Vector3 velocity = transform.transformInverseDirection(direction);
+
+    // Casts that start touching the box don't hit it.
+    Vector3 nearest = start;
+    for (unsigned i = 0; i < 3; i++)
+    {
+        if (nearest[i] > halfSize[i]) nearest[i] = halfSize[i];
+        else if (nearest[i] < -halfSize[i]) nearest[i] = -halfSize[i];
+    }
+    if ((start - nearest).squareMagnitude() <= radius*radius) return false;
+
+    BoundingBox grown(Vector3(), halfSize);
+    real entry;
+    if (!grown.intersectsRay(start, velocity, length,
+        Vector3(radius, radius, radius), &entry)) return false;
+    Vector3 centre = start + velocity * entry;
+
+    // Find which side of the box's faces the centre arrives on.
+    Vector3 side;
+    unsigned outside = 0;
+    for (unsigned i = 0; i < 3; i++)
+    {
+        if (centre[i] > halfSize[i]) side[i] = 1;
+        else if (centre[i] < -halfSize[i]) side[i] = -1;
+        else continue;
+        outside++;
+    }
+
+    Vector3 point, normal;
+    if (outside < 2 || radius <= 0)
+    {
+        // The centre is beside a face, so the grown box's face is
+        // where it hits: the one the centre is furthest outside.
+        unsigned face = 0;
+        real furthest = -REAL_MAX;
+        for (unsigned i = 0; i < 3; i++)
+        {
+            real beyond = real_abs(centre[i]) - halfSize[i];
+            if (beyond > furthest)
+            {
+                furthest = beyond;
+                face = i;
+            }
+        }
+        normal[face] = centre[face] < 0 ? -1 : 1;
+        point = centre;
+        for (unsigned i = 0; i < 3; i++)
+        {
+            if (point[i] > halfSize[i]) point[i] = halfSize[i];
+            else if (point[i] < -halfSize[i]) point[i] = -halfSize[i];
+        }
+    }
+    else
+    {
+        // Beside an edge only that edge's capsule is tried, and
+        // beside a corner, the three meeting there.
+        bool found = false;
+        for (unsigned k = 0; k < 3; k++)
+        {
+            if (outside == 2 && side[k] != 0) continue;
+
+            Vector3 edgeStart, edgeEnd;
+            for (unsigned j = 0; j < 3; j++)
+            {
+                edgeStart[j] = edgeEnd[j] = side[j] * halfSize[j];
+            }
+            edgeStart[k] = -halfSize[k];
+            edgeEnd[k] = halfSize[k];
+
+            real distance;
+            Vector3 closest;
+            if (_rayAndCapsule(start, velocity, edgeStart, edgeEnd, radius,
+                length, &distance, &closest))
+            {
+                length = distance;
+                point = closest;
+                found = true;
+            }
+        }
+        if (!found) return false;
+
+        entry = length;
+        normal = (start + velocity * entry - point) * (((real)1.0) / radius);
+    }
+
+    hit->distance = entry;
+    hit->point = transform.transform(point);
+    hit->normal = transform.transformDirection(normal);
+    return true;
+}
+
+/**
+ * Internal function that casts a sphere, or a ray if the radius is
+ * zero, against a triangle. The sphere first hits the face, if it
+ * hits at all, unless it passes beside it, in which case it can only
+ * hit the capsules around the edges.
+ */
+static bool _sweptSphereAndTriangle(const Vector3 &origin,
+                                    const Vector3 &direction, real radius,
+                                    const Vector3 *triangle,
+                                    real length, CastHit *hit)
+{
+    Vector3 normal =
+        (triangle[1] - triangle[0]) % (triangle[2] - triangle[0]);
+    normal.normalise();
+    if (normal.squareMagnitude() <= 0) return false;
+
+    // Triangles can't be hit from behind.
+    real height = (origin - triangle[0]) * normal;
+    if (height < 0) return false;
+
+    // Casts that start touching the triangle don't hit it.
+    if (height <= radius)
+    {
+        if (_isOverTriangle(origin, triangle, normal)) return false;
+        for (unsigned i = 0; i < 3; i++)
+        {
+            Vector3 closest = _closestPointOnSegment(
+                origin, triangle[i], triangle[(i+1)%3]);
+            if ((origin - closest).squareMagnitude() <= radius*radius)
+            {
+                return false;
+            }
+        }
+    }
+
+    real speed = direction * normal;
+    if (height > radius)
+    {
+        // The sphere can't touch anything until it is within its
+        // radius of the plane.
+        if (speed >= 0) return false;
+        real distance = (height - radius) / -speed;
+        if (distance > length) return false;
+
+        Vector3 point = origin + direction * distance - normal * radius;
+        if (_isOverTriangle(point, triangle, normal))
+        {
+            hit->distance = distance;
+            hit->point = point;
+            hit->normal = normal;
+            return true;
+        }
+    }
+    if (radius <= 0) return false;
+
+    bool found = false;
+    Vector3 point;
+    for (unsigned i = 0; i < 3; i++)
+    {
+        real distance;
+        Vector3 closest;
+        if (_rayAndCapsule(origin, direction, triangle[i],
+            triangle[(i+1)%3], radius, length, &distance, &closest))
+        {
+            length = distance;
+            point = closest;
+            found = true;
+        }
+    }
+    if (!found) return false;
+
+    hit->distance = length;
+    hit->point = point;
+    hit->normal = (origin + direction * length - point) *
+        (((real)1.0) / radius);
+    return true;
+}
+
+/**
+ * Internal function that returns the point of the cast shape that is
+ * furthest against the given normal, after travelling the given
+ * distance. For a box this is the middle of the face or edge facing
+ * that way, if there is one, rather than an arbitrary corner.
+ */
+static Vector3 _supportPoint(const CastShape &shape, const Vector3 &normal,
+                             real distance)
+{
+    Vector3 point = shape.origin + shape.direction * distance;
+    if (shape.type == CAST_SPHERE)
+    {
+        point -= normal * shape.radius;
+    }
+    else if (shape.type == CAST_BOX)
+    {
+        for (unsigned i = 0; i < 3; i++)
+        {
+            Vector3 axis = shape.transform.getAxisVector(i);
+            real facing = axis * normal;
+            if (facing > (real)0.01) point -= axis * shape.halfSize[i];
+            else if (facing < -(real)0.01) point += axis * shape.halfSize[i];
+        }
+    }
+    return point;
+}
+
+/**
+ * Internal function that finds the lowest and highest projections of
+ * a box onto the given axis.
+ */
+static inline void _projectBox(const Matrix4 &transform,
+                               const Vector3 &halfSize, const Vector3 &axis,
+                               real *low, real *high)
+{
+    real centre = transform.getAxisVector(3) * axis;
+    real extent =
+        halfSize.x * real_abs(transform.getAxisVector(0) * axis) +
+        halfSize.y * real_abs(transform.getAxisVector(1) * axis) +
+        halfSize.z * real_abs(transform.getAxisVector(2) * axis);
+    *low = centre - extent;
+    *high = centre + extent;
+}
+
+/**
+ * Internal class that runs a swept separating axis test between a
+ * moving convex shape and a fixed one. On each axis that could
+ * separate them, the moving shape's projection overlaps the fixed
+ * one's for a range of distances along the cast. The shapes touch
+ * where all these ranges overlap, first at the latest of their
+ * starts, and the axis with that start is the normal of the hit.
+ */
+struct _SweptAxes
+{
+    real enter;
+    real leave;
+    Vector3 normal;
+
+    _SweptAxes(real length)
+        : enter(-REAL_MAX), leave(length)
+    {
+    }
+
+    /**
+     * Adds an axis, given the projections of the shapes onto it at
+     * the start, and the speed of the moving shape along it. Returns
+     * false if the shapes can't touch.
+     */
+    bool add(const Vector3 &axis, real movingLow, real movingHigh,
+             real fixedLow, real fixedHigh, real speed)
+    {
+        real start, end;
+        if (movingHigh < fixedLow)
+        {
+            if (speed <= 0) return false;
+            start = (fixedLow - movingHigh) / speed;
+            end = (fixedHigh - movingLow) / speed;
+            if (start > enter)
+            {
+                enter = start;
+                normal = axis * -1;
+            }
+        }
+        else if (movingLow > fixedHigh)
+        {
+            if (speed >= 0) return false;
+            start = (fixedHigh - movingLow) / speed;
+            end = (fixedLow - movingHigh) / speed;
+            if (start > enter)
+            {
+                enter = start;
+                normal = axis;
+            }
+        }
+        else
+        {
+            // Already overlapping on this axis.
+            if (speed > 0) end = (fixedHigh - movingLow) / speed;
+            else if (speed < 0) end = (fixedLow - movingHigh) / speed;
+            else end = REAL_MAX;
+        }
+
+        if (end < leave) leave = end;
+        return enter <= leave;
+    }
+
+    /**
+     * Fills in the hit, if the shapes didn't start touching.
+     */
+    bool setHit(const CastShape &shape, CastHit *hit) const
+    {
+        if (enter <= 0) return false;
+        hit->distance = enter;
+        hit->normal = normal;
+        hit->point = _supportPoint(shape, normal, enter);
+        return true;
+    }
+};
+
+/**
+ * Internal function that turns the given vector into a unit axis,
+ * returning false if it is too short to be used, as for the product
+ * of two parallel edges.
+ */
+static inline bool _makeAxis(Vector3 &axis)
+{
+    real squared = axis.squareMagnitude();
+    if (squared < (real)1e-6) return false;
+    axis *= ((real)1.0) / real_sqrt(squared);
+    return true;
+}
+
+/**
+ * Internal function that casts a box against a box.
+ */
+static bool _sweptBoxAndBox(const CastShape &shape,
+                            const Matrix4 &transform,
+                            const Vector3 &halfSize,
+                            real length, CastHit *hit)
+{
+    Vector3 axes[15];
+    unsigned count = 0;
+    for (unsigned i = 0; i < 3; i++)
+    {
+        axes[count++] = shape.transform.getAxisVector(i);
+        axes[count++] = transform.getAxisVector(i);
+    }
+    for (unsigned i = 0; i < 3; i++)
+    {
+        for (unsigned j = 0; j < 3; j++)
+        {
+            Vector3 axis = shape.transform.getAxisVector(i) %
+                transform.getAxisVector(j);
+            if (_makeAxis(axis)) axes[count++] = axis;
+        }
+    }
+
+    _SweptAxes sweep(length);
+    for (unsigned i = 0; i < count; i++)
+    {
+        real movingLow, movingHigh, fixedLow, fixedHigh;
+        _projectBox(shape.transform, shape.halfSize, axes[i],
+            &movingLow, &movingHigh);
+        _projectBox(transform, halfSize, axes[i], &fixedLow, &fixedHigh);
+        if (!sweep.add(axes[i], movingLow, movingHigh, fixedLow, fixedHigh,
+            shape.direction * axes[i])) return false;
+    }
+    return sweep.setHit(shape, hit);
+}
+
+/**
+ * Internal function that casts a box against a triangle.
+ */
+static bool _sweptBoxAndTriangle(const CastShape &shape,
+                                 const Vector3 *triangle,
+                                 real length, CastHit *hit)
+{
+    Vector3 normal =
+        (triangle[1] - triangle[0]) % (triangle[2] - triangle[0]);
+    if (!_makeAxis(normal)) return false;
+    if ((shape.origin - triangle[0]) * normal < 0) return false;
+
+    Vector3 axes[13];
+    unsigned count = 0;
+    axes[count++] = normal;
+    for (unsigned i = 0; i < 3; i++)
+    {
+        axes[count++] = shape.transform.getAxisVector(i);
+    }
+    for (unsigned i = 0; i < 3; i++)
+    {
+        Vector3 edge = triangle[(i+1)%3] - triangle[i];
+        for (unsigned j = 0; j < 3; j++)
+        {
+            Vector3 axis = shape.transform.getAxisVector(j) % edge;
+            if (_makeAxis(axis)) axes[count++] = axis;
+        }
+    }
+
+    _SweptAxes sweep(length);
+    for (unsigned i = 0; i < count; i++)
+    {
+        real movingLow, movingHigh;
+        _projectBox(shape.transform, shape.halfSize, axes[i],
+            &movingLow, &movingHigh);
+        real fixedLow = triangle[0] * axes[i];
+        real fixedHigh = fixedLow;
+        for (unsigned j = 1; j < 3; j++)
+        {
+            real projection = triangle[j] * axes[i];
+            if (projection < fixedLow) fixedLow = projection;
+            if (projection > fixedHigh) fixedHigh = projection;
+        }
+        if (!sweep.add(axes[i], movingLow, movingHigh, fixedLow, fixedHigh,
+            shape.direction * axes[i])) return false;
+    }
+    return sweep.setHit(shape, hit);
+}
+
+void CastShape::setRay(const Vector3 &origin, const Vector3 &direction)
+{
+    type = CAST_RAY;
+    CastShape::origin = origin;
+    CastShape::direction = direction;
+    radius = 0;
+    transform = Matrix4();
+    halfSize = Vector3();
+    extents = Vector3();
+}
+
+void CastShape::setSphere(const Vector3 &centre, real radius,
+                          const Vector3 &direction)
+{
+    type = CAST_SPHERE;
+    origin = centre;
+    CastShape::direction = direction;
+    CastShape::radius = radius;
+    transform = Matrix4();
+    halfSize = Vector3(radius, radius, radius);
+    extents = halfSize;
+}
+
+void CastShape::setBox(const Matrix4 &transform, const Vector3 &halfSize,
+                       const Vector3 &direction)
+{
+    type = CAST_BOX;
+    origin = transform.getAxisVector(3);
+    CastShape::direction = direction;
+    radius = 0;
+    CastShape::transform = transform;
+    CastShape::halfSize = halfSize;
+    for (unsigned i = 0; i < 3; i++)
+    {
+        extents[i] =
+            halfSize.x * real_abs(transform.data[i*4]) +
+            halfSize.y * real_abs(transform.data[i*4+1]) +
+            halfSize.z * real_abs(transform.data[i*4+2]);
+    }
+}
+
+bool CastTests::shapeAndSphere(const CastShape &shape,
+                               const Vector3 &centre, real radius,
+                               real length, CastHit *hit)
+{
+    if (shape.type == CAST_BOX)
+    {
+        // A box hitting a sphere is a sphere hitting the box, cast
+        // the other way.
+        CastHit reverse;
+        if (!_sweptSphereAndBox(centre, shape.direction * -1, radius,
+            shape.transform, shape.halfSize, length, &reverse)) return false;
+
+        hit->distance = reverse.distance;
+        hit->point = reverse.point + shape.direction * reverse.distance;
+        hit->normal = reverse.normal * -1;
+        return true;
+    }
+
+    real reach = radius + shape.radius;
+    real distance;
+    if (!_rayAndSphere(shape.origin, shape.direction, centre, reach,
+        length, &distance)) return false;
+
+    Vector3 normal = (shape.origin + shape.direction * distance - centre) *
+        (((real)1.0) / reach);
+    hit->distance = distance;
+    hit->point = centre + normal * radius;
+    hit->normal = normal;
+    return true;
+}
+
+bool CastTests::shapeAndBox(const CastShape &shape,
+                            const Matrix4 &transform,
+                            const Vector3 &halfSize,
+                            real length, CastHit *hit)
+{
+    if (shape.type == CAST_BOX)
+    {
+        return _sweptBoxAndBox(shape, transform, halfSize, length, hit);
+    }
+    return _sweptSphereAndBox(shape.origin, shape.direction, shape.radius,
+        transform, halfSize, length, hit);
+}
+
+bool CastTests::shapeAndTriangle(const CastShape &shape,
+                                 const Vector3 *triangle,
+                                 real length, CastHit *hit)
+{
+    if (shape.type == CAST_BOX)
+    {
+        return _sweptBoxAndTriangle(shape, triangle, length, hit);
+    }
+    return _sweptSphereAndTriangle(shape.origin, shape.direction,
+        shape.radius, triangle, length, hit);
+}
+
+bool CastTests::shapeAndHalfSpace(const CastShape &shape,
+                                  const CollisionPlane &plane,
+                                  real length, CastHit *hit)
+{
+    // Find how far the shape reaches towards the plane.
+    real reach = shape.radius;
+    if (shape.type == CAST_BOX)
+    {
+        for (unsigned i = 0; i < 3; i++)
+        {
+            reach += shape.halfSize[i] *
+                real_abs(shape.transform.getAxisVector(i) * plane.direction);
+        }
+    }
+
+    real height = plane.direction * shape.origin - plane.offset - reach;
+    real speed = plane.direction * shape.direction;
+    if (height <= 0 || speed >= 0) return false;
+
+    real distance = height / -speed;
+    if (distance > length) return false;
+
+    hit->distance = distance;
+    hit->normal = plane.direction;
+    hit->point = _supportPoint(shape, plane.direction, distance);
+    return true;
+}
+
+bool CastTests::shapeAndPrimitive(const CastShape &shape,
+                                  const CollisionPrimitive &primitive,
+                                  real length, CastHit *hit)
+{
+    bool found = false;
+    switch (primitive.getType())
+    {
+    case PRIMITIVE_SPHERE:
+        found = shapeAndSphere(shape, primitive.getAxis(3),
+            static_cast<const CollisionSphere&>(primitive).radius,
+            length, hit);
+        break;
+
+    case PRIMITIVE_BOX:
+        found = shapeAndBox(shape, primitive.getTransform(),
+            static_cast<const CollisionBox&>(primitive).halfSize,
+            length, hit);
+        break;
+
+    case PRIMITIVE_COMPOUND:
+        {
+            // The children fill in the hit themselves.
+            const CollisionCompound &compound =
+                static_cast<const CollisionCompound&>(primitive);
+            real entry;
+            if (compound.nodes.empty() ||
+                !compound.nodes[0].volume.intersectsRay(shape.origin,
+                    shape.direction, length, shape.extents, &entry))
+            {
+                return false;
+            }
+            return shapeAndCompoundNode(shape, compound, 0, length, hit);
+        }
+
+    case PRIMITIVE_MESH:
+        found = shapeAndMesh(shape,
+            static_cast<const CollisionMesh&>(primitive), length, hit);
+        break;
+
+    case PRIMITIVE_HEIGHTFIELD:
+        found = shapeAndHeightfield(shape,
+            static_cast<const CollisionHeightfield&>(primitive), length, hit);
+        break;
+    }
+
+    if (found)
+    {
+        hit->body = primitive.body;
+        hit->primitive = &primitive;
+    }
+    return found;
+}
+
+bool CastTests::shapeAndCompoundNode(const CastShape &shape,
+                                     const CollisionCompound &compound,
+                                     unsigned index, real length,
+                                     CastHit *hit)
+{
+    const CollisionCompound::Node &node = compound.nodes[index];
+    if (node.isLeaf())
+    {
+        return shapeAndPrimitive(shape, *node.primitive, length, hit);
+    }
+
+    real entry[2];
+    bool crosses[2];
+    for (unsigned i = 0; i < 2; i++)
+    {
+        crosses[i] = compound.nodes[node.children[i]].volume.intersectsRay(
+            shape.origin, shape.direction, length, shape.extents, entry + i);
+    }
+
+    // Try the nearer child first, as a hit there can rule out the
+    // further one.
+    unsigned first = (crosses[1] && (!crosses[0] || entry[1] < entry[0])) ?
+        1 : 0;
+    bool found = false;
+    for (unsigned i = 0; i < 2; i++)
+    {
+        unsigned child = i == 0 ? first : 1 - first;
+        if (crosses[child] && entry[child] <= length &&
+            shapeAndCompoundNode(shape, compound, node.children[child],
+                length, hit))
+        {
+            length = hit->distance;
+            found = true;
+        }
+    }
+    return found;
+}
+
+bool CastTests::shapeAndMesh(const CastShape &shape,
+                             const CollisionMesh &mesh,
+                             real length, CastHit *hit)
+{
+    if (mesh.nodes.empty()) return false;
+
+    // Move the cast into the space of the quantised bounds. This
+    // doesn't change distances along the cast, so the nodes' bounds
+    // can be checked against it as they are.
+    const Matrix4 &transform = mesh.getTransform();
+    Vector3 origin = transform.transformInverse(shape.origin);
+    Vector3 direction = transform.transformInverseDirection(shape.direction);
+    Vector3 extents = _extentsToLocal(transform, shape.extents);
+    Vector3 start, velocity, inflate;
+    for (unsigned j = 0; j < 3; j++)
+    {
+        start[j] = (origin[j] - mesh.boundsMinimum[j]) * mesh.quantisation[j];
+        velocity[j] = direction[j] * mesh.quantisation[j];
+        inflate[j] = extents[j] * mesh.quantisation[j];
+    }
+
+    // Walk the nodes in order, skipping the subtrees of branches
+    // the cast misses. Each hit shortens the cast, so fewer branches
+    // are crossed as the walk goes on.
+    bool found = false;
+    unsigned index = 0;
+    unsigned end = (unsigned)mesh.nodes.size();
+    while (index < end)
+    {
+        const CollisionMesh::Node &node = mesh.nodes[index];
+        Vector3 low(node.minimum[0], node.minimum[1], node.minimum[2]);
+        Vector3 high(node.maximum[0], node.maximum[1], node.maximum[2]);
+        BoundingBox volume((low + high) * ((real)0.5),
+            (high - low) * ((real)0.5));
+        real entry;
+        bool crosses = volume.intersectsRay(start, velocity, length,
+            inflate, &entry);
+        bool leaf = (node.data & CollisionMesh::LEAF_NODE) != 0;
+
+        if (crosses && leaf)
+        {
+            unsigned triangle = node.data & ~CollisionMesh::LEAF_NODE;
+            Vector3 corners[3];
+            for (unsigned i = 0; i < 3; i++)
+            {
+                corners[i] = transform.transform(
+                    mesh.vertices[mesh.indices[triangle*3 + i]]);
+            }
+            if (shapeAndTriangle(shape, corners, length, hit))
+            {
+                length = hit->distance;
+                found = true;
+            }
+        }
+
+        if (crosses || leaf) index++;
+        else index += node.data;
+    }
+    return found;
+}
+
+bool CastTests::shapeAndHeightfield(const CastShape &shape,
+                                    const CollisionHeightfield &heightfield,
+                                    real length, CastHit *hit)
+{
+    unsigned columns = heightfield.columns;
+    unsigned rows = heightfield.rows;
+    real spacing = heightfield.spacing;
+    if (columns < 2 || rows < 2) return false;
+
+    const Matrix4 &transform = heightfield.getTransform();
+    Vector3 origin = transform.transformInverse(shape.origin);
+    Vector3 direction = transform.transformInverseDirection(shape.direction);
+    Vector3 extents = _extentsToLocal(transform, shape.extents);
+
+    // Find where the cast enters the grid's bounds.
+    Vector3 boundsHalfSize(
+        (columns - 1) * spacing * ((real)0.5),
+        (heightfield.maximumHeight - heightfield.minimumHeight) * ((real)0.5),
+        (rows - 1) * spacing * ((real)0.5));
+    BoundingBox bounds(Vector3(boundsHalfSize.x,
+        heightfield.minimumHeight + boundsHalfSize.y, boundsHalfSize.z),
+        boundsHalfSize);
+    real distance;
+    if (!bounds.intersectsRay(origin, direction, length, extents, &distance))
+    {
+        return false;
+    }
+
+    // The shape can touch cells up to this many away from the one
+    // under its centre.
+    int reachX = (int)real_floor(extents.x / spacing) + 1;
+    int reachZ = (int)real_floor(extents.z / spacing) + 1;
+    if (extents.x <= 0) reachX = 0;
+    if (extents.z <= 0) reachZ = 0;
+    int lastColumn = (int)columns - 2;
+    int lastRow = (int)rows - 2;
+
+    // Step through the cells under the centre of the shape in the
+    // order it passes over them, working out the distance at which
+    // it next crosses into a new column and a new row.
+    Vector3 point = origin + direction * distance;
+    int column = (int)real_floor(point.x / spacing);
+    int row = (int)real_floor(point.z / spacing);
+    int stepX = direction.x > 0 ? 1 : -1;
+    int stepZ = direction.z > 0 ? 1 : -1;
+    real nextX = REAL_MAX, nextZ = REAL_MAX;
+    real deltaX = REAL_MAX, deltaZ = REAL_MAX;
+    if (direction.x != 0)
+    {
+        deltaX = spacing / real_abs(direction.x);
+        nextX = distance +
+            ((column + (stepX > 0 ? 1 : 0)) * spacing - point.x) / direction.x;
+    }
+    if (direction.z != 0)
+    {
+        deltaZ = spacing / real_abs(direction.z);
+        nextZ = distance +
+            ((row + (stepZ > 0 ? 1 : 0)) * spacing - point.z) / direction.z;
+    }
+
+    bool found = false;
+    while (distance <= length)
+    {
+        // Stop once the cells in reach have left the grid for good.
+        if ((stepX > 0 ? column - reachX > lastColumn : column + reachX < 0) ||
+            (stepZ > 0 ? row - reachZ > lastRow : row + reachZ < 0))
+        {
+            break;
+        }
+
+        int columnStart = column - reachX < 0 ? 0 : column - reachX;
+        int columnEnd = column + reachX > lastColumn ?
+            lastColumn : column + reachX;
+        int rowStart = row - reachZ < 0 ? 0 : row - reachZ;
+        int rowEnd = row + reachZ > lastRow ? lastRow : row + reachZ;
+        for (int z = rowStart; z <= rowEnd; z++)
+        {
+            for (int x = columnStart; x <= columnEnd; x++)
+            {
+                Vector3 p00 = transform.transform(heightfield.getPoint(x, z));
+                Vector3 p10 = transform.transform(heightfield.getPoint(x + 1, z));
+                Vector3 p01 = transform.transform(heightfield.getPoint(x, z + 1));
+                Vector3 p11 = transform.transform(
+                    heightfield.getPoint(x + 1, z + 1));
+
+                Vector3 first[3] = { p00, p01, p10 };
+                Vector3 second[3] = { p10, p01, p11 };
+                if (shapeAndTriangle(shape, first, length, hit))
+                {
+                    length = hit->distance;
+                    found = true;
+                }
+                if (shapeAndTriangle(shape, second, length, hit))
+                {
+                    length = hit->distance;
+                    found = true;
+                }
+            }
+        }
+
+        if (nextX < nextZ)
+        {
+            distance = nextX;
+            nextX += deltaX;
+            column += stepX;
+        }
+        else
+        {
+            distance = nextZ;
+            nextZ += deltaZ;
+            row += stepZ;
+        }
+    }
+    return found;
+}
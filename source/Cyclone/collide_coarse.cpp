@@ -11,10 +11,36 @@
  */
 
 
+#include <memory.h>
 #include <cyclone/collide_coarse.h>
 
 using namespace cyclone;
 
+RayPacket::RayPacket()
+{
+    memset(this, 0, sizeof(RayPacket));
+}
+
+void RayPacket::setRay(unsigned lane, const Vector3 &origin,
+                       const Vector3 &direction, real length)
+{
+    // Large enough to put the crossing of any slab out of reach,
+    // without overflowing when multiplied.
+    const real huge = (real)1e30;
+
+    originX[lane] = origin.x;
+    originY[lane] = origin.y;
+    originZ[lane] = origin.z;
+    directionX[lane] = direction.x;
+    directionY[lane] = direction.y;
+    directionZ[lane] = direction.z;
+    inverseX[lane] = direction.x != 0 ? ((real)1.0) / direction.x : huge;
+    inverseY[lane] = direction.y != 0 ? ((real)1.0) / direction.y : huge;
+    inverseZ[lane] = direction.z != 0 ? ((real)1.0) / direction.z : huge;
+    RayPacket::length[lane] = length;
+    active |= 1u << lane;
+}
+
 BoundingSphere::BoundingSphere(const Vector3 &centre, real radius)
 {
     BoundingSphere::centre = centre;
@@ -75,4 +101,111 @@ real BoundingSphere::getGrowth(const BoundingSphere &other) const
     // We return a value proportional to the change in surface
     // area of the sphere.
     return newSphere.radius*newSphere.radius - radius*radius;
-}
\ No newline at end of file
+}
+
+bool BoundingSphere::intersectsRay(const Vector3 &origin,
+                                   const Vector3 &direction, real length,
+                                   const Vector3 &inflate, real *entry) const
+{
+    real grownRadius = radius + inflate.magnitude();
+    Vector3 offset = origin - centre;
+    real along = offset * direction;
+    real excess = offset.squareMagnitude() - grownRadius*grownRadius;
+
+    // Check if the ray starts inside the sphere
+    if (excess <= 0)
+    {
+        *entry = 0;
+        return true;
+    }
+
+    // Otherwise it must point towards the sphere, and its line
+    // must pass within the radius.
+    if (along >= 0) return false;
+    real discriminant = along*along - excess;
+    if (discriminant < 0) return false;
+
+    *entry = -along - real_sqrt(discriminant);
+    return *entry <= length;
+}
+
+BoundingBox::BoundingBox(const Vector3 &centre, const Vector3 &halfSize)
+{
+    BoundingBox::centre = centre;
+    BoundingBox::halfSize = halfSize;
+}
+
+BoundingBox::BoundingBox(const BoundingBox &one, const BoundingBox &two)
+{
+    Vector3 minimum, maximum;
+    for (unsigned i = 0; i < 3; i++)
+    {
+        real oneLow = one.centre[i] - one.halfSize[i];
+        real twoLow = two.centre[i] - two.halfSize[i];
+        real oneHigh = one.centre[i] + one.halfSize[i];
+        real twoHigh = two.centre[i] + two.halfSize[i];
+        minimum[i] = oneLow < twoLow ? oneLow : twoLow;
+        maximum[i] = oneHigh > twoHigh ? oneHigh : twoHigh;
+    }
+    centre = (minimum + maximum) * ((real)0.5);
+    halfSize = (maximum - minimum) * ((real)0.5);
+}
+
+bool BoundingBox::overlaps(const BoundingBox *other) const
+{
+    for (unsigned i = 0; i < 3; i++)
+    {
+        if (real_abs(centre[i] - other->centre[i]) >
+            halfSize[i] + other->halfSize[i]) return false;
+    }
+    return true;
+}
+
+real BoundingBox::getGrowth(const BoundingBox &other) const
+{
+    BoundingBox newBox(*this, other);
+
+    // We return a value proportional to the change in surface
+    // area of the box.
+    return newBox.halfSize.x * newBox.halfSize.y +
+        newBox.halfSize.y * newBox.halfSize.z +
+        newBox.halfSize.z * newBox.halfSize.x -
+        halfSize.x * halfSize.y -
+        halfSize.y * halfSize.z -
+        halfSize.z * halfSize.x;
+}
+
+bool BoundingBox::intersectsRay(const Vector3 &origin,
+                                const Vector3 &direction, real length,
+                                const Vector3 &inflate, real *entry) const
+{
+    // Clip the ray to the slab between each pair of faces in turn.
+    real enter = 0;
+    real leave = length;
+    for (unsigned i = 0; i < 3; i++)
+    {
+        real offset = origin[i] - centre[i];
+        real extent = halfSize[i] + inflate[i];
+        if (direction[i] == 0)
+        {
+            if (real_abs(offset) > extent) return false;
+            continue;
+        }
+
+        real inverse = ((real)1.0) / direction[i];
+        real one = (-extent - offset) * inverse;
+        real two = (extent - offset) * inverse;
+        if (one > two)
+        {
+            real swap = one;
+            one = two;
+            two = swap;
+        }
+        if (one > enter) enter = one;
+        if (two < leave) leave = two;
+        if (enter > leave) return false;
+    }
+
+    *entry = enter;
+    return true;
+}
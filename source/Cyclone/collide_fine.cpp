@@ -12,6 +12,7 @@
 
 
 #include <cyclone/collide_fine.h>
+#include <cyclone/collide_mesh.h>
 #include <memory.h>
 #include <assert.h>
 #include <cstdlib>
@@ -19,9 +20,177 @@
 
 using namespace cyclone;
 
+CollisionPrimitive::CollisionPrimitive()
+:
+body(0),
+boundingBox(Vector3(), Vector3()),
+transformBody(0),
+transformVersion(0),
+transformCurrent(false)
+{
+}
+
 void CollisionPrimitive::calculateInternals()
 {
-    transform = body->getTransform() * offset;
+    // Nothing has changed if the body hasn't moved since last time.
+    // Primitives without a body never move once calculated.
+    unsigned version = body ? body->getTransformVersion() : 0;
+    if (transformCurrent && transformBody == body &&
+        transformVersion == version) return;
+
+    setTransform(body ? body->getTransform() * offset : offset);
+
+    transformBody = body;
+    transformVersion = version;
+    transformCurrent = true;
+}
+
+void CollisionPrimitive::setTransform(const Matrix4 &newTransform)
+{
+    transform = newTransform;
+    boundingBox = BoundingBox(transform.getAxisVector(3),
+        getBoundingHalfSize());
+}
+
+Vector3 CollisionPrimitive::getBoundingHalfSize() const
+{
+    return Vector3();
+}
+
+Vector3 CollisionSphere::getBoundingHalfSize() const
+{
+    return Vector3(radius, radius, radius);
+}
+
+Vector3 CollisionBox::getBoundingHalfSize() const
+{
+    // Each world axis sees the box's local axes projected onto it.
+    Vector3 result;
+    for (unsigned i = 0; i < 3; i++)
+    {
+        result[i] =
+            halfSize.x * real_abs(transform.data[i*4]) +
+            halfSize.y * real_abs(transform.data[i*4+1]) +
+            halfSize.z * real_abs(transform.data[i*4+2]);
+    }
+    return result;
+}
+
+void CollisionCompound::addChild(CollisionPrimitive *child)
+{
+    child->body = body;
+    children.push_back(child);
+
+    // The hierarchy is rebuilt the next time the compound moves.
+    nodes.clear();
+    invalidate();
+}
+
+void CollisionCompound::clearChildren()
+{
+    children.clear();
+    nodes.clear();
+    invalidate();
+}
+
+void CollisionCompound::setTransform(const Matrix4 &newTransform)
+{
+    transform = newTransform;
+
+    // Move the children with the compound. Their caches are marked
+    // as up to date, so they aren't recalculated from the body alone.
+    for (unsigned i = 0; i < children.size(); i++)
+    {
+        CollisionPrimitive *child = children[i];
+        child->body = body;
+        child->setTransform(transform * child->offset);
+        child->transformBody = body;
+        child->transformVersion = body ? body->getTransformVersion() : 0;
+        child->transformCurrent = true;
+    }
+
+    if (children.empty())
+    {
+        boundingBox = BoundingBox(transform.getAxisVector(3), Vector3());
+        return;
+    }
+
+    // Build the hierarchy the first time it is needed.
+    if (nodes.empty())
+    {
+        std::vector<unsigned> indices(children.size());
+        for (unsigned i = 0; i < indices.size(); i++) indices[i] = i;
+        buildNodes(&indices[0], (unsigned)indices.size());
+    }
+
+    // Refit the hierarchy. Every node is stored before its children,
+    // so working backwards reaches the children first.
+    for (unsigned i = (unsigned)nodes.size(); i-- > 0; )
+    {
+        Node &node = nodes[i];
+        if (node.isLeaf())
+        {
+            node.volume = node.primitive->boundingBox;
+        }
+        else
+        {
+            node.volume = BoundingBox(nodes[node.children[0]].volume,
+                nodes[node.children[1]].volume);
+        }
+    }
+    boundingBox = nodes[0].volume;
+}
+
+unsigned CollisionCompound::buildNodes(unsigned *indices, unsigned count)
+{
+    unsigned index = (unsigned)nodes.size();
+    nodes.push_back(Node());
+    if (count == 1)
+    {
+        nodes[index].primitive = children[indices[0]];
+        return index;
+    }
+
+    // Find the axis along which the children's centres are most
+    // spread out, and split them at their mean along it.
+    Vector3 low = children[indices[0]]->offset.getAxisVector(3);
+    Vector3 high = low;
+    Vector3 total;
+    for (unsigned i = 0; i < count; i++)
+    {
+        Vector3 centre = children[indices[i]]->offset.getAxisVector(3);
+        total += centre;
+        for (unsigned j = 0; j < 3; j++)
+        {
+            if (centre[j] < low[j]) low[j] = centre[j];
+            if (centre[j] > high[j]) high[j] = centre[j];
+        }
+    }
+    Vector3 spread = high - low;
+    unsigned axis = 0;
+    if (spread.y > spread[axis]) axis = 1;
+    if (spread.z > spread[axis]) axis = 2;
+    real split = total[axis] / (real)count;
+
+    unsigned middle = 0;
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (children[indices[i]]->offset.getAxisVector(3)[axis] < split)
+        {
+            unsigned swap = indices[i];
+            indices[i] = indices[middle];
+            indices[middle++] = swap;
+        }
+    }
+
+    // Children all at the same place are split evenly.
+    if (middle == 0 || middle == count) middle = count / 2;
+
+    unsigned first = buildNodes(indices, middle);
+    unsigned second = buildNodes(indices + middle, count - middle);
+    nodes[index].children[0] = first;
+    nodes[index].children[1] = second;
+    return index;
 }
 
 bool IntersectionTests::sphereAndHalfSpace(
@@ -122,6 +291,28 @@ bool IntersectionTests::boxAndBox(
 }
 #undef TEST_OVERLAP
 
+bool IntersectionTests::boxAndSphere(
+    const CollisionBox &box,
+    const CollisionSphere &sphere
+    )
+{
+    // Transform the centre of the sphere into box coordinates
+    Vector3 relCentre = box.transform.transformInverse(sphere.getAxis(3));
+
+    // Clamp each coordinate to the box to find the closest point
+    Vector3 closestPt = relCentre;
+    if (closestPt.x > box.halfSize.x) closestPt.x = box.halfSize.x;
+    if (closestPt.x < -box.halfSize.x) closestPt.x = -box.halfSize.x;
+    if (closestPt.y > box.halfSize.y) closestPt.y = box.halfSize.y;
+    if (closestPt.y < -box.halfSize.y) closestPt.y = -box.halfSize.y;
+    if (closestPt.z > box.halfSize.z) closestPt.z = box.halfSize.z;
+    if (closestPt.z < -box.halfSize.z) closestPt.z = -box.halfSize.z;
+
+    // Check it is within the sphere
+    return (closestPt - relCentre).squareMagnitude() <=
+        sphere.radius * sphere.radius;
+}
+
 bool IntersectionTests::boxAndHalfSpace(
     const CollisionBox &box,
     const CollisionPlane &plane
@@ -765,4 +956,232 @@ unsigned CollisionDetector::eightDiceAndHalfSpace(
 
     data->addContacts(contactsUsed);
     return contactsUsed;
-}
\ No newline at end of file
+}
+
+unsigned CollisionDetector::primitiveAndPrimitive(
+    const CollisionPrimitive &one,
+    const CollisionPrimitive &two,
+    CollisionData *data
+    )
+{
+    PrimitiveType typeOne = one.getType();
+    PrimitiveType typeTwo = two.getType();
+
+    // Compounds pass their children back to this function.
+    if (typeOne == PRIMITIVE_COMPOUND)
+    {
+        const CollisionCompound &compound =
+            static_cast<const CollisionCompound&>(one);
+        if (typeTwo == PRIMITIVE_COMPOUND)
+        {
+            return compoundAndCompound(compound,
+                static_cast<const CollisionCompound&>(two), data);
+        }
+        return compoundAndPrimitive(compound, two, data);
+    }
+    if (typeTwo == PRIMITIVE_COMPOUND)
+    {
+        return compoundAndPrimitive(
+            static_cast<const CollisionCompound&>(two), one, data);
+    }
+
+    // Meshes and heightfields are tested against spheres and boxes,
+    // which are put first.
+    if (typeOne == PRIMITIVE_MESH || typeOne == PRIMITIVE_HEIGHTFIELD)
+    {
+        if (typeTwo == PRIMITIVE_MESH || typeTwo == PRIMITIVE_HEIGHTFIELD)
+        {
+            return 0;
+        }
+        return primitiveAndPrimitive(two, one, data);
+    }
+    if (typeTwo == PRIMITIVE_MESH)
+    {
+        const CollisionMesh &mesh = static_cast<const CollisionMesh&>(two);
+        if (typeOne == PRIMITIVE_SPHERE)
+        {
+            return sphereAndMesh(
+                static_cast<const CollisionSphere&>(one), mesh, data);
+        }
+        return boxAndMesh(
+            static_cast<const CollisionBox&>(one), mesh, data);
+    }
+    if (typeTwo == PRIMITIVE_HEIGHTFIELD)
+    {
+        const CollisionHeightfield &heightfield =
+            static_cast<const CollisionHeightfield&>(two);
+        if (typeOne == PRIMITIVE_SPHERE)
+        {
+            return sphereAndHeightfield(
+                static_cast<const CollisionSphere&>(one), heightfield, data);
+        }
+        return boxAndHeightfield(
+            static_cast<const CollisionBox&>(one), heightfield, data);
+    }
+
+    if (typeOne == PRIMITIVE_SPHERE && typeTwo == PRIMITIVE_SPHERE)
+    {
+        return sphereAndSphere(static_cast<const CollisionSphere&>(one),
+            static_cast<const CollisionSphere&>(two), data);
+    }
+    if (typeOne == PRIMITIVE_BOX && typeTwo == PRIMITIVE_BOX)
+    {
+        return boxAndBox(static_cast<const CollisionBox&>(one),
+            static_cast<const CollisionBox&>(two), data);
+    }
+    if (typeOne == PRIMITIVE_BOX && typeTwo == PRIMITIVE_SPHERE)
+    {
+        return boxAndSphere(static_cast<const CollisionBox&>(one),
+            static_cast<const CollisionSphere&>(two), data);
+    }
+    if (typeOne == PRIMITIVE_SPHERE && typeTwo == PRIMITIVE_BOX)
+    {
+        return boxAndSphere(static_cast<const CollisionBox&>(two),
+            static_cast<const CollisionSphere&>(one), data);
+    }
+    return 0;
+}
+
+unsigned CollisionDetector::primitiveAndHalfSpace(
+    const CollisionPrimitive &primitive,
+    const CollisionPlane &plane,
+    CollisionData *data
+    )
+{
+    switch (primitive.getType())
+    {
+    case PRIMITIVE_SPHERE:
+        return sphereAndHalfSpace(
+            static_cast<const CollisionSphere&>(primitive), plane, data);
+    case PRIMITIVE_BOX:
+        return boxAndHalfSpace(
+            static_cast<const CollisionBox&>(primitive), plane, data);
+    case PRIMITIVE_COMPOUND:
+        return compoundAndHalfSpace(
+            static_cast<const CollisionCompound&>(primitive), plane, data);
+    case PRIMITIVE_MESH:
+    case PRIMITIVE_HEIGHTFIELD:
+        // Scenery isn't tested against other scenery.
+        break;
+    }
+    return 0;
+}
+
+unsigned CollisionDetector::compoundAndPrimitive(
+    const CollisionCompound &compound,
+    const CollisionPrimitive &primitive,
+    CollisionData *data
+    )
+{
+    if (compound.nodes.empty()) return 0;
+    return compoundNodeAndPrimitive(compound, 0, primitive, data);
+}
+
+unsigned CollisionDetector::compoundNodeAndPrimitive(
+    const CollisionCompound &compound,
+    unsigned node,
+    const CollisionPrimitive &primitive,
+    CollisionData *data
+    )
+{
+    const CollisionCompound::Node &current = compound.nodes[node];
+    if (data->contactsLeft <= 0 ||
+        !current.volume.overlaps(&primitive.boundingBox)) return 0;
+
+    if (current.isLeaf())
+    {
+        return primitiveAndPrimitive(*current.primitive, primitive, data);
+    }
+    unsigned count = compoundNodeAndPrimitive(
+        compound, current.children[0], primitive, data);
+    return count + compoundNodeAndPrimitive(
+        compound, current.children[1], primitive, data);
+}
+
+unsigned CollisionDetector::compoundAndCompound(
+    const CollisionCompound &one,
+    const CollisionCompound &two,
+    CollisionData *data
+    )
+{
+    if (one.nodes.empty() || two.nodes.empty()) return 0;
+    return compoundNodeAndCompoundNode(one, 0, two, 0, data);
+}
+
+unsigned CollisionDetector::compoundNodeAndCompoundNode(
+    const CollisionCompound &one,
+    unsigned nodeOne,
+    const CollisionCompound &two,
+    unsigned nodeTwo,
+    CollisionData *data
+    )
+{
+    const CollisionCompound::Node &first = one.nodes[nodeOne];
+    const CollisionCompound::Node &second = two.nodes[nodeTwo];
+    if (data->contactsLeft <= 0 ||
+        !first.volume.overlaps(&second.volume)) return 0;
+
+    if (first.isLeaf() && second.isLeaf())
+    {
+        return primitiveAndPrimitive(
+            *first.primitive, *second.primitive, data);
+    }
+
+    // Descend into the larger of the two nodes, as the bounding
+    // volume hierarchy does.
+    if (second.isLeaf() ||
+        (!first.isLeaf() &&
+            first.volume.getSize() >= second.volume.getSize()))
+    {
+        unsigned count = compoundNodeAndCompoundNode(
+            one, first.children[0], two, nodeTwo, data);
+        return count + compoundNodeAndCompoundNode(
+            one, first.children[1], two, nodeTwo, data);
+    }
+    else
+    {
+        unsigned count = compoundNodeAndCompoundNode(
+            one, nodeOne, two, second.children[0], data);
+        return count + compoundNodeAndCompoundNode(
+            one, nodeOne, two, second.children[1], data);
+    }
+}
+
+unsigned CollisionDetector::compoundAndHalfSpace(
+    const CollisionCompound &compound,
+    const CollisionPlane &plane,
+    CollisionData *data
+    )
+{
+    if (compound.nodes.empty()) return 0;
+    return compoundNodeAndHalfSpace(compound, 0, plane, data);
+}
+
+unsigned CollisionDetector::compoundNodeAndHalfSpace(
+    const CollisionCompound &compound,
+    unsigned node,
+    const CollisionPlane &plane,
+    CollisionData *data
+    )
+{
+    const CollisionCompound::Node &current = compound.nodes[node];
+    if (data->contactsLeft <= 0) return 0;
+
+    // Skip nodes whose bounding box is clear of the half-space.
+    const BoundingBox &volume = current.volume;
+    real projectedRadius =
+        volume.halfSize.x * real_abs(plane.direction.x) +
+        volume.halfSize.y * real_abs(plane.direction.y) +
+        volume.halfSize.z * real_abs(plane.direction.z);
+    if (plane.direction * volume.centre - projectedRadius >
+        plane.offset) return 0;
+
+    if (current.isLeaf())
+    {
+        return primitiveAndHalfSpace(*current.primitive, plane, data);
+    }
+    unsigned count = compoundNodeAndHalfSpace(
+        compound, current.children[0], plane, data);
+    return count + compoundNodeAndHalfSpace(
+        compound, current.children[1], plane, data);
+}
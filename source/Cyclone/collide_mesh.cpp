@@ -0,0 +1,871 @@
+/*
+ * Implementation file for the triangle mesh and heightfield primitives.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+#include <cyclone/collide_mesh.h>
+#include <algorithm>
+
+using namespace cyclone;
+
+/**
+ * Flags marking a triangle's edges as internal. The edge from corner
+ * i to the next corner has the flag shifted up by i.
+ */
+static const unsigned INTERNAL_EDGE = 1;
+
+/**
+ * Flags marking a triangle's corners as internal. Corner i has the
+ * flag shifted up by i.
+ */
+static const unsigned INTERNAL_CORNER = 8;
+
+/**
+ * Marks a missing neighbour when building a mesh's internal edges.
+ */
+static const unsigned NO_VERTEX = 0xffffffff;
+
+/**
+ * Internal function that returns a box, in the space of the given
+ * transform, enclosing the given world space box.
+ */
+static inline BoundingBox _boxToLocal(const Matrix4 &transform,
+                                      const BoundingBox &box)
+{
+    Vector3 halfSize;
+    for (unsigned i = 0; i < 3; i++)
+    {
+        halfSize[i] =
+            box.halfSize.x * real_abs(transform.data[i]) +
+            box.halfSize.y * real_abs(transform.data[4+i]) +
+            box.halfSize.z * real_abs(transform.data[8+i]);
+    }
+    return BoundingBox(transform.transformInverse(box.centre), halfSize);
+}
+
+/**
+ * Internal function that returns a world space box enclosing the
+ * given box in the space of the given transform.
+ */
+static inline BoundingBox _boxToWorld(const Matrix4 &transform,
+                                      const Vector3 &centre,
+                                      const Vector3 &halfSize)
+{
+    Vector3 worldHalfSize;
+    for (unsigned i = 0; i < 3; i++)
+    {
+        worldHalfSize[i] =
+            halfSize.x * real_abs(transform.data[i*4]) +
+            halfSize.y * real_abs(transform.data[i*4+1]) +
+            halfSize.z * real_abs(transform.data[i*4+2]);
+    }
+    return BoundingBox(transform.transform(centre), worldHalfSize);
+}
+
+/**
+ * Internal function that returns the unit normal of the front face
+ * of a triangle, or a zero vector if the triangle has no area.
+ */
+static inline Vector3 _triangleNormal(const Vector3 *triangle)
+{
+    Vector3 normal =
+        (triangle[1] - triangle[0]) % (triangle[2] - triangle[0]);
+    normal.normalise();
+    return normal;
+}
+
+/**
+ * Internal function that checks if the edge from start to end of a
+ * triangle with the given normal is internal, given the far corner
+ * of the neighbouring triangle across it. Concave and flat edges,
+ * and convex edges bending by less than about five degrees, are
+ * internal: nothing can touch them without also touching a face.
+ */
+static bool _isInternalEdge(const Vector3 &start, const Vector3 &end,
+                            const Vector3 &normal, const Vector3 &opposite)
+{
+    if ((opposite - start) * normal >= 0) return true;
+
+    Vector3 neighbourNormal = (start - end) % (opposite - end);
+    neighbourNormal.normalise();
+    return neighbourNormal * normal > (real)0.996;
+}
+
+/**
+ * Internal function that works out the internal edge and corner
+ * flags of a triangle, given the far corner of the neighbour across
+ * each edge, or NULL where there is no neighbour. A corner is
+ * internal if both its edges are.
+ */
+static unsigned _triangleFlags(const Vector3 *triangle,
+                               const Vector3 *const *opposite)
+{
+    Vector3 normal = _triangleNormal(triangle);
+    unsigned flags = 0;
+    for (unsigned i = 0; i < 3; i++)
+    {
+        if (opposite[i] && _isInternalEdge(triangle[i],
+            triangle[(i+1)%3], normal, *opposite[i]))
+        {
+            flags |= INTERNAL_EDGE << i;
+        }
+    }
+    for (unsigned i = 0; i < 3; i++)
+    {
+        if ((flags & (INTERNAL_EDGE << i)) &&
+            (flags & (INTERNAL_EDGE << ((i+2)%3))))
+        {
+            flags |= INTERNAL_CORNER << i;
+        }
+    }
+    return flags;
+}
+
+/**
+ * Internal function that finds the closest point on a triangle to
+ * the given point. The feature of the triangle it lies on is
+ * returned as the flag that would mark that edge or corner as
+ * internal, or zero for the face.
+ */
+static Vector3 _closestPointOnTriangle(const Vector3 &point,
+                                       const Vector3 *triangle,
+                                       unsigned *feature)
+{
+    const Vector3 &a = triangle[0];
+    const Vector3 &b = triangle[1];
+    const Vector3 &c = triangle[2];
+    Vector3 ab = b - a;
+    Vector3 ac = c - a;
+
+    // Check the region beyond each corner, then beyond each edge.
+    Vector3 ap = point - a;
+    real d1 = ab * ap;
+    real d2 = ac * ap;
+    if (d1 <= 0 && d2 <= 0)
+    {
+        *feature = INTERNAL_CORNER;
+        return a;
+    }
+
+    Vector3 bp = point - b;
+    real d3 = ab * bp;
+    real d4 = ac * bp;
+    if (d3 >= 0 && d4 <= d3)
+    {
+        *feature = INTERNAL_CORNER << 1;
+        return b;
+    }
+
+    real vc = d1*d4 - d3*d2;
+    if (vc <= 0 && d1 >= 0 && d3 <= 0)
+    {
+        *feature = INTERNAL_EDGE;
+        return a + ab * (d1 / (d1 - d3));
+    }
+
+    Vector3 cp = point - c;
+    real d5 = ab * cp;
+    real d6 = ac * cp;
+    if (d6 >= 0 && d5 <= d6)
+    {
+        *feature = INTERNAL_CORNER << 2;
+        return c;
+    }
+
+    real vb = d5*d2 - d1*d6;
+    if (vb <= 0 && d2 >= 0 && d6 <= 0)
+    {
+        *feature = INTERNAL_EDGE << 2;
+        return a + ac * (d2 / (d2 - d6));
+    }
+
+    real va = d3*d6 - d5*d4;
+    if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0)
+    {
+        *feature = INTERNAL_EDGE << 1;
+        return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+    }
+
+    // Otherwise the point is over the face.
+    *feature = 0;
+    real denominator = ((real)1.0) / (va + vb + vc);
+    return a + ab * (vb * denominator) + ac * (vc * denominator);
+}
+
+/**
+ * Internal function that checks if the given point is over the
+ * triangle, looking along its normal. Points on an edge are over
+ * both triangles that share it, with a little tolerance for rounding.
+ */
+static bool _isOverTriangle(const Vector3 &point, const Vector3 *triangle,
+                            const Vector3 &normal)
+{
+    for (unsigned i = 0; i < 3; i++)
+    {
+        Vector3 edge = triangle[(i+1)%3] - triangle[i];
+        real side = (edge % (point - triangle[i])) * normal;
+        if (side < -(real)1e-6 * edge.squareMagnitude()) return false;
+    }
+    return true;
+}
+
+/**
+ * Internal function that fills in a contact.
+ */
+static inline void _setContact(Contact *contact, const Vector3 &point,
+                               const Vector3 &normal, real penetration,
+                               RigidBody *one, RigidBody *two,
+                               const CollisionData *data)
+{
+    contact->contactPoint = point;
+    contact->contactNormal = normal;
+    contact->penetration = penetration;
+    contact->setBodyData(one, two, data->friction, data->restitution);
+}
+
+/**
+ * Internal test for a sphere and a triangle.
+ */
+static unsigned _sphereAndTriangle(const CollisionPrimitive &primitive,
+                                   const Vector3 *triangle,
+                                   unsigned flags,
+                                   RigidBody *body,
+                                   CollisionData *data)
+{
+    const CollisionSphere &sphere =
+        static_cast<const CollisionSphere&>(primitive);
+    if (data->contactsLeft <= 0) return 0;
+
+    Vector3 normal = _triangleNormal(triangle);
+    if (normal.squareMagnitude() == 0) return 0;
+
+    // The triangle is one sided, so ignore spheres behind it.
+    Vector3 centre = sphere.getAxis(3);
+    real distance = (centre - triangle[0]) * normal;
+    if (distance < 0 || distance > sphere.radius) return 0;
+
+    unsigned feature;
+    Vector3 closest = _closestPointOnTriangle(centre, triangle, &feature);
+    Vector3 offset = centre - closest;
+    real squareDistance = offset.squareMagnitude();
+    if (squareDistance > sphere.radius * sphere.radius) return 0;
+
+    // An internal edge or corner is left to the neighbouring face
+    // the sphere is over, unless it is over this one too.
+    if ((feature & flags) && !_isOverTriangle(centre, triangle, normal))
+    {
+        return 0;
+    }
+
+    // Touching the face, or an internal edge or corner, pushes out
+    // along the face normal. Other edges and corners push out
+    // directly away from the closest point.
+    Vector3 contactNormal = normal;
+    real penetration = sphere.radius - distance;
+    if (feature != 0 && !(feature & flags) && squareDistance > 0)
+    {
+        real length = real_sqrt(squareDistance);
+        contactNormal = offset * (((real)1.0) / length);
+        penetration = sphere.radius - length;
+    }
+
+    _setContact(data->contacts, closest, contactNormal, penetration,
+        sphere.body, body, data);
+    data->addContacts(1);
+    return 1;
+}
+
+/**
+ * Internal function that checks if the triangle, given relative to
+ * the box's centre, is clear of the box along the given axis.
+ */
+static inline bool _separatedOnAxis(const Vector3 &axis,
+                                    const Vector3 *relative,
+                                    const Vector3 *boxAxes,
+                                    const Vector3 &halfSize)
+{
+    // Edges that are parallel give no axis.
+    if (axis.squareMagnitude() < (real)1e-10) return false;
+
+    real first = relative[0] * axis;
+    real second = relative[1] * axis;
+    real third = relative[2] * axis;
+    real minimum = first, maximum = first;
+    if (second < minimum) minimum = second;
+    if (second > maximum) maximum = second;
+    if (third < minimum) minimum = third;
+    if (third > maximum) maximum = third;
+
+    real projectedRadius =
+        halfSize.x * real_abs(boxAxes[0] * axis) +
+        halfSize.y * real_abs(boxAxes[1] * axis) +
+        halfSize.z * real_abs(boxAxes[2] * axis);
+    return minimum > projectedRadius || maximum < -projectedRadius;
+}
+
+/**
+ * Internal function that checks if a point given in the box's space
+ * is inside the box, and if so finds the face it is least deep
+ * below. The normal pushes the box away from the point.
+ */
+static bool _boxAndLocalPoint(const CollisionBox &box,
+                              const Vector3 &point,
+                              Vector3 *normal, real *depth)
+{
+    real minimumDepth = REAL_MAX;
+    for (unsigned i = 0; i < 3; i++)
+    {
+        real axisDepth = box.halfSize[i] - real_abs(point[i]);
+        if (axisDepth < 0) return false;
+        if (axisDepth < minimumDepth)
+        {
+            minimumDepth = axisDepth;
+            *normal = box.getAxis(i) * ((point[i] < 0) ? 1 : -1);
+        }
+    }
+    *depth = minimumDepth;
+    return true;
+}
+
+/**
+ * Internal test for a box and a triangle.
+ */
+static unsigned _boxAndTriangle(const CollisionPrimitive &primitive,
+                                const Vector3 *triangle,
+                                unsigned flags,
+                                RigidBody *body,
+                                CollisionData *data)
+{
+    const CollisionBox &box = static_cast<const CollisionBox&>(primitive);
+    if (data->contactsLeft <= 0) return 0;
+
+    Vector3 normal = _triangleNormal(triangle);
+    if (normal.squareMagnitude() == 0) return 0;
+
+    // The triangle is one sided, so ignore boxes whose centre is
+    // behind it, and those clear of its plane.
+    Vector3 centre = box.getAxis(3);
+    Vector3 axes[3] = { box.getAxis(0), box.getAxis(1), box.getAxis(2) };
+    real projectedRadius =
+        box.halfSize.x * real_abs(axes[0] * normal) +
+        box.halfSize.y * real_abs(axes[1] * normal) +
+        box.halfSize.z * real_abs(axes[2] * normal);
+    real distance = (centre - triangle[0]) * normal;
+    if (distance < 0 || distance > projectedRadius) return 0;
+
+    // Check the rest of the separating axes.
+    Vector3 relative[3] = {
+        triangle[0] - centre, triangle[1] - centre, triangle[2] - centre
+    };
+    Vector3 edges[3] = {
+        triangle[1] - triangle[0],
+        triangle[2] - triangle[1],
+        triangle[0] - triangle[2]
+    };
+    for (unsigned i = 0; i < 3; i++)
+    {
+        if (_separatedOnAxis(axes[i], relative, axes, box.halfSize))
+        {
+            return 0;
+        }
+        for (unsigned j = 0; j < 3; j++)
+        {
+            if (_separatedOnAxis(axes[i] % edges[j], relative, axes,
+                box.halfSize)) return 0;
+        }
+    }
+
+    Contact *contact = data->contacts;
+    unsigned contactsUsed = 0;
+    unsigned contactsLeft = (unsigned)data->contactsLeft;
+
+    // Corners of the box below the face push out along the normal.
+    for (unsigned i = 0; i < 8 && contactsUsed < contactsLeft; i++)
+    {
+        Vector3 vertex = centre +
+            axes[0] * ((i & 1) ? box.halfSize.x : -box.halfSize.x) +
+            axes[1] * ((i & 2) ? box.halfSize.y : -box.halfSize.y) +
+            axes[2] * ((i & 4) ? box.halfSize.z : -box.halfSize.z);
+        real depth = (triangle[0] - vertex) * normal;
+        if (depth < 0) continue;
+
+        if (!_isOverTriangle(vertex, triangle, normal)) continue;
+
+        _setContact(contact++, vertex, normal, depth, box.body, body, data);
+        contactsUsed++;
+    }
+
+    // Corners and edges of the triangle that stick out into the box.
+    // Internal ones are left to the faces around them.
+    Vector3 local[3];
+    for (unsigned i = 0; i < 3; i++)
+    {
+        local[i] = box.getTransform().transformInverse(triangle[i]);
+    }
+    bool inside[3];
+    for (unsigned i = 0; i < 3; i++)
+    {
+        Vector3 contactNormal;
+        real depth;
+        inside[i] = _boxAndLocalPoint(box, local[i], &contactNormal, &depth);
+        if (!inside[i] || (flags & (INTERNAL_CORNER << i)) ||
+            contactsUsed >= contactsLeft) continue;
+
+        _setContact(contact++, triangle[i], contactNormal, depth,
+            box.body, body, data);
+        contactsUsed++;
+    }
+    for (unsigned i = 0; i < 3 && contactsUsed < contactsLeft; i++)
+    {
+        unsigned next = (i+1)%3;
+        if ((flags & (INTERNAL_EDGE << i)) || (inside[i] && inside[next]))
+        {
+            continue;
+        }
+
+        // Clip the edge to the box, and use the middle of what's left.
+        Vector3 start = local[i];
+        Vector3 direction = local[next] - local[i];
+        real entry = 0, exit = 1;
+        for (unsigned j = 0; j < 3 && entry <= exit; j++)
+        {
+            if (direction[j] == 0)
+            {
+                if (real_abs(start[j]) > box.halfSize[j]) exit = -1;
+                continue;
+            }
+            real inverse = ((real)1.0) / direction[j];
+            real enter = (-box.halfSize[j] - start[j]) * inverse;
+            real leave = (box.halfSize[j] - start[j]) * inverse;
+            if (enter > leave) std::swap(enter, leave);
+            if (enter > entry) entry = enter;
+            if (leave < exit) exit = leave;
+        }
+        if (entry > exit) continue;
+
+        Vector3 middle = start + direction * ((entry + exit) * (real)0.5);
+        Vector3 contactNormal;
+        real depth;
+        if (!_boxAndLocalPoint(box, middle, &contactNormal, &depth)) continue;
+
+        _setContact(contact++, box.getTransform().transform(middle),
+            contactNormal, depth, box.body, body, data);
+        contactsUsed++;
+    }
+
+    data->addContacts(contactsUsed);
+    return contactsUsed;
+}
+
+/**
+ * Internal comparison that orders triangles by their centres along
+ * one axis, for splitting a mesh's hierarchy.
+ */
+struct _TriangleCentreOrder
+{
+    const Vector3 *centres;
+    unsigned axis;
+
+    _TriangleCentreOrder(const Vector3 *centres, unsigned axis)
+        : centres(centres), axis(axis)
+    {
+    }
+
+    bool operator()(unsigned a, unsigned b) const
+    {
+        return centres[a][axis] < centres[b][axis];
+    }
+};
+
+/**
+ * Internal structure holding an edge of a mesh, used to find the
+ * neighbouring triangles. The edge's vertex indices are held lowest
+ * first.
+ */
+struct _MeshEdge
+{
+    unsigned low;
+    unsigned high;
+    unsigned triangle;
+    unsigned edge;
+
+    bool operator<(const _MeshEdge &other) const
+    {
+        if (low != other.low) return low < other.low;
+        return high < other.high;
+    }
+};
+
+void CollisionMesh::setTriangles(const Vector3 *vertices,
+                                 unsigned vertexCount,
+                                 const unsigned *indices,
+                                 unsigned triangleCount)
+{
+    CollisionMesh::vertices.assign(vertices, vertices + vertexCount);
+    CollisionMesh::indices.assign(indices, indices + triangleCount * 3);
+    nodes.clear();
+    flags.clear();
+    invalidate();
+    if (triangleCount == 0) return;
+
+    // Find the neighbour across each edge. Edges shared by more than
+    // two triangles are treated as having no neighbour.
+    std::vector<_MeshEdge> edges(triangleCount * 3);
+    for (unsigned t = 0; t < triangleCount; t++)
+    {
+        for (unsigned e = 0; e < 3; e++)
+        {
+            unsigned start = indices[t*3 + e];
+            unsigned end = indices[t*3 + (e+1)%3];
+            _MeshEdge &edge = edges[t*3 + e];
+            edge.low = start < end ? start : end;
+            edge.high = start < end ? end : start;
+            edge.triangle = t;
+            edge.edge = e;
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+
+    std::vector<unsigned> opposite(triangleCount * 3, NO_VERTEX);
+    for (unsigned i = 0; i < edges.size(); )
+    {
+        unsigned run = i + 1;
+        while (run < edges.size() && !(edges[i] < edges[run])) run++;
+        if (run - i == 2)
+        {
+            const _MeshEdge &one = edges[i];
+            const _MeshEdge &two = edges[i+1];
+            opposite[one.triangle*3 + one.edge] =
+                indices[two.triangle*3 + (two.edge+2)%3];
+            opposite[two.triangle*3 + two.edge] =
+                indices[one.triangle*3 + (one.edge+2)%3];
+        }
+        i = run;
+    }
+
+    flags.resize(triangleCount);
+    std::vector<Vector3> centres(triangleCount);
+    for (unsigned t = 0; t < triangleCount; t++)
+    {
+        Vector3 triangle[3];
+        const Vector3 *neighbours[3];
+        for (unsigned i = 0; i < 3; i++)
+        {
+            triangle[i] = vertices[indices[t*3 + i]];
+            unsigned vertex = opposite[t*3 + i];
+            neighbours[i] = (vertex == NO_VERTEX) ? NULL : &vertices[vertex];
+        }
+        flags[t] = (unsigned char)_triangleFlags(triangle, neighbours);
+        centres[t] = (triangle[0] + triangle[1] + triangle[2]) *
+            ((real)1.0 / (real)3.0);
+    }
+
+    // Work out the bounds, and the scale to quantise within them.
+    Vector3 low = vertices[indices[0]];
+    Vector3 high = low;
+    for (unsigned i = 0; i < triangleCount * 3; i++)
+    {
+        const Vector3 &vertex = vertices[indices[i]];
+        for (unsigned j = 0; j < 3; j++)
+        {
+            if (vertex[j] < low[j]) low[j] = vertex[j];
+            if (vertex[j] > high[j]) high[j] = vertex[j];
+        }
+    }
+    boundsMinimum = low;
+    boundsCentre = (low + high) * ((real)0.5);
+    boundsHalfSize = (high - low) * ((real)0.5);
+    for (unsigned j = 0; j < 3; j++)
+    {
+        real extent = high[j] - low[j];
+        quantisation[j] = extent > 0 ? ((real)65535) / extent : 0;
+    }
+
+    std::vector<unsigned> order(triangleCount);
+    for (unsigned t = 0; t < triangleCount; t++) order[t] = t;
+    nodes.reserve(triangleCount * 2 - 1);
+    buildNodes(&order[0], triangleCount, &centres[0]);
+}
+
+void CollisionMesh::buildNodes(unsigned *triangles, unsigned count,
+                               const Vector3 *centres)
+{
+    unsigned index = (unsigned)nodes.size();
+    nodes.push_back(Node());
+
+    // Find the bounds of the triangles.
+    Vector3 low = vertices[indices[triangles[0]*3]];
+    Vector3 high = low;
+    for (unsigned i = 0; i < count; i++)
+    {
+        for (unsigned k = 0; k < 3; k++)
+        {
+            const Vector3 &vertex = vertices[indices[triangles[i]*3 + k]];
+            for (unsigned j = 0; j < 3; j++)
+            {
+                if (vertex[j] < low[j]) low[j] = vertex[j];
+                if (vertex[j] > high[j]) high[j] = vertex[j];
+            }
+        }
+    }
+    quantise(low, high, nodes[index].minimum, nodes[index].maximum);
+
+    if (count == 1)
+    {
+        nodes[index].data = LEAF_NODE | triangles[0];
+        return;
+    }
+
+    // Split the triangles in half along the longest axis.
+    Vector3 extent = high - low;
+    unsigned axis = 0;
+    if (extent.y > extent[axis]) axis = 1;
+    if (extent.z > extent[axis]) axis = 2;
+
+    unsigned half = count / 2;
+    std::nth_element(triangles, triangles + half, triangles + count,
+        _TriangleCentreOrder(centres, axis));
+    buildNodes(triangles, half, centres);
+    buildNodes(triangles + half, count - half, centres);
+
+    nodes[index].data = (unsigned)nodes.size() - index;
+}
+
+bool CollisionMesh::quantise(const Vector3 &low, const Vector3 &high,
+                             unsigned short *quantisedLow,
+                             unsigned short *quantisedHigh) const
+{
+    for (unsigned j = 0; j < 3; j++)
+    {
+        real lowValue = (low[j] - boundsMinimum[j]) * quantisation[j];
+        real highValue = (high[j] - boundsMinimum[j]) * quantisation[j];
+        if (highValue < 0 || lowValue > 65535) return false;
+
+        quantisedLow[j] = lowValue <= 0 ? 0 : (unsigned short)lowValue;
+        quantisedHigh[j] = highValue >= 65534 ?
+            65535 : (unsigned short)((unsigned)highValue + 1);
+    }
+    return true;
+}
+
+void CollisionMesh::setTransform(const Matrix4 &newTransform)
+{
+    transform = newTransform;
+    boundingBox = _boxToWorld(transform, boundsCentre, boundsHalfSize);
+}
+
+unsigned CollisionMesh::collideTriangles(const CollisionPrimitive &primitive,
+                                         TriangleCollisionTest test,
+                                         CollisionData *data) const
+{
+    if (nodes.empty()) return 0;
+
+    // Find the primitive's box in the mesh's space.
+    BoundingBox query = _boxToLocal(transform, primitive.getBoundingBox());
+    unsigned short low[3], high[3];
+    if (!quantise(query.centre - query.halfSize,
+        query.centre + query.halfSize, low, high)) return 0;
+
+    // Walk the nodes in order, skipping the subtrees of branches
+    // that don't overlap.
+    unsigned count = 0;
+    unsigned index = 0;
+    unsigned end = (unsigned)nodes.size();
+    while (index < end && data->contactsLeft > 0)
+    {
+        const Node &node = nodes[index];
+        bool overlaps =
+            node.minimum[0] <= high[0] && node.maximum[0] >= low[0] &&
+            node.minimum[1] <= high[1] && node.maximum[1] >= low[1] &&
+            node.minimum[2] <= high[2] && node.maximum[2] >= low[2];
+        bool leaf = (node.data & LEAF_NODE) != 0;
+
+        if (overlaps && leaf)
+        {
+            unsigned triangle = node.data & ~LEAF_NODE;
+            Vector3 corners[3];
+            for (unsigned i = 0; i < 3; i++)
+            {
+                corners[i] = transform.transform(
+                    vertices[indices[triangle*3 + i]]);
+            }
+            count += test(primitive, corners, flags[triangle], body, data);
+        }
+
+        if (overlaps || leaf) index++;
+        else index += node.data;
+    }
+    return count;
+}
+
+CollisionHeightfield::CollisionHeightfield()
+:
+columns(0),
+rows(0),
+spacing(1),
+minimumHeight(0),
+maximumHeight(0)
+{
+}
+
+void CollisionHeightfield::setHeights(const real *heights,
+                                      unsigned columns, unsigned rows,
+                                      real spacing)
+{
+    CollisionHeightfield::heights.assign(heights, heights + columns * rows);
+    CollisionHeightfield::columns = columns;
+    CollisionHeightfield::rows = rows;
+    CollisionHeightfield::spacing = spacing;
+
+    minimumHeight = maximumHeight = (columns * rows > 0) ? heights[0] : 0;
+    for (unsigned i = 1; i < columns * rows; i++)
+    {
+        if (heights[i] < minimumHeight) minimumHeight = heights[i];
+        if (heights[i] > maximumHeight) maximumHeight = heights[i];
+    }
+    invalidate();
+}
+
+void CollisionHeightfield::setTransform(const Matrix4 &newTransform)
+{
+    transform = newTransform;
+
+    real width = columns > 1 ? (columns - 1) * spacing : 0;
+    real depth = rows > 1 ? (rows - 1) * spacing : 0;
+    Vector3 halfSize(width * (real)0.5,
+        (maximumHeight - minimumHeight) * (real)0.5, depth * (real)0.5);
+    Vector3 centre(halfSize.x, minimumHeight + halfSize.y, halfSize.z);
+    boundingBox = _boxToWorld(transform, centre, halfSize);
+}
+
+unsigned CollisionHeightfield::collideTriangles(
+    const CollisionPrimitive &primitive,
+    TriangleCollisionTest test,
+    CollisionData *data) const
+{
+    if (columns < 2 || rows < 2) return 0;
+
+    // Find the primitive's box in the heightfield's space, and the
+    // cells under it.
+    BoundingBox query = _boxToLocal(transform, primitive.getBoundingBox());
+    Vector3 low = query.centre - query.halfSize;
+    Vector3 high = query.centre + query.halfSize;
+    if (high.y < minimumHeight || low.y > maximumHeight) return 0;
+
+    real lastCell = (real)(columns - 2);
+    real lastRow = (real)(rows - 2);
+    real firstX = Scalar<real>::floor(low.x / spacing);
+    real lastX = Scalar<real>::floor(high.x / spacing);
+    real firstZ = Scalar<real>::floor(low.z / spacing);
+    real lastZ = Scalar<real>::floor(high.z / spacing);
+    if (lastX < 0 || firstX > lastCell || lastZ < 0 || firstZ > lastRow)
+    {
+        return 0;
+    }
+    unsigned columnStart = firstX < 0 ? 0 : (unsigned)firstX;
+    unsigned columnEnd = lastX > lastCell ? columns - 2 : (unsigned)lastX;
+    unsigned rowStart = firstZ < 0 ? 0 : (unsigned)firstZ;
+    unsigned rowEnd = lastZ > lastRow ? rows - 2 : (unsigned)lastZ;
+
+    unsigned count = 0;
+    for (unsigned row = rowStart; row <= rowEnd; row++)
+    {
+        for (unsigned column = columnStart; column <= columnEnd; column++)
+        {
+            if (data->contactsLeft <= 0) return count;
+
+            Vector3 p00 = getPoint(column, row);
+            Vector3 p10 = getPoint(column + 1, row);
+            Vector3 p01 = getPoint(column, row + 1);
+            Vector3 p11 = getPoint(column + 1, row + 1);
+
+            // Skip cells entirely above or below the box.
+            real cellLow = p00.y, cellHigh = p00.y;
+            real cornerHeights[3] = { p10.y, p01.y, p11.y };
+            for (unsigned i = 0; i < 3; i++)
+            {
+                if (cornerHeights[i] < cellLow) cellLow = cornerHeights[i];
+                if (cornerHeights[i] > cellHigh) cellHigh = cornerHeights[i];
+            }
+            if (cellHigh < low.y || cellLow > high.y) continue;
+
+            // The far corners of the neighbouring triangles, for
+            // finding internal edges. The cell's diagonal is always
+            // shared.
+            Vector3 left, below, above, right;
+            if (column > 0) left = getPoint(column - 1, row + 1);
+            if (row > 0) below = getPoint(column + 1, row - 1);
+            if (row + 2 < rows) above = getPoint(column, row + 2);
+            if (column + 2 < columns) right = getPoint(column + 2, row);
+
+            Vector3 first[3] = { p00, p01, p10 };
+            const Vector3 *firstFar[3] = {
+                column > 0 ? &left : NULL, &p11, row > 0 ? &below : NULL
+            };
+            Vector3 second[3] = { p10, p01, p11 };
+            const Vector3 *secondFar[3] = {
+                &p00, row + 2 < rows ? &above : NULL,
+                column + 2 < columns ? &right : NULL
+            };
+
+            Vector3 corners[3];
+            unsigned firstFlags = _triangleFlags(first, firstFar);
+            for (unsigned i = 0; i < 3; i++)
+            {
+                corners[i] = transform.transform(first[i]);
+            }
+            count += test(primitive, corners, firstFlags, body, data);
+
+            unsigned secondFlags = _triangleFlags(second, secondFar);
+            for (unsigned i = 0; i < 3; i++)
+            {
+                corners[i] = transform.transform(second[i]);
+            }
+            count += test(primitive, corners, secondFlags, body, data);
+        }
+    }
+    return count;
+}
+
+unsigned CollisionDetector::sphereAndMesh(
+    const CollisionSphere &sphere,
+    const CollisionMesh &mesh,
+    CollisionData *data
+    )
+{
+    return mesh.collideTriangles(sphere, _sphereAndTriangle, data);
+}
+
+unsigned CollisionDetector::boxAndMesh(
+    const CollisionBox &box,
+    const CollisionMesh &mesh,
+    CollisionData *data
+    )
+{
+    return mesh.collideTriangles(box, _boxAndTriangle, data);
+}
+
+unsigned CollisionDetector::sphereAndHeightfield(
+    const CollisionSphere &sphere,
+    const CollisionHeightfield &heightfield,
+    CollisionData *data
+    )
+{
+    return heightfield.collideTriangles(sphere, _sphereAndTriangle, data);
+}
+
+unsigned CollisionDetector::boxAndHeightfield(
+    const CollisionBox &box,
+    const CollisionHeightfield &heightfield,
+    CollisionData *data
+    )
+{
+    return heightfield.collideTriangles(box, _boxAndTriangle, data);
+}
@@ -15,14 +15,22 @@
 
 using namespace cyclone;
 
-const Vector3 Vector3::GRAVITY = Vector3(0, -9.81, 0);
-const Vector3 Vector3::HIGH_GRAVITY = Vector3(0, -19.62, 0);
-const Vector3 Vector3::UP = Vector3(0, 1, 0);
-const Vector3 Vector3::RIGHT = Vector3(1, 0, 0);
-const Vector3 Vector3::OUT_OF_SCREEN = Vector3(0, 0, 1);
-const Vector3 Vector3::X = Vector3(0, 1, 0);
-const Vector3 Vector3::Y = Vector3(1, 0, 0);
-const Vector3 Vector3::Z = Vector3(0, 0, 1);
+template <typename Real>
+const Vector3T<Real> Vector3T<Real>::GRAVITY = Vector3T<Real>(0, (Real)-9.81, 0);
+template <typename Real>
+const Vector3T<Real> Vector3T<Real>::HIGH_GRAVITY = Vector3T<Real>(0, (Real)-19.62, 0);
+template <typename Real>
+const Vector3T<Real> Vector3T<Real>::UP = Vector3T<Real>(0, 1, 0);
+template <typename Real>
+const Vector3T<Real> Vector3T<Real>::RIGHT = Vector3T<Real>(1, 0, 0);
+template <typename Real>
+const Vector3T<Real> Vector3T<Real>::OUT_OF_SCREEN = Vector3T<Real>(0, 0, 1);
+template <typename Real>
+const Vector3T<Real> Vector3T<Real>::X = Vector3T<Real>(0, 1, 0);
+template <typename Real>
+const Vector3T<Real> Vector3T<Real>::Y = Vector3T<Real>(1, 0, 0);
+template <typename Real>
+const Vector3T<Real> Vector3T<Real>::Z = Vector3T<Real>(0, 0, 1);
 
 /*
  * Definition of the sleep epsilon extern.
@@ -42,7 +50,8 @@ real cyclone::getSleepEpsilon()
     return cyclone::sleepEpsilon;
 }
 
-real Matrix4::getDeterminant() const
+template <typename Real>
+Real Matrix4T<Real>::getDeterminant() const
 {
     return data[8]*data[5]*data[2]+
         data[4]*data[9]*data[2]+
@@ -52,12 +61,13 @@ real Matrix4::getDeterminant() const
         data[0]*data[5]*data[10];
 }
 
-void Matrix4::setInverse(const Matrix4 &m)
+template <typename Real>
+void Matrix4T<Real>::setInverse(const Matrix4T &m)
 {
     // Make sure the determinant is non-zero.
-    real det = getDeterminant();
+    Real det = getDeterminant();
     if (det == 0) return;
-    det = ((real)1.0)/det;
+    det = ((Real)1.0)/det;
 
     data[0] = (-m.data[9]*m.data[6]+m.data[5]*m.data[10])*det;
     data[4] = (m.data[8]*m.data[6]-m.data[4]*m.data[10])*det;
@@ -91,11 +101,70 @@ void Matrix4::setInverse(const Matrix4 &m)
                -m.data[0]*m.data[5]*m.data[11])*det;
 }
 
-Matrix3 Matrix3::linearInterpolate(const Matrix3& a, const Matrix3& b, real prop)
+template <typename Real>
+Matrix3T<Real> Matrix3T<Real>::linearInterpolate(const Matrix3T& a,
+                                                 const Matrix3T& b, Real prop)
 {
-    Matrix3 result;
+    Matrix3T result;
     for (unsigned i = 0; i < 9; i++) {
         result.data[i] = a.data[i] * (1-prop) + b.data[i] * prop;
     }
     return result;
 }
+
+/*
+ * Compile the core types for both precisions, so that code using them
+ * links against these whichever precision the library uses. The
+ * fixed point formats are compiled too, though their quaternions,
+ * and the matrices that convert from them, need a compiler that
+ * allows them (see CYCLONE_FIXED_QUATERNIONS).
+ */
+template class cyclone::Vector3T<float>;
+template class cyclone::Vector3T<double>;
+template class cyclone::QuaternionT<float>;
+template class cyclone::QuaternionT<double>;
+template class cyclone::Matrix4T<float>;
+template class cyclone::Matrix4T<double>;
+template class cyclone::Matrix3T<float>;
+template class cyclone::Matrix3T<double>;
+
+template class cyclone::Vector3T<Fixed16>;
+template class cyclone::Vector3T<Fixed32>;
+#ifdef CYCLONE_FIXED_QUATERNIONS
+template class cyclone::QuaternionT<Fixed16>;
+template class cyclone::QuaternionT<Fixed32>;
+template class cyclone::Matrix4T<Fixed16>;
+template class cyclone::Matrix4T<Fixed32>;
+template class cyclone::Matrix3T<Fixed16>;
+template class cyclone::Matrix3T<Fixed32>;
+#endif
+
+unsigned cyclone::addToChecksum(unsigned checksum, const void *data,
+                                unsigned size)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    for (unsigned i = 0; i < size; i++)
+    {
+        checksum ^= bytes[i];
+        checksum *= 16777619u;
+    }
+    return checksum;
+}
+
+unsigned cyclone::addToChecksum(unsigned checksum, real value)
+{
+    return addToChecksum(checksum, &value, sizeof(real));
+}
+
+unsigned cyclone::addToChecksum(unsigned checksum, const Vector3 &vector)
+{
+    checksum = addToChecksum(checksum, vector.x);
+    checksum = addToChecksum(checksum, vector.y);
+    return addToChecksum(checksum, vector.z);
+}
+
+unsigned cyclone::addToChecksum(unsigned checksum,
+                                const Quaternion &quaternion)
+{
+    return addToChecksum(checksum, quaternion.data, sizeof(real)*4);
+}
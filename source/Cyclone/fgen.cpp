@@ -10,12 +10,273 @@
  * software license.
  */
 
+#include <typeinfo>
 #include <cyclone/fgen.h>
 
 using namespace cyclone;
 
+/**
+ * Internal function that adds a registration to a bucket, and returns
+ * a handle to it.
+ */
+template<class Registration, class Generator>
+static inline ForceHandle _addRegistration(std::vector<Registration> &bucket,
+                                           unsigned bucketId,
+                                           ForceHandleTable &handles,
+                                           RigidBody *body, Generator *fg)
+{
+    ForceHandle handle = handles.allocate(bucketId, (unsigned)bucket.size());
+
+    Registration registration;
+    registration.body = body;
+    registration.fg = fg;
+    registration.slot = handle.slot;
+    bucket.push_back(registration);
+    return handle;
+}
+
+/**
+ * Internal function that removes a registration from a bucket by
+ * moving the last registration into its place.
+ */
+template<class Registration>
+static inline void _swapRemove(std::vector<Registration> &bucket,
+                               unsigned index,
+                               ForceHandleTable &handles)
+{
+    handles.release(bucket[index].slot);
+    if (index + 1 < bucket.size())
+    {
+        bucket[index] = bucket.back();
+        handles.move(bucket[index].slot, index);
+    }
+    bucket.pop_back();
+}
+
+/**
+ * Internal function that finds the given pair in a bucket, returning
+ * false if it is not there.
+ */
+template<class Registration>
+static inline bool _findPair(const std::vector<Registration> &bucket,
+                             const RigidBody *body,
+                             const ForceGenerator *fg,
+                             unsigned *index)
+{
+    for (unsigned i = 0; i < bucket.size(); i++)
+    {
+        if (bucket[i].body == body &&
+            (const ForceGenerator*)bucket[i].fg == fg)
+        {
+            *index = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Internal function that removes every registration for a body from
+ * a bucket in a single pass, keeping the order of the rest.
+ */
+template<class Registration>
+static inline void _removeBody(std::vector<Registration> &bucket,
+                               const RigidBody *body,
+                               ForceHandleTable &handles)
+{
+    unsigned kept = 0;
+    for (unsigned i = 0; i < bucket.size(); i++)
+    {
+        if (bucket[i].body == body)
+        {
+            handles.release(bucket[i].slot);
+            continue;
+        }
+        if (kept != i)
+        {
+            bucket[kept] = bucket[i];
+            handles.move(bucket[kept].slot, kept);
+        }
+        kept++;
+    }
+    bucket.resize(kept);
+}
+
+/**
+ * Internal function that updates every registration in a bucket. The
+ * call is qualified with the generator's type, so it is made directly
+ * rather than through the virtual table, and can be inlined.
+ */
+template<class Generator, class Registration>
+static inline void _updateBucket(std::vector<Registration> &bucket,
+                                 real duration)
+{
+    typename std::vector<Registration>::iterator i = bucket.begin();
+    for (; i != bucket.end(); i++)
+    {
+        i->fg->Generator::updateForce(i->body, duration);
+    }
+}
+
+/**
+ * Internal function that updates every registration in the gravity
+ * bucket. The inverse masses of the bodies are gathered first, the
+ * forces for each run of registrations sharing a generator are found
+ * in one call, and then they are applied.
+ */
+template<class Registration>
+static inline void _updateGravityBucket(std::vector<Registration> &bucket,
+                                        std::vector<real> &inverseMasses,
+                                        std::vector<Vector3> &forces)
+{
+    unsigned count = (unsigned)bucket.size();
+    if (count == 0) return;
+    if (inverseMasses.size() < count)
+    {
+        inverseMasses.resize(count);
+        forces.resize(count);
+    }
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        inverseMasses[i] = bucket[i].body->getInverseMass();
+    }
+
+    unsigned start = 0;
+    while (start < count)
+    {
+        const Gravity *fg = bucket[start].fg;
+        unsigned end = start + 1;
+        while (end < count && bucket[end].fg == fg) end++;
+        fg->getForces(&inverseMasses[start], &forces[start], end - start);
+        start = end;
+    }
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        bucket[i].body->addForce(forces[i]);
+    }
+}
+
+/**
+ * Internal function that updates every registration in a bucket of
+ * aerodynamic surfaces. The wind for each surface is found first,
+ * sampling each run of registrations that share a wind field in one
+ * call, and then the forces are applied.
+ */
+template<class Generator, class Registration>
+static inline void _updateAeroBucket(std::vector<Registration> &bucket,
+                                     real duration,
+                                     std::vector<Vector3> &points,
+                                     std::vector<Vector3> &winds)
+{
+    unsigned count = (unsigned)bucket.size();
+    if (count == 0) return;
+    if (points.size() < count)
+    {
+        points.resize(count);
+        winds.resize(count);
+    }
+
+    // Gather the sample points, and the wind for surfaces without a
+    // field.
+    for (unsigned i = 0; i < count; i++)
+    {
+        const Generator *fg = bucket[i].fg;
+        if (fg->getWindField())
+        {
+            points[i] = fg->getSamplePoint(bucket[i].body);
+        }
+        else
+        {
+            winds[i] = fg->Generator::getWind(bucket[i].body);
+        }
+    }
+
+    // Sample each run of surfaces that share a field.
+    unsigned start = 0;
+    while (start < count)
+    {
+        const WindField *field = bucket[start].fg->getWindField();
+        unsigned end = start + 1;
+        while (end < count && bucket[end].fg->getWindField() == field)
+        {
+            end++;
+        }
+        if (field)
+        {
+            field->sample(&points[start], &winds[start], end - start);
+        }
+        start = end;
+    }
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        bucket[i].fg->Generator::updateForceInWind(
+            bucket[i].body, duration, winds[i]);
+    }
+}
+
+/**
+ * Internal function that updates every registration in a buoyancy
+ * bucket. The water heights that are not already known are looked up
+ * first, each run of registrations sharing a surface in one call, and
+ * then the forces are applied.
+ */
+template<class Generator, class Registration>
+static inline void _updateBuoyancyBucket(std::vector<Registration> &bucket,
+                                         real duration,
+                                         std::vector<Vector3> &points,
+                                         std::vector<const WaterSurface*> &surfaces,
+                                         std::vector<real> &heights)
+{
+    unsigned count = (unsigned)bucket.size();
+    if (count == 0) return;
+    if (points.size() < count)
+    {
+        points.resize(count);
+        surfaces.resize(count);
+        heights.resize(count);
+    }
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        const Generator *fg = bucket[i].fg;
+        points[i] = fg->getSamplePoint(bucket[i].body);
+        if (fg->getKnownHeight(points[i], &heights[i]))
+        {
+            surfaces[i] = NULL;
+        }
+        else
+        {
+            surfaces[i] = fg->getWaterSurface();
+        }
+    }
+
+    WaterSurface::getHeights(&surfaces[0], &points[0], &heights[0], count);
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        Generator *fg = bucket[i].fg;
+        if (surfaces[i]) fg->cacheHeight(points[i], heights[i]);
+        fg->updateForceAtHeight(bucket[i].body, duration,
+            points[i], heights[i]);
+    }
+}
+
 void ForceRegistry::updateForces(real duration)
 {
+    _updateGravityBucket(gravityRegistrations, batchMasses, batchForces);
+    _updateBucket<Spring>(springRegistrations, duration);
+    _updateAeroBucket<Aero>(aeroRegistrations, duration,
+        windPoints, windSamples);
+    _updateAeroBucket<AeroControl>(aeroControlRegistrations, duration,
+        windPoints, windSamples);
+    _updateAeroBucket<AngledAero>(angledAeroRegistrations, duration,
+        windPoints, windSamples);
+    _updateBuoyancyBucket<Buoyancy>(buoyancyRegistrations, duration,
+        waterPoints, waterSurfaces, waterHeights);
+
     Registry::iterator i = registrations.begin();
     for (; i != registrations.end(); i++)
     {
@@ -23,12 +284,126 @@ void ForceRegistry::updateForces(real duration)
     }
 }
 
-void ForceRegistry::add(RigidBody *body, ForceGenerator *fg)
+unsigned ForceRegistry::getBucket(const ForceGenerator *fg)
 {
-    ForceRegistry::ForceRegistration registration;
-    registration.body = body;
-    registration.fg = fg;
-    registrations.push_back(registration);
+    // Only generators of exactly a bucketed type can be bucketed,
+    // since derived classes may override updateForce.
+    const std::type_info &type = typeid(*fg);
+    if (type == typeid(Gravity)) return GRAVITY_BUCKET;
+    if (type == typeid(Spring)) return SPRING_BUCKET;
+    if (type == typeid(Aero)) return AERO_BUCKET;
+    if (type == typeid(AeroControl)) return AERO_CONTROL_BUCKET;
+    if (type == typeid(AngledAero)) return ANGLED_AERO_BUCKET;
+    if (type == typeid(Buoyancy)) return BUOYANCY_BUCKET;
+    return GENERAL_BUCKET;
+}
+
+ForceHandle ForceRegistry::add(RigidBody *body, ForceGenerator *fg)
+{
+    unsigned bucket = getBucket(fg);
+    switch (bucket)
+    {
+    case GRAVITY_BUCKET:
+        return _addRegistration(gravityRegistrations, bucket, handles,
+            body, (Gravity*)fg);
+    case SPRING_BUCKET:
+        return _addRegistration(springRegistrations, bucket, handles,
+            body, (Spring*)fg);
+    case AERO_BUCKET:
+        return _addRegistration(aeroRegistrations, bucket, handles,
+            body, (Aero*)fg);
+    case AERO_CONTROL_BUCKET:
+        return _addRegistration(aeroControlRegistrations, bucket, handles,
+            body, (AeroControl*)fg);
+    case ANGLED_AERO_BUCKET:
+        return _addRegistration(angledAeroRegistrations, bucket, handles,
+            body, (AngledAero*)fg);
+    case BUOYANCY_BUCKET:
+        return _addRegistration(buoyancyRegistrations, bucket, handles,
+            body, (Buoyancy*)fg);
+    default:
+        return _addRegistration(registrations, GENERAL_BUCKET, handles,
+            body, fg);
+    }
+}
+
+void ForceRegistry::removeAt(unsigned bucket, unsigned index)
+{
+    switch (bucket)
+    {
+    case GRAVITY_BUCKET:
+        _swapRemove(gravityRegistrations, index, handles); break;
+    case SPRING_BUCKET:
+        _swapRemove(springRegistrations, index, handles); break;
+    case AERO_BUCKET:
+        _swapRemove(aeroRegistrations, index, handles); break;
+    case AERO_CONTROL_BUCKET:
+        _swapRemove(aeroControlRegistrations, index, handles); break;
+    case ANGLED_AERO_BUCKET:
+        _swapRemove(angledAeroRegistrations, index, handles); break;
+    case BUOYANCY_BUCKET:
+        _swapRemove(buoyancyRegistrations, index, handles); break;
+    default:
+        _swapRemove(registrations, index, handles); break;
+    }
+}
+
+bool ForceRegistry::remove(const ForceHandle &handle)
+{
+    unsigned bucket, index;
+    if (!handles.find(handle, &bucket, &index)) return false;
+    removeAt(bucket, index);
+    return true;
+}
+
+void ForceRegistry::remove(RigidBody* body, ForceGenerator *fg)
+{
+    unsigned bucket = getBucket(fg);
+    unsigned index;
+    bool found;
+    switch (bucket)
+    {
+    case GRAVITY_BUCKET:
+        found = _findPair(gravityRegistrations, body, fg, &index); break;
+    case SPRING_BUCKET:
+        found = _findPair(springRegistrations, body, fg, &index); break;
+    case AERO_BUCKET:
+        found = _findPair(aeroRegistrations, body, fg, &index); break;
+    case AERO_CONTROL_BUCKET:
+        found = _findPair(aeroControlRegistrations, body, fg, &index);
+        break;
+    case ANGLED_AERO_BUCKET:
+        found = _findPair(angledAeroRegistrations, body, fg, &index);
+        break;
+    case BUOYANCY_BUCKET:
+        found = _findPair(buoyancyRegistrations, body, fg, &index); break;
+    default:
+        found = _findPair(registrations, body, fg, &index); break;
+    }
+    if (found) removeAt(bucket, index);
+}
+
+void ForceRegistry::removeAll(RigidBody* body)
+{
+    _removeBody(gravityRegistrations, body, handles);
+    _removeBody(springRegistrations, body, handles);
+    _removeBody(aeroRegistrations, body, handles);
+    _removeBody(aeroControlRegistrations, body, handles);
+    _removeBody(angledAeroRegistrations, body, handles);
+    _removeBody(buoyancyRegistrations, body, handles);
+    _removeBody(registrations, body, handles);
+}
+
+void ForceRegistry::clear()
+{
+    registrations.clear();
+    gravityRegistrations.clear();
+    springRegistrations.clear();
+    aeroRegistrations.clear();
+    aeroControlRegistrations.clear();
+    angledAeroRegistrations.clear();
+    buoyancyRegistrations.clear();
+    handles.clear();
 }
 
 Buoyancy::Buoyancy(const Vector3 &cOfB, real maxDepth, real volume,
@@ -39,20 +414,55 @@ Buoyancy::Buoyancy(const Vector3 &cOfB, real maxDepth, real volume,
     Buoyancy::maxDepth = maxDepth;
     Buoyancy::volume = volume;
     Buoyancy::waterHeight = waterHeight;
+    Buoyancy::surface = NULL;
+}
+
+void Buoyancy::setWaterSurface(const WaterSurface *surface)
+{
+    Buoyancy::surface = surface;
+    heightCache = WaterHeightCache();
+}
+
+bool Buoyancy::getKnownHeight(const Vector3 &point, real *height) const
+{
+    if (!surface)
+    {
+        *height = waterHeight;
+        return true;
+    }
+    return surface->getCachedHeight(point.x, point.z, heightCache, height);
+}
+
+void Buoyancy::cacheHeight(const Vector3 &point, real height)
+{
+    if (surface) surface->cacheHeight(point.x, point.z, height, &heightCache);
 }
 
 void Buoyancy::updateForce(RigidBody *body, real duration)
+{
+    Vector3 pointInWorld = getSamplePoint(body);
+    real height = waterHeight;
+    if (surface)
+    {
+        height = surface->getHeight(pointInWorld.x, pointInWorld.z,
+            &heightCache);
+    }
+    updateForceAtHeight(body, duration, pointInWorld, height);
+}
+
+void Buoyancy::updateForceAtHeight(RigidBody *body, real,
+                                   const Vector3 &pointInWorld,
+                                   real waterLevel)
 {
     // Calculate the submersion depth
-    Vector3 pointInWorld = body->getPointInWorldSpace(centreOfBuoyancy);
     real depth = pointInWorld.y;
 
     // Check if we're out of the water
-    if (depth >= waterHeight + maxDepth) return;
+    if (depth >= waterLevel + maxDepth) return;
     Vector3 force(0,0,0);
 
     // Check if we're at maximum depth
-    if (depth <= waterHeight - maxDepth)
+    if (depth <= waterLevel - maxDepth)
     {
         force.y = liquidDensity * volume;
         body->addForceAtBodyPoint(force, centreOfBuoyancy);
@@ -61,7 +471,7 @@ void Buoyancy::updateForce(RigidBody *body, real duration)
 
     // Otherwise we are partly submerged
     force.y = liquidDensity * volume *
-        (depth - maxDepth - waterHeight) / 2 * maxDepth;
+        (depth - maxDepth - waterLevel) / 2 * maxDepth;
     body->addForceAtBodyPoint(force, centreOfBuoyancy);
 }
 
@@ -76,7 +486,16 @@ void Gravity::updateForce(RigidBody* body, real duration)
     if (!body->hasFiniteMass()) return;
 
     // Apply the mass-scaled force to the body
-    body->addForce(gravity * body->getMass());
+    real inverseMass = body->getInverseMass();
+    Vector3 force;
+    getForces(&inverseMass, &force, 1);
+    body->addForce(force);
+}
+
+void Gravity::getForces(const real *inverseMasses, Vector3 *forces,
+                        unsigned count) const
+{
+    simdGravity(&gravity.x, inverseMasses, &forces->x, count);
 }
 
 Spring::Spring(const Vector3 &localConnectionPt,
@@ -117,19 +536,54 @@ Aero::Aero(const Matrix3 &tensor, const Vector3 &position, const Vector3 *windsp
     Aero::tensor = tensor;
     Aero::position = position;
     Aero::windspeed = windspeed;
+    Aero::windField = NULL;
+}
+
+Aero::Aero(const Matrix3 &tensor, const Vector3 &position,
+           const WindField *windField)
+{
+    Aero::tensor = tensor;
+    Aero::position = position;
+    Aero::windspeed = NULL;
+    Aero::windField = windField;
+}
+
+void Aero::setWindField(const WindField *windField)
+{
+    Aero::windField = windField;
+}
+
+Vector3 Aero::getWind(const RigidBody *body) const
+{
+    if (windField) return windField->sample(getSamplePoint(body));
+    if (windspeed) return *windspeed;
+    return Vector3();
 }
 
 void Aero::updateForce(RigidBody *body, real duration)
 {
-    Aero::updateForceFromTensor(body, duration, tensor);
+    Aero::updateForceFromTensor(body, duration, tensor, getWind(body));
+}
+
+void Aero::updateForceInWind(RigidBody *body, real duration,
+                             const Vector3 &wind)
+{
+    Aero::updateForceFromTensor(body, duration, tensor, wind);
 }
 
 void Aero::updateForceFromTensor(RigidBody *body, real duration,
                                  const Matrix3 &tensor)
+{
+    updateForceFromTensor(body, duration, tensor, getWind(body));
+}
+
+void Aero::updateForceFromTensor(RigidBody *body, real,
+                                 const Matrix3 &tensor,
+                                 const Vector3 &wind)
 {
     // Calculate total velocity (windspeed and body's velocity).
     Vector3 velocity = body->getVelocity();
-    velocity += *windspeed;
+    velocity += wind;
 
     // Calculate the velocity in body coordinates
     Vector3 bodyVel = body->getTransform().transformInverseDirection(velocity);
@@ -152,6 +606,16 @@ Aero(base, position, windspeed)
     controlSetting = 0.0f;
 }
 
+AeroControl::AeroControl(const Matrix3 &base, const Matrix3 &min, const Matrix3 &max,
+                         const Vector3 &position, const WindField *windField)
+:
+Aero(base, position, windField)
+{
+    AeroControl::minTensor = min;
+    AeroControl::maxTensor = max;
+    controlSetting = 0.0f;
+}
+
 Matrix3 AeroControl::getTensor()
 {
     if (controlSetting <= -1.0f) return minTensor;
@@ -175,10 +639,181 @@ void AeroControl::setControl(real value)
 void AeroControl::updateForce(RigidBody *body, real duration)
 {
     Matrix3 tensor = getTensor();
-    Aero::updateForceFromTensor(body, duration, tensor);
+    Aero::updateForceFromTensor(body, duration, tensor, getWind(body));
+}
+
+void AeroControl::updateForceInWind(RigidBody *body, real duration,
+                                    const Vector3 &wind)
+{
+    Matrix3 tensor = getTensor();
+    Aero::updateForceFromTensor(body, duration, tensor, wind);
+}
+
+AngledAero::AngledAero(const Matrix3 &tensor, const Vector3 &position,
+                       const Vector3 *windspeed)
+:
+Aero(tensor, position, windspeed)
+{
+    orientation = Quaternion();
+}
+
+AngledAero::AngledAero(const Matrix3 &tensor, const Vector3 &position,
+                       const WindField *windField)
+:
+Aero(tensor, position, windField)
+{
+    orientation = Quaternion();
+}
+
+void AngledAero::setOrientation(const Quaternion &quat)
+{
+    orientation = quat;
+    orientation.normalise();
+}
+
+void AngledAero::updateForce(RigidBody *body, real duration)
+{
+    AngledAero::updateForceInWind(body, duration, getWind(body));
+}
+
+void AngledAero::updateForceInWind(RigidBody *body, real duration,
+                                   const Vector3 &wind)
+{
+    // Rotate the surface's tensor into body coordinates: velocities
+    // are taken into the surface's frame, and the force back out.
+    Matrix3 rotation;
+    rotation.setOrientation(orientation);
+    Matrix3 bodyTensor = rotation * tensor * rotation.transpose();
+    Aero::updateForceFromTensor(body, duration, bodyTensor, wind);
+}
+
+Explosion::Explosion()
+{
+    timePassed = 0;
+    detonation = Vector3(0, 0, 0);
+    implosionMaxRadius = 20;
+    implosionMinRadius = 2;
+    implosionDuration = (real)0.1;
+    implosionForce = 100;
+    shockwaveSpeed = 60;
+    shockwaveThickness = 4;
+    peakConcussionForce = 2000;
+    concussionDuration = (real)0.5;
+    peakConvectionForce = 200;
+    chimneyRadius = 5;
+    chimneyHeight = 20;
+    convectionDuration = 5;
+}
+
+Vector3 Explosion::getForce(const Vector3 &position,
+                            const Vector3 &velocity) const
+{
+    Vector3 force;
+    Vector3 offset = position - detonation;
+    real distance = offset.magnitude();
+    Vector3 direction = Vector3::UP;
+    if (distance > 0) direction = offset * (((real)1.0) / distance);
+
+    // In the implosion phase objects in a shell around the
+    // detonation are sucked in towards it.
+    if (timePassed < implosionDuration &&
+        distance > implosionMinRadius && distance < implosionMaxRadius)
+    {
+        force.addScaledVector(direction, -implosionForce);
+    }
+
+    // The concussion wave starts when the implosion ends, and pushes
+    // outwards on objects near its front.
+    real waveTime = timePassed - implosionDuration;
+    if (waveTime >= 0 && waveTime < concussionDuration)
+    {
+        real front = shockwaveSpeed * waveTime;
+        real halfThickness = shockwaveThickness * ((real)0.5);
+        real fromFront = real_abs(distance - front);
+        if (fromFront < halfThickness)
+        {
+            real strength = peakConcussionForce *
+                (1 - fromFront / halfThickness) *
+                (1 - waveTime / concussionDuration);
+
+            // Objects already moving outwards get less of a push,
+            // and objects moving inwards get more.
+            real relative = 1 - (velocity * direction) / shockwaveSpeed;
+            if (relative > 0)
+            {
+                force.addScaledVector(direction, strength * relative);
+            }
+        }
+    }
+
+    // The convection chimney lifts objects above the detonation,
+    // most strongly at its centre and base.
+    if (timePassed < convectionDuration)
+    {
+        real height = offset.y;
+        real radiusSquared = offset.x*offset.x + offset.z*offset.z;
+        if (height >= 0 && height < chimneyHeight &&
+            radiusSquared < chimneyRadius*chimneyRadius)
+        {
+            real strength = peakConvectionForce *
+                (1 - real_sqrt(radiusSquared) / chimneyRadius) *
+                (1 - height / chimneyHeight) *
+                (1 - timePassed / convectionDuration);
+            force.y += strength;
+        }
+    }
+
+    return force;
+}
+
+real Explosion::getRadius() const
+{
+    real radius = 0;
+    if (timePassed < implosionDuration)
+    {
+        radius = implosionMaxRadius;
+    }
+
+    real waveTime = timePassed - implosionDuration;
+    if (waveTime < concussionDuration)
+    {
+        if (waveTime < 0) waveTime = 0;
+        real front = shockwaveSpeed * waveTime +
+            shockwaveThickness * ((real)0.5);
+        if (front > radius) radius = front;
+    }
+
+    if (timePassed < convectionDuration)
+    {
+        real chimney = real_sqrt(chimneyRadius*chimneyRadius +
+            chimneyHeight*chimneyHeight);
+        if (chimney > radius) radius = chimney;
+    }
+    return radius;
+}
+
+bool Explosion::isFinished() const
+{
+    return timePassed >= implosionDuration + concussionDuration &&
+        timePassed >= convectionDuration;
+}
+
+void Explosion::advance(real duration)
+{
+    timePassed += duration;
 }
 
 void Explosion::updateForce(RigidBody* body, real duration)
 {
+    Vector3 force = getForce(body->getPosition(), body->getVelocity());
 
+    // Avoid waking bodies the explosion doesn't touch.
+    if (force.squareMagnitude() > 0) body->addForce(force);
+}
+
+void Explosion::updateForce(Particle* particle, real)
+{
+    Vector3 force = getForce(particle->getPosition(),
+        particle->getVelocity());
+    if (force.squareMagnitude() > 0) particle->addForce(force);
 }
\ No newline at end of file
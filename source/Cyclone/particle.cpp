@@ -22,7 +22,14 @@ using namespace cyclone;
  * --------------------------------------------------------------------------
  */
 
-void Particle::integrate(real duration)
+Particle::Particle()
+:
+id(0),
+fieldMask(FIELD_ALL)
+{
+}
+
+void Particle::integrate(real duration, const UniformFields *fields)
 {
     // We don't integrate things with zero mass.
     if (inverseMass <= 0.0f) return;
@@ -35,6 +42,11 @@ void Particle::integrate(real duration)
     // Work out the acceleration from the force
     Vector3 resultingAcc = acceleration;
     resultingAcc.addScaledVector(forceAccum, inverseMass);
+    if (fields)
+    {
+        fields->addAcceleration(&resultingAcc, velocity,
+            inverseMass, fieldMask);
+    }
 
     // Update linear velocity from the acceleration.
     velocity.addScaledVector(resultingAcc, duration);
@@ -154,6 +166,36 @@ Vector3 Particle::getAcceleration() const
     return acceleration;
 }
 
+void Particle::setId(const unsigned id)
+{
+    Particle::id = id;
+}
+
+void Particle::setFieldMask(const unsigned mask)
+{
+    Particle::fieldMask = mask;
+}
+
+void Particle::getState(ParticleState *state) const
+{
+    state->position[0] = position.x;
+    state->position[1] = position.y;
+    state->position[2] = position.z;
+    state->velocity[0] = velocity.x;
+    state->velocity[1] = velocity.y;
+    state->velocity[2] = velocity.z;
+}
+
+void Particle::setState(const ParticleState &state)
+{
+    position.x = state.position[0];
+    position.y = state.position[1];
+    position.z = state.position[2];
+    velocity.x = state.velocity[0];
+    velocity.y = state.velocity[1];
+    velocity.z = state.velocity[2];
+}
+
 void Particle::clearAccumulator()
 {
     forceAccum.clear();
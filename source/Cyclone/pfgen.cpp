@@ -10,13 +10,283 @@
  * software licence.
  */
 
+#include <typeinfo>
 #include <cyclone/pfgen.h>
 
 using namespace cyclone;
 
 
+ForceHandle ForceHandleTable::allocate(unsigned bucket, unsigned index)
+{
+    unsigned slot;
+    if (firstFree != ~0u)
+    {
+        slot = firstFree;
+        firstFree = slots[slot].index;
+    }
+    else
+    {
+        Slot fresh;
+        fresh.generation = 0;
+        slots.push_back(fresh);
+        slot = (unsigned)slots.size() - 1;
+    }
+    slots[slot].bucket = bucket;
+    slots[slot].index = index;
+
+    ForceHandle handle;
+    handle.slot = slot;
+    handle.generation = slots[slot].generation;
+    return handle;
+}
+
+bool ForceHandleTable::find(const ForceHandle &handle,
+                            unsigned *bucket, unsigned *index) const
+{
+    if (handle.slot >= slots.size()) return false;
+    const Slot &slot = slots[handle.slot];
+    if (slot.generation != handle.generation) return false;
+    *bucket = slot.bucket;
+    *index = slot.index;
+    return true;
+}
+
+void ForceHandleTable::release(unsigned slot)
+{
+    // Changing the generation makes any handle to the slot stale.
+    slots[slot].generation++;
+    slots[slot].index = firstFree;
+    firstFree = slot;
+}
+
+void ForceHandleTable::clear()
+{
+    // Slots are kept, with their generations increased, so that
+    // handles from before the clear are recognised as stale.
+    firstFree = ~0u;
+    for (unsigned i = (unsigned)slots.size(); i > 0; i--)
+    {
+        slots[i-1].generation++;
+        slots[i-1].index = firstFree;
+        firstFree = i-1;
+    }
+}
+
+/**
+ * Internal function that adds a registration to a bucket, and returns
+ * a handle to it.
+ */
+template<class Registration, class Generator>
+static inline ForceHandle _addRegistration(std::vector<Registration> &bucket,
+                                           unsigned bucketId,
+                                           ForceHandleTable &handles,
+                                           Particle *particle, Generator *fg)
+{
+    ForceHandle handle = handles.allocate(bucketId, (unsigned)bucket.size());
+
+    Registration registration;
+    registration.particle = particle;
+    registration.fg = fg;
+    registration.slot = handle.slot;
+    bucket.push_back(registration);
+    return handle;
+}
+
+/**
+ * Internal function that removes a registration from a bucket by
+ * moving the last registration into its place.
+ */
+template<class Registration>
+static inline void _swapRemove(std::vector<Registration> &bucket,
+                               unsigned index,
+                               ForceHandleTable &handles)
+{
+    handles.release(bucket[index].slot);
+    if (index + 1 < bucket.size())
+    {
+        bucket[index] = bucket.back();
+        handles.move(bucket[index].slot, index);
+    }
+    bucket.pop_back();
+}
+
+/**
+ * Internal function that finds the given pair in a bucket, returning
+ * false if it is not there.
+ */
+template<class Registration>
+static inline bool _findPair(const std::vector<Registration> &bucket,
+                             const Particle *particle,
+                             const ParticleForceGenerator *fg,
+                             unsigned *index)
+{
+    for (unsigned i = 0; i < bucket.size(); i++)
+    {
+        if (bucket[i].particle == particle &&
+            (const ParticleForceGenerator*)bucket[i].fg == fg)
+        {
+            *index = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Internal function that removes every registration for a particle
+ * from a bucket in a single pass, keeping the order of the rest.
+ */
+template<class Registration>
+static inline void _removeParticle(std::vector<Registration> &bucket,
+                                   const Particle *particle,
+                                   ForceHandleTable &handles)
+{
+    unsigned kept = 0;
+    for (unsigned i = 0; i < bucket.size(); i++)
+    {
+        if (bucket[i].particle == particle)
+        {
+            handles.release(bucket[i].slot);
+            continue;
+        }
+        if (kept != i)
+        {
+            bucket[kept] = bucket[i];
+            handles.move(bucket[kept].slot, kept);
+        }
+        kept++;
+    }
+    bucket.resize(kept);
+}
+
+/**
+ * Internal function that updates every registration in a bucket. The
+ * call is qualified with the generator's type, so it is made directly
+ * rather than through the virtual table, and can be inlined.
+ */
+template<class Generator, class Registration>
+static inline void _updateBucket(std::vector<Registration> &bucket,
+                                 real duration)
+{
+    typename std::vector<Registration>::iterator i = bucket.begin();
+    for (; i != bucket.end(); i++)
+    {
+        i->fg->Generator::updateForce(i->particle, duration);
+    }
+}
+
+/**
+ * Internal functions that find what a generator with batched forces
+ * needs to know about a particle.
+ */
+static inline void _getBatchInput(const Particle *particle, real *input)
+{
+    *input = particle->getInverseMass();
+}
+
+static inline void _getBatchInput(const Particle *particle, Vector3 *input)
+{
+    particle->getVelocity(input);
+}
+
+/**
+ * Internal function that updates every registration in a bucket of
+ * generators that can find many forces at once. What each generator
+ * needs to know about its particle is gathered first, the forces for
+ * each run of registrations sharing a generator are found in one
+ * call, and then they are applied.
+ */
+template<class Generator, class Registration, class Input>
+static inline void _updateBatchBucket(std::vector<Registration> &bucket,
+                                      std::vector<Input> &inputs,
+                                      std::vector<Vector3> &forces)
+{
+    unsigned count = (unsigned)bucket.size();
+    if (count == 0) return;
+    if (inputs.size() < count) inputs.resize(count);
+    if (forces.size() < count) forces.resize(count);
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        _getBatchInput(bucket[i].particle, &inputs[i]);
+    }
+
+    unsigned start = 0;
+    while (start < count)
+    {
+        const Generator *fg = bucket[start].fg;
+        unsigned end = start + 1;
+        while (end < count && bucket[end].fg == fg) end++;
+        fg->getForces(&inputs[start], &forces[start], end - start);
+        start = end;
+    }
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        bucket[i].particle->addForce(forces[i]);
+    }
+}
+
+/**
+ * Internal function that updates every registration in a buoyancy
+ * bucket. The water heights that are not already known are looked up
+ * first, each run of registrations sharing a surface in one call, and
+ * then the forces are applied.
+ */
+template<class Generator, class Registration>
+static inline void _updateBuoyancyBucket(std::vector<Registration> &bucket,
+                                         real duration,
+                                         std::vector<Vector3> &points,
+                                         std::vector<const WaterSurface*> &surfaces,
+                                         std::vector<real> &heights)
+{
+    unsigned count = (unsigned)bucket.size();
+    if (count == 0) return;
+    if (points.size() < count)
+    {
+        points.resize(count);
+        surfaces.resize(count);
+        heights.resize(count);
+    }
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        const Generator *fg = bucket[i].fg;
+        points[i] = fg->getSamplePoint(bucket[i].particle);
+        if (fg->getKnownHeight(points[i], &heights[i]))
+        {
+            surfaces[i] = NULL;
+        }
+        else
+        {
+            surfaces[i] = fg->getWaterSurface();
+        }
+    }
+
+    WaterSurface::getHeights(&surfaces[0], &points[0], &heights[0], count);
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        Generator *fg = bucket[i].fg;
+        if (surfaces[i]) fg->cacheHeight(points[i], heights[i]);
+        fg->updateForceAtHeight(bucket[i].particle, duration,
+            points[i], heights[i]);
+    }
+}
+
 void ParticleForceRegistry::updateForces(real duration)
 {
+    _updateBatchBucket<ParticleGravity>(gravityRegistrations,
+        batchMasses, batchForces);
+    _updateBatchBucket<ParticleDrag>(dragRegistrations,
+        batchVelocities, batchForces);
+    _updateBucket<ParticleSpring>(springRegistrations, duration);
+    _updateBucket<ParticleBungee>(bungeeRegistrations, duration);
+    _updateBucket<ParticleAnchoredSpring>(
+        anchoredSpringRegistrations, duration);
+    _updateBuoyancyBucket<ParticleBuoyancy>(buoyancyRegistrations, duration,
+        waterPoints, waterSurfaces, waterHeights);
+
     Registry::iterator i = registrations.begin();
     for (; i != registrations.end(); i++)
     {
@@ -24,12 +294,128 @@ void ParticleForceRegistry::updateForces(real duration)
     }
 }
 
-void ParticleForceRegistry::add(Particle* particle, ParticleForceGenerator *fg)
+unsigned ParticleForceRegistry::getBucket(const ParticleForceGenerator *fg)
 {
-    ParticleForceRegistry::ParticleForceRegistration registration;
-    registration.particle = particle;
-    registration.fg = fg;
-    registrations.push_back(registration);
+    // Only generators of exactly a bucketed type can be bucketed,
+    // since derived classes may override updateForce.
+    const std::type_info &type = typeid(*fg);
+    if (type == typeid(ParticleGravity)) return GRAVITY_BUCKET;
+    if (type == typeid(ParticleDrag)) return DRAG_BUCKET;
+    if (type == typeid(ParticleSpring)) return SPRING_BUCKET;
+    if (type == typeid(ParticleBungee)) return BUNGEE_BUCKET;
+    if (type == typeid(ParticleAnchoredSpring)) return ANCHORED_SPRING_BUCKET;
+    if (type == typeid(ParticleBuoyancy)) return BUOYANCY_BUCKET;
+    return GENERAL_BUCKET;
+}
+
+ForceHandle ParticleForceRegistry::add(Particle* particle,
+                                       ParticleForceGenerator *fg)
+{
+    unsigned bucket = getBucket(fg);
+    switch (bucket)
+    {
+    case GRAVITY_BUCKET:
+        return _addRegistration(gravityRegistrations, bucket, handles,
+            particle, (ParticleGravity*)fg);
+    case DRAG_BUCKET:
+        return _addRegistration(dragRegistrations, bucket, handles,
+            particle, (ParticleDrag*)fg);
+    case SPRING_BUCKET:
+        return _addRegistration(springRegistrations, bucket, handles,
+            particle, (ParticleSpring*)fg);
+    case BUNGEE_BUCKET:
+        return _addRegistration(bungeeRegistrations, bucket, handles,
+            particle, (ParticleBungee*)fg);
+    case ANCHORED_SPRING_BUCKET:
+        return _addRegistration(anchoredSpringRegistrations, bucket,
+            handles, particle, (ParticleAnchoredSpring*)fg);
+    case BUOYANCY_BUCKET:
+        return _addRegistration(buoyancyRegistrations, bucket, handles,
+            particle, (ParticleBuoyancy*)fg);
+    default:
+        return _addRegistration(registrations, GENERAL_BUCKET, handles,
+            particle, fg);
+    }
+}
+
+void ParticleForceRegistry::removeAt(unsigned bucket, unsigned index)
+{
+    switch (bucket)
+    {
+    case GRAVITY_BUCKET:
+        _swapRemove(gravityRegistrations, index, handles); break;
+    case DRAG_BUCKET:
+        _swapRemove(dragRegistrations, index, handles); break;
+    case SPRING_BUCKET:
+        _swapRemove(springRegistrations, index, handles); break;
+    case BUNGEE_BUCKET:
+        _swapRemove(bungeeRegistrations, index, handles); break;
+    case ANCHORED_SPRING_BUCKET:
+        _swapRemove(anchoredSpringRegistrations, index, handles); break;
+    case BUOYANCY_BUCKET:
+        _swapRemove(buoyancyRegistrations, index, handles); break;
+    default:
+        _swapRemove(registrations, index, handles); break;
+    }
+}
+
+bool ParticleForceRegistry::remove(const ForceHandle &handle)
+{
+    unsigned bucket, index;
+    if (!handles.find(handle, &bucket, &index)) return false;
+    removeAt(bucket, index);
+    return true;
+}
+
+void ParticleForceRegistry::remove(Particle* particle,
+                                   ParticleForceGenerator *fg)
+{
+    unsigned bucket = getBucket(fg);
+    unsigned index;
+    bool found;
+    switch (bucket)
+    {
+    case GRAVITY_BUCKET:
+        found = _findPair(gravityRegistrations, particle, fg, &index); break;
+    case DRAG_BUCKET:
+        found = _findPair(dragRegistrations, particle, fg, &index); break;
+    case SPRING_BUCKET:
+        found = _findPair(springRegistrations, particle, fg, &index); break;
+    case BUNGEE_BUCKET:
+        found = _findPair(bungeeRegistrations, particle, fg, &index); break;
+    case ANCHORED_SPRING_BUCKET:
+        found = _findPair(anchoredSpringRegistrations, particle, fg,
+            &index);
+        break;
+    case BUOYANCY_BUCKET:
+        found = _findPair(buoyancyRegistrations, particle, fg, &index); break;
+    default:
+        found = _findPair(registrations, particle, fg, &index); break;
+    }
+    if (found) removeAt(bucket, index);
+}
+
+void ParticleForceRegistry::removeAll(Particle* particle)
+{
+    _removeParticle(gravityRegistrations, particle, handles);
+    _removeParticle(dragRegistrations, particle, handles);
+    _removeParticle(springRegistrations, particle, handles);
+    _removeParticle(bungeeRegistrations, particle, handles);
+    _removeParticle(anchoredSpringRegistrations, particle, handles);
+    _removeParticle(buoyancyRegistrations, particle, handles);
+    _removeParticle(registrations, particle, handles);
+}
+
+void ParticleForceRegistry::clear()
+{
+    registrations.clear();
+    gravityRegistrations.clear();
+    dragRegistrations.clear();
+    springRegistrations.clear();
+    bungeeRegistrations.clear();
+    anchoredSpringRegistrations.clear();
+    buoyancyRegistrations.clear();
+    handles.clear();
 }
 
 ParticleGravity::ParticleGravity(const Vector3& gravity)
@@ -43,7 +429,16 @@ void ParticleGravity::updateForce(Particle* particle, real duration)
     if (!particle->hasFiniteMass()) return;
 
     // Apply the mass-scaled force to the particle
-    particle->addForce(gravity * particle->getMass());
+    real inverseMass = particle->getInverseMass();
+    Vector3 force;
+    getForces(&inverseMass, &force, 1);
+    particle->addForce(force);
+}
+
+void ParticleGravity::getForces(const real *inverseMasses, Vector3 *forces,
+                                unsigned count) const
+{
+    simdGravity(&gravity.x, inverseMasses, &forces->x, count);
 }
 
 ParticleDrag::ParticleDrag(real k1, real k2)
@@ -53,19 +448,20 @@ ParticleDrag::ParticleDrag(real k1, real k2)
 
 void ParticleDrag::updateForce(Particle* particle, real duration)
 {
-    Vector3 force;
-    particle->getVelocity(&force);
+    Vector3 velocity;
+    particle->getVelocity(&velocity);
 
-    // Calculate the total drag coefficient
-    real dragCoeff = force.magnitude();
-    dragCoeff = k1 * dragCoeff + k2 * dragCoeff * dragCoeff;
-
-    // Calculate the final force and apply it
-    force.normalise();
-    force *= -dragCoeff;
+    Vector3 force;
+    getForces(&velocity, &force, 1);
     particle->addForce(force);
 }
 
+void ParticleDrag::getForces(const Vector3 *velocities, Vector3 *forces,
+                             unsigned count) const
+{
+    simdDrag(&velocities->x, k1, k2, &forces->x, count);
+}
+
 ParticleSpring::ParticleSpring(Particle *other, real sc, real rl)
 : other(other), springConstant(sc), restLength(rl)
 {
@@ -95,21 +491,57 @@ ParticleBuoyancy::ParticleBuoyancy(real maxDepth,
                                  real liquidDensity)
 :
 maxDepth(maxDepth), volume(volume),
-waterHeight(waterHeight), liquidDensity(liquidDensity)
+waterHeight(waterHeight), liquidDensity(liquidDensity),
+surface(NULL)
 {
 }
 
+void ParticleBuoyancy::setWaterSurface(const WaterSurface *surface)
+{
+    ParticleBuoyancy::surface = surface;
+    heightCache = WaterHeightCache();
+}
+
+bool ParticleBuoyancy::getKnownHeight(const Vector3 &point,
+                                      real *height) const
+{
+    if (!surface)
+    {
+        *height = waterHeight;
+        return true;
+    }
+    return surface->getCachedHeight(point.x, point.z, heightCache, height);
+}
+
+void ParticleBuoyancy::cacheHeight(const Vector3 &point, real height)
+{
+    if (surface) surface->cacheHeight(point.x, point.z, height, &heightCache);
+}
+
 void ParticleBuoyancy::updateForce(Particle* particle, real duration)
+{
+    Vector3 position = particle->getPosition();
+    real height = waterHeight;
+    if (surface)
+    {
+        height = surface->getHeight(position.x, position.z, &heightCache);
+    }
+    updateForceAtHeight(particle, duration, position, height);
+}
+
+void ParticleBuoyancy::updateForceAtHeight(Particle* particle, real,
+                                           const Vector3 &position,
+                                           real waterLevel)
 {
     // Calculate the submersion depth
-    real depth = particle->getPosition().y;
+    real depth = position.y;
 
     // Check if we're out of the water
-    if (depth >= waterHeight + maxDepth) return;
+    if (depth >= waterLevel + maxDepth) return;
     Vector3 force(0,0,0);
 
     // Check if we're at maximum depth
-    if (depth <= waterHeight - maxDepth)
+    if (depth <= waterLevel - maxDepth)
     {
         force.y = liquidDensity * volume;
         particle->addForce(force);
@@ -118,7 +550,7 @@ void ParticleBuoyancy::updateForce(Particle* particle, real duration)
 
     // Otherwise we are partly submerged
     force.y = liquidDensity * volume *
-        (depth - maxDepth - waterHeight) / 2 * maxDepth;
+        (depth - maxDepth - waterLevel) / 2 * maxDepth;
     particle->addForce(force);
 }
 
@@ -149,4 +149,46 @@ unsigned ParticleRodConstraint::addContact(ParticleContact *contact,
     contact->restitution = 0;
 
     return 1;
-}
\ No newline at end of file
+}
+
+bool ParticleCable::getDistanceConstraint(
+    ParticleDistanceConstraint *constraint) const
+{
+    constraint->particle[0] = particle[0];
+    constraint->particle[1] = particle[1];
+    constraint->minLength = 0;
+    constraint->maxLength = maxLength;
+    return true;
+}
+
+bool ParticleRod::getDistanceConstraint(
+    ParticleDistanceConstraint *constraint) const
+{
+    constraint->particle[0] = particle[0];
+    constraint->particle[1] = particle[1];
+    constraint->minLength = length;
+    constraint->maxLength = length;
+    return true;
+}
+
+bool ParticleCableConstraint::getDistanceConstraint(
+    ParticleDistanceConstraint *constraint) const
+{
+    constraint->particle[0] = particle;
+    constraint->particle[1] = NULL;
+    constraint->anchor = anchor;
+    constraint->minLength = 0;
+    constraint->maxLength = maxLength;
+    return true;
+}
+
+bool ParticleRodConstraint::getDistanceConstraint(
+    ParticleDistanceConstraint *constraint) const
+{
+    constraint->particle[0] = particle;
+    constraint->particle[1] = NULL;
+    constraint->anchor = anchor;
+    constraint->minLength = length;
+    constraint->maxLength = length;
+    return true;
+}
@@ -0,0 +1,341 @@
+/*
+ * Implementation file for implicitly integrated particle spring networks.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+#include <assert.h>
+#include <cyclone/pnetwork.h>
+
+using namespace cyclone;
+
+ParticleSpringNetwork::ParticleSpringNetwork(unsigned maxIterations,
+                                             real tolerance)
+:
+maxIterations(maxIterations),
+tolerance(tolerance),
+lastIterations(0)
+{
+}
+
+unsigned ParticleSpringNetwork::addParticle(Particle *particle)
+{
+    particles.push_back(particle);
+    return (unsigned)particles.size() - 1;
+}
+
+void ParticleSpringNetwork::addSpring(unsigned a, unsigned b,
+                                      const Vector3 *anchor,
+                                      real springConstant, real restLength,
+                                      real damping, bool bungee)
+{
+    Spring spring;
+    spring.particle[0] = a;
+    spring.particle[1] = b;
+    spring.anchor = anchor;
+    spring.springConstant = springConstant;
+    spring.restLength = restLength;
+    spring.damping = damping;
+    spring.bungee = bungee;
+    springs.push_back(spring);
+}
+
+void ParticleSpringNetwork::addSpring(unsigned a, unsigned b,
+                                      real springConstant, real restLength,
+                                      real damping)
+{
+    addSpring(a, b, NULL, springConstant, restLength, damping, false);
+}
+
+void ParticleSpringNetwork::addBungee(unsigned a, unsigned b,
+                                      real springConstant, real restLength,
+                                      real damping)
+{
+    addSpring(a, b, NULL, springConstant, restLength, damping, true);
+}
+
+void ParticleSpringNetwork::addAnchoredSpring(unsigned a,
+                                              const Vector3 *anchor,
+                                              real springConstant,
+                                              real restLength,
+                                              real damping)
+{
+    addSpring(a, ANCHOR, anchor, springConstant, restLength, damping, false);
+}
+
+void ParticleSpringNetwork::clear()
+{
+    particles.clear();
+    springs.clear();
+}
+
+void ParticleSpringNetwork::setSolverLimits(unsigned maxIterations,
+                                            real tolerance)
+{
+    ParticleSpringNetwork::maxIterations = maxIterations;
+    ParticleSpringNetwork::tolerance = tolerance;
+}
+
+/**
+ * Internal function that sets the given matrix to the outer product
+ * of a unit vector with itself, scaled by a, plus the identity scaled
+ * by b.
+ */
+static inline void _setOuter(Matrix3 *m, const Vector3 &n, real a, real b)
+{
+    m->data[0] = a*n.x*n.x + b; m->data[1] = a*n.x*n.y; m->data[2] = a*n.x*n.z;
+    m->data[3] = a*n.y*n.x; m->data[4] = a*n.y*n.y + b; m->data[5] = a*n.y*n.z;
+    m->data[6] = a*n.z*n.x; m->data[7] = a*n.z*n.y; m->data[8] = a*n.z*n.z + b;
+}
+
+/**
+ * Internal function that subtracts one matrix from another.
+ */
+static inline void _subtract(Matrix3 *m, const Matrix3 &o)
+{
+    for (unsigned i = 0; i < 9; i++) m->data[i] -= o.data[i];
+}
+
+void ParticleSpringNetwork::assemble(real duration,
+                                     const UniformFields *fields)
+{
+    unsigned count = (unsigned)particles.size();
+    diagonal.resize(count);
+    rhs.resize(count);
+    offDiagonal.resize(springs.size());
+
+    real h = duration;
+    real h2 = duration * duration;
+
+    // Start with the mass matrix and the explicit forces.
+    for (unsigned i = 0; i < count; i++)
+    {
+        const Particle *particle = particles[i];
+        real inverseMass = particle->getInverseMass();
+        if (inverseMass <= 0)
+        {
+            diagonal[i] = Matrix3(1,0,0, 0,1,0, 0,0,1);
+            rhs[i] = Vector3();
+            continue;
+        }
+
+        real mass = ((real)1.0) / inverseMass;
+        diagonal[i] = Matrix3(mass,0,0, 0,mass,0, 0,0,mass);
+
+        Vector3 acceleration = particle->getAcceleration();
+        if (fields)
+        {
+            fields->addAcceleration(&acceleration, particle->getVelocity(),
+                inverseMass, particle->getFieldMask());
+        }
+        Vector3 force = particle->getAccumulatedForce();
+        force.addScaledVector(acceleration, mass);
+        rhs[i] = force * h;
+    }
+
+    // Add each spring's force, and the change in its force over the
+    // step, linearised about the current positions.
+    for (unsigned s = 0; s < springs.size(); s++)
+    {
+        const Spring &spring = springs[s];
+        unsigned a = spring.particle[0];
+        unsigned b = spring.particle[1];
+        Matrix3 &block = offDiagonal[s];
+
+        Vector3 positionB, velocityB;
+        if (b == ANCHOR) positionB = *spring.anchor;
+        else
+        {
+            positionB = particles[b]->getPosition();
+            velocityB = particles[b]->getVelocity();
+        }
+        Vector3 d = particles[a]->getPosition() - positionB;
+        Vector3 relativeVelocity = particles[a]->getVelocity() - velocityB;
+        real length = d.magnitude();
+        real extension = length - spring.restLength;
+
+        if (length <= 0 || (spring.bungee && extension <= 0))
+        {
+            block = Matrix3();
+            continue;
+        }
+        Vector3 n = d * (((real)1.0) / length);
+
+        // The force on the first particle.
+        Vector3 force = n * (-spring.springConstant * extension -
+            spring.damping * (relativeVelocity * n));
+
+        // The derivative of that force with respect to its position.
+        // The transverse term is dropped for compressed springs,
+        // where it would make the matrix indefinite.
+        real transverse = ((real)1.0) - spring.restLength / length;
+        if (transverse < 0) transverse = 0;
+        Matrix3 stiffness;
+        _setOuter(&stiffness, n,
+            -spring.springConstant * (((real)1.0) - transverse),
+            -spring.springConstant * transverse);
+
+        // The derivative with respect to its velocity.
+        Matrix3 damping;
+        _setOuter(&damping, n, -spring.damping, 0);
+
+        // The block is h times the damping derivative plus h squared
+        // times the stiffness, which appears with opposite signs on
+        // and off the diagonal.
+        block = stiffness;
+        block *= h2;
+        damping *= h;
+        block += damping;
+
+        Vector3 stiffnessTerm = stiffness.transform(relativeVelocity) * h2;
+        if (particles[a]->getInverseMass() > 0)
+        {
+            _subtract(&diagonal[a], block);
+            rhs[a] += force * h + stiffnessTerm;
+        }
+        if (b != ANCHOR && particles[b]->getInverseMass() > 0)
+        {
+            _subtract(&diagonal[b], block);
+            rhs[b] -= force * h + stiffnessTerm;
+        }
+    }
+
+    // The preconditioner is the inverse of the matrix's diagonal.
+    preconditioner.resize(count);
+    for (unsigned i = 0; i < count; i++)
+    {
+        const real *m = diagonal[i].data;
+        preconditioner[i] = Vector3(((real)1.0) / m[0],
+            ((real)1.0) / m[4], ((real)1.0) / m[8]);
+    }
+}
+
+void ParticleSpringNetwork::multiply(const std::vector<Vector3> &vector,
+                                     std::vector<Vector3> &result) const
+{
+    unsigned count = (unsigned)particles.size();
+    for (unsigned i = 0; i < count; i++)
+    {
+        result[i] = diagonal[i].transform(vector[i]);
+    }
+
+    for (unsigned s = 0; s < springs.size(); s++)
+    {
+        unsigned a = springs[s].particle[0];
+        unsigned b = springs[s].particle[1];
+        if (b == ANCHOR) continue;
+
+        const Matrix3 &block = offDiagonal[s];
+        result[a] += block.transform(vector[b]);
+        result[b] += block.transform(vector[a]);
+    }
+
+    // Fixed particles never move, so take no part in the system.
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (particles[i]->getInverseMass() <= 0) result[i] = Vector3();
+    }
+}
+
+/**
+ * Internal function that returns the dot product of two arrays of
+ * vectors.
+ */
+static inline real _dot(const std::vector<Vector3> &a,
+                        const std::vector<Vector3> &b)
+{
+    real sum = 0;
+    for (unsigned i = 0; i < a.size(); i++) sum += a[i] * b[i];
+    return sum;
+}
+
+/**
+ * Internal function that multiplies two arrays of vectors component
+ * by component.
+ */
+static inline void _scale(const std::vector<Vector3> &a,
+                          const std::vector<Vector3> &b,
+                          std::vector<Vector3> &result)
+{
+    for (unsigned i = 0; i < a.size(); i++)
+    {
+        result[i] = Vector3(a[i].x*b[i].x, a[i].y*b[i].y, a[i].z*b[i].z);
+    }
+}
+
+unsigned ParticleSpringNetwork::solve()
+{
+    unsigned count = (unsigned)particles.size();
+    deltaV.assign(count, Vector3());
+    residual = rhs;
+    preconditioned.resize(count);
+    direction.resize(count);
+    product.resize(count);
+
+    real target = _dot(rhs, rhs) * tolerance * tolerance;
+    _scale(preconditioner, residual, preconditioned);
+    direction = preconditioned;
+    real rz = _dot(residual, preconditioned);
+
+    unsigned iteration = 0;
+    while (iteration < maxIterations && _dot(residual, residual) > target)
+    {
+        multiply(direction, product);
+        real pAp = _dot(direction, product);
+        if (pAp <= 0) break;
+
+        real alpha = rz / pAp;
+        for (unsigned i = 0; i < count; i++)
+        {
+            deltaV[i].addScaledVector(direction[i], alpha);
+            residual[i].addScaledVector(product[i], -alpha);
+        }
+
+        _scale(preconditioner, residual, preconditioned);
+        real newRz = _dot(residual, preconditioned);
+        real beta = newRz / rz;
+        rz = newRz;
+        for (unsigned i = 0; i < count; i++)
+        {
+            direction[i] = preconditioned[i] + direction[i] * beta;
+        }
+        iteration++;
+    }
+    return iteration;
+}
+
+void ParticleSpringNetwork::integrate(real duration,
+                                      const UniformFields *fields)
+{
+    assert(duration > 0.0);
+
+    assemble(duration, fields);
+    lastIterations = solve();
+
+    for (unsigned i = 0; i < particles.size(); i++)
+    {
+        Particle *particle = particles[i];
+        if (particle->getInverseMass() <= 0)
+        {
+            particle->clearAccumulator();
+            continue;
+        }
+
+        // Backward Euler moves the particle with its new velocity.
+        Vector3 velocity = particle->getVelocity() + deltaV[i];
+        velocity *= real_pow(particle->getDamping(), duration);
+        particle->setVelocity(velocity);
+
+        Vector3 position = particle->getPosition();
+        position.addScaledVector(velocity, duration);
+        particle->setPosition(position);
+
+        particle->clearAccumulator();
+    }
+}
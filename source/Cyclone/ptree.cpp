@@ -0,0 +1,464 @@
+/*
+ * Implementation file for the direct solver for trees of particle links.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+#include <cyclone/ptree.h>
+
+using namespace cyclone;
+
+ParticleTreeSolver::ParticleTreeSolver(unsigned positionIterations)
+:
+positionIterations(positionIterations),
+constraintCount(0),
+particleCount(0),
+constraints(NULL),
+particles(NULL)
+{
+}
+
+void ParticleTreeSolver::setPositionIterations(unsigned iterations)
+{
+    positionIterations = iterations;
+}
+
+/**
+ * Internal function that finds the group a particle belongs to,
+ * shortening the path to it as it goes.
+ */
+static inline unsigned _findGroup(std::vector<unsigned> &groups,
+                                  unsigned particle)
+{
+    while (groups[particle] != particle)
+    {
+        groups[particle] = groups[groups[particle]];
+        particle = groups[particle];
+    }
+    return particle;
+}
+
+/**
+ * Internal function that returns the index of a constraint's
+ * particle, NO_NODE if it is an anchor or can't move, or the particle
+ * count if it isn't one of the solver's particles.
+ */
+static inline unsigned _endIndex(const Particle *particle,
+                                 Particle *const *particles,
+                                 unsigned count, unsigned noNode)
+{
+    if (!particle) return noNode;
+    unsigned id = particle->getId();
+    if (id >= count || particles[id] != particle) return count;
+    if (particle->getInverseMass() <= 0) return noNode;
+    return id;
+}
+
+unsigned ParticleTreeSolver::buildForest()
+{
+    ends.resize(constraintCount * 2);
+    active.assign(constraintCount, false);
+    groups.resize(particleCount);
+    loops.assign(particleCount, false);
+    for (unsigned i = 0; i < particleCount; i++) groups[i] = i;
+
+    // Find the constraints that need solving, and the groups of
+    // particles they link, noting any group with a loop.
+    for (unsigned c = 0; c < constraintCount; c++)
+    {
+        const ParticleDistanceConstraint &constraint = constraints[c];
+        unsigned a = _endIndex(constraint.particle[0], particles,
+            particleCount, NO_NODE);
+        unsigned b = _endIndex(constraint.particle[1], particles,
+            particleCount, NO_NODE);
+        ends[c*2] = a;
+        ends[c*2+1] = b;
+        if (a == particleCount || b == particleCount) continue;
+        if (a == NO_NODE && b == NO_NODE) continue;
+
+        Vector3 positionB = constraint.particle[1] ?
+            constraint.particle[1]->getPosition() : constraint.anchor;
+        real length = (constraint.particle[0]->getPosition() -
+            positionB).magnitude();
+        if (constraint.minLength != constraint.maxLength &&
+            length > constraint.minLength && length < constraint.maxLength)
+        {
+            continue;
+        }
+        active[c] = true;
+
+        if (a == NO_NODE || b == NO_NODE) continue;
+        unsigned groupA = _findGroup(groups, a);
+        unsigned groupB = _findGroup(groups, b);
+        if (groupA == groupB)
+        {
+            loops[groupA] = true;
+        }
+        else
+        {
+            groups[groupB] = groupA;
+            loops[groupA] = loops[groupA] || loops[groupB];
+        }
+    }
+
+    // Anchors and fixed particles are all part of the world, so a
+    // group held to it by more than one constraint has a loop
+    // through it.
+    grounded.assign(particleCount, 0);
+    for (unsigned c = 0; c < constraintCount; c++)
+    {
+        if (!active[c]) continue;
+        unsigned a = ends[c*2];
+        unsigned b = ends[c*2+1];
+        if (a != NO_NODE && b != NO_NODE) continue;
+        unsigned group = _findGroup(groups, a != NO_NODE ? a : b);
+        if (++grounded[group] > 1) loops[group] = true;
+    }
+
+    // Drop the constraints in groups with loops.
+    unsigned solvable = 0;
+    for (unsigned c = 0; c < constraintCount; c++)
+    {
+        if (!active[c]) continue;
+        unsigned a = ends[c*2];
+        unsigned b = ends[c*2+1];
+        unsigned end = a != NO_NODE ? a : b;
+        if (loops[_findGroup(groups, end)])
+        {
+            active[c] = false;
+            continue;
+        }
+        solvable++;
+    }
+
+    orderForest();
+    return solvable;
+}
+
+void ParticleTreeSolver::orderForest()
+{
+    // List the constraints at each of their particles.
+    adjacencyStart.assign(particleCount + 1, 0);
+    for (unsigned c = 0; c < constraintCount; c++)
+    {
+        if (!active[c]) continue;
+        if (ends[c*2] != NO_NODE) adjacencyStart[ends[c*2]+1]++;
+        if (ends[c*2+1] != NO_NODE) adjacencyStart[ends[c*2+1]+1]++;
+    }
+    for (unsigned i = 0; i < particleCount; i++)
+    {
+        adjacencyStart[i+1] += adjacencyStart[i];
+    }
+    adjacency.resize(adjacencyStart[particleCount]);
+    std::vector<unsigned> &fill = groups;
+    for (unsigned i = 0; i < particleCount; i++) fill[i] = adjacencyStart[i];
+    for (unsigned c = 0; c < constraintCount; c++)
+    {
+        if (!active[c]) continue;
+        if (ends[c*2] != NO_NODE) adjacency[fill[ends[c*2]]++] = c;
+        if (ends[c*2+1] != NO_NODE) adjacency[fill[ends[c*2+1]]++] = c;
+    }
+
+    // Walk each tree out from its root, so every node comes after its
+    // parent. A tree held to the world is rooted at the constraint
+    // that holds it, since eliminating that constraint before its
+    // particle would divide by zero. Other trees are rooted at a
+    // particle.
+    parent.assign(particleCount + constraintCount, (unsigned)NO_NODE);
+    order.clear();
+    std::vector<bool> &visited = loops;
+    visited.assign(particleCount, false);
+    for (unsigned c = 0; c < constraintCount; c++)
+    {
+        if (!active[c]) continue;
+        unsigned a = ends[c*2];
+        unsigned b = ends[c*2+1];
+        if (a != NO_NODE && b != NO_NODE) continue;
+        if (visited[a != NO_NODE ? a : b]) continue;
+        addTree(particleCount + c);
+    }
+    for (unsigned root = 0; root < particleCount; root++)
+    {
+        if (visited[root]) continue;
+        if (adjacencyStart[root] == adjacencyStart[root+1]) continue;
+        addTree(root);
+    }
+}
+
+void ParticleTreeSolver::addTree(unsigned root)
+{
+    std::vector<bool> &visited = loops;
+    if (root < particleCount) visited[root] = true;
+    unsigned next = (unsigned)order.size();
+    order.push_back(root);
+    while (next < order.size())
+    {
+        unsigned node = order[next++];
+        if (node < particleCount)
+        {
+            for (unsigned k = adjacencyStart[node];
+                k < adjacencyStart[node+1]; k++)
+            {
+                unsigned constraintNode = particleCount + adjacency[k];
+                if (constraintNode == parent[node]) continue;
+                parent[constraintNode] = node;
+                order.push_back(constraintNode);
+            }
+        }
+        else
+        {
+            unsigned c = node - particleCount;
+            for (unsigned k = 0; k < 2; k++)
+            {
+                unsigned end = ends[c*2+k];
+                if (end == NO_NODE || end == parent[node]) continue;
+                parent[end] = node;
+                visited[end] = true;
+                order.push_back(end);
+            }
+        }
+    }
+}
+
+/**
+ * Internal function that subtracts the outer product of a vector
+ * with itself, scaled, from a matrix.
+ */
+static inline void _subtractOuter(Matrix3 *m, const Vector3 &v, real scale)
+{
+    m->data[0] -= scale*v.x*v.x; m->data[1] -= scale*v.x*v.y;
+    m->data[2] -= scale*v.x*v.z; m->data[3] -= scale*v.y*v.x;
+    m->data[4] -= scale*v.y*v.y; m->data[5] -= scale*v.y*v.z;
+    m->data[6] -= scale*v.z*v.x; m->data[7] -= scale*v.z*v.y;
+    m->data[8] -= scale*v.z*v.z;
+}
+
+void ParticleTreeSolver::factor()
+{
+    unsigned nodeCount = particleCount + constraintCount;
+    normals.resize(constraintCount);
+    particleBlocks.resize(particleCount);
+    constraintBlocks.resize(constraintCount);
+    links.resize(nodeCount);
+
+    // The system has each particle's mass on the diagonal, and the
+    // gradient of each constraint linking it to its particles.
+    for (unsigned k = 0; k < order.size(); k++)
+    {
+        unsigned node = order[k];
+        if (node < particleCount)
+        {
+            real mass = ((real)1.0) / particles[node]->getInverseMass();
+            particleBlocks[node] = Matrix3(mass,0,0, 0,mass,0, 0,0,mass);
+        }
+        else
+        {
+            unsigned c = node - particleCount;
+            const ParticleDistanceConstraint &constraint = constraints[c];
+            Vector3 positionB = constraint.particle[1] ?
+                constraint.particle[1]->getPosition() : constraint.anchor;
+            Vector3 d = constraint.particle[0]->getPosition() - positionB;
+            real length = d.magnitude();
+            normals[c] = length > 0 ? d * (((real)1.0) / length) :
+                Vector3::UP;
+            constraintBlocks[c] = 0;
+        }
+    }
+
+    // Eliminate from the leaves in, folding each node into its
+    // parent's block.
+    for (unsigned k = (unsigned)order.size(); k-- > 0; )
+    {
+        unsigned node = order[k];
+        unsigned up = parent[node];
+        if (node < particleCount)
+        {
+            particleBlocks[node] = particleBlocks[node].inverse();
+            if (up == NO_NODE) continue;
+
+            unsigned c = up - particleCount;
+            Vector3 gradient = getGradient(c, node);
+            links[node] = particleBlocks[node].transform(gradient);
+            constraintBlocks[c] -= gradient * links[node];
+        }
+        else
+        {
+            if (up == NO_NODE) continue;
+            unsigned c = node - particleCount;
+            Vector3 gradient = getGradient(c, up);
+            real block = constraintBlocks[c];
+            links[node] = gradient * (((real)1.0) / block);
+            _subtractOuter(&particleBlocks[up], gradient,
+                ((real)1.0) / block);
+        }
+    }
+}
+
+void ParticleTreeSolver::solve(const std::vector<real> &rhs)
+{
+    particleValues.resize(particleCount);
+    constraintValues.resize(constraintCount);
+    for (unsigned k = 0; k < order.size(); k++)
+    {
+        unsigned node = order[k];
+        if (node < particleCount) particleValues[node] = Vector3();
+        else constraintValues[node - particleCount] =
+            rhs[node - particleCount];
+    }
+
+    // Eliminate from the leaves in.
+    for (unsigned k = (unsigned)order.size(); k-- > 0; )
+    {
+        unsigned node = order[k];
+        unsigned up = parent[node];
+        if (up == NO_NODE) continue;
+        if (node < particleCount)
+        {
+            constraintValues[up - particleCount] -=
+                links[node] * particleValues[node];
+        }
+        else
+        {
+            particleValues[up].addScaledVector(links[node],
+                -constraintValues[node - particleCount]);
+        }
+    }
+
+    // Divide through by the blocks, and substitute back from the
+    // roots out.
+    for (unsigned k = 0; k < order.size(); k++)
+    {
+        unsigned node = order[k];
+        unsigned up = parent[node];
+        if (node < particleCount)
+        {
+            particleValues[node] =
+                particleBlocks[node].transform(particleValues[node]);
+            if (up != NO_NODE)
+            {
+                particleValues[node].addScaledVector(links[node],
+                    -constraintValues[up - particleCount]);
+            }
+        }
+        else
+        {
+            unsigned c = node - particleCount;
+            constraintValues[c] /= constraintBlocks[c];
+            if (up != NO_NODE)
+            {
+                constraintValues[c] -= links[node] * particleValues[up];
+            }
+        }
+    }
+}
+
+unsigned ParticleTreeSolver::solve(const ParticleDistanceConstraint *constraints,
+                                   unsigned constraintCount,
+                                   Particle *const *particles,
+                                   unsigned particleCount,
+                                   bool *solved)
+{
+    ParticleTreeSolver::constraints = constraints;
+    ParticleTreeSolver::constraintCount = constraintCount;
+    ParticleTreeSolver::particles = particles;
+    ParticleTreeSolver::particleCount = particleCount;
+
+    unsigned solvable = buildForest();
+    for (unsigned c = 0; c < constraintCount; c++) solved[c] = active[c];
+    if (solvable == 0) return 0;
+
+    std::vector<real> &rhs = rhsValues;
+    rhs.resize(constraintCount);
+
+    // Move the particles so each constraint is at its length.
+    for (unsigned pass = 0; pass < positionIterations; pass++)
+    {
+        factor();
+        for (unsigned c = 0; c < constraintCount; c++)
+        {
+            if (!active[c]) continue;
+            const ParticleDistanceConstraint &constraint = constraints[c];
+            Vector3 positionB = constraint.particle[1] ?
+                constraint.particle[1]->getPosition() : constraint.anchor;
+            real length = (constraint.particle[0]->getPosition() -
+                positionB).magnitude();
+            real target = length < constraint.minLength ?
+                constraint.minLength : constraint.maxLength;
+            rhs[c] = target - length;
+        }
+        solve(rhs);
+        for (unsigned k = 0; k < order.size(); k++)
+        {
+            unsigned node = order[k];
+            if (node >= particleCount) continue;
+            Particle *particle = particles[node];
+            particle->setPosition(particle->getPosition() +
+                particleValues[node]);
+        }
+    }
+
+    // Remove the velocity that would stretch or compress them. A
+    // constraint at one of its limits can only stop the particles
+    // moving further past it, so any that would have to hold them
+    // back from moving inside it is dropped, and the rest are solved
+    // again. Each round drops at least one, so this ends.
+    bool dropped = true;
+    while (dropped)
+    {
+        dropped = false;
+        factor();
+        for (unsigned c = 0; c < constraintCount; c++)
+        {
+            if (!active[c]) continue;
+            real rate = 0;
+            for (unsigned k = 0; k < 2; k++)
+            {
+                unsigned end = ends[c*2+k];
+                if (end == NO_NODE) continue;
+                rate += getGradient(c, end) *
+                    particles[end]->getVelocity();
+            }
+            rhs[c] = -rate;
+        }
+        solve(rhs);
+
+        for (unsigned c = 0; c < constraintCount; c++)
+        {
+            if (!active[c]) continue;
+            const ParticleDistanceConstraint &constraint = constraints[c];
+            if (constraint.minLength == constraint.maxLength) continue;
+
+            // A positive multiplier pulls the ends together, which is
+            // only allowed at the maximum length.
+            Vector3 positionB = constraint.particle[1] ?
+                constraint.particle[1]->getPosition() : constraint.anchor;
+            real length = (constraint.particle[0]->getPosition() -
+                positionB).magnitude();
+            bool atMaximum =
+                length*2 > constraint.minLength + constraint.maxLength;
+            real multiplier = constraintValues[c];
+            if (atMaximum ? multiplier < 0 : multiplier > 0)
+            {
+                active[c] = false;
+                dropped = true;
+            }
+        }
+        if (dropped) orderForest();
+    }
+    for (unsigned k = 0; k < order.size(); k++)
+    {
+        unsigned node = order[k];
+        if (node >= particleCount) continue;
+        Particle *particle = particles[node];
+        particle->setVelocity(particle->getVelocity() +
+            particleValues[node]);
+    }
+
+    return solvable;
+}
@@ -11,27 +11,76 @@
  */
 
 #include <cstdlib>
+#include <memory.h>
+#include <algorithm>
 #include <cyclone/pworld.h>
 
 using namespace cyclone;
 
+/**
+ * Internal function that returns the identifier used to order a
+ * contact's particle. Contacts with the scenery have no second
+ * particle, and are sorted after all others.
+ */
+static inline unsigned _contactParticleId(const Particle *particle)
+{
+    return particle ? particle->getId() : ~0u;
+}
+
+/**
+ * Internal comparison that puts particle contacts into a fixed order,
+ * based first on the identifiers of the particles involved and then
+ * on the contact geometry.
+ */
+static bool _contactOrder(const ParticleContact &a, const ParticleContact &b)
+{
+    unsigned aId = _contactParticleId(a.particle[0]);
+    unsigned bId = _contactParticleId(b.particle[0]);
+    if (aId != bId) return aId < bId;
+
+    aId = _contactParticleId(a.particle[1]);
+    bId = _contactParticleId(b.particle[1]);
+    if (aId != bId) return aId < bId;
+
+    if (a.penetration != b.penetration)
+        return a.penetration < b.penetration;
+    if (a.contactNormal.x != b.contactNormal.x)
+        return a.contactNormal.x < b.contactNormal.x;
+    if (a.contactNormal.y != b.contactNormal.y)
+        return a.contactNormal.y < b.contactNormal.y;
+    return a.contactNormal.z < b.contactNormal.z;
+}
+
 ParticleWorld::ParticleWorld(unsigned maxContacts, unsigned iterations)
 :
 resolver(iterations),
-maxContacts(maxContacts)
+arena(maxContacts * sizeof(ParticleContact) * 2),
+contacts(NULL),
+contactCapacity(maxContacts > 0 ? maxContacts : 1),
+deterministic(false),
+lastContactCount(0),
+solverMode(CONTACT_SOLVER),
+xpbdSubsteps(4),
+xpbdIterations(1),
+xpbdCompliance(0),
+lastColourCount(0),
+directlySolved(NULL)
 {
-    contacts = new ParticleContact[maxContacts];
     calculateIterations = (iterations == 0);
-
 }
 
 ParticleWorld::~ParticleWorld()
 {
-    delete[] contacts;
 }
 
 void ParticleWorld::startFrame()
 {
+    // Release the last frame's contacts and scratch data.
+    arena.reset();
+    contacts = NULL;
+    lastContactCount = 0;
+    directlySolved = NULL;
+
     for (Particles::iterator p = particles.begin();
         p != particles.end();
         p++)
@@ -43,47 +92,352 @@ void ParticleWorld::startFrame()
 
 unsigned ParticleWorld::generateContacts()
 {
-    unsigned limit = maxContacts;
-    ParticleContact *nextContact = contacts;
+    contacts = arena.allocateArray<ParticleContact>(contactCapacity);
+    unsigned used = 0;
 
-    for (ContactGenerators::iterator g = contactGenerators.begin();
-        g != contactGenerators.end();
-        g++)
+    ParticleDistanceConstraint constraint;
+    ContactGenerators::iterator g = contactGenerators.begin();
+    while (g != contactGenerators.end())
     {
-        unsigned used =(*g)->addContact(nextContact, limit);
-        limit -= used;
-        nextContact += used;
+        // Distance constraints may already have been solved.
+        if (solverMode == XPBD_SOLVER &&
+            (*g)->getDistanceConstraint(&constraint))
+        {
+            g++;
+            continue;
+        }
+        if (directlySolved && directlySolved[g - contactGenerators.begin()])
+        {
+            g++;
+            continue;
+        }
+
+        // Generators can change the particles, so each is only
+        // called once. Make room for all it could report first.
+        unsigned needed = (*g)->getMaxContacts();
+        while (contactCapacity - used < needed)
+        {
+            contactCapacity *= 2;
+            ParticleContact *larger =
+                arena.allocateArray<ParticleContact>(contactCapacity);
+            memcpy(larger, contacts, used * sizeof(ParticleContact));
+            contacts = larger;
+        }
 
-        // We've run out of contacts to fill. This means we're missing
-        // contacts.
-        if (limit <= 0) break;
+        used += (*g)->addContact(contacts + used, contactCapacity - used);
+        g++;
+    }
+
+    // Put the contacts into an order that doesn't depend on the
+    // order the generators were registered in.
+    if (deterministic)
+    {
+        unsigned index = 0;
+        for (Particles::iterator p = particles.begin();
+            p != particles.end();
+            p++)
+        {
+            (*p)->setId(index++);
+        }
+        std::stable_sort(contacts, contacts + used, _contactOrder);
     }
 
     // Return the number of contacts used.
-    return maxContacts - limit;
+    return used;
+}
+
+bool* ParticleWorld::findNetworkedParticles()
+{
+    if (springNetworks.empty()) return NULL;
+
+    unsigned networked = 0;
+    for (SpringNetworks::iterator n = springNetworks.begin();
+        n != springNetworks.end();
+        n++)
+    {
+        networked += (unsigned)(*n)->getParticles().size();
+    }
+
+    // Make a sorted list of the networks' particles to look each
+    // particle in the world up in.
+    Particle **members = arena.allocateArray<Particle*>(networked);
+    Particle **end = members;
+    for (SpringNetworks::iterator n = springNetworks.begin();
+        n != springNetworks.end();
+        n++)
+    {
+        const std::vector<Particle*> &list = (*n)->getParticles();
+        for (unsigned i = 0; i < list.size(); i++) *end++ = list[i];
+    }
+    std::sort(members, end);
+
+    unsigned count = (unsigned)particles.size();
+    bool *flags = arena.allocateArray<bool>(count);
+    for (unsigned i = 0; i < count; i++)
+    {
+        flags[i] = std::binary_search(members, end, particles[i]);
+    }
+    return flags;
 }
 
 void ParticleWorld::integrate(real duration)
 {
-    for (Particles::iterator p = particles.begin();
-        p != particles.end();
-        p++)
+    // Let each network integrate its own particles.
+    bool *networked = findNetworkedParticles();
+    for (SpringNetworks::iterator n = springNetworks.begin();
+        n != springNetworks.end();
+        n++)
     {
-        // Remove all forces from the accumulator
-        (*p)->integrate(duration);
+        (*n)->integrate(duration, &fields);
+    }
+
+    for (unsigned i = 0; i < particles.size(); i++)
+    {
+        if (networked && networked[i]) continue;
+
+        // Integrate the particle, including the world's fields
+        particles[i]->integrate(duration, &fields);
     }
 }
 
+/**
+ * The largest number of colours a particle's constraints are divided
+ * into. Constraints that can't be given one of these are put in a
+ * final batch that is solved in sequence.
+ */
+static const unsigned MAX_COLOURS = 32;
+
+/**
+ * Internal function that projects the particles of a distance
+ * constraint back into its allowed range, accumulating the
+ * constraint's Lagrange multiplier.
+ */
+static inline void _projectConstraint(const ParticleDistanceConstraint &c,
+                                      real *lambda, real alphaTilde)
+{
+    Particle *a = c.particle[0];
+    Particle *b = c.particle[1];
+    Vector3 positionA = a->getPosition();
+    Vector3 positionB = b ? b->getPosition() : c.anchor;
+
+    Vector3 d = positionA - positionB;
+    real length = d.magnitude();
+    if (length <= 0) return;
+
+    real error;
+    if (length < c.minLength) error = length - c.minLength;
+    else if (length > c.maxLength) error = length - c.maxLength;
+    else return;
+
+    real wa = a->getInverseMass();
+    real wb = b ? b->getInverseMass() : 0;
+    if (wa < 0) wa = 0;
+    if (wb < 0) wb = 0;
+    real denominator = wa + wb + alphaTilde;
+    if (denominator <= 0) return;
+
+    real deltaLambda = (-error - alphaTilde * *lambda) / denominator;
+    *lambda += deltaLambda;
+
+    Vector3 n = d * (((real)1.0) / length);
+    a->setPosition(positionA + n * (wa * deltaLambda));
+    if (b) b->setPosition(positionB - n * (wb * deltaLambda));
+}
+
+/**
+ * Internal function that returns true if the given particle is the
+ * one registered at its id in the given list.
+ */
+static inline bool _isRegistered(const Particle *particle,
+                                 const ParticleWorld::Particles &particles)
+{
+    unsigned id = particle->getId();
+    return id < particles.size() && particles[id] == particle;
+}
+
+void ParticleWorld::runPositionSolver(real duration)
+{
+    unsigned count = (unsigned)particles.size();
+    for (unsigned i = 0; i < count; i++) particles[i]->setId(i);
+    bool *networked = findNetworkedParticles();
+
+    // Gather the distance constraints.
+    ParticleDistanceConstraint *constraints =
+        arena.allocateArray<ParticleDistanceConstraint>(
+            (unsigned)contactGenerators.size());
+    unsigned constraintCount = 0;
+    for (ContactGenerators::iterator g = contactGenerators.begin();
+        g != contactGenerators.end();
+        g++)
+    {
+        if ((*g)->getDistanceConstraint(constraints + constraintCount))
+        {
+            constraintCount++;
+        }
+    }
+
+    // Colour the constraints greedily, so no two of a colour share a
+    // particle, then order them by colour.
+    unsigned *usedColours = arena.allocateArray<unsigned>(count);
+    for (unsigned i = 0; i < count; i++) usedColours[i] = 0;
+    unsigned *colours = arena.allocateArray<unsigned>(constraintCount);
+    unsigned batchSizes[MAX_COLOURS + 1] = {0};
+    for (unsigned c = 0; c < constraintCount; c++)
+    {
+        // Constraints on particles that aren't in the world have no
+        // colour to track, so they go in the last batch, which is
+        // projected one constraint at a time.
+        const Particle *one = constraints[c].particle[0];
+        const Particle *two = constraints[c].particle[1];
+        if (!_isRegistered(one, particles) ||
+            (two && !_isRegistered(two, particles)))
+        {
+            colours[c] = MAX_COLOURS;
+            batchSizes[MAX_COLOURS]++;
+            continue;
+        }
+
+        unsigned a = one->getId();
+        unsigned mask = usedColours[a];
+        unsigned b = 0;
+        if (two)
+        {
+            b = two->getId();
+            mask |= usedColours[b];
+        }
+
+        unsigned colour = 0;
+        while (colour < MAX_COLOURS && (mask & (1u << colour))) colour++;
+        if (colour < MAX_COLOURS)
+        {
+            usedColours[a] |= 1u << colour;
+            if (two) usedColours[b] |= 1u << colour;
+        }
+        colours[c] = colour;
+        batchSizes[colour]++;
+    }
+
+    unsigned batchStarts[MAX_COLOURS + 2];
+    batchStarts[0] = 0;
+    lastColourCount = 0;
+    for (unsigned colour = 0; colour <= MAX_COLOURS; colour++)
+    {
+        batchStarts[colour + 1] = batchStarts[colour] + batchSizes[colour];
+        if (batchSizes[colour] > 0) lastColourCount = colour + 1;
+    }
+    unsigned *order = arena.allocateArray<unsigned>(constraintCount);
+    unsigned fill[MAX_COLOURS + 1];
+    memcpy(fill, batchStarts, sizeof(fill));
+    for (unsigned c = 0; c < constraintCount; c++)
+    {
+        order[fill[colours[c]]++] = c;
+    }
+
+    // The forces for the frame are applied in every substep.
+    Vector3 *forces = arena.allocateArray<Vector3>(count);
+    Vector3 *previous = arena.allocateArray<Vector3>(count);
+    real *lambda = arena.allocateArray<real>(constraintCount);
+    for (unsigned i = 0; i < count; i++)
+    {
+        forces[i] = particles[i]->getAccumulatedForce();
+    }
+
+    real h = duration / (real)xpbdSubsteps;
+    real alphaTilde = xpbdCompliance / (h * h);
+    for (unsigned step = 0; step < xpbdSubsteps; step++)
+    {
+        // Predict the new positions.
+        for (unsigned i = 0; i < count; i++)
+        {
+            previous[i] = particles[i]->getPosition();
+        }
+        if (networked)
+        {
+            for (unsigned i = 0; i < count; i++)
+            {
+                if (!networked[i]) continue;
+                particles[i]->clearAccumulator();
+                particles[i]->addForce(forces[i]);
+            }
+            for (SpringNetworks::iterator n = springNetworks.begin();
+                n != springNetworks.end();
+                n++)
+            {
+                (*n)->integrate(h, &fields);
+            }
+        }
+        for (unsigned i = 0; i < count; i++)
+        {
+            Particle *particle = particles[i];
+            real inverseMass = particle->getInverseMass();
+            if (inverseMass <= 0 || (networked && networked[i])) continue;
+
+            Vector3 velocity = particle->getVelocity();
+            Vector3 acceleration = particle->getAcceleration();
+            acceleration.addScaledVector(forces[i], inverseMass);
+            fields.addAcceleration(&acceleration, velocity,
+                inverseMass, particle->getFieldMask());
+            velocity.addScaledVector(acceleration, h);
+            velocity *= real_pow(particle->getDamping(), h);
+            particle->setVelocity(velocity);
+            particle->setPosition(previous[i] + velocity * h);
+        }
+
+        // Project the constraints, one colour at a time.
+        for (unsigned c = 0; c < constraintCount; c++) lambda[c] = 0;
+        for (unsigned iteration = 0; iteration < xpbdIterations; iteration++)
+        {
+            for (unsigned colour = 0; colour <= MAX_COLOURS; colour++)
+            {
+                int start = (int)batchStarts[colour];
+                int end = (int)batchStarts[colour + 1];
+
+                // The last batch holds constraints that may share
+                // particles, so only the coloured ones can be split
+                // between threads.
+#ifdef _OPENMP
+                #pragma omp parallel for if (colour < MAX_COLOURS && end - start > 256)
+#endif
+                for (int k = start; k < end; k++)
+                {
+                    unsigned c = order[k];
+                    _projectConstraint(constraints[c], lambda + c,
+                        alphaTilde);
+                }
+            }
+        }
+
+        // The velocity is whatever moved the particle to where it
+        // ended up.
+        real inverseH = ((real)1.0) / h;
+        for (unsigned i = 0; i < count; i++)
+        {
+            Particle *particle = particles[i];
+            if (particle->getInverseMass() <= 0) continue;
+            particle->setVelocity(
+                (particle->getPosition() - previous[i]) * inverseH);
+        }
+    }
+
+    for (unsigned i = 0; i < count; i++) particles[i]->clearAccumulator();
+}
+
 void ParticleWorld::runPhysics(real duration)
 {
     // First apply the force generators
     registry.updateForces(duration);
 
-    // Then integrate the objects
-    integrate(duration);
+    // Then integrate the objects, solving their distance
+    // constraints as they move in XPBD mode
+    if (solverMode == XPBD_SOLVER) runPositionSolver(duration);
+    else integrate(duration);
+
+    // Hold chains and trees of links exactly
+    if (solverMode == DIRECT_SOLVER) runDirectSolver();
 
     // Generate contacts
     unsigned usedContacts = generateContacts();
+    lastContactCount = usedContacts;
 
     // And process them
     if (usedContacts)
@@ -108,6 +462,153 @@ ParticleForceRegistry& ParticleWorld::getForceRegistry()
     return registry;
 }
 
+unsigned ParticleWorld::runDirectSolver()
+{
+    unsigned count = (unsigned)particles.size();
+    for (unsigned i = 0; i < count; i++) particles[i]->setId(i);
+
+    // Gather the distance constraints, remembering the generator
+    // each came from.
+    unsigned generatorCount = (unsigned)contactGenerators.size();
+    ParticleDistanceConstraint *constraints =
+        arena.allocateArray<ParticleDistanceConstraint>(generatorCount);
+    unsigned *sources = arena.allocateArray<unsigned>(generatorCount);
+    unsigned constraintCount = 0;
+    for (unsigned g = 0; g < generatorCount; g++)
+    {
+        if (contactGenerators[g]->getDistanceConstraint(
+            constraints + constraintCount))
+        {
+            sources[constraintCount++] = g;
+        }
+    }
+    if (constraintCount == 0) return 0;
+
+    bool *solved = arena.allocateArray<bool>(constraintCount);
+    unsigned solvedCount = treeSolver.solve(constraints, constraintCount,
+        count > 0 ? &particles[0] : NULL, count, solved);
+    if (solvedCount == 0) return 0;
+
+    directlySolved = arena.allocateArray<bool>(generatorCount);
+    for (unsigned g = 0; g < generatorCount; g++) directlySolved[g] = false;
+    for (unsigned c = 0; c < constraintCount; c++)
+    {
+        directlySolved[sources[c]] = solved[c];
+    }
+    return solvedCount;
+}
+
+void ParticleWorld::setSolverMode(SolverMode mode)
+{
+    solverMode = mode;
+}
+
+void ParticleWorld::setXPBDParameters(unsigned substeps,
+                                      unsigned iterations,
+                                      real compliance)
+{
+    xpbdSubsteps = substeps > 0 ? substeps : 1;
+    xpbdIterations = iterations > 0 ? iterations : 1;
+    xpbdCompliance = compliance;
+}
+
+void ParticleWorld::shiftOrigin(const Vector3 &newOrigin)
+{
+    for (Particles::iterator p = particles.begin();
+        p != particles.end();
+        p++)
+    {
+        (*p)->setPosition((*p)->getPosition() - newOrigin);
+    }
+
+    origin.position.x += newOrigin.x;
+    origin.position.y += newOrigin.y;
+    origin.position.z += newOrigin.z;
+}
+
+void ParticleWorld::setDeterministic(bool deterministic)
+{
+    ParticleWorld::deterministic = deterministic;
+}
+
+unsigned ParticleWorld::getChecksum() const
+{
+    unsigned checksum = CHECKSUM_SEED;
+    for (Particles::const_iterator p = particles.begin();
+        p != particles.end();
+        p++)
+    {
+        checksum = addToChecksum(checksum, (*p)->getPosition());
+        checksum = addToChecksum(checksum, (*p)->getVelocity());
+    }
+    return checksum;
+}
+
+void ParticleWorld::saveSnapshot(Snapshot *snapshot)
+{
+    unsigned count = (unsigned)particles.size();
+    snapshot->particles.resize(count);
+    for (unsigned i = 0; i < count; i++)
+    {
+        particles[i]->setId(i);
+        particles[i]->getState(&snapshot->particles[i]);
+    }
+
+    snapshot->particleContacts.resize(lastContactCount);
+    for (unsigned i = 0; i < lastContactCount; i++)
+    {
+        const ParticleContact &contact = contacts[i];
+        ParticleContactState &state = snapshot->particleContacts[i];
+        state.particle[0] = _contactParticleId(contact.particle[0]);
+        state.particle[1] = _contactParticleId(contact.particle[1]);
+        state.contactNormal[0] = contact.contactNormal.x;
+        state.contactNormal[1] = contact.contactNormal.y;
+        state.contactNormal[2] = contact.contactNormal.z;
+        state.penetration = contact.penetration;
+        state.restitution = contact.restitution;
+    }
+}
+
+bool ParticleWorld::restoreSnapshot(const Snapshot &snapshot)
+{
+    unsigned count = (unsigned)particles.size();
+    unsigned contactCount = (unsigned)snapshot.particleContacts.size();
+    if (snapshot.particles.size() != count) return false;
+    for (unsigned i = 0; i < contactCount; i++)
+    {
+        const ParticleContactState &state = snapshot.particleContacts[i];
+        for (unsigned p = 0; p < 2; p++)
+        {
+            if (state.particle[p] != ~0u && state.particle[p] >= count)
+                return false;
+        }
+    }
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        particles[i]->setState(snapshot.particles[i]);
+    }
+
+    if (contactCount > contactCapacity) contactCapacity = contactCount;
+    contacts = arena.allocateArray<ParticleContact>(contactCount);
+    for (unsigned i = 0; i < contactCount; i++)
+    {
+        const ParticleContactState &state = snapshot.particleContacts[i];
+        ParticleContact &contact = contacts[i];
+        for (unsigned p = 0; p < 2; p++)
+        {
+            contact.particle[p] = (state.particle[p] == ~0u) ?
+                NULL : particles[state.particle[p]];
+        }
+        contact.contactNormal = Vector3(state.contactNormal[0],
+            state.contactNormal[1], state.contactNormal[2]);
+        contact.penetration = state.penetration;
+        contact.restitution = state.restitution;
+    }
+    lastContactCount = contactCount;
+    return true;
+}
+
 void GroundContacts::init(cyclone::ParticleWorld::Particles *particles)
 {
     GroundContacts::particles = particles;
@@ -136,4 +637,9 @@ unsigned GroundContacts::addContact(cyclone::ParticleContact *contact,
         if (count >= limit) return count;
     }
     return count;
-}
\ No newline at end of file
+}
+
+unsigned GroundContacts::getMaxContacts() const
+{
+    return (unsigned)particles->size();
+}
@@ -0,0 +1,759 @@
+/*
+ * Implementation file for the trajectory recorder.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+#include <memory.h>
+#include <math.h>
+#include <cyclone/recorder.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace cyclone;
+
+static const unsigned RECORDING_MAGIC = 0x4e525943; // "CYRN"
+static const unsigned RECORDING_VERSION = 3;
+
+/**
+ * The tags at the start of each frame of a delta recording.
+ */
+static const unsigned char FRAME_KEY = 1;
+static const unsigned char FRAME_DELTA = 2;
+
+/**
+ * The number of frames the file is first created with room for.
+ */
+static const unsigned INITIAL_FRAMES = 64;
+
+/*
+ * --------------------------------------------------------------------------
+ * MEMORY MAPPED FILE
+ * --------------------------------------------------------------------------
+ */
+
+MappedFile::MappedFile()
+:
+fileHandle(NULL),
+mappingHandle(NULL),
+descriptor(-1),
+writable(false),
+data(NULL),
+size(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+#ifdef _WIN32
+
+/**
+ * Internal function that maps the whole of an open file.
+ */
+static bool _mapFile(void *file, size_t size, bool writable,
+                     void **mapping, unsigned char **data)
+{
+    unsigned long long size64 = size;
+    *mapping = CreateFileMappingA((HANDLE)file, NULL,
+        writable ? PAGE_READWRITE : PAGE_READONLY,
+        (DWORD)(size64 >> 32), (DWORD)(size64 & 0xffffffff), NULL);
+    if (*mapping == NULL) return false;
+
+    *data = (unsigned char *)MapViewOfFile((HANDLE)*mapping,
+        writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size);
+    if (*data == NULL)
+    {
+        CloseHandle((HANDLE)*mapping);
+        *mapping = NULL;
+        return false;
+    }
+    return true;
+}
+
+bool MappedFile::create(const char *filename, size_t size)
+{
+    close();
+    HANDLE handle = CreateFileA(filename, GENERIC_READ | GENERIC_WRITE,
+        0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE) return false;
+
+    fileHandle = handle;
+    writable = true;
+    if (!resize(size))
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool MappedFile::open(const char *filename)
+{
+    close();
+    HANDLE handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ,
+        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE) return false;
+    fileHandle = handle;
+    writable = false;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(handle, &fileSize) || fileSize.QuadPart == 0 ||
+        !_mapFile(fileHandle, (size_t)fileSize.QuadPart, false,
+            &mappingHandle, &data))
+    {
+        close();
+        return false;
+    }
+    size = (size_t)fileSize.QuadPart;
+    return true;
+}
+
+bool MappedFile::resize(size_t newSize)
+{
+    if (!writable) return false;
+    if (data) UnmapViewOfFile(data);
+    if (mappingHandle) CloseHandle((HANDLE)mappingHandle);
+    data = NULL;
+    mappingHandle = NULL;
+
+    // Setting the end of the file both grows and trims it.
+    LARGE_INTEGER end;
+    end.QuadPart = (LONGLONG)newSize;
+    if (!SetFilePointerEx((HANDLE)fileHandle, end, NULL, FILE_BEGIN) ||
+        !SetEndOfFile((HANDLE)fileHandle))
+    {
+        return false;
+    }
+
+    if (!_mapFile(fileHandle, newSize, true, &mappingHandle, &data))
+    {
+        return false;
+    }
+    size = newSize;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (data) UnmapViewOfFile(data);
+    if (mappingHandle) CloseHandle((HANDLE)mappingHandle);
+    if (fileHandle) CloseHandle((HANDLE)fileHandle);
+    data = NULL;
+    mappingHandle = NULL;
+    fileHandle = NULL;
+    size = 0;
+}
+
+#else
+
+bool MappedFile::create(const char *filename, size_t size)
+{
+    close();
+    descriptor = ::open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (descriptor < 0) return false;
+
+    writable = true;
+    if (!resize(size))
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool MappedFile::open(const char *filename)
+{
+    close();
+    descriptor = ::open(filename, O_RDONLY);
+    if (descriptor < 0) return false;
+    writable = false;
+
+    struct stat info;
+    if (fstat(descriptor, &info) != 0 || info.st_size == 0)
+    {
+        close();
+        return false;
+    }
+
+    void *mapped = mmap(NULL, (size_t)info.st_size, PROT_READ,
+        MAP_SHARED, descriptor, 0);
+    if (mapped == MAP_FAILED)
+    {
+        close();
+        return false;
+    }
+    data = (unsigned char *)mapped;
+    size = (size_t)info.st_size;
+    return true;
+}
+
+bool MappedFile::resize(size_t newSize)
+{
+    if (!writable) return false;
+    if (data) munmap(data, size);
+    data = NULL;
+    size = 0;
+
+    if (ftruncate(descriptor, (off_t)newSize) != 0) return false;
+
+    void *mapped = mmap(NULL, newSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED, descriptor, 0);
+    if (mapped == MAP_FAILED) return false;
+
+    data = (unsigned char *)mapped;
+    size = newSize;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (data) munmap(data, size);
+    if (descriptor >= 0) ::close(descriptor);
+    data = NULL;
+    descriptor = -1;
+    size = 0;
+}
+
+#endif
+
+/*
+ * --------------------------------------------------------------------------
+ * FRAME LAYOUT
+ * --------------------------------------------------------------------------
+ */
+
+/**
+ * Internal function that returns the size of a full precision frame.
+ */
+static inline size_t _keyframeSize(const RecordingHeader &header)
+{
+    return header.bodyCount * 7 * sizeof(real) +
+        header.particleCount * 3 * sizeof(real);
+}
+
+/**
+ * Internal function that returns the size of a delta frame.
+ */
+static inline size_t _deltaFrameSize(const RecordingHeader &header)
+{
+    return header.bodyCount * 7 * sizeof(short) +
+        header.particleCount * 3 * sizeof(short);
+}
+
+/**
+ * Internal function that returns the byte offset of the given frame
+ * of a raw recording.
+ */
+static inline size_t _rawFrameOffset(const RecordingHeader &header,
+                                     unsigned frame)
+{
+    return sizeof(RecordingHeader) + frame * _keyframeSize(header);
+}
+
+/**
+ * Internal function that quantises a value to a short, clamping it
+ * to the range a short can hold. Returns true if it was clamped.
+ */
+static inline bool _quantise(real value, real scale, short *out)
+{
+    real scaled = real_floor(value * scale + (real)0.5);
+    if (scaled > (real)32767)
+    {
+        *out = 32767;
+        return true;
+    }
+    else if (scaled < (real)-32767)
+    {
+        *out = -32767;
+        return true;
+    }
+    *out = (short)scaled;
+    return false;
+}
+
+/*
+ * --------------------------------------------------------------------------
+ * RECORDER
+ * --------------------------------------------------------------------------
+ */
+
+TrajectoryRecorder::TrajectoryRecorder()
+:
+writeOffset(0),
+keyframeOffset(0),
+deltaCount(0),
+extraKeyframeCount(0)
+{
+    memset(&header, 0, sizeof(header));
+}
+
+TrajectoryRecorder::~TrajectoryRecorder()
+{
+    close();
+}
+
+void TrajectoryRecorder::addBody(const RigidBody *body)
+{
+    if (file.data) return;
+    bodies.push_back(body);
+}
+
+void TrajectoryRecorder::addParticle(const Particle *particle)
+{
+    if (file.data) return;
+    particles.push_back(particle);
+}
+
+bool TrajectoryRecorder::open(const char *filename,
+                              RecordingEncoding encoding,
+                              unsigned keyframeInterval,
+                              real precision)
+{
+    close();
+
+    header.magic = RECORDING_MAGIC;
+    header.version = RECORDING_VERSION;
+    header.realSize = sizeof(real);
+    header.encoding = encoding;
+    header.bodyCount = (unsigned)bodies.size();
+    header.particleCount = (unsigned)particles.size();
+    header.keyframeInterval = keyframeInterval > 0 ? keyframeInterval : 1;
+    header.frameCount = 0;
+    header.keyframeCount = 0;
+    header.indexOffset = 0;
+    header.precision = precision;
+
+    size_t initialSize = sizeof(RecordingHeader) +
+        INITIAL_FRAMES * _keyframeSize(header);
+    if (!file.create(filename, initialSize)) return false;
+
+    memcpy(file.data, &header, sizeof(header));
+    writeOffset = sizeof(RecordingHeader);
+    keyframeOffset = writeOffset;
+    deltaCount = 0;
+    extraKeyframeCount = 0;
+    keyframes.clear();
+    return true;
+}
+
+bool TrajectoryRecorder::reserve(size_t bytes)
+{
+    if (writeOffset + bytes <= file.size) return true;
+
+    // Grow geometrically so that appending is amortised constant.
+    size_t newSize = file.size * 2;
+    while (newSize < writeOffset + bytes) newSize *= 2;
+    return file.resize(newSize);
+}
+
+void TrajectoryRecorder::writeKeyframe(unsigned char *out) const
+{
+    real values[7];
+    for (unsigned i = 0; i < bodies.size(); i++)
+    {
+        const RigidBody *body = bodies[i];
+        Vector3 position = body->getPosition();
+        Quaternion orientation = body->getOrientation();
+        values[0] = position.x;
+        values[1] = position.y;
+        values[2] = position.z;
+        values[3] = orientation.r;
+        values[4] = orientation.i;
+        values[5] = orientation.j;
+        values[6] = orientation.k;
+        memcpy(out, values, sizeof(values));
+        out += sizeof(values);
+    }
+    for (unsigned i = 0; i < particles.size(); i++)
+    {
+        Vector3 position = particles[i]->getPosition();
+        values[0] = position.x;
+        values[1] = position.y;
+        values[2] = position.z;
+        memcpy(out, values, 3 * sizeof(real));
+        out += 3 * sizeof(real);
+    }
+}
+
+bool TrajectoryRecorder::writeDeltaFrame(unsigned char *out) const
+{
+    // Positions are stored relative to the last keyframe.
+    const unsigned char *key = file.data + keyframeOffset;
+    real scale = ((real)1.0) / header.precision;
+    real keyValues[7];
+    short values[7];
+    for (unsigned i = 0; i < bodies.size(); i++)
+    {
+        const RigidBody *body = bodies[i];
+        Vector3 position = body->getPosition();
+        Quaternion orientation = body->getOrientation();
+        memcpy(keyValues, key, sizeof(keyValues));
+        key += sizeof(keyValues);
+
+        if (_quantise(position.x - keyValues[0], scale, &values[0]) ||
+            _quantise(position.y - keyValues[1], scale, &values[1]) ||
+            _quantise(position.z - keyValues[2], scale, &values[2]))
+        {
+            return false;
+        }
+        _quantise(orientation.r, (real)32767, &values[3]);
+        _quantise(orientation.i, (real)32767, &values[4]);
+        _quantise(orientation.j, (real)32767, &values[5]);
+        _quantise(orientation.k, (real)32767, &values[6]);
+        memcpy(out, values, sizeof(values));
+        out += sizeof(values);
+    }
+    for (unsigned i = 0; i < particles.size(); i++)
+    {
+        Vector3 position = particles[i]->getPosition();
+        memcpy(keyValues, key, 3 * sizeof(real));
+        key += 3 * sizeof(real);
+
+        if (_quantise(position.x - keyValues[0], scale, &values[0]) ||
+            _quantise(position.y - keyValues[1], scale, &values[1]) ||
+            _quantise(position.z - keyValues[2], scale, &values[2]))
+        {
+            return false;
+        }
+        memcpy(out, values, 3 * sizeof(short));
+        out += 3 * sizeof(short);
+    }
+    return true;
+}
+
+bool TrajectoryRecorder::recordFrame()
+{
+    if (!file.data) return false;
+
+    if (header.encoding == RECORD_RAW)
+    {
+        size_t frameSize = _keyframeSize(header);
+        if (!reserve(frameSize)) return false;
+        writeKeyframe(file.data + writeOffset);
+        writeOffset += frameSize;
+    }
+    else
+    {
+        // Make room for a tagged keyframe, the larger kind of frame,
+        // as a delta frame can turn out not to fit.
+        if (!reserve(1 + _keyframeSize(header))) return false;
+        unsigned char *out = file.data + writeOffset;
+
+        bool isKeyframe = header.frameCount == 0 ||
+            deltaCount + 1 >= header.keyframeInterval;
+        if (!isKeyframe && !writeDeltaFrame(out + 1))
+        {
+            isKeyframe = true;
+            extraKeyframeCount++;
+        }
+
+        if (isKeyframe)
+        {
+            RecordingKeyframe keyframe;
+            keyframe.frame = header.frameCount;
+            keyframe.offset = writeOffset;
+            keyframes.push_back(keyframe);
+
+            out[0] = FRAME_KEY;
+            writeKeyframe(out + 1);
+            keyframeOffset = writeOffset + 1;
+            deltaCount = 0;
+            writeOffset += 1 + _keyframeSize(header);
+        }
+        else
+        {
+            out[0] = FRAME_DELTA;
+            deltaCount++;
+            writeOffset += 1 + _deltaFrameSize(header);
+        }
+    }
+
+    header.frameCount++;
+    memcpy(file.data, &header, sizeof(header));
+    return true;
+}
+
+void TrajectoryRecorder::close()
+{
+    if (!file.data) return;
+
+    // Write the keyframe index after the frames. The header only
+    // points to it once it is complete, and if there is no room for
+    // it the reader finds the keyframes from the tags instead.
+    size_t indexSize = keyframes.size() * sizeof(RecordingKeyframe);
+    if (header.encoding == RECORD_DELTA && reserve(indexSize))
+    {
+        if (indexSize > 0)
+        {
+            memcpy(file.data + writeOffset, &keyframes[0], indexSize);
+        }
+        header.keyframeCount = (unsigned)keyframes.size();
+        header.indexOffset = writeOffset;
+        writeOffset += indexSize;
+    }
+    memcpy(file.data, &header, sizeof(header));
+    file.resize(writeOffset);
+    file.close();
+}
+
+/*
+ * --------------------------------------------------------------------------
+ * READER
+ * --------------------------------------------------------------------------
+ */
+
+TrajectoryReader::TrajectoryReader()
+:
+knownFrameCount(0),
+scanOffset(0),
+framesEnd(0)
+{
+    memset(&header, 0, sizeof(header));
+}
+
+bool TrajectoryReader::open(const char *filename)
+{
+    close();
+    if (!file.open(filename)) return false;
+
+    if (file.size < sizeof(RecordingHeader))
+    {
+        close();
+        return false;
+    }
+    memcpy(&header, file.data, sizeof(header));
+    if (header.magic != RECORDING_MAGIC ||
+        header.version != RECORDING_VERSION ||
+        header.realSize != sizeof(real) ||
+        header.keyframeInterval == 0)
+    {
+        close();
+        return false;
+    }
+
+    // Only trust the frames that are fully present in the file.
+    if (header.encoding == RECORD_RAW)
+    {
+        while (header.frameCount > 0 &&
+            _rawFrameOffset(header, header.frameCount) > file.size)
+        {
+            header.frameCount--;
+        }
+        return true;
+    }
+
+    // A closed recording has an index of its keyframes after the
+    // frames. One that wasn't has its tags read as they're needed.
+    unsigned long long indexOffset = header.indexOffset;
+    size_t indexSize = header.keyframeCount * sizeof(RecordingKeyframe);
+    if (indexOffset != 0 && indexOffset <= file.size &&
+        indexSize <= file.size - (size_t)indexOffset)
+    {
+        keyframes.resize(header.keyframeCount);
+        if (indexSize > 0)
+        {
+            memcpy(&keyframes[0], file.data + indexOffset, indexSize);
+        }
+        knownFrameCount = header.frameCount;
+        framesEnd = (size_t)indexOffset;
+    }
+    else
+    {
+        knownFrameCount = 0;
+        scanOffset = sizeof(RecordingHeader);
+        framesEnd = file.size;
+    }
+    return true;
+}
+
+void TrajectoryReader::scanFrames(unsigned frame) const
+{
+    size_t keySize = _keyframeSize(header);
+    size_t deltaSize = _deltaFrameSize(header);
+    while (knownFrameCount <= frame && knownFrameCount < header.frameCount)
+    {
+        if (scanOffset >= framesEnd) break;
+
+        size_t frameSize;
+        unsigned char tag = file.data[scanOffset];
+        if (tag == FRAME_KEY)
+        {
+            frameSize = keySize;
+        }
+        else if (tag == FRAME_DELTA && !keyframes.empty())
+        {
+            frameSize = deltaSize;
+        }
+        else break;
+        if (scanOffset + 1 + frameSize > framesEnd) break;
+
+        if (tag == FRAME_KEY)
+        {
+            RecordingKeyframe keyframe;
+            keyframe.frame = knownFrameCount;
+            keyframe.offset = scanOffset;
+            keyframes.push_back(keyframe);
+        }
+        scanOffset += 1 + frameSize;
+        knownFrameCount++;
+    }
+}
+
+void TrajectoryReader::close()
+{
+    file.close();
+    memset(&header, 0, sizeof(header));
+    keyframes.clear();
+    knownFrameCount = 0;
+    scanOffset = 0;
+    framesEnd = 0;
+}
+
+bool TrajectoryReader::readFrame(unsigned frame,
+                                 Vector3 *bodyPositions,
+                                 Quaternion *bodyOrientations,
+                                 Vector3 *particlePositions) const
+{
+    if (frame >= header.frameCount) return false;
+
+    const unsigned char *in;
+    const unsigned char *key;
+    if (header.encoding == RECORD_RAW)
+    {
+        in = key = file.data + _rawFrameOffset(header, frame);
+    }
+    else
+    {
+        if (frame >= knownFrameCount) scanFrames(frame);
+        if (frame >= knownFrameCount || keyframes.empty()) return false;
+
+        // Find the last keyframe at or before the frame. Every frame
+        // after it is a delta frame, so the frame's offset follows.
+        unsigned low = 0;
+        unsigned high = (unsigned)keyframes.size();
+        while (high - low > 1)
+        {
+            unsigned middle = (low + high) / 2;
+            if (keyframes[middle].frame <= frame) low = middle;
+            else high = middle;
+        }
+        const RecordingKeyframe &keyframe = keyframes[low];
+        if (keyframe.frame > frame) return false;
+
+        size_t keySize = _keyframeSize(header);
+        size_t deltaSize = _deltaFrameSize(header);
+        size_t keyOffset = (size_t)keyframe.offset;
+        size_t offset = keyOffset;
+        unsigned char tag = FRAME_KEY;
+        size_t frameSize = keySize;
+        if (frame > keyframe.frame)
+        {
+            offset += 1 + keySize +
+                (frame - keyframe.frame - 1) * (1 + deltaSize);
+            tag = FRAME_DELTA;
+            frameSize = deltaSize;
+        }
+
+        // Check the frame is where the index says.
+        if (offset + 1 + frameSize > framesEnd ||
+            file.data[keyOffset] != FRAME_KEY || file.data[offset] != tag)
+        {
+            return false;
+        }
+        in = file.data + offset + 1;
+        key = file.data + keyOffset + 1;
+    }
+
+    if (in == key)
+    {
+        real values[7];
+        for (unsigned i = 0; i < header.bodyCount; i++)
+        {
+            memcpy(values, in, sizeof(values));
+            in += sizeof(values);
+            if (bodyPositions)
+            {
+                bodyPositions[i] = Vector3(values[0], values[1], values[2]);
+            }
+            if (bodyOrientations)
+            {
+                bodyOrientations[i] =
+                    Quaternion(values[3], values[4], values[5], values[6]);
+            }
+        }
+        if (particlePositions)
+        {
+            for (unsigned i = 0; i < header.particleCount; i++)
+            {
+                memcpy(values, in, 3 * sizeof(real));
+                in += 3 * sizeof(real);
+                particlePositions[i] =
+                    Vector3(values[0], values[1], values[2]);
+            }
+        }
+        return true;
+    }
+
+    // A delta frame is decoded against its keyframe.
+    real precision = header.precision;
+    real orientationScale = ((real)1.0) / (real)32767;
+    real keyValues[7];
+    short values[7];
+
+    for (unsigned i = 0; i < header.bodyCount; i++)
+    {
+        memcpy(keyValues, key, sizeof(keyValues));
+        key += sizeof(keyValues);
+        memcpy(values, in, sizeof(values));
+        in += sizeof(values);
+        if (bodyPositions)
+        {
+            bodyPositions[i] = Vector3(
+                keyValues[0] + values[0] * precision,
+                keyValues[1] + values[1] * precision,
+                keyValues[2] + values[2] * precision);
+        }
+        if (bodyOrientations)
+        {
+            Quaternion orientation(
+                values[3] * orientationScale,
+                values[4] * orientationScale,
+                values[5] * orientationScale,
+                values[6] * orientationScale);
+            orientation.normalise();
+            bodyOrientations[i] = orientation;
+        }
+    }
+    if (particlePositions)
+    {
+        for (unsigned i = 0; i < header.particleCount; i++)
+        {
+            memcpy(keyValues, key, 3 * sizeof(real));
+            key += 3 * sizeof(real);
+            memcpy(values, in, 3 * sizeof(short));
+            in += 3 * sizeof(short);
+            particlePositions[i] = Vector3(
+                keyValues[0] + values[0] * precision,
+                keyValues[1] + values[1] * precision,
+                keyValues[2] + values[2] * precision);
+        }
+    }
+    return true;
+}
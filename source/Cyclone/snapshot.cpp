@@ -0,0 +1,149 @@
+/*
+ * Implementation file for simulation snapshots.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+#include <memory.h>
+#include <cyclone/snapshot.h>
+
+using namespace cyclone;
+
+/**
+ * Internal structure that starts the binary form of a snapshot.
+ */
+struct SnapshotHeader
+{
+    unsigned magic;
+    unsigned version;
+    unsigned realSize;
+    unsigned bodyCount;
+    unsigned contactCount;
+    unsigned particleCount;
+    unsigned particleContactCount;
+};
+
+static const unsigned SNAPSHOT_MAGIC = 0x4e535943; // "CYSN"
+static const unsigned SNAPSHOT_VERSION = 1;
+
+/**
+ * Internal function that copies an array of records into the buffer
+ * and returns the position after it.
+ */
+template<class Record>
+static inline unsigned char* _writeSection(unsigned char *out,
+                                           const std::vector<Record> &records)
+{
+    if (records.empty()) return out;
+    unsigned bytes = (unsigned)(records.size() * sizeof(Record));
+    memcpy(out, &records[0], bytes);
+    return out + bytes;
+}
+
+/**
+ * Internal function that fills an array of records from the buffer
+ * and returns the position after it.
+ */
+template<class Record>
+static inline const unsigned char* _readSection(const unsigned char *in,
+                                                unsigned count,
+                                                std::vector<Record> &records)
+{
+    records.resize(count);
+    if (count == 0) return in;
+    size_t bytes = count * sizeof(Record);
+    memcpy(&records[0], in, bytes);
+    return in + bytes;
+}
+
+/**
+ * Internal function that checks a section of the given number of
+ * records fits in the bytes that remain, and takes it from them.
+ * The count is checked before it is multiplied, so a corrupt count
+ * can't wrap around to a small size.
+ */
+template<class Record>
+static inline bool _takeSection(unsigned count, size_t *remaining)
+{
+    if (count > *remaining / sizeof(Record)) return false;
+    *remaining -= count * sizeof(Record);
+    return true;
+}
+
+void Snapshot::clear()
+{
+    bodies.clear();
+    contacts.clear();
+    particles.clear();
+    particleContacts.clear();
+}
+
+unsigned Snapshot::getBinarySize() const
+{
+    return (unsigned)(sizeof(SnapshotHeader) +
+        bodies.size() * sizeof(RigidBodyState) +
+        contacts.size() * sizeof(ContactState) +
+        particles.size() * sizeof(ParticleState) +
+        particleContacts.size() * sizeof(ParticleContactState));
+}
+
+void Snapshot::writeBinary(void *buffer) const
+{
+    SnapshotHeader header;
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.realSize = sizeof(real);
+    header.bodyCount = (unsigned)bodies.size();
+    header.contactCount = (unsigned)contacts.size();
+    header.particleCount = (unsigned)particles.size();
+    header.particleContactCount = (unsigned)particleContacts.size();
+
+    unsigned char *out = (unsigned char *)buffer;
+    memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+
+    out = _writeSection(out, bodies);
+    out = _writeSection(out, contacts);
+    out = _writeSection(out, particles);
+    _writeSection(out, particleContacts);
+}
+
+bool Snapshot::readBinary(const void *buffer, unsigned size)
+{
+    if (size < sizeof(SnapshotHeader)) return false;
+
+    SnapshotHeader header;
+    memcpy(&header, buffer, sizeof(header));
+    if (header.magic != SNAPSHOT_MAGIC ||
+        header.version != SNAPSHOT_VERSION ||
+        header.realSize != sizeof(real))
+    {
+        return false;
+    }
+
+    // Check the sections fit in the data we were given. The counts
+    // come from the buffer, so they can't be trusted.
+    size_t remaining = size - sizeof(SnapshotHeader);
+    if (!_takeSection<RigidBodyState>(header.bodyCount, &remaining) ||
+        !_takeSection<ContactState>(header.contactCount, &remaining) ||
+        !_takeSection<ParticleState>(header.particleCount, &remaining) ||
+        !_takeSection<ParticleContactState>(
+            header.particleContactCount, &remaining))
+    {
+        return false;
+    }
+
+    const unsigned char *in =
+        (const unsigned char *)buffer + sizeof(SnapshotHeader);
+    in = _readSection(in, header.bodyCount, bodies);
+    in = _readSection(in, header.contactCount, contacts);
+    in = _readSection(in, header.particleCount, particles);
+    _readSection(in, header.particleContactCount, particleContacts);
+    return true;
+}
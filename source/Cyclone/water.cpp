@@ -0,0 +1,220 @@
+/*
+ * Implementation file for the water surface.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+#include <math.h>
+#include <cyclone/water.h>
+
+using namespace cyclone;
+
+WaterSurface::WaterSurface(real baseHeight)
+:
+baseHeight(baseHeight),
+originX(0), originZ(0),
+cellSize(1),
+countX(0), countZ(0),
+time(0),
+version(1)
+{
+}
+
+void WaterSurface::setBaseHeight(real height)
+{
+    baseHeight = height;
+    changed();
+}
+
+void WaterSurface::setHeightfield(real originX, real originZ, real cellSize,
+                                  unsigned x, unsigned z)
+{
+    WaterSurface::originX = originX;
+    WaterSurface::originZ = originZ;
+    WaterSurface::cellSize = cellSize;
+    countX = x > 0 ? x : 1;
+    countZ = z > 0 ? z : 1;
+    heights.assign(countX * countZ, 0);
+    changed();
+}
+
+void WaterSurface::setFieldHeight(unsigned x, unsigned z, real height)
+{
+    heights[z * countX + x] = height;
+    changed();
+}
+
+void WaterSurface::clearHeightfield()
+{
+    heights.clear();
+    countX = countZ = 0;
+    changed();
+}
+
+void WaterSurface::addWave(const WaterWave &wave)
+{
+    WaterWave added = wave;
+    real length = real_sqrt(added.directionX*added.directionX +
+        added.directionZ*added.directionZ);
+    if (length > 0)
+    {
+        added.directionX /= length;
+        added.directionZ /= length;
+    }
+    waves.push_back(added);
+    changed();
+}
+
+void WaterSurface::clearWaves()
+{
+    waves.clear();
+    changed();
+}
+
+void WaterSurface::setTime(real newTime)
+{
+    time = newTime;
+
+    // Only the waves move, so a still surface keeps its version and
+    // any cached heights.
+    if (!waves.empty()) changed();
+}
+
+/**
+ * Internal function that finds the cell and interpolation fraction
+ * along one heightfield axis, clamping to the edges of the field.
+ */
+static inline void _locate(real coordinate, unsigned count,
+                           unsigned *cell, real *fraction)
+{
+    if (count < 2 || coordinate <= 0)
+    {
+        *cell = 0;
+        *fraction = 0;
+        return;
+    }
+    real last = (real)(count - 1);
+    if (coordinate >= last)
+    {
+        *cell = count - 2;
+        *fraction = 1;
+        return;
+    }
+    real cellStart = real_floor(coordinate);
+    *cell = (unsigned)cellStart;
+    *fraction = coordinate - cellStart;
+}
+
+real WaterSurface::getHeight(real x, real z) const
+{
+    Vector3 position(x, 0, z);
+    real height;
+    getHeights(&position, &height, 1);
+    return height;
+}
+
+bool WaterSurface::getCachedHeight(real x, real z,
+                                   const WaterHeightCache &cache,
+                                   real *height) const
+{
+    if (isFlat())
+    {
+        *height = baseHeight;
+        return true;
+    }
+    if (cache.version == version && cache.x == x && cache.z == z)
+    {
+        *height = cache.height;
+        return true;
+    }
+    return false;
+}
+
+void WaterSurface::cacheHeight(real x, real z, real height,
+                               WaterHeightCache *cache) const
+{
+    cache->x = x;
+    cache->z = z;
+    cache->version = version;
+    cache->height = height;
+}
+
+real WaterSurface::getHeight(real x, real z, WaterHeightCache *cache) const
+{
+    real height;
+    if (getCachedHeight(x, z, *cache, &height)) return height;
+    height = getHeight(x, z);
+    cacheHeight(x, z, height, cache);
+    return height;
+}
+
+void WaterSurface::getHeights(const Vector3 *positions, real *output,
+                              unsigned count) const
+{
+    for (unsigned i = 0; i < count; i++) output[i] = baseHeight;
+
+    if (!heights.empty())
+    {
+        real inverseCellSize = ((real)1.0) / cellSize;
+        unsigned dx = countX > 1 ? 1 : 0;
+        unsigned dz = countZ > 1 ? countX : 0;
+        for (unsigned i = 0; i < count; i++)
+        {
+            unsigned cx, cz;
+            real fx, fz;
+            _locate((positions[i].x - originX) * inverseCellSize,
+                countX, &cx, &fx);
+            _locate((positions[i].z - originZ) * inverseCellSize,
+                countZ, &cz, &fz);
+
+            const real *h = &heights[cz * countX + cx];
+            real front = h[0] + (h[dx] - h[0]) * fx;
+            real back = h[dz] + (h[dz+dx] - h[dz]) * fx;
+            output[i] += front + (back - front) * fz;
+        }
+    }
+
+    // Each wave is added to every point in turn, so the inner loop
+    // does the same work for each point. It is left to the compiler
+    // rather than written with simd.h, as nearly all of its time is
+    // in the sine, which has no vector version there that gives the
+    // same results as real_sin.
+    for (unsigned w = 0; w < waves.size(); w++)
+    {
+        const WaterWave &wave = waves[w];
+        real k = ((real)2.0) * Scalar<real>::pi() / wave.wavelength;
+        real kx = k * wave.directionX;
+        real kz = k * wave.directionZ;
+        real offset = wave.phase - k * wave.speed * time;
+        for (unsigned i = 0; i < count; i++)
+        {
+            output[i] += wave.amplitude * real_sin(
+                kx * positions[i].x + kz * positions[i].z + offset);
+        }
+    }
+}
+
+void WaterSurface::getHeights(const WaterSurface *const *surfaces,
+                              const Vector3 *positions, real *heights,
+                              unsigned count)
+{
+    unsigned start = 0;
+    while (start < count)
+    {
+        const WaterSurface *surface = surfaces[start];
+        unsigned end = start + 1;
+        while (end < count && surfaces[end] == surface) end++;
+        if (surface)
+        {
+            surface->getHeights(positions + start, heights + start,
+                end - start);
+        }
+        start = end;
+    }
+}
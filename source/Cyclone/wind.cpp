@@ -0,0 +1,194 @@
+/*
+ * Implementation file for the gridded wind field.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <cyclone/wind.h>
+
+using namespace cyclone;
+
+WindField::WindField(const Vector3 &origin, real cellSize,
+                     unsigned x, unsigned y, unsigned z,
+                     unsigned seed)
+:
+origin(origin),
+cellSize(cellSize),
+keyframe(0),
+turbulence(0),
+period(1),
+seed(seed),
+time(0)
+{
+    counts[0] = x > 0 ? x : 1;
+    counts[1] = y > 0 ? y : 1;
+    counts[2] = z > 0 ? z : 1;
+
+    unsigned points = counts[0] * counts[1] * counts[2];
+    base.resize(points);
+    values.resize(points);
+    keyframes[0].resize(points);
+    keyframes[1].resize(points);
+}
+
+void WindField::setBase(unsigned x, unsigned y, unsigned z,
+                        const Vector3 &wind)
+{
+    unsigned index = getIndex(x, y, z);
+    base[index] = wind;
+    values[index] = calculateValue(index, getKeyframeBlend());
+}
+
+void WindField::setMeanWind(const Vector3 &wind)
+{
+    meanWind = wind;
+    calculateValues();
+}
+
+void WindField::setTurbulence(real amount, real period)
+{
+    // The keyframes are found by dividing by the period, so a period
+    // that isn't positive is rejected rather than filling the field
+    // with invalid wind.
+    assert(period > 0);
+    if (!(period > 0)) return;
+
+    turbulence = amount;
+    WindField::period = period;
+
+    // Regenerate the keyframes around the current time.
+    keyframe = (int)real_floor(time / period);
+    generateKeyframe(keyframe, keyframes[0]);
+    generateKeyframe(keyframe + 1, keyframes[1]);
+    calculateValues();
+}
+
+void WindField::setTime(real newTime)
+{
+    time = newTime;
+    if (turbulence <= 0) return;
+
+    int newKeyframe = (int)real_floor(time / period);
+    if (newKeyframe == keyframe + 1)
+    {
+        // Moving on by one keyframe reuses the later one.
+        keyframes[0].swap(keyframes[1]);
+        generateKeyframe(newKeyframe + 1, keyframes[1]);
+    }
+    else if (newKeyframe != keyframe)
+    {
+        generateKeyframe(newKeyframe, keyframes[0]);
+        generateKeyframe(newKeyframe + 1, keyframes[1]);
+    }
+    keyframe = newKeyframe;
+    calculateValues();
+}
+
+void WindField::generateKeyframe(int index, std::vector<Vector3> &output)
+{
+    // Each keyframe has its own stream, so it depends only on the
+    // seed and its index.
+    Random random(seed * 2654435761u + (unsigned)index * 40503u + 1);
+    for (unsigned i = 0; i < output.size(); i++)
+    {
+        output[i] = random.randomVector(turbulence);
+    }
+}
+
+real WindField::getKeyframeBlend() const
+{
+    if (turbulence <= 0) return 0;
+
+    // Blend the keyframes with a smoothstep, so the wind has no
+    // sudden changes in its rate of change at each keyframe.
+    real t = time / period - (real)keyframe;
+    return t * t * (3 - 2*t);
+}
+
+Vector3 WindField::calculateValue(unsigned index, real blend) const
+{
+    Vector3 value = base[index] + meanWind;
+    if (turbulence > 0)
+    {
+        value.addScaledVector(keyframes[0][index], 1 - blend);
+        value.addScaledVector(keyframes[1][index], blend);
+    }
+    return value;
+}
+
+void WindField::calculateValues()
+{
+    real blend = getKeyframeBlend();
+    unsigned points = (unsigned)values.size();
+    for (unsigned i = 0; i < points; i++)
+    {
+        values[i] = calculateValue(i, blend);
+    }
+}
+
+/**
+ * Internal function that finds the grid cell and interpolation
+ * fraction along one axis, clamping to the edges of the grid.
+ */
+static inline void _locate(real coordinate, unsigned count,
+                           unsigned *cell, real *fraction)
+{
+    if (count < 2 || coordinate <= 0)
+    {
+        *cell = 0;
+        *fraction = 0;
+        return;
+    }
+    real last = (real)(count - 1);
+    if (coordinate >= last)
+    {
+        *cell = count - 2;
+        *fraction = 1;
+        return;
+    }
+    real cellStart = real_floor(coordinate);
+    *cell = (unsigned)cellStart;
+    *fraction = coordinate - cellStart;
+}
+
+Vector3 WindField::sample(const Vector3 &position) const
+{
+    Vector3 wind;
+    sample(&position, &wind, 1);
+    return wind;
+}
+
+void WindField::sample(const Vector3 *positions, Vector3 *winds,
+                       unsigned count) const
+{
+    real inverseCellSize = ((real)1.0) / cellSize;
+
+    // The offsets to the neighbouring grid points on each axis, which
+    // are zero along any axis with a single point.
+    unsigned dx = counts[0] > 1 ? 1 : 0;
+    unsigned dy = counts[1] > 1 ? counts[0] : 0;
+    unsigned dz = counts[2] > 1 ? counts[0] * counts[1] : 0;
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        Vector3 local = (positions[i] - origin) * inverseCellSize;
+
+        unsigned cx, cy, cz;
+        real fx, fy, fz;
+        _locate(local.x, counts[0], &cx, &fx);
+        _locate(local.y, counts[1], &cy, &fy);
+        _locate(local.z, counts[2], &cz, &fz);
+
+        // Interpolate along x, then y, then z.
+        simdTrilinear(&values[getIndex(cx, cy, cz)].x, dx, dy, dz,
+            fx, fy, fz, &winds[i].x);
+    }
+}
@@ -11,28 +11,775 @@
  */
 
 #include <cstdlib>
+#include <memory.h>
+#include <algorithm>
 #include <cyclone/world.h>
+#include <cyclone/fgen.h>
 
 using namespace cyclone;
 
+/**
+ * Internal function that returns the identifier used to order a
+ * contact's body. Contacts with the scenery have no second body, and
+ * are sorted after all others.
+ */
+static inline unsigned _contactBodyId(const RigidBody *body)
+{
+    return body ? body->getId() : ~0u;
+}
+
+/**
+ * Internal comparison that puts contacts into a fixed order, based
+ * first on the identifiers of the bodies involved and then on the
+ * contact geometry.
+ */
+static bool _contactOrder(const Contact &a, const Contact &b)
+{
+    unsigned aId = _contactBodyId(a.body[0]);
+    unsigned bId = _contactBodyId(b.body[0]);
+    if (aId != bId) return aId < bId;
+
+    aId = _contactBodyId(a.body[1]);
+    bId = _contactBodyId(b.body[1]);
+    if (aId != bId) return aId < bId;
+
+    if (a.penetration != b.penetration)
+        return a.penetration < b.penetration;
+    if (a.contactPoint.x != b.contactPoint.x)
+        return a.contactPoint.x < b.contactPoint.x;
+    if (a.contactPoint.y != b.contactPoint.y)
+        return a.contactPoint.y < b.contactPoint.y;
+    return a.contactPoint.z < b.contactPoint.z;
+}
+
 World::World(unsigned maxContacts, unsigned iterations)
 :
 firstBody(NULL),
-firstContactGen(NULL),
 resolver(iterations),
-maxContacts(maxContacts)
+firstContactGen(NULL),
+arena(maxContacts * sizeof(Contact) * 2),
+contacts(NULL),
+contactCapacity(maxContacts > 0 ? maxContacts : 1),
+deterministic(false),
+nextBodyId(0),
+lastContactCount(0),
+broadphaseMargin((real)0.5),
+staticFriction((real)0.9),
+staticRestitution((real)0.1)
 {
-    contacts = new Contact[maxContacts];
     calculateIterations = (iterations == 0);
 }
 
 World::~World()
 {
-    delete[] contacts;
+    while (firstBody)
+    {
+        BodyRegistration *next = firstBody->next;
+        delete firstBody;
+        firstBody = next;
+    }
+    while (firstContactGen)
+    {
+        ContactGenRegistration *next = firstContactGen->next;
+        delete firstContactGen;
+        firstContactGen = next;
+    }
+}
+
+void World::addBody(RigidBody *body, real boundingRadius,
+                    CollisionPrimitive *primitive)
+{
+    body->setId(nextBodyId++);
+
+    BodyRegistration *reg = new BodyRegistration;
+    reg->body = body;
+    reg->next = firstBody;
+    reg->radius = boundingRadius;
+    reg->primitive = primitive;
+    if (registrations.size() < nextBodyId)
+    {
+        registrations.resize(nextBodyId, NULL);
+    }
+    registrations[body->getId()] = reg;
+    reg->broadphaseCentre = body->getPosition();
+    reg->broadphaseMargin = broadphaseMargin;
+    real extent = boundingRadius + broadphaseMargin;
+    reg->broadphaseHandle = broadphase.insert(body, BoundingBox(
+        reg->broadphaseCentre, Vector3(extent, extent, extent)));
+    firstBody = reg;
+}
+
+void World::addStaticPrimitive(CollisionPrimitive *primitive)
+{
+    staticGeometry.addChild(primitive);
+}
+
+void World::addStaticPlane(const CollisionPlane &plane)
+{
+    staticPlanes.push_back(plane);
+}
+
+void World::setStaticMaterial(real friction, real restitution)
+{
+    staticFriction = friction;
+    staticRestitution = restitution;
+}
+
+void World::setBroadphaseMargin(real margin)
+{
+    broadphaseMargin = margin;
+}
+
+void World::updateBroadphase()
+{
+    for (BodyRegistration *reg = firstBody; reg; reg = reg->next)
+    {
+        // Bodies that stay within their enlarged box are left
+        // where they are in the hierarchy, unless the margin has
+        // changed since the box was built.
+        Vector3 position = reg->body->getPosition();
+        real margin = reg->broadphaseMargin;
+        if (margin == broadphaseMargin &&
+            (position - reg->broadphaseCentre).squareMagnitude() <=
+            margin * margin)
+        {
+            continue;
+        }
+
+        reg->broadphaseCentre = position;
+        reg->broadphaseMargin = broadphaseMargin;
+        real extent = reg->radius + broadphaseMargin;
+        broadphase.update(reg->broadphaseHandle, BoundingBox(
+            position, Vector3(extent, extent, extent)));
+    }
+}
+
+void World::shiftOrigin(const Vector3 &newOrigin)
+{
+    for (BodyRegistration *reg = firstBody; reg; reg = reg->next)
+    {
+        RigidBody *body = reg->body;
+        body->setPosition(body->getPosition() - newOrigin);
+        body->calculateDerivedData();
+        reg->broadphaseCentre -= newOrigin;
+    }
+    broadphase.translate(newOrigin * -1);
+
+    for (unsigned i = 0; i < staticGeometry.getChildCount(); i++)
+    {
+        Matrix4 &offset = staticGeometry.getChild(i)->offset;
+        offset.data[3] -= newOrigin.x;
+        offset.data[7] -= newOrigin.y;
+        offset.data[11] -= newOrigin.z;
+    }
+    staticGeometry.invalidate();
+    for (unsigned i = 0; i < staticPlanes.size(); i++)
+    {
+        staticPlanes[i].offset -= staticPlanes[i].direction * newOrigin;
+    }
+
+    for (unsigned i = 0; i < lastContactCount; i++)
+    {
+        contacts[i].contactPoint -= newOrigin;
+    }
+
+    origin.position.x += newOrigin.x;
+    origin.position.y += newOrigin.y;
+    origin.position.z += newOrigin.z;
+}
+
+/**
+ * Visits the bodies found near an explosion, applying its force to
+ * those within its reach.
+ */
+struct World::ExplosionVisitor
+{
+    const World *world;
+    Explosion *explosion;
+    real duration;
+    unsigned count;
+
+    ExplosionVisitor(const World *world, Explosion *explosion,
+                     real duration)
+        : world(world), explosion(explosion), duration(duration), count(0)
+    {
+    }
+
+    bool operator()(RigidBody *body)
+    {
+        // The broadphase holds boxes, so check the bodies it finds
+        // against the blast's sphere.
+        const BodyRegistration *reg = world->registrations[body->getId()];
+        real reach = explosion->getRadius() + reg->radius +
+            reg->broadphaseMargin;
+        if ((body->getPosition() - explosion->detonation).squareMagnitude()
+            <= reach * reach)
+        {
+            explosion->updateForce(body, duration);
+            count++;
+        }
+        return true;
+    }
+};
+
+unsigned World::applyExplosion(Explosion &explosion, real duration)
+{
+    unsigned count = 0;
+    real radius = explosion.getRadius();
+    if (radius > 0)
+    {
+        ExplosionVisitor visitor(this, &explosion, duration);
+        broadphase.query(BoundingBox(explosion.detonation,
+            Vector3(radius, radius, radius)), visitor);
+        count = visitor.count;
+    }
+
+    explosion.advance(duration);
+    return count;
+}
+
+/**
+ * Visits the bodies found by a single cast through the broadphase,
+ * keeping the nearest hit.
+ */
+struct World::CastVisitor
+{
+    World *world;
+    const CastShape *shape;
+    CastHit *hit;
+    bool found;
+
+    CastVisitor(World *world, const CastShape *shape, CastHit *hit)
+        : world(world), shape(shape), hit(hit), found(false)
+    {
+    }
+
+    void operator()(RigidBody *body, real &length)
+    {
+        if (world->castBody(body, *shape, length, hit))
+        {
+            length = hit->distance;
+            found = true;
+        }
+    }
+};
+
+/**
+ * Visits the bodies found by a packet of four rays, keeping the
+ * nearest hit of each ray and shortening it to match.
+ */
+struct World::PacketVisitor
+{
+    World *world;
+    const CastShape *shapes;
+    CastHit *hits;
+    unsigned hitMask;
+
+    PacketVisitor(World *world, const CastShape *shapes, CastHit *hits)
+        : world(world), shapes(shapes), hits(hits), hitMask(0)
+    {
+    }
+
+    void operator()(RigidBody *body, unsigned mask, RayPacket &packet)
+    {
+        for (unsigned i = 0; i < 4; i++)
+        {
+            if ((mask & (1u << i)) &&
+                world->castBody(body, shapes[i], packet.length[i], hits + i))
+            {
+                packet.length[i] = hits[i].distance;
+                hitMask |= 1u << i;
+            }
+        }
+    }
+};
+
+bool World::castBody(RigidBody *body, const CastShape &shape,
+                     real length, CastHit *hit)
+{
+    BodyRegistration *reg = registrations[body->getId()];
+    if (reg->primitive)
+    {
+        reg->primitive->calculateInternals();
+        return CastTests::shapeAndPrimitive(shape, *reg->primitive,
+            length, hit);
+    }
+
+    if (reg->radius <= 0 || !CastTests::shapeAndSphere(shape,
+        body->getPosition(), reg->radius, length, hit)) return false;
+    hit->body = body;
+    hit->primitive = NULL;
+    return true;
+}
+
+bool World::castStatic(const CastShape &shape, real length, CastHit *hit)
+{
+    bool found = false;
+    if (staticGeometry.getChildCount() > 0)
+    {
+        staticGeometry.calculateInternals();
+        found = CastTests::shapeAndPrimitive(shape, staticGeometry,
+            length, hit);
+        if (found) length = hit->distance;
+    }
+
+    for (unsigned i = 0; i < staticPlanes.size(); i++)
+    {
+        if (CastTests::shapeAndHalfSpace(shape, staticPlanes[i], length, hit))
+        {
+            hit->body = NULL;
+            hit->primitive = NULL;
+            length = hit->distance;
+            found = true;
+        }
+    }
+    return found;
+}
+
+bool World::cast(const CastShape &shape, real length, CastHit *hit)
+{
+    CastVisitor visitor(this, &shape, hit);
+    broadphase.raycast(shape.origin, shape.direction, length,
+        shape.extents, visitor);
+    if (visitor.found) length = hit->distance;
+
+    return castStatic(shape, length, hit) || visitor.found;
+}
+
+bool World::raycast(const Vector3 &origin, const Vector3 &direction,
+                    real length, CastHit *hit)
+{
+    CastShape shape;
+    shape.setRay(origin, direction);
+    return cast(shape, length, hit);
+}
+
+bool World::sphereCast(const Vector3 &centre, real radius,
+                       const Vector3 &direction, real length, CastHit *hit)
+{
+    CastShape shape;
+    shape.setSphere(centre, radius, direction);
+    return cast(shape, length, hit);
+}
+
+bool World::boxCast(const Matrix4 &transform, const Vector3 &halfSize,
+                    const Vector3 &direction, real length, CastHit *hit)
+{
+    CastShape shape;
+    shape.setBox(transform, halfSize, direction);
+    return cast(shape, length, hit);
+}
+
+unsigned World::raycast(const Ray *rays, unsigned count, CastHit *hits)
+{
+    unsigned hitCount = 0;
+    for (unsigned first = 0; first < count; first += 4)
+    {
+        // Fill in a packet with up to four rays, each starting as a
+        // miss. Unused lanes are left inactive.
+        RayPacket packet;
+        CastShape shapes[4];
+        unsigned lanes = count - first < 4 ? count - first : 4;
+        for (unsigned i = 0; i < lanes; i++)
+        {
+            const Ray &ray = rays[first + i];
+            packet.setRay(i, ray.origin, ray.direction, ray.length);
+            shapes[i].setRay(ray.origin, ray.direction);
+
+            CastHit &hit = hits[first + i];
+            hit.body = NULL;
+            hit.primitive = NULL;
+            hit.distance = ray.length;
+            hit.point = ray.origin + ray.direction * ray.length;
+            hit.normal.clear();
+        }
+
+        PacketVisitor visitor(this, shapes, hits + first);
+        broadphase.raycastPacket(packet, visitor);
+
+        // The static geometry is cast against one ray at a time, no
+        // further than each ray's nearest body.
+        for (unsigned i = 0; i < lanes; i++)
+        {
+            if (castStatic(shapes[i], packet.length[i], hits + first + i) ||
+                (visitor.hitMask & (1u << i)))
+            {
+                hitCount++;
+            }
+        }
+    }
+    return hitCount;
+}
+
+/**
+ * Visits the bodies found by a region query, keeping those that
+ * overlap the query's shape.
+ */
+struct World::OverlapVisitor
+{
+    const World *world;
+    const CollisionPrimitive *shape;
+    RigidBody **bodies;
+    unsigned limit;
+    OverlapCallback *callback;
+    unsigned count;
+
+    OverlapVisitor(const World *world, const CollisionPrimitive *shape,
+                   RigidBody **bodies, unsigned limit,
+                   OverlapCallback *callback)
+        : world(world), shape(shape), bodies(bodies), limit(limit),
+          callback(callback), count(0)
+    {
+    }
+
+    bool operator()(RigidBody *body)
+    {
+        if (!world->overlapsBody(world->registrations[body->getId()],
+            *shape)) return true;
+
+        count++;
+        if (callback) return callback->addBody(body);
+        bodies[count - 1] = body;
+        return count < limit;
+    }
+};
+
+/**
+ * Sets the given matrix to a translation to the given position.
+ */
+static void _setPosition(Matrix4 *matrix, const Vector3 &position)
+{
+    *matrix = Matrix4();
+    matrix->data[3] = position.x;
+    matrix->data[7] = position.y;
+    matrix->data[11] = position.z;
+}
+
+/**
+ * Sets up the given sphere for a query, with no body.
+ */
+static void _makeSphere(CollisionSphere *sphere, const Vector3 &centre,
+                        real radius)
+{
+    sphere->radius = radius;
+    _setPosition(&sphere->offset, centre);
+    sphere->calculateInternals();
+}
+
+/**
+ * Sets up the given box for a query, with no body.
+ */
+static void _makeBox(CollisionBox *box, const Matrix4 &transform,
+                     const Vector3 &halfSize)
+{
+    box->halfSize = halfSize;
+    box->offset = transform;
+    box->calculateInternals();
+}
+
+/**
+ * Returns true if the given sphere overlaps the given query shape,
+ * which is a sphere or a box.
+ */
+static bool _sphereOverlaps(const CollisionSphere &sphere,
+                            const CollisionPrimitive &shape)
+{
+    if (shape.getType() == PRIMITIVE_SPHERE)
+    {
+        return IntersectionTests::sphereAndSphere(sphere,
+            static_cast<const CollisionSphere&>(shape));
+    }
+    return IntersectionTests::boxAndSphere(
+        static_cast<const CollisionBox&>(shape), sphere);
+}
+
+/**
+ * Returns true if the given box overlaps the given query shape,
+ * which is a sphere or a box.
+ */
+static bool _boxOverlaps(const CollisionBox &box,
+                         const CollisionPrimitive &shape)
+{
+    if (shape.getType() == PRIMITIVE_SPHERE)
+    {
+        return IntersectionTests::boxAndSphere(box,
+            static_cast<const CollisionSphere&>(shape));
+    }
+    return IntersectionTests::boxAndBox(box,
+        static_cast<const CollisionBox&>(shape));
+}
+
+/**
+ * Returns true if the given primitive, whose internals are up to
+ * date, overlaps the given query shape. Compounds are tested child by
+ * child, and meshes and heightfields only as their bounding box.
+ */
+static bool _primitiveOverlaps(const CollisionPrimitive &primitive,
+                               const CollisionPrimitive &shape)
+{
+    switch (primitive.getType())
+    {
+    case PRIMITIVE_SPHERE:
+        return _sphereOverlaps(
+            static_cast<const CollisionSphere&>(primitive), shape);
+
+    case PRIMITIVE_BOX:
+        return _boxOverlaps(
+            static_cast<const CollisionBox&>(primitive), shape);
+
+    case PRIMITIVE_COMPOUND:
+        {
+            const CollisionCompound &compound =
+                static_cast<const CollisionCompound&>(primitive);
+            for (unsigned i = 0; i < compound.getChildCount(); i++)
+            {
+                const CollisionPrimitive *child = compound.getChild(i);
+                if (child->getBoundingBox().overlaps(
+                        &shape.getBoundingBox()) &&
+                    _primitiveOverlaps(*child, shape))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    default:
+        {
+            const BoundingBox &bounds = primitive.getBoundingBox();
+            Matrix4 transform;
+            _setPosition(&transform, bounds.centre);
+            CollisionBox box;
+            _makeBox(&box, transform, bounds.halfSize);
+            return _boxOverlaps(box, shape);
+        }
+    }
+}
+
+bool World::overlapsBody(const BodyRegistration *reg,
+                         const CollisionPrimitive &shape) const
+{
+    if (reg->primitive)
+    {
+        reg->primitive->calculateInternals();
+        return _primitiveOverlaps(*reg->primitive, shape);
+    }
+
+    CollisionSphere sphere;
+    _makeSphere(&sphere, reg->body->getPosition(), reg->radius);
+    return _sphereOverlaps(sphere, shape);
+}
+
+unsigned World::overlap(const CollisionPrimitive &shape,
+                        RigidBody **bodies, unsigned limit,
+                        OverlapCallback *callback)
+{
+    if (!callback && limit == 0) return 0;
+
+    OverlapVisitor visitor(this, &shape, bodies, limit, callback);
+    broadphase.query(shape.getBoundingBox(), visitor);
+    return visitor.count;
+}
+
+unsigned World::overlapBox(const Vector3 &centre, const Vector3 &halfSize,
+                           RigidBody **bodies, unsigned limit)
+{
+    Matrix4 transform;
+    _setPosition(&transform, centre);
+    return overlapBox(transform, halfSize, bodies, limit);
+}
+
+unsigned World::overlapBox(const Vector3 &centre, const Vector3 &halfSize,
+                           OverlapCallback *callback)
+{
+    Matrix4 transform;
+    _setPosition(&transform, centre);
+    return overlapBox(transform, halfSize, callback);
+}
+
+unsigned World::overlapBox(const Matrix4 &transform,
+                           const Vector3 &halfSize,
+                           RigidBody **bodies, unsigned limit)
+{
+    CollisionBox box;
+    _makeBox(&box, transform, halfSize);
+    return overlap(box, bodies, limit, NULL);
+}
+
+unsigned World::overlapBox(const Matrix4 &transform,
+                           const Vector3 &halfSize,
+                           OverlapCallback *callback)
+{
+    CollisionBox box;
+    _makeBox(&box, transform, halfSize);
+    return overlap(box, NULL, 0, callback);
+}
+
+unsigned World::overlapSphere(const Vector3 &centre, real radius,
+                              RigidBody **bodies, unsigned limit)
+{
+    CollisionSphere sphere;
+    _makeSphere(&sphere, centre, radius);
+    return overlap(sphere, bodies, limit, NULL);
+}
+
+unsigned World::overlapSphere(const Vector3 &centre, real radius,
+                              OverlapCallback *callback)
+{
+    CollisionSphere sphere;
+    _makeSphere(&sphere, centre, radius);
+    return overlap(sphere, NULL, 0, callback);
+}
+
+void World::addContactGenerator(ContactGenerator *gen)
+{
+    ContactGenRegistration *reg = new ContactGenRegistration;
+    reg->gen = gen;
+    reg->next = firstContactGen;
+    firstContactGen = reg;
+}
+
+void World::setDeterministic(bool deterministic)
+{
+    World::deterministic = deterministic;
+}
+
+unsigned World::getChecksum() const
+{
+    unsigned checksum = CHECKSUM_SEED;
+
+    BodyRegistration *reg = firstBody;
+    while (reg)
+    {
+        const RigidBody *body = reg->body;
+        unsigned id = body->getId();
+        unsigned char awake = body->getAwake() ? 1 : 0;
+
+        checksum = addToChecksum(checksum, &id, sizeof(id));
+        checksum = addToChecksum(checksum, body->getPosition());
+        checksum = addToChecksum(checksum, body->getOrientation());
+        checksum = addToChecksum(checksum, body->getVelocity());
+        checksum = addToChecksum(checksum, body->getRotation());
+        checksum = addToChecksum(checksum, &awake, sizeof(awake));
+
+        reg = reg->next;
+    }
+    return checksum;
+}
+
+/**
+ * Internal function that copies a vector into a flat array.
+ */
+static inline void _storeVector(real *out, const Vector3 &v)
+{
+    out[0] = v.x;
+    out[1] = v.y;
+    out[2] = v.z;
+}
+
+void World::saveSnapshot(Snapshot *snapshot) const
+{
+    snapshot->bodies.clear();
+    BodyRegistration *reg = firstBody;
+    while (reg)
+    {
+        snapshot->bodies.push_back(RigidBodyState());
+        reg->body->getState(&snapshot->bodies.back());
+        reg = reg->next;
+    }
+
+    snapshot->contacts.resize(lastContactCount);
+    for (unsigned i = 0; i < lastContactCount; i++)
+    {
+        const Contact &contact = contacts[i];
+        ContactState &state = snapshot->contacts[i];
+        state.body[0] = _contactBodyId(contact.body[0]);
+        state.body[1] = _contactBodyId(contact.body[1]);
+        _storeVector(state.contactPoint, contact.contactPoint);
+        _storeVector(state.contactNormal, contact.contactNormal);
+        state.penetration = contact.penetration;
+        state.friction = contact.friction;
+        state.restitution = contact.restitution;
+    }
+}
+
+bool World::restoreSnapshot(const Snapshot &snapshot)
+{
+    // Check the snapshot holds the same bodies in the same order
+    // before changing anything.
+    unsigned count = (unsigned)snapshot.bodies.size();
+    unsigned index = 0;
+    BodyRegistration *reg = firstBody;
+    while (reg)
+    {
+        if (index >= count) return false;
+        if (snapshot.bodies[index].id != reg->body->getId()) return false;
+        index++;
+        reg = reg->next;
+    }
+    if (index != count) return false;
+
+    // Build the identifier table if we need it to resolve contacts.
+    unsigned contactCount = (unsigned)snapshot.contacts.size();
+    if (contactCount > 0)
+    {
+        bodiesById.assign(nextBodyId, (RigidBody*)NULL);
+        for (reg = firstBody; reg; reg = reg->next)
+        {
+            bodiesById[reg->body->getId()] = reg->body;
+        }
+        for (unsigned i = 0; i < contactCount; i++)
+        {
+            const ContactState &state = snapshot.contacts[i];
+            for (unsigned b = 0; b < 2; b++)
+            {
+                if (state.body[b] == ~0u) continue;
+                if (state.body[b] >= nextBodyId ||
+                    bodiesById[state.body[b]] == NULL) return false;
+            }
+        }
+    }
+
+    // Restore the bodies.
+    index = 0;
+    for (reg = firstBody; reg; reg = reg->next)
+    {
+        reg->body->setState(snapshot.bodies[index++]);
+    }
+
+    // Restore the contact cache.
+    if (contactCount > contactCapacity) contactCapacity = contactCount;
+    contacts = arena.allocateArray<Contact>(contactCount);
+    for (unsigned i = 0; i < contactCount; i++)
+    {
+        const ContactState &state = snapshot.contacts[i];
+        Contact &contact = contacts[i];
+        for (unsigned b = 0; b < 2; b++)
+        {
+            contact.body[b] =
+                (state.body[b] == ~0u) ? NULL : bodiesById[state.body[b]];
+        }
+        contact.contactPoint = Vector3(state.contactPoint[0],
+            state.contactPoint[1], state.contactPoint[2]);
+        contact.contactNormal = Vector3(state.contactNormal[0],
+            state.contactNormal[1], state.contactNormal[2]);
+        contact.penetration = state.penetration;
+        contact.friction = state.friction;
+        contact.restitution = state.restitution;
+    }
+    lastContactCount = contactCount;
+
+    updateBroadphase();
+    return true;
 }
 
 void World::startFrame()
 {
+    // Release the last frame's contacts and scratch data.
+    arena.reset();
+    contacts = NULL;
+    lastContactCount = 0;
+
     BodyRegistration *reg = firstBody;
     while (reg)
     {
@@ -47,25 +794,151 @@ void World::startFrame()
 
 unsigned World::generateContacts()
 {
-    unsigned limit = maxContacts;
-    Contact *nextContact = contacts;
+    contacts = arena.allocateArray<Contact>(contactCapacity);
+    unsigned used = 0;
 
     ContactGenRegistration * reg = firstContactGen;
     while (reg)
     {
-        unsigned used = reg->gen->addContact(nextContact, limit);
-        limit -= used;
-        nextContact += used;
-
-        // We've run out of contacts to fill. This means we're missing
-        // contacts.
-        if (limit <= 0) break;
+        // Generators can change the bodies, so each is only called
+        // once. Make room for all it could report before calling it.
+        unsigned needed = reg->gen->getMaxContacts();
+        while (contactCapacity - used < needed)
+        {
+            growContacts(used);
+        }
 
+        used += reg->gen->addContact(contacts + used,
+            contactCapacity - used);
         reg = reg->next;
     }
 
+    used = generateStaticContacts(used);
+
+    // Put the contacts into an order that doesn't depend on the
+    // order the generators were registered in.
+    if (deterministic)
+    {
+        std::stable_sort(contacts, contacts + used, _contactOrder);
+    }
+
     // Return the number of contacts used.
-    return maxContacts - limit;
+    return used;
+}
+
+void World::growContacts(unsigned used)
+{
+    contactCapacity *= 2;
+    Contact *larger = arena.allocateArray<Contact>(contactCapacity);
+    memcpy(larger, contacts, used * sizeof(Contact));
+    contacts = larger;
+}
+
+unsigned World::generateStaticContacts(unsigned used)
+{
+    if (staticGeometry.getChildCount() == 0 && staticPlanes.empty())
+    {
+        return used;
+    }
+
+    // This only does any work the first time after geometry is added.
+    staticGeometry.calculateInternals();
+
+    CollisionData data;
+    data.friction = staticFriction;
+    data.restitution = staticRestitution;
+    data.tolerance = 0;
+
+    BodyRegistration *reg = firstBody;
+    while (reg)
+    {
+        // Sleeping and immovable bodies can't hit the static
+        // geometry, so it costs nothing until something moves.
+        CollisionPrimitive *primitive = reg->primitive;
+        if (!primitive || !reg->body->getAwake() ||
+            reg->body->getInverseMass() <= 0)
+        {
+            reg = reg->next;
+            continue;
+        }
+        primitive->calculateInternals();
+
+        unsigned limit = contactCapacity - used;
+        data.contactArray = contacts + used;
+        data.reset(limit);
+
+        CollisionDetector::compoundAndPrimitive(
+            staticGeometry, *primitive, &data);
+
+        // Planes are tested only if the primitive's box reaches them.
+        const BoundingBox &volume = primitive->getBoundingBox();
+        for (unsigned i = 0; i < staticPlanes.size(); i++)
+        {
+            const CollisionPlane &plane = staticPlanes[i];
+            real projectedRadius =
+                volume.halfSize.x * real_abs(plane.direction.x) +
+                volume.halfSize.y * real_abs(plane.direction.y) +
+                volume.halfSize.z * real_abs(plane.direction.z);
+            if (plane.direction * volume.centre - projectedRadius <=
+                plane.offset)
+            {
+                CollisionDetector::primitiveAndHalfSpace(
+                    *primitive, plane, &data);
+            }
+        }
+
+        // A body that filled all the room may have had more
+        // contacts. The tests don't change anything, so make more
+        // room and test it again.
+        if (data.contactCount >= limit)
+        {
+            growContacts(used);
+            continue;
+        }
+
+        used += data.contactCount;
+        reg = reg->next;
+    }
+    return used;
+}
+
+bool* World::findArticulatedBodies()
+{
+    if (articulations.empty()) return NULL;
+
+    unsigned articulated = 0;
+    for (Articulations::iterator a = articulations.begin();
+        a != articulations.end();
+        a++)
+    {
+        articulated += (*a)->getLinkCount();
+    }
+
+    // Make a sorted list of the articulations' bodies to look each
+    // body in the world up in.
+    RigidBody **members = arena.allocateArray<RigidBody*>(articulated);
+    RigidBody **end = members;
+    for (Articulations::iterator a = articulations.begin();
+        a != articulations.end();
+        a++)
+    {
+        for (unsigned i = 0; i < (*a)->getLinkCount(); i++)
+        {
+            *end++ = (*a)->getBody(i);
+        }
+    }
+    std::sort(members, end);
+
+    unsigned count = 0;
+    for (BodyRegistration *reg = firstBody; reg; reg = reg->next) count++;
+
+    bool *flags = arena.allocateArray<bool>(count);
+    unsigned index = 0;
+    for (BodyRegistration *reg = firstBody; reg; reg = reg->next)
+    {
+        flags[index++] = std::binary_search(members, end, reg->body);
+    }
+    return flags;
 }
 
 void World::runPhysics(real duration)
@@ -73,19 +946,37 @@ void World::runPhysics(real duration)
     // First apply the force generators
     //registry.updateForces(duration);
 
+    // Let each articulation integrate its own bodies.
+    bool *articulated = findArticulatedBodies();
+    for (Articulations::iterator a = articulations.begin();
+        a != articulations.end();
+        a++)
+    {
+        (*a)->integrate(duration, &fields);
+    }
+
     // Then integrate the objects
     BodyRegistration *reg = firstBody;
+    unsigned index = 0;
     while (reg)
     {
-        // Remove all forces from the accumulator
-        reg->body->integrate(duration);
+        // Integrate the body, including the world's fields
+        if (!articulated || !articulated[index])
+        {
+            reg->body->integrate(duration, &fields);
+        }
 
         // Get the next registration
         reg = reg->next;
+        index++;
     }
 
+    // Keep the broadphase up to date with the bodies' new positions
+    updateBroadphase();
+
     // Generate contacts
     unsigned usedContacts = generateContacts();
+    lastContactCount = usedContacts;
 
     // And process them
     if (calculateIterations) resolver.setIterations(usedContacts * 4);